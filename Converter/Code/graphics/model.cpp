@@ -24,10 +24,23 @@ namespace gfx
 		if (FAILED(hr))
 			throw std::exception("Failed to create vertex buffer");
 
+		std::vector<UINT> baseVertices;
+		std::vector<USHORT> indices16;
+		UINT indexSize = model.ChooseIndexSize(baseVertices);
+		m_indexFormat = indexSize == sizeof(USHORT) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+		m_hasBaseVertices = std::any_of(baseVertices.begin(), baseVertices.end(), [](UINT base) { return base != 0; });
+
 		bufferDesc.Usage = D3D11_USAGE_DEFAULT;
-		bufferDesc.ByteWidth = m_indexCount * sizeof(UINT);
+		bufferDesc.ByteWidth = m_indexCount * indexSize;
 		bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		subResourceData.pSysMem = model.getIndices();
+		if (indexSize == sizeof(USHORT))
+		{
+			indices16.resize(m_indexCount);
+			model.CopyIndices16(indices16.data(), baseVertices);
+			subResourceData.pSysMem = indices16.data();
+		}
+		else
+			subResourceData.pSysMem = model.getIndices();
 
 		hr = device->CreateBuffer(&bufferDesc, &subResourceData, &m_indexBuffer);
 		if (FAILED(hr))
@@ -36,7 +49,7 @@ namespace gfx
 		for (UINT i = 0; i < model.getVertexGroupCount(); i++)
 		{
 			VertexGroup vg = model.getVertexGroup(i);
-			m_groups.push_back({ vg.startIndex, vg.indexCount });
+			m_groups.push_back({ vg.startIndex, vg.indexCount, baseVertices[i] });
 		}
 	}
 
@@ -47,17 +60,23 @@ namespace gfx
 		auto context = graphics.getContext();
 
 		context->IASetVertexBuffers(0, 1, &m_vertexBuffer, &stride, &offset);
-		context->IASetIndexBuffer(m_indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+		context->IASetIndexBuffer(m_indexBuffer, m_indexFormat, 0);
 	}
 
 	void Model::DrawGroup(Graphics& graphics, UINT index)
 	{
-		graphics.getContext()->DrawIndexed(m_groups[index].indexCount, m_groups[index].startIndex, 0);
+		graphics.getContext()->DrawIndexed(m_groups[index].indexCount, m_groups[index].startIndex, m_groups[index].baseVertex);
 	}
 
 	void Model::RenderAll(Graphics& graphics)
 	{
 		SetBuffersToRender(graphics);
-		graphics.getContext()->DrawIndexed(m_indexCount, 0, 0);
+		if (m_hasBaseVertices)
+		{
+			for (UINT i = 0; i < (UINT)m_groups.size(); i++)
+				DrawGroup(graphics, i);
+		}
+		else
+			graphics.getContext()->DrawIndexed(m_indexCount, 0, 0);
 	}
 }
\ No newline at end of file
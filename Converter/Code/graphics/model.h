@@ -17,11 +17,14 @@ namespace gfx
 		UINT m_modelType;
 		UINT m_vertexCount;
 		UINT m_indexCount;
+		DXGI_FORMAT m_indexFormat;
+		bool m_hasBaseVertices;	//groups have to be drawn one by one
 
 		struct Group
 		{
 			UINT startIndex;
 			UINT indexCount;
+			UINT baseVertex;
 		};
 		std::vector<Group> m_groups;
 
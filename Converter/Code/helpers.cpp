@@ -1,5 +1,9 @@
 #include "helpers.h"
 #include <filesystem>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 std::wstring g_ExeFolder;
 
@@ -19,6 +23,26 @@ std::string ToStr(const wchar_t* str)
 	return r;
 }
 
+std::wstring Utf8ToWStr(const char* str)
+{
+	int length = MultiByteToWideChar(CP_UTF8, 0, str, -1, nullptr, 0);
+	if (length <= 1)
+		return std::wstring();
+	std::wstring r(length - 1, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, str, -1, &r[0], length);
+	return r;
+}
+
+std::string ToUtf8(const wchar_t* str)
+{
+	int length = WideCharToMultiByte(CP_UTF8, 0, str, -1, nullptr, 0, nullptr, nullptr);
+	if (length <= 1)
+		return std::string();
+	std::string r(length - 1, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, str, -1, &r[0], length, nullptr, nullptr);
+	return r;
+}
+
 void SetExeFolderName(HINSTANCE hInstance)
 {
 	WCHAR path[MAX_PATH];
@@ -32,9 +56,137 @@ void SetExeFolderName(HINSTANCE hInstance)
 		g_ExeFolder += (WCHAR)path[i];
 }
 
+namespace
+{
+	thread_local bool t_insideParallelFor = false;
+
+	/* Threads started by the first ParallelFor and reused by every later one. A job is handed
+	to all of them, they take tasks from it until none are left, the calling thread takes tasks
+	too. Jobs of different calling threads run one after the other. */
+	class WorkerPool
+	{
+		struct Job
+		{
+			const std::function<void(UINT task)>* func;
+			UINT taskCount;
+			std::atomic<UINT> nextTask;
+			std::exception_ptr error;
+			std::mutex errorLock;
+		};
+
+		std::vector<std::thread> m_threads;
+		std::mutex m_submitLock;
+		std::mutex m_lock;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+		Job* m_job;
+		UINT64 m_generation;	//counts the jobs, a worker runs each one once
+		UINT m_busy;			//workers still on the current job
+		bool m_stop;
+
+	private:
+		static void RunTasks(Job& job)
+		{
+			for (UINT task; (task = job.nextTask++) < job.taskCount;)
+			{
+				try
+				{
+					(*job.func)(task);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(job.errorLock);
+					if (!job.error)
+						job.error = std::current_exception();
+					job.nextTask = job.taskCount;
+				}
+			}
+		}
+		void Work()
+		{
+			t_insideParallelFor = true;
+			UINT64 generation = 0;
+			std::unique_lock<std::mutex> lock(m_lock);
+			while (true)
+			{
+				m_wake.wait(lock, [&]() { return m_stop || m_generation != generation; });
+				if (m_stop)
+					return;
+				generation = m_generation;
+				Job* job = m_job;
+				lock.unlock();
+				RunTasks(*job);
+				lock.lock();
+				if (--m_busy == 0)
+					m_done.notify_one();
+			}
+		}
+
+	public:
+		WorkerPool(UINT threadCount) :
+			m_job(nullptr),
+			m_generation(0),
+			m_busy(0),
+			m_stop(false)
+		{
+			for (UINT i = 0; i < threadCount; i++)
+				m_threads.emplace_back([this]() { Work(); });
+		}
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_stop = true;
+			}
+			m_wake.notify_all();
+			for (std::thread& thread : m_threads)
+				thread.join();
+		}
+		void Run(UINT taskCount, const std::function<void(UINT task)>& func)
+		{
+			std::lock_guard<std::mutex> submit(m_submitLock);
+			Job job;
+			job.func = &func;
+			job.taskCount = taskCount;
+			job.nextTask = 0;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_job = &job;
+				m_generation++;
+				m_busy = (UINT)m_threads.size();
+			}
+			m_wake.notify_all();
+			t_insideParallelFor = true;
+			RunTasks(job);
+			t_insideParallelFor = false;
+			{
+				//the job lives on this stack, so every worker has to be done with it
+				std::unique_lock<std::mutex> lock(m_lock);
+				m_done.wait(lock, [this]() { return m_busy == 0; });
+				m_job = nullptr;
+			}
+			if (job.error)
+				std::rethrow_exception(job.error);
+		}
+	};
+}
+
+void ParallelFor(UINT taskCount, const std::function<void(UINT task)>& func)
+{
+	static const UINT ThreadCount = (std::max)(std::thread::hardware_concurrency(), 1u);
+	if (taskCount <= 1 || ThreadCount == 1 || t_insideParallelFor)
+	{
+		for (UINT i = 0; i < taskCount; i++)
+			func(i);
+		return;
+	}
+	static WorkerPool pool(ThreadCount - 1);
+	pool.Run(taskCount, func);
+}
+
 std::wstring ResolveFilename(std::wstring filename)
 {
-	if (std::experimental::filesystem::exists(g_ExeFolder + filename))
+	if (std::filesystem::exists(g_ExeFolder + filename))
 		return g_ExeFolder + filename;
 	return filename;
 }
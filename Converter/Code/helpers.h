@@ -94,8 +94,17 @@ public:
 
 std::wstring ToWStr(const char *str);
 std::string ToStr(const wchar_t *str);
+/* Lossless conversions, ToStr and ToWStr only keep the low byte of each character */
+std::wstring Utf8ToWStr(const char* str);
+std::string ToUtf8(const wchar_t* str);
 
 void SetExeFolderName(HINSTANCE hInstance);
 
+/* Runs func(task) for every task in [0, taskCount) on all hardware threads, the calling thread included.
+The threads are started once and kept. Calls from inside a task run their tasks on the calling thread,
+so nested loops do not start more threads than there are cores.
+The first exception thrown by a task stops the remaining tasks and is rethrown. */
+void ParallelFor(UINT taskCount, const std::function<void(UINT task)>& func);
+
 std::wstring ResolveFilename(std::wstring filename);
 std::wstring GetFileExtension(LPCWSTR filename);
\ No newline at end of file
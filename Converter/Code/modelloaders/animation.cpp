@@ -0,0 +1,340 @@
+#include "animation.h"
+#include <algorithm>
+
+namespace gfx
+{
+	Bone::Bone() :
+		parent(-1),
+		translation(0.0f),
+		rotation(1.0f),
+		scale(1.0f),
+		hasOffset(false),
+		offset(mth::float4x4::Identity()) {}
+
+#pragma region Compression
+
+	static inline float Dot(const mth::float4& a, const mth::float4& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	}
+	static mth::float4 InterpolateKey(UINT kind, const mth::float4& a, const mth::float4& b, float t)
+	{
+		if (kind != AnimationChannel::ROTATION)
+			return a + (b - a) * t;
+		mth::quaternion q = NormalizedLerp(mth::quaternion(a.x, a.y, a.z, a.w), mth::quaternion(b.x, b.y, b.z, b.w), t);
+		return mth::float4(q.x, q.y, q.z, q.w);
+	}
+	static float KeyError(UINT kind, const mth::float4& a, const mth::float4& b)
+	{
+		if (kind == AnimationChannel::ROTATION)
+			return 2.0f * acosf((std::min)(fabsf(Dot(a, b)), 1.0f));	//angle between the rotations
+		return (std::max)((std::max)(fabsf(a.x - b.x), fabsf(a.y - b.y)), fabsf(a.z - b.z));
+	}
+
+	/* Greedy reduction, a segment grows while interpolating between its ends
+	reproduces every key inside it within the tolerance */
+	static std::vector<UINT> ReduceKeys(UINT kind, const std::vector<float>& times, const std::vector<mth::float4>& values, float tolerance)
+	{
+		UINT count = (UINT)times.size();
+		std::vector<UINT> kept = { 0 };
+		bool constant = true;
+		for (UINT i = 1; i < count && constant; i++)
+			constant = KeyError(kind, values[0], values[i]) <= tolerance;
+		if (constant)
+			return kept;
+
+		UINT start = 0;
+		for (UINT end = 2; end < count; end++)
+		{
+			float span = times[end] - times[start];
+			bool fits = true;
+			for (UINT i = start + 1; i < end && fits; i++)
+			{
+				float t = span > 0.0f ? (times[i] - times[start]) / span : 0.0f;
+				fits = KeyError(kind, InterpolateKey(kind, values[start], values[end], t), values[i]) <= tolerance;
+			}
+			if (!fits)
+			{
+				start = end - 1;
+				kept.push_back(start);
+			}
+		}
+		kept.push_back(count - 1);
+		return kept;
+	}
+
+	static inline USHORT QuantizeUnit(float value, float minimum, float extent, float maximum)
+	{
+		if (extent <= 0.0f)
+			return 0;
+		float u = (value - minimum) / extent * maximum + 0.5f;
+		return (USHORT)(std::min)((std::max)(u, 0.0f), maximum);
+	}
+
+	/* the three smallest components of a unit quaternion, the dropped largest one is made positive */
+	static UINT SmallestThree(const mth::float4& q, float components[3])
+	{
+		const float* v = (const float*)&q;
+		UINT largest = 0;
+		for (UINT i = 1; i < 4; i++)
+			if (fabsf(v[i]) > fabsf(v[largest]))
+				largest = i;
+		float sign = v[largest] < 0.0f ? -1.0f : 1.0f;
+		for (UINT i = 0, c = 0; i < 4; i++)
+			if (i != largest)
+				components[c++] = v[i] * sign;
+		return largest;
+	}
+
+	void Animation::AddChannel(UINT bone, UINT kind, const std::vector<float>& times, const std::vector<mth::float4>& values, float tolerance)
+	{
+		if (times.empty())
+			return;
+		std::vector<UINT> kept = ReduceKeys(kind, times, values, tolerance);
+		UINT keyCount = (UINT)kept.size();
+
+		std::vector<mth::float3> components(keyCount);
+		std::vector<UINT> largest(keyCount, 0);
+		for (UINT k = 0; k < keyCount; k++)
+		{
+			const mth::float4& value = values[kept[k]];
+			if (kind == AnimationChannel::ROTATION)
+				largest[k] = SmallestThree(value, (float*)&components[k]);
+			else
+				components[k] = mth::float3(value.x, value.y, value.z);
+		}
+
+		AnimationChannelHeader channel = {};
+		channel.bone = bone;
+		channel.kind = kind;
+		channel.keyCount = keyCount;
+		channel.dataOffset = (UINT)m_keyData.size();
+		for (UINT c = 0; c < 3; c++)
+		{
+			float minimum = components[0](c);
+			float maximum = components[0](c);
+			for (UINT k = 1; k < keyCount; k++)
+			{
+				minimum = (std::min)(minimum, components[k](c));
+				maximum = (std::max)(maximum, components[k](c));
+			}
+			channel.rangeMin[c] = minimum;
+			channel.rangeExtent[c] = maximum - minimum;
+		}
+
+		m_keyData.resize(m_keyData.size() + (size_t)keyCount * AnimationChannel::KeySize);
+		USHORT* timeData = (USHORT*)(m_keyData.data() + channel.dataOffset);
+		USHORT* valueData = timeData + keyCount;
+		for (UINT k = 0; k < keyCount; k++)
+		{
+			timeData[k] = QuantizeUnit(times[kept[k]], 0.0f, m_duration, 65535.0f);
+			USHORT* v = valueData + k * 3;
+			if (kind == AnimationChannel::ROTATION)
+			{
+				v[0] = QuantizeUnit(components[k].x, channel.rangeMin[0], channel.rangeExtent[0], 32767.0f) | ((largest[k] >> 1) << 15);
+				v[1] = QuantizeUnit(components[k].y, channel.rangeMin[1], channel.rangeExtent[1], 32767.0f) | ((largest[k] & 1) << 15);
+				v[2] = QuantizeUnit(components[k].z, channel.rangeMin[2], channel.rangeExtent[2], 65535.0f);
+			}
+			else
+			{
+				for (UINT c = 0; c < 3; c++)
+					v[c] = QuantizeUnit(components[k](c), channel.rangeMin[c], channel.rangeExtent[c], 65535.0f);
+			}
+		}
+		m_channels.push_back(channel);
+	}
+
+	Animation::Animation() :
+		m_duration(0.0f) {}
+	Animation::Animation(const AnimationData& data, const AnimationTolerance& tolerance) :
+		m_name(data.name),
+		m_duration(data.duration)
+	{
+		std::vector<float> times;
+		std::vector<mth::float4> values;
+		for (const AnimationTrack& track : data.tracks)
+		{
+			times.clear();
+			values.clear();
+			for (const Keyframe<mth::float3>& key : track.translations)
+			{
+				times.push_back(key.time);
+				values.push_back(mth::float4(key.value.x, key.value.y, key.value.z, 0.0f));
+			}
+			AddChannel(track.bone, AnimationChannel::TRANSLATION, times, values, tolerance.translation);
+
+			times.clear();
+			values.clear();
+			for (const Keyframe<mth::quaternion>& key : track.rotations)
+			{
+				mth::float4 q(key.value.x, key.value.y, key.value.z, key.value.w);
+				q.Normalize();
+				if (!values.empty() && Dot(values.back(), q) < 0.0f)
+					q = -q;	//interpolate along the shorter arc
+				times.push_back(key.time);
+				values.push_back(q);
+			}
+			AddChannel(track.bone, AnimationChannel::ROTATION, times, values, tolerance.rotation);
+
+			times.clear();
+			values.clear();
+			for (const Keyframe<mth::float3>& key : track.scales)
+			{
+				times.push_back(key.time);
+				values.push_back(mth::float4(key.value.x, key.value.y, key.value.z, 0.0f));
+			}
+			AddChannel(track.bone, AnimationChannel::SCALE, times, values, tolerance.scale);
+		}
+	}
+	Animation::Animation(const std::wstring& name, float duration, const AnimationChannelHeader* channels, UINT channelCount,
+		const char* keyData, size_t keyDataSize, UINT boneCount) :
+		m_name(name),
+		m_duration(duration),
+		m_channels(channels, channels + channelCount),
+		m_keyData(keyData, keyData + keyDataSize)
+	{
+		if (!(duration >= 0.0f))
+			throw std::exception("Corrupted animation: invalid duration");
+		for (AnimationChannelHeader& channel : m_channels)
+		{
+			if (channel.bone >= boneCount || channel.kind > AnimationChannel::SCALE || channel.keyCount == 0 ||
+				channel.dataOffset % sizeof(USHORT) ||
+				(UINT64)channel.dataOffset + (UINT64)channel.keyCount * AnimationChannel::KeySize > keyDataSize)
+				throw std::exception("Corrupted animation: channel out of range");
+		}
+	}
+
+#pragma endregion
+
+#pragma region Decoding
+
+	float Animation::getKeyTime(UINT channel, UINT key)
+	{
+		const USHORT* times = (const USHORT*)(m_keyData.data() + m_channels[channel].dataOffset);
+		return times[key] * (m_duration / 65535.0f);
+	}
+	mth::float3 Animation::getKeyVector(UINT channel, UINT key)
+	{
+		AnimationChannelHeader& c = m_channels[channel];
+		const USHORT* v = (const USHORT*)(m_keyData.data() + c.dataOffset) + c.keyCount + key * 3;
+		return mth::float3(
+			c.rangeMin[0] + c.rangeExtent[0] * (v[0] * (1.0f / 65535.0f)),
+			c.rangeMin[1] + c.rangeExtent[1] * (v[1] * (1.0f / 65535.0f)),
+			c.rangeMin[2] + c.rangeExtent[2] * (v[2] * (1.0f / 65535.0f)));
+	}
+	mth::quaternion Animation::getKeyRotation(UINT channel, UINT key)
+	{
+		AnimationChannelHeader& c = m_channels[channel];
+		const USHORT* v = (const USHORT*)(m_keyData.data() + c.dataOffset) + c.keyCount + key * 3;
+		UINT largest = ((v[0] >> 15) << 1) | (v[1] >> 15);
+		float components[3] = {
+			c.rangeMin[0] + c.rangeExtent[0] * ((v[0] & 0x7fff) * (1.0f / 32767.0f)),
+			c.rangeMin[1] + c.rangeExtent[1] * ((v[1] & 0x7fff) * (1.0f / 32767.0f)),
+			c.rangeMin[2] + c.rangeExtent[2] * (v[2] * (1.0f / 65535.0f)) };
+		float q[4];
+		float lengthSquare = 0.0f;
+		for (UINT i = 0, k = 0; i < 4; i++)
+		{
+			if (i == largest)
+				continue;
+			q[i] = components[k++];
+			lengthSquare += q[i] * q[i];
+		}
+		q[largest] = sqrtf((std::max)(1.0f - lengthSquare, 0.0f));
+		mth::quaternion result(q);
+		return result / result.Length();
+	}
+
+	AnimationSampler::AnimationSampler(Animation& animation) :
+		m_animation(&animation),
+		m_cursors(animation.getChannelCount(), 0) {}
+
+	UINT AnimationSampler::FindKey(UINT channel, float time)
+	{
+		AnimationChannelHeader& c = m_animation->getChannel(channel);
+		const USHORT* times = (const USHORT*)(m_animation->getKeyData().data() + c.dataOffset);
+		auto contains = [&](UINT key) {
+			return times[key] <= time && (key + 1 == c.keyCount || time < times[key + 1]);
+		};
+		UINT cursor = m_cursors[channel];
+		if (contains(cursor))
+			return cursor;
+		if (cursor + 1 < c.keyCount && contains(cursor + 1))
+			return cursor + 1;
+		UINT key = (UINT)(std::upper_bound(times, times + c.keyCount, time) - times);
+		return key ? key - 1 : 0;
+	}
+
+	void AnimationSampler::Sample(float time, BonePose* pose)
+	{
+		float duration = m_animation->getDuration();
+		float keyTime = duration > 0.0f ? (std::min)((std::max)(time / duration, 0.0f), 1.0f) * 65535.0f : 0.0f;
+		for (UINT channel = 0; channel < m_animation->getChannelCount(); channel++)
+		{
+			AnimationChannelHeader& c = m_animation->getChannel(channel);
+			const USHORT* times = (const USHORT*)(m_animation->getKeyData().data() + c.dataOffset);
+			UINT key = FindKey(channel, keyTime);
+			m_cursors[channel] = key;
+			UINT next = key + 1 < c.keyCount ? key + 1 : key;
+			float t = times[next] > times[key] ? (std::min)((std::max)((keyTime - times[key]) / (times[next] - times[key]), 0.0f), 1.0f) : 0.0f;
+
+			BonePose& bone = pose[c.bone];
+			if (c.kind == AnimationChannel::ROTATION)
+			{
+				mth::quaternion a = m_animation->getKeyRotation(channel, key);
+				bone.rotation = next == key ? a : NormalizedLerp(a, m_animation->getKeyRotation(channel, next), t);
+			}
+			else
+			{
+				mth::float3 a = m_animation->getKeyVector(channel, key);
+				mth::float3 value = next == key ? a : a + (m_animation->getKeyVector(channel, next) - a) * t;
+				if (c.kind == AnimationChannel::TRANSLATION)
+					bone.translation = value;
+				else
+					bone.scale = value;
+			}
+		}
+	}
+
+#pragma endregion
+
+#pragma region Poses
+
+	void BindPose(const std::vector<Bone>& bones, BonePose* pose)
+	{
+		for (size_t i = 0; i < bones.size(); i++)
+			pose[i] = { bones[i].translation, bones[i].rotation, bones[i].scale };
+	}
+
+	mth::float4x4 PoseMatrix(const BonePose& pose)
+	{
+		const mth::quaternion& q = pose.rotation;
+		const mth::float3& s = pose.scale;
+		return mth::float4x4(
+			(1.0f - 2.0f * (q.y * q.y + q.z * q.z)) * s.x, 2.0f * (q.x * q.y - q.z * q.w) * s.y, 2.0f * (q.x * q.z + q.y * q.w) * s.z, pose.translation.x,
+			2.0f * (q.x * q.y + q.z * q.w) * s.x, (1.0f - 2.0f * (q.x * q.x + q.z * q.z)) * s.y, 2.0f * (q.y * q.z - q.x * q.w) * s.z, pose.translation.y,
+			2.0f * (q.x * q.z - q.y * q.w) * s.x, 2.0f * (q.y * q.z + q.x * q.w) * s.y, (1.0f - 2.0f * (q.x * q.x + q.y * q.y)) * s.z, pose.translation.z,
+			0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	void PoseToModelSpace(const std::vector<Bone>& bones, const BonePose* pose, mth::float4x4* transforms)
+	{
+		for (size_t i = 0; i < bones.size(); i++)
+		{
+			transforms[i] = PoseMatrix(pose[i]);
+			if (bones[i].parent >= 0)
+				transforms[i] = transforms[bones[i].parent] * transforms[i];
+		}
+	}
+
+	mth::quaternion NormalizedLerp(mth::quaternion a, mth::quaternion b, float t)
+	{
+		if (a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w < 0.0f)
+			b = -b;
+		mth::quaternion q = a * (1.0f - t) + b * t;
+		float length = q.Length();
+		return length > 0.0f ? q / length : a;
+	}
+
+#pragma endregion
+}
\ No newline at end of file
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "helpers.h"
+#include "math/linalg.h"
+
+namespace gfx
+{
+	struct Bone
+	{
+		std::wstring name;
+		int parent;					//-1 for roots, parents always come before their children
+		mth::float3 translation;	//bind pose relative to the parent
+		mth::quaternion rotation;
+		mth::float3 scale;
+		bool hasOffset;				//the importer gave the offset matrix of the bone
+		mth::float4x4 offset;		//from mesh space to the space of the bone in the bind pose
+
+		Bone();
+	};
+
+	struct BonePose
+	{
+		mth::float3 translation;
+		mth::quaternion rotation;
+		mth::float3 scale;
+	};
+
+	template <typename T>
+	struct Keyframe
+	{
+		float time;
+		T value;
+	};
+
+	/* Animation as an importer delivers it, every track may have its own key times */
+	struct AnimationTrack
+	{
+		UINT bone;
+		std::vector<Keyframe<mth::float3>> translations;
+		std::vector<Keyframe<mth::quaternion>> rotations;
+		std::vector<Keyframe<mth::float3>> scales;
+	};
+
+	struct AnimationData
+	{
+		std::wstring name;
+		float duration;
+		std::vector<AnimationTrack> tracks;
+	};
+
+	/* Largest interpolation error a removed key may cause */
+	struct AnimationTolerance
+	{
+		float translation = 1e-4f;	//model units
+		float rotation = 1e-3f;		//radians
+		float scale = 1e-4f;
+	};
+
+	namespace AnimationChannel
+	{
+		enum Kind :UINT
+		{
+			TRANSLATION = 0,
+			ROTATION = 1,
+			SCALE = 2
+		};
+
+		const UINT KeySize = 8;	//USHORT time, 3 USHORT value
+	}
+
+	/* One curve of a compressed animation, stored in OMD files as it is.
+	The key data of a channel holds keyCount USHORT times (0 - 65535 over the duration),
+	followed by 3 USHORT values per key. Translation and scale components are mapped to
+	[rangeMin, rangeMin + rangeExtent] of the channel. Rotations are stored as the three
+	smallest quaternion components mapped to the channel range, the first two have 15 bits,
+	their top bits hold the index of the dropped largest component, which is positive. */
+	struct AnimationChannelHeader
+	{
+		UINT bone;
+		UINT kind;			//AnimationChannel::Kind
+		UINT keyCount;
+		UINT dataOffset;	//bytes from the start of the key data
+		float rangeMin[3];
+		float rangeExtent[3];
+	};
+
+	static_assert(sizeof(AnimationChannelHeader) == 40, "AnimationChannelHeader must be 40 bytes");
+
+	/* Animation clip with compressed curves. Keys that linear interpolation reproduces
+	within the tolerance are removed, the rest are quantized to 16 bits per component. */
+	class Animation
+	{
+	private:
+		std::wstring m_name;
+		float m_duration;
+		std::vector<AnimationChannelHeader> m_channels;
+		std::vector<char> m_keyData;
+
+	private:
+		void AddChannel(UINT bone, UINT kind, const std::vector<float>& times, const std::vector<mth::float4>& values, float tolerance);
+
+	public:
+		Animation();
+		Animation(const AnimationData& data, const AnimationTolerance& tolerance = AnimationTolerance());
+		/* compressed data read from a file, throws if the channels do not fit the key data */
+		Animation(const std::wstring& name, float duration, const AnimationChannelHeader* channels, UINT channelCount,
+			const char* keyData, size_t keyDataSize, UINT boneCount);
+
+		float getKeyTime(UINT channel, UINT key);
+		mth::float3 getKeyVector(UINT channel, UINT key);
+		mth::quaternion getKeyRotation(UINT channel, UINT key);
+
+		inline std::wstring& getName() { return m_name; }
+		inline float getDuration() { return m_duration; }
+		inline UINT getChannelCount() { return (UINT)m_channels.size(); }
+		inline AnimationChannelHeader& getChannel(UINT index) { return m_channels[index]; }
+		inline std::vector<AnimationChannelHeader>& getChannels() { return m_channels; }
+		inline std::vector<char>& getKeyData() { return m_keyData; }
+	};
+
+	/* Decodes poses at any time without decompressing the clip, only the two keys around
+	the time are decoded per channel. The key found last is remembered for every channel,
+	so playing forward finds the next keys without searching. */
+	class AnimationSampler
+	{
+	private:
+		Animation* m_animation;
+		std::vector<UINT> m_cursors;
+
+	private:
+		UINT FindKey(UINT channel, float time);
+
+	public:
+		AnimationSampler(Animation& animation);
+
+		/* Writes the channels of the animation into pose, which has an element per bone.
+		Bones without channels keep their pose, start from the bind pose for those. */
+		void Sample(float time, BonePose* pose);
+	};
+
+	void BindPose(const std::vector<Bone>& bones, BonePose* pose);
+	/* transforms[i] maps from the space of bone i to model space */
+	void PoseToModelSpace(const std::vector<Bone>& bones, const BonePose* pose, mth::float4x4* transforms);
+	mth::float4x4 PoseMatrix(const BonePose& pose);
+	mth::quaternion NormalizedLerp(mth::quaternion a, mth::quaternion b, float t);
+}
\ No newline at end of file
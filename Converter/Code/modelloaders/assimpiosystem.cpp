@@ -0,0 +1,148 @@
+#include "assimpiosystem.h"
+
+namespace gfx
+{
+#pragma region MappedIOStream
+
+	MappedIOStream::MappedIOStream(LPCWSTR filename, LoadProgress* progress) :
+		m_file(filename),
+		m_data(m_file.getData()),
+		m_size(m_file.getSize()),
+		m_position(0),
+		m_reported(0),
+		m_progress(progress) {}
+	MappedIOStream::MappedIOStream(const char* data, size_t size, LoadProgress* progress) :
+		m_data(data),
+		m_size(size),
+		m_position(0),
+		m_reported(0),
+		m_progress(progress) {}
+
+	size_t MappedIOStream::Read(void* buffer, size_t size, size_t count)
+	{
+		if (size == 0 || count == 0)
+			return 0;
+		if (m_progress && m_progress->isCanceled())
+			return 0;
+		count = (std::min)(count, (m_size - m_position) / size);	//only whole elements, like fread
+		if (count == 0)
+			return 0;	//an empty file has no mapping to copy from
+		memcpy(buffer, m_data + m_position, size * count);
+		m_position += size * count;
+		if (m_progress && m_position > m_reported)
+		{
+			m_progress->Advance(m_position - m_reported);
+			m_reported = m_position;
+		}
+		return count;
+	}
+	size_t MappedIOStream::Write(const void* buffer, size_t size, size_t count)
+	{
+		return 0;
+	}
+	aiReturn MappedIOStream::Seek(size_t offset, aiOrigin origin)
+	{
+		size_t position;
+		switch (origin)
+		{
+		case aiOrigin_SET:
+			position = offset;
+			break;
+		case aiOrigin_CUR:
+			position = m_position + offset;
+			break;
+		case aiOrigin_END:
+			position = m_size + offset;	//the offset is negative here
+			break;
+		default:
+			return aiReturn_FAILURE;
+		}
+		if (position > m_size)
+			return aiReturn_FAILURE;
+		m_position = position;
+		return aiReturn_SUCCESS;
+	}
+	size_t MappedIOStream::Tell() const
+	{
+		return m_position;
+	}
+	size_t MappedIOStream::FileSize() const
+	{
+		return m_size;
+	}
+	void MappedIOStream::Flush() {}
+
+#pragma endregion
+
+#pragma region MappedIOSystem
+
+	MappedIOSystem::MappedIOSystem(LoadProgress* progress) :
+		m_memoryData(nullptr),
+		m_memorySize(0),
+		m_progress(progress) {}
+	MappedIOSystem::MappedIOSystem(const char* memoryName, const char* memoryData, size_t memorySize, LoadProgress* progress) :
+		m_memoryName(memoryName),
+		m_memoryData(memoryData),
+		m_memorySize(memorySize),
+		m_progress(progress) {}
+
+	bool MappedIOSystem::IsMemoryFile(const char* file) const
+	{
+		return m_memoryData && ComparePaths(m_memoryName.c_str(), file);
+	}
+	Assimp::IOStream* MappedIOSystem::Count(const char* file, MappedIOStream* stream)
+	{
+		if (m_progress && m_counted.insert(file).second)
+			m_progress->AddTotal(stream->FileSize());
+		return stream;
+	}
+	bool MappedIOSystem::Exists(const char* file) const
+	{
+		if (IsMemoryFile(file))
+			return true;
+		DWORD attributes = GetFileAttributesW(Utf8ToWStr(file).c_str());
+		return attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+	}
+	char MappedIOSystem::getOsSeparator() const
+	{
+		return '\\';
+	}
+	Assimp::IOStream* MappedIOSystem::Open(const char* file, const char* mode)
+	{
+		for (int i = 0; mode[i]; i++)	//the importers only read
+			if (mode[i] == 'w' || mode[i] == 'a' || mode[i] == '+')
+				return nullptr;
+		if (m_progress && m_progress->isCanceled())
+			return nullptr;
+		if (IsMemoryFile(file))
+			return Count(file, new MappedIOStream(m_memoryData, m_memorySize, m_progress));
+		MappedIOStream* stream;
+		try
+		{
+			stream = new MappedIOStream(Utf8ToWStr(file).c_str(), m_progress);
+		}
+		catch (std::exception&)
+		{
+			return nullptr;	//Assimp handles missing files itself, e.g. an OBJ without its MTL
+		}
+		return Count(file, stream);
+	}
+	void MappedIOSystem::Close(Assimp::IOStream* file)
+	{
+		delete file;
+	}
+
+#pragma endregion
+
+#pragma region AssimpProgressHandler
+
+	AssimpProgressHandler::AssimpProgressHandler(LoadProgress& progress) :
+		m_progress(progress) {}
+
+	bool AssimpProgressHandler::Update(float percentage)
+	{
+		return !m_progress.isCanceled();
+	}
+
+#pragma endregion
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "mappedfile.h"
+#include "loadprogress.h"
+#include "assimp/IOStream.hpp"
+#include "assimp/IOSystem.hpp"
+#include "assimp/ProgressHandler.hpp"
+#include <set>
+
+namespace gfx
+{
+	/* Read-only Assimp stream over a mapped file or over memory owned by the caller.
+	Reads are copies out of the mapping, there is no stdio buffer in between.
+	The bytes read past the furthest position so far are added to progress,
+	after a cancellation the reads return nothing, so the importer fails early. */
+	class MappedIOStream :public Assimp::IOStream
+	{
+	private:
+		MappedFile m_file;
+		const char* m_data;
+		size_t m_size;
+		size_t m_position;
+		size_t m_reported;
+		LoadProgress* m_progress;
+
+	public:
+		MappedIOStream(LPCWSTR filename, LoadProgress* progress = nullptr);
+		MappedIOStream(const char* data, size_t size, LoadProgress* progress = nullptr);
+
+		virtual size_t Read(void* buffer, size_t size, size_t count) override;
+		virtual size_t Write(const void* buffer, size_t size, size_t count) override;
+		virtual aiReturn Seek(size_t offset, aiOrigin origin) override;
+		virtual size_t Tell() const override;
+		virtual size_t FileSize() const override;
+		virtual void Flush() override;
+	};
+
+	/* Assimp file system that maps the files it opens. Assimp paths are UTF-8 and are
+	converted to UTF-16 for Windows, so folders and files with any name can be imported.
+	A file already in memory can be registered under a name, Assimp then reads it from
+	there while the files it references are still looked up on disk.
+	The size of every file opened is added to the total of progress once. */
+	class MappedIOSystem :public Assimp::IOSystem
+	{
+	private:
+		std::string m_memoryName;
+		const char* m_memoryData;
+		size_t m_memorySize;
+		LoadProgress* m_progress;
+		std::set<std::string> m_counted;	//files whose size is in the progress total
+
+		bool IsMemoryFile(const char* file) const;
+		Assimp::IOStream* Count(const char* file, MappedIOStream* stream);
+
+	public:
+		MappedIOSystem(LoadProgress* progress = nullptr);
+		MappedIOSystem(const char* memoryName, const char* memoryData, size_t memorySize, LoadProgress* progress = nullptr);
+
+		virtual bool Exists(const char* file) const override;
+		virtual char getOsSeparator() const override;
+		virtual Assimp::IOStream* Open(const char* file, const char* mode = "rb") override;
+		virtual void Close(Assimp::IOStream* file) override;
+	};
+
+	/* Asks Assimp to stop the import when the load is canceled. Assimp calls it between
+	the steps of an import, its post-processing steps included. */
+	class AssimpProgressHandler :public Assimp::ProgressHandler
+	{
+	private:
+		LoadProgress& m_progress;
+
+	public:
+		AssimpProgressHandler(LoadProgress& progress);
+
+		virtual bool Update(float percentage = -1.f) override;
+	};
+}
\ No newline at end of file
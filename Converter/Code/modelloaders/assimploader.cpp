@@ -2,23 +2,70 @@
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 #include "assimploader.h"
+#include "assimpiosystem.h"
+#include "simd.h"
+#include "imagedecoder.h"
+#include "omdarchive.h"
+#include <set>
+#include <unordered_map>
+#include <functional>
 
 #pragma comment (lib, "Code/assimp/lib/assimp.lib")
 
 namespace gfx
 {
-	void AssimpLoader::LoadAssimp(LPCWSTR filename, UINT modelType)
+	/* Removes the components the caller did not ask for before Assimp processes the meshes,
+	so they are neither converted nor compared when the identical vertices are joined.
+	Tangents are only generated when they are kept. Returns the post-processing steps. */
+	static UINT PlanImport(Assimp::Importer& importer, UINT modelType)
 	{
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(ToStr(filename).c_str(),
-			aiProcess_CalcTangentSpace |
+		UINT requested = ModelType::RemoveUnnecessary(modelType);
+		int removed = aiComponent_COLORS | aiComponent_LIGHTS | aiComponent_CAMERAS;	//never stored
+		if (!ModelType::HasNormals(requested))
+			removed |= aiComponent_NORMALS;
+		if (!ModelType::HasTangentsBinormals(requested))
+			removed |= aiComponent_TANGENTS_AND_BITANGENTS;
+		if (!ModelType::HasTexcoords(requested))
+			removed |= aiComponent_TEXCOORDS;
+		if (!ModelType::HasTexture(requested) && !ModelType::HasNormalmap(requested))
+			removed |= aiComponent_TEXTURES;
+		importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, removed);
+
+		UINT steps = aiProcess_RemoveComponent |
 			aiProcess_JoinIdenticalVertices |
 			aiProcess_Triangulate |
-			aiProcess_SortByPType);
+			aiProcess_SortByPType;
+		if (ModelType::HasTangentsBinormals(requested))
+			steps |= aiProcess_CalcTangentSpace;
+		return steps;
+	}
+
+	void AssimpLoader::LoadAssimp(LPCWSTR filename, UINT modelType)
+	{
+		Assimp::Importer importer;
+		importer.SetIOHandler(new MappedIOSystem(m_progress));	//the importer deletes it
+		ReadScene(importer, ToUtf8(filename), modelType);
+	}
+	void AssimpLoader::LoadAssimp(const char* data, size_t size, LPCWSTR filename, UINT modelType)
+	{
+		Assimp::Importer importer;
+		std::string path = ToUtf8(filename);
+		importer.SetIOHandler(new MappedIOSystem(path.c_str(), data, size, m_progress));
+		ReadScene(importer, path, modelType);
+	}
+	void AssimpLoader::ReadScene(Assimp::Importer& importer, const std::string& path, UINT modelType)
+	{
+		/* the IO system adds the files Assimp opens to the total, the post-processing
+		steps run inside ReadFile and can only be stopped through the progress handler */
+		BeginProgress(LoadStage::READ, 0);
+		if (m_progress)
+			importer.SetProgressHandler(new AssimpProgressHandler(*m_progress));	//the importer deletes it
+		const aiScene* scene = importer.ReadFile(path.c_str(), PlanImport(importer, modelType));
+		CheckCanceled();
 		if (scene == NULL)
 		{
 			auto error = importer.GetErrorString();
-			throw std::exception(("Importing " + ToStr(filename) + " failed: " + error).c_str());
+			throw std::exception(("Importing " + path + " failed: " + error).c_str());
 		}
 		StoreData(scene, modelType);
 	}
@@ -26,7 +73,13 @@ namespace gfx
 	void AssimpLoader::StoreData(const aiScene* scene, UINT modelType)
 	{
 		StoreMaterials(scene, modelType);
-		StoreVertices(scene, modelType);
+		std::map<std::string, UINT> boneIndices = StoreBones(scene);
+		std::vector<AssimpMeshPlacement> placements = PlaceMeshes(scene);
+		StoreVertices(scene, modelType, boneIndices, placements);
+		CheckCanceled();
+		StoreAnimations(scene, boneIndices);
+		CheckCanceled();
+		StoreMorphs(scene, placements);
 	}
 
 	std::wstring FolderlessFilename(LPCSTR filename)
@@ -35,10 +88,7 @@ namespace gfx
 		for (int i = 0; filename[i]; i++)
 			if (filename[i] == '\\' || filename[i] == '/')
 				lastSlashIndex = i;
-		std::wstring str;
-		for (int i = lastSlashIndex + 1; filename[i]; i++)
-			str += (WCHAR)filename[i];
-		return str;
+		return Utf8ToWStr(filename + lastSlashIndex + 1);	//Assimp strings are UTF-8
 	}
 	void AssimpLoader::StoreMaterials(const aiScene* scene, UINT modelType)
 	{
@@ -67,15 +117,410 @@ namespace gfx
 			else
 				m_normalmaps[i].filename = L"";
 		}
+		StoreEmbeddedTextures(scene);
+	}
+	static void DecodeEmbeddedTexture(const aiTexture* src, TextureToLoad& texture)
+	{
+		std::vector<unsigned char> pixels;
+		if (src->mHeight == 0)	//an image file of mWidth bytes
+			DecodeImage(src->pcData, src->mWidth, pixels, texture.width, texture.height);
+		else
+		{
+			texture.width = (int)src->mWidth;
+			texture.height = (int)src->mHeight;
+			pixels.resize((size_t)src->mWidth * src->mHeight * 4);
+			unsigned char* dst = pixels.data();
+			for (size_t i = 0; i < (size_t)src->mWidth * src->mHeight; i++, dst += 4)
+			{
+				dst[0] = src->pcData[i].r;
+				dst[1] = src->pcData[i].g;
+				dst[2] = src->pcData[i].b;
+				dst[3] = src->pcData[i].a;
+			}
+		}
+		texture.data = std::make_shared<const std::vector<unsigned char>>(std::move(pixels));
+		texture.loaded = true;
+	}
+	void AssimpLoader::StoreEmbeddedTextures(const aiScene* scene)
+	{
+		auto embeddedIndex = [scene](const TextureToLoad& texture) {
+			if (texture.filename.length() < 2 || texture.filename[0] != L'*')
+				return -1;
+			int index = (int)wcstol(texture.filename.c_str() + 1, nullptr, 10);
+			return index >= 0 && (UINT)index < scene->mNumTextures ? index : -1;
+		};
+		std::vector<UINT> used;
+		std::vector<bool> isUsed(scene->mNumTextures, false);
+		for (std::vector<TextureToLoad>* textures : { &m_textures, &m_normalmaps })
+			for (TextureToLoad& texture : *textures)
+			{
+				int index = embeddedIndex(texture);
+				if (index >= 0 && !isUsed[index])
+				{
+					isUsed[index] = true;
+					used.push_back((UINT)index);
+				}
+			}
+		if (used.empty())
+			return;
+
+		//a texture that cannot be decoded stays unloaded, like a missing texture file
+		BeginProgress(LoadStage::TEXTURES, used.size());
+		std::vector<TextureToLoad> decoded(scene->mNumTextures);
+		ParallelFor((UINT)used.size(), [&](UINT i) {
+			try
+			{
+				DecodeEmbeddedTexture(scene->mTextures[used[i]], decoded[used[i]]);
+			}
+			catch (std::exception&)
+			{
+				decoded[used[i]] = TextureToLoad();
+			}
+			AdvanceProgress(1);
+			});
+		for (std::vector<TextureToLoad>* textures : { &m_textures, &m_normalmaps })
+			for (TextureToLoad& texture : *textures)
+			{
+				int index = embeddedIndex(texture);
+				if (index >= 0 && decoded[index].loaded)
+				{
+					texture.width = decoded[index].width;
+					texture.height = decoded[index].height;
+					texture.data = decoded[index].data;	//the materials using the image share its pixels
+					texture.loaded = true;
+				}
+			}
+	}
+
+	/* Assimp scenes are right handed, z is mirrored like for the vertices */
+	static inline mth::float3 MirrorVector(const aiVector3D& v)
+	{
+		return mth::float3(v.x, v.y, -v.z);
+	}
+	static inline mth::quaternion MirrorRotation(const aiQuaternion& q)
+	{
+		return mth::quaternion(-q.x, -q.y, q.z, q.w);
+	}
+	static mth::float4x4 MirrorTransform(const aiMatrix4x4& m)
+	{
+		const float sign[4] = { 1.0f, 1.0f, -1.0f, 1.0f };
+		mth::float4x4 r;
+		for (int row = 0; row < 4; row++)
+			for (int column = 0; column < 4; column++)
+				r(row, column) = m[row][column] * sign[row] * sign[column];
+		return r;
+	}
+
+	std::map<std::string, UINT> AssimpLoader::StoreBones(const aiScene* scene)
+	{
+		std::map<std::string, UINT> boneIndices;
+		std::set<std::string> used;
+		for (UINT m = 0; m < scene->mNumMeshes; m++)
+			for (UINT b = 0; b < scene->mMeshes[m]->mNumBones; b++)
+				used.insert(scene->mMeshes[m]->mBones[b]->mName.C_Str());
+		for (UINT a = 0; a < scene->mNumAnimations; a++)
+			for (UINT c = 0; c < scene->mAnimations[a]->mNumChannels; c++)
+				used.insert(scene->mAnimations[a]->mChannels[c]->mNodeName.C_Str());
+		if (used.empty() || scene->mRootNode == nullptr)
+			return boneIndices;
+
+		std::set<const aiNode*> needed;
+		std::function<bool(const aiNode*)> markNeeded = [&](const aiNode* node) {
+			bool need = used.count(node->mName.C_Str()) != 0;
+			for (UINT c = 0; c < node->mNumChildren; c++)
+				need |= markNeeded(node->mChildren[c]);
+			if (need)
+				needed.insert(node);
+			return need;
+		};
+		markNeeded(scene->mRootNode);
+
+		//depth first, so parents come before their children
+		std::function<void(const aiNode*, int)> addBones = [&](const aiNode* node, int parent) {
+			if (needed.count(node) == 0)
+				return;
+			Bone bone;
+			bone.name = Utf8ToWStr(node->mName.C_Str());
+			bone.parent = parent;
+			aiVector3D scaling, position;
+			aiQuaternion rotation;
+			node->mTransformation.Decompose(scaling, rotation, position);
+			bone.translation = MirrorVector(position);
+			bone.rotation = MirrorRotation(rotation);
+			bone.scale = mth::float3(scaling.x, scaling.y, scaling.z);
+			int index = (int)m_bones.size();
+			boneIndices.emplace(node->mName.C_Str(), (UINT)index);
+			m_bones.push_back(bone);
+			for (UINT c = 0; c < node->mNumChildren; c++)
+				addBones(node->mChildren[c], index);
+		};
+		addBones(scene->mRootNode, -1);
+
+		//skinned meshes are not baked, the offset matrices still map from their mesh space
+		for (UINT m = 0; m < scene->mNumMeshes; m++)
+			for (UINT b = 0; b < scene->mMeshes[m]->mNumBones; b++)
+			{
+				const aiBone* src = scene->mMeshes[m]->mBones[b];
+				auto index = boneIndices.find(src->mName.C_Str());
+				if (index == boneIndices.end() || m_bones[index->second].hasOffset)
+					continue;
+				m_bones[index->second].hasOffset = true;
+				m_bones[index->second].offset = MirrorTransform(src->mOffsetMatrix);
+			}
+		return boneIndices;
+	}
+
+	void AssimpLoader::StoreAnimations(const aiScene* scene, std::map<std::string, UINT>& boneIndices)
+	{
+		for (UINT a = 0; a < scene->mNumAnimations; a++)
+		{
+			const aiAnimation* animation = scene->mAnimations[a];
+			double secondsPerTick = 1.0 / (animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0);
+			AnimationData data;
+			data.name = Utf8ToWStr(animation->mName.C_Str());
+			data.duration = (float)(animation->mDuration * secondsPerTick);
+			for (UINT c = 0; c < animation->mNumChannels; c++)
+			{
+				const aiNodeAnim* channel = animation->mChannels[c];
+				auto bone = boneIndices.find(channel->mNodeName.C_Str());
+				if (bone == boneIndices.end())
+					continue;
+				AnimationTrack track;
+				track.bone = bone->second;
+				for (UINT k = 0; k < channel->mNumPositionKeys; k++)
+					track.translations.push_back({ (float)(channel->mPositionKeys[k].mTime * secondsPerTick), MirrorVector(channel->mPositionKeys[k].mValue) });
+				for (UINT k = 0; k < channel->mNumRotationKeys; k++)
+					track.rotations.push_back({ (float)(channel->mRotationKeys[k].mTime * secondsPerTick), MirrorRotation(channel->mRotationKeys[k].mValue) });
+				for (UINT k = 0; k < channel->mNumScalingKeys; k++)
+				{
+					const aiVector3D& s = channel->mScalingKeys[k].mValue;
+					track.scales.push_back({ (float)(channel->mScalingKeys[k].mTime * secondsPerTick), mth::float3(s.x, s.y, s.z) });
+				}
+				data.tracks.push_back(std::move(track));
+			}
+			m_animations.push_back(Animation(data));
+		}
+	}
+
+	/* meshes with the same hash are compared with SameGeometry */
+	static UINT64 HashMesh(const aiMesh* mesh)
+	{
+		auto combine = [](UINT64 hash, const void* data, size_t size) {
+			return (hash ^ OMDArchive::HashData((const char*)data, size)) * 1099511628211ull;
+		};
+		UINT64 hash = combine(mesh->mMaterialIndex, &mesh->mNumVertices, sizeof(mesh->mNumVertices));
+		size_t size = (size_t)mesh->mNumVertices * sizeof(aiVector3D);
+		hash = combine(hash, mesh->mVertices, mesh->HasPositions() ? size : 0);
+		hash = combine(hash, mesh->mNormals, mesh->HasNormals() ? size : 0);
+		hash = combine(hash, mesh->mTextureCoords[0], mesh->HasTextureCoords(0) ? size : 0);
+		hash = combine(hash, mesh->mTangents, mesh->HasTangentsAndBitangents() ? size : 0);
+		for (UINT f = 0; f < mesh->mNumFaces; f++)
+			hash = combine(hash, mesh->mFaces[f].mIndices, mesh->mFaces[f].mNumIndices * sizeof(UINT));
+		return hash;
+	}
+	static bool SameGeometry(const aiMesh* a, const aiMesh* b)
+	{
+		if (a->mMaterialIndex != b->mMaterialIndex || a->mNumVertices != b->mNumVertices || a->mNumFaces != b->mNumFaces ||
+			a->HasPositions() != b->HasPositions() || a->HasNormals() != b->HasNormals() ||
+			a->HasTextureCoords(0) != b->HasTextureCoords(0) || a->HasTangentsAndBitangents() != b->HasTangentsAndBitangents())
+			return false;
+		auto same = [a](const aiVector3D* x, const aiVector3D* y) {
+			return x == nullptr || memcmp(x, y, (size_t)a->mNumVertices * sizeof(aiVector3D)) == 0;
+		};
+		if (!same(a->mVertices, b->mVertices) || !same(a->mNormals, b->mNormals) || !same(a->mTextureCoords[0], b->mTextureCoords[0]) ||
+			!same(a->mTangents, b->mTangents) || !same(a->mBitangents, b->mBitangents))
+			return false;
+		for (UINT f = 0; f < a->mNumFaces; f++)
+			if (a->mFaces[f].mNumIndices != b->mFaces[f].mNumIndices ||
+				memcmp(a->mFaces[f].mIndices, b->mFaces[f].mIndices, a->mFaces[f].mNumIndices * sizeof(UINT)) != 0)
+				return false;
+		return true;
+	}
+	std::vector<AssimpMeshPlacement> AssimpLoader::PlaceMeshes(const aiScene* scene)
+	{
+		std::vector<AssimpMeshPlacement> placements(scene->mNumMeshes);
+		//skinned and morphed meshes keep their own vertices, the others are hashed in parallel
+		auto shareable = [scene](UINT m) { return !scene->mMeshes[m]->HasBones() && scene->mMeshes[m]->mNumAnimMeshes == 0; };
+		std::vector<UINT64> hashes(scene->mNumMeshes);
+		ParallelFor(scene->mNumMeshes, [&](UINT m) {
+			if (shareable(m))
+				hashes[m] = HashMesh(scene->mMeshes[m]);
+			});
+		std::unordered_map<UINT64, std::vector<UINT>> stored;
+		for (UINT m = 0; m < scene->mNumMeshes; m++)
+		{
+			AssimpMeshPlacement& placement = placements[m];
+			placement.source = m;
+			placement.group = 0;
+			placement.vertexStart = 0;
+			placement.bake = false;
+			placement.transform = mth::float4x4::Identity();
+			if (!shareable(m))
+				continue;
+			std::vector<UINT>& candidates = stored[hashes[m]];
+			for (UINT other : candidates)
+				if (SameGeometry(scene->mMeshes[m], scene->mMeshes[other]))
+				{
+					placement.source = other;
+					break;
+				}
+			if (placement.source == m)
+				candidates.push_back(m);
+		}
+
+		//every node referencing a mesh places its stored copy once more
+		std::vector<std::vector<aiMatrix4x4>> places(scene->mNumMeshes);
+		std::vector<std::pair<const aiNode*, aiMatrix4x4>> nodes;
+		if (scene->mRootNode)
+			nodes.push_back({ scene->mRootNode, scene->mRootNode->mTransformation });
+		while (!nodes.empty())
+		{
+			const aiNode* node = nodes.back().first;
+			aiMatrix4x4 transform = nodes.back().second;
+			nodes.pop_back();
+			for (UINT i = 0; i < node->mNumMeshes; i++)
+				if (node->mMeshes[i] < scene->mNumMeshes && !scene->mMeshes[node->mMeshes[i]]->HasBones())
+					places[placements[node->mMeshes[i]].source].push_back(transform);
+			for (UINT c = 0; c < node->mNumChildren; c++)
+				nodes.push_back({ node->mChildren[c], transform * node->mChildren[c]->mTransformation });
+		}
+		for (UINT m = 0; m < scene->mNumMeshes; m++)
+		{
+			if (places[m].size() == 1)
+			{
+				placements[m].transform = MirrorTransform(places[m][0]);
+				placements[m].bake = !places[m][0].IsIdentity();
+			}
+			else if (places[m].size() > 1)
+				for (aiMatrix4x4& place : places[m])
+					placements[m].instances.push_back(MirrorTransform(place));
+		}
+		return placements;
 	}
 
-	void AssimpLoader::StoreVertices(const aiScene* scene, UINT modelType)
+	/* keeps the 4 largest influences of a vertex */
+	static void AddInfluence(float weights[4], UINT indices[4], float weight, UINT index)
+	{
+		UINT smallest = 0;
+		for (UINT i = 1; i < 4; i++)
+			if (weights[i] < weights[smallest])
+				smallest = i;
+		if (weight > weights[smallest])
+		{
+			weights[smallest] = weight;
+			indices[smallest] = index;
+		}
+	}
+
+	const UINT AssimpCopyChunkSize = 16384;	//vertices and faces per parallel task
+
+	/* dst = src * scale + bias for every vertex, the coordinate flips are in scale and bias.
+	Attributes the mesh does not have (src is null) become zero. */
+	template <int N>
+	static void CopyVectors(VertexElement* dst, UINT vertexSize, const aiVector3D* src, UINT count, __m128 scale, __m128 bias)
+	{
+		if (src == nullptr)
+		{
+			for (UINT v = 0; v < count; v++, dst += vertexSize)
+				for (int i = 0; i < N; i++)
+					dst[i] = 0.0f;
+			return;
+		}
+		for (UINT v = 0; v < count; v++, dst += vertexSize)
+		{
+			__m128 value = _mm_add_ps(_mm_mul_ps(simd::Load3(&src[v].x), scale), bias);
+			if constexpr (N == 3)
+				simd::Store3(&dst->f, value);
+			else
+				simd::Store2(&dst->f, value);
+		}
+	}
+	static void NormalizeWeights(VertexElement* dst, UINT vertexSize, UINT count)
+	{
+		for (UINT v = 0; v < count; v++, dst += vertexSize)
+		{
+			float sum = dst[0].f + dst[1].f + dst[2].f + dst[3].f;
+			float scale = sum > 0.0f ? 1.0f / sum : 0.0f;
+			for (UINT i = 0; i < 4; i++)
+				dst[i].f *= scale;
+		}
+	}
+	/* copies vertices [first, first + count) of mesh to dst, one attribute at a time */
+	static void CopyVertexChunk(const aiMesh* mesh, UINT first, UINT count, VertexElement* dst, UINT modelType)
+	{
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 flipZ = _mm_setr_ps(1.0f, 1.0f, -1.0f, 0.0f);
+		if (ModelType::HasPositions(modelType))
+			CopyVectors<3>(dst + ModelType::PositionOffset(modelType), vertexSize,
+				mesh->mVertices + first, count, flipZ, zero);
+		if (ModelType::HasTexcoords(modelType))
+			CopyVectors<2>(dst + ModelType::TexCoordOffset(modelType), vertexSize,
+				mesh->HasTextureCoords(0) ? mesh->mTextureCoords[0] + first : nullptr, count,
+				_mm_setr_ps(1.0f, -1.0f, 0.0f, 0.0f), _mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f));
+		if (ModelType::HasNormals(modelType))
+			CopyVectors<3>(dst + ModelType::NormalOffset(modelType), vertexSize,
+				mesh->HasNormals() ? mesh->mNormals + first : nullptr, count, flipZ, zero);
+		if (ModelType::HasTangentsBinormals(modelType))
+		{
+			bool hasTangents = mesh->HasTangentsAndBitangents();
+			CopyVectors<3>(dst + ModelType::TangentOffset(modelType), vertexSize,
+				hasTangents ? mesh->mTangents + first : nullptr, count, flipZ, zero);
+			CopyVectors<3>(dst + ModelType::BinormalOffset(modelType), vertexSize,
+				hasTangents ? mesh->mBitangents + first : nullptr, count, _mm_setr_ps(-1.0f, -1.0f, 1.0f, 0.0f), zero);
+		}
+		if (ModelType::HasBones(modelType))
+			NormalizeWeights(dst + ModelType::BoneWeightsOffset(modelType), vertexSize, count);
+	}
+	/* applies a baked node transform to vertices that were already copied to dst */
+	static void TransformVertexChunk(VertexElement* dst, UINT count, UINT modelType, const mth::float4x4& transform)
 	{
-		m_groups.resize(scene->mNumMeshes);
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		mth::float4x4 normalTransform = transform.Inverse();
+		normalTransform.Transpose();
+		__m128 column[4], normalColumn[3];
+		for (int c = 0; c < 4; c++)
+			column[c] = _mm_setr_ps(transform(0, c), transform(1, c), transform(2, c), 0.0f);
+		for (int c = 0; c < 3; c++)
+			normalColumn[c] = _mm_setr_ps(normalTransform(0, c), normalTransform(1, c), normalTransform(2, c), 0.0f);
+		auto direction = [](const __m128* m, __m128 v) {
+			return _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(m[0], _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0))),
+				_mm_mul_ps(m[1], _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)))),
+				_mm_mul_ps(m[2], _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+		};
+		auto transformDirections = [&](UINT offset, const __m128* m) {
+			float* v = &dst[offset].f;
+			for (UINT i = 0; i < count; i++, v += vertexSize)
+				simd::Store3(v, simd::Normalize3(direction(m, simd::Load3(v))));
+		};
+		if (ModelType::HasPositions(modelType))
+		{
+			float* v = &dst[ModelType::PositionOffset(modelType)].f;
+			for (UINT i = 0; i < count; i++, v += vertexSize)
+				simd::Store3(v, _mm_add_ps(direction(column, simd::Load3(v)), column[3]));
+		}
+		if (ModelType::HasNormals(modelType))
+			transformDirections(ModelType::NormalOffset(modelType), normalColumn);
+		if (ModelType::HasTangentsBinormals(modelType))
+		{
+			transformDirections(ModelType::TangentOffset(modelType), column);
+			transformDirections(ModelType::BinormalOffset(modelType), column);
+		}
+	}
+	void AssimpLoader::StoreVertices(const aiScene* scene, UINT modelType, std::map<std::string, UINT>& boneIndices,
+		std::vector<AssimpMeshPlacement>& placements)
+	{
+		/* first pass: the layout, and where every stored mesh and every chunk of its faces starts in the buffers */
+		m_groups.clear();
+		std::vector<std::vector<UINT>> chunkIndexStarts(scene->mNumMeshes);
+		std::vector<std::pair<UINT, UINT>> tasks;	//mesh and chunk
 		UINT vertexCount = 0;
 		UINT indexCount = 0;
 		for (UINT m = 0; m < scene->mNumMeshes; m++)
 		{
+			if (placements[m].source != m)
+				continue;
 			aiMesh* mesh = scene->mMeshes[m];
 			m_modelType |= ModelType::ToModelType(
 				mesh->HasPositions(),
@@ -85,76 +530,155 @@ namespace gfx
 				mesh->HasBones(),
 				scene->mMaterials[mesh->mMaterialIndex]->GetTextureCount(aiTextureType_DIFFUSE) > 0,
 				scene->mMaterials[mesh->mMaterialIndex]->GetTextureCount(aiTextureType_NORMALS) > 0);
-			m_groups[m].startIndex = indexCount;
-			m_groups[m].materialIndex = mesh->mMaterialIndex;
-			vertexCount += scene->mMeshes[m]->mNumVertices;
-			for (UINT ii = 0; ii < scene->mMeshes[m]->mNumFaces; ii++)
-				indexCount += scene->mMeshes[m]->mFaces[ii].mNumIndices;
-			m_groups[m].indexCount = indexCount - m_groups[m].startIndex;
+			placements[m].group = (UINT)m_groups.size();
+			placements[m].vertexStart = vertexCount;
+			VertexGroup& group = m_groups.emplace_back();
+			group.startIndex = indexCount;
+			group.materialIndex = mesh->mMaterialIndex;
+			vertexCount += mesh->mNumVertices;
+			for (UINT f = 0; f < mesh->mNumFaces; f++)
+			{
+				if (f % AssimpCopyChunkSize == 0)
+					chunkIndexStarts[m].push_back(indexCount);
+				if (mesh->mFaces[f].mNumIndices >= 3)	//points and lines are not stored
+					indexCount += (mesh->mFaces[f].mNumIndices - 2) * 3;
+			}
+			group.indexCount = indexCount - group.startIndex;
+			UINT chunkCount = (std::max)((mesh->mNumVertices + AssimpCopyChunkSize - 1) / AssimpCopyChunkSize, (UINT)chunkIndexStarts[m].size());
+			for (UINT c = 0; c < chunkCount; c++)
+				tasks.push_back({ m, c });
 		}
 		m_modelType = ModelType::RemoveUnnecessary(m_modelType & modelType);
 		m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
-		m_vertices.resize(vertexCount * m_vertexSizeInBytes / sizeof(VertexElement));
+		m_vertices.resize((size_t)vertexCount * m_vertexSizeInBytes / sizeof(VertexElement));
 		m_indices.resize(indexCount);
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(m_modelType);
+		BeginProgress(LoadStage::VERTICES, vertexCount);
 
-		vertexCount = 0;
-		UINT vertexCounter = 0;
-		UINT indexCounter = 0;
-		for (UINT m = 0; m < scene->mNumMeshes; m++)
+		if (ModelType::HasBones(m_modelType))
 		{
-			aiMesh* mesh = scene->mMeshes[m];
-
-			for (UINT v = 0; v < mesh->mNumVertices; v++)
-			{
-				if (ModelType::HasPositions(m_modelType))
+			/* the bone names are looked up here, the influences are scattered per mesh in parallel */
+			std::vector<std::vector<UINT>> meshBones(scene->mNumMeshes);
+			for (UINT m = 0; m < scene->mNumMeshes; m++)
+				for (UINT b = 0; b < scene->mMeshes[m]->mNumBones; b++)
 				{
-					m_vertices[vertexCounter++] = mesh->mVertices[v].x;
-					m_vertices[vertexCounter++] = mesh->mVertices[v].y;
-					m_vertices[vertexCounter++] = -mesh->mVertices[v].z;
+					auto bone = boneIndices.find(scene->mMeshes[m]->mBones[b]->mName.C_Str());
+					meshBones[m].push_back(bone == boneIndices.end() ? 0 : bone->second);
 				}
-				if (ModelType::HasTexcoords(m_modelType))
+			UINT weightsOffset = ModelType::BoneWeightsOffset(m_modelType);
+			UINT indexOffset = ModelType::BoneIndexOffset(m_modelType);
+			ParallelFor(scene->mNumMeshes, [&](UINT m) {
+				if (placements[m].source != m)
+					return;
+				CheckCanceled();
+				const aiMesh* mesh = scene->mMeshes[m];
+				VertexElement* vertices = m_vertices.data() + (size_t)placements[m].vertexStart * vertexSize;
+				for (UINT v = 0; v < mesh->mNumVertices; v++)
+					for (UINT i = 0; i < 4; i++)
+					{
+						vertices[(size_t)v * vertexSize + weightsOffset + i] = 0.0f;
+						vertices[(size_t)v * vertexSize + indexOffset + i] = 0u;
+					}
+				for (UINT b = 0; b < mesh->mNumBones; b++)
 				{
-					m_vertices[vertexCounter++] = mesh->mTextureCoords[0][v].x;
-					m_vertices[vertexCounter++] = 1.0f - mesh->mTextureCoords[0][v].y;
+					const aiBone* bone = mesh->mBones[b];
+					for (UINT w = 0; w < bone->mNumWeights; w++)
+					{
+						size_t v = bone->mWeights[w].mVertexId;
+						if (v < mesh->mNumVertices)
+							AddInfluence(&vertices[v * vertexSize + weightsOffset].f, &vertices[v * vertexSize + indexOffset].u,
+								bone->mWeights[w].mWeight, meshBones[m][b]);
+					}
 				}
-				if (ModelType::HasNormals(m_modelType))
-				{
-					m_vertices[vertexCounter++] = mesh->mNormals[v].x;
-					m_vertices[vertexCounter++] = mesh->mNormals[v].y;
-					m_vertices[vertexCounter++] = -mesh->mNormals[v].z;
-				}
-				if (ModelType::HasTangentsBinormals(m_modelType))
-				{
-					m_vertices[vertexCounter++] = mesh->mTangents[v].x;
-					m_vertices[vertexCounter++] = mesh->mTangents[v].y;
-					m_vertices[vertexCounter++] = -mesh->mTangents[v].z;
-					m_vertices[vertexCounter++] = -mesh->mBitangents[v].x;
-					m_vertices[vertexCounter++] = -mesh->mBitangents[v].y;
-					m_vertices[vertexCounter++] = mesh->mBitangents[v].z;
-				}
-				if (ModelType::HasBones(m_modelType))
+				});
+		}
+
+		ParallelFor((UINT)tasks.size(), [&](UINT task) {
+			UINT m = tasks[task].first;
+			UINT chunk = tasks[task].second;
+			const aiMesh* mesh = scene->mMeshes[m];
+			UINT first = chunk * AssimpCopyChunkSize;
+			const AssimpMeshPlacement& placement = placements[m];
+			if (first < mesh->mNumVertices)
+			{
+				UINT count = (std::min)(AssimpCopyChunkSize, mesh->mNumVertices - first);
+				VertexElement* vertices = m_vertices.data() + ((size_t)placement.vertexStart + first) * vertexSize;
+				CopyVertexChunk(mesh, first, count, vertices, m_modelType);
+				if (placement.bake)
+					TransformVertexChunk(vertices, count, m_modelType, placement.transform);
+				AdvanceProgress(count);
+			}
+			if (chunk < chunkIndexStarts[m].size())
+			{
+				UINT* indices = m_indices.data() + chunkIndexStarts[m][chunk];
+				UINT base = placement.vertexStart;
+				//a mirroring transform turns the triangles inside out, the winding has to follow
+				UINT second = placement.bake && placement.transform.Determinant() < 0.0f ? 1 : 0;
+				UINT last = (std::min)(first + AssimpCopyChunkSize, mesh->mNumFaces);
+				for (UINT f = first; f < last; f++)
 				{
-					m_vertices[vertexCounter++] = 0.0f;
-					m_vertices[vertexCounter++] = 0.0f;
-					m_vertices[vertexCounter++] = 0.0f;
-					m_vertices[vertexCounter++] = 0.0f;
-					m_vertices[vertexCounter++] = 0u;
-					m_vertices[vertexCounter++] = 0u;
-					m_vertices[vertexCounter++] = 0u;
-					m_vertices[vertexCounter++] = 0u;
+					const aiFace& face = mesh->mFaces[f];
+					for (UINT i = 2; i < face.mNumIndices; i++)
+					{
+						*indices++ = face.mIndices[0] + base;
+						*indices++ = face.mIndices[i - second] + base;
+						*indices++ = face.mIndices[i - 1 + second] + base;
+					}
 				}
 			}
+			});
 
-			for (UINT f = 0; f < mesh->mNumFaces; f++)
+		for (UINT m = 0; m < scene->mNumMeshes; m++)
+			for (const mth::float4x4& transform : placements[m].instances)
+				m_instances.push_back({ placements[m].group, transform });
+	}
+
+	void AssimpLoader::StoreMorphs(const aiScene* scene, const std::vector<AssimpMeshPlacement>& placements)
+	{
+		for (UINT m = 0; m < scene->mNumMeshes; m++)
+		{
+			const aiMesh* mesh = scene->mMeshes[m];
+			const AssimpMeshPlacement& placement = placements[m];
+			//deltas are directions, a baked transform moves them without its translation
+			mth::float4x4 normalTransform = placement.transform.Inverse();
+			normalTransform.Transpose();
+			auto transformDelta = [&placement](const mth::float4x4& transform, mth::float3 delta) {
+				if (!placement.bake)
+					return delta;
+				mth::float4 v = transform * mth::float4(delta.x, delta.y, delta.z, 0.0f);
+				return mth::float3(v.x, v.y, v.z);
+			};
+			for (UINT a = 0; a < mesh->mNumAnimMeshes; a++)
 			{
-				for (UINT i = 2; i < mesh->mFaces[f].mNumIndices; i++)
+				const aiAnimMesh* target = mesh->mAnimMeshes[a];
+				if (target->mNumVertices != mesh->mNumVertices)
+					continue;
+				Morph morph;
+				std::string name = mesh->mName.length ? mesh->mName.C_Str() : "mesh" + std::to_string(m);
+				morph.name = Utf8ToWStr((name + "." + std::to_string(a)).c_str());
+				bool positions = target->HasPositions() && mesh->HasPositions();
+				bool normals = target->HasNormals() && mesh->HasNormals();
+				bool texcoords = target->HasTextureCoords(0) && mesh->HasTextureCoords(0);
+				morph.deltas.resize(mesh->mNumVertices);
+				for (UINT v = 0; v < mesh->mNumVertices; v++)
 				{
-					m_indices[indexCounter++] = mesh->mFaces[f].mIndices[0] + vertexCount;
-					m_indices[indexCounter++] = mesh->mFaces[f].mIndices[i] + vertexCount;
-					m_indices[indexCounter++] = mesh->mFaces[f].mIndices[i - 1] + vertexCount;
+					MorphDelta& delta = morph.deltas[v];
+					delta = MorphDelta{};
+					delta.vertex = placement.vertexStart + v;
+					if (positions)
+						delta.position = transformDelta(placement.transform, MirrorVector(target->mVertices[v] - mesh->mVertices[v]));
+					if (normals)
+						delta.normal = transformDelta(normalTransform, MirrorVector(target->mNormals[v] - mesh->mNormals[v]));
+					if (texcoords)
+					{
+						delta.texcoord.x = target->mTextureCoords[0][v].x - mesh->mTextureCoords[0][v].x;
+						delta.texcoord.y = mesh->mTextureCoords[0][v].y - target->mTextureCoords[0][v].y;
+					}
 				}
+				SortMorphDeltas(morph);
+				if (!morph.deltas.empty())
+					m_morphs.push_back(std::move(morph));
 			}
-			vertexCount += mesh->mNumVertices;
 		}
 	}
 }
\ No newline at end of file
@@ -1,19 +1,49 @@
 #pragma once
 
 #include "modelloader.h"
+#include <map>
 
 struct aiScene;
+namespace Assimp { class Importer; }
 
 namespace gfx
 {
+	/* What the node hierarchy does with an aiMesh */
+	struct AssimpMeshPlacement
+	{
+		UINT source;		//mesh whose vertices are stored for this one, itself unless it has the same content as an earlier mesh
+		UINT group;			//vertex group of the stored mesh, set by StoreVertices
+		UINT vertexStart;	//first vertex of the stored mesh, set by StoreVertices
+		bool bake;			//transform is applied to the stored vertices
+		mth::float4x4 transform;
+		std::vector<mth::float4x4> instances;	//for stored meshes drawn at more than one place
+	};
+
 	class AssimpLoader :public ModelLoader
 	{
 	private:
+		/* importer has to have its IO handler set, path is UTF-8 */
+		void ReadScene(Assimp::Importer& importer, const std::string& path, UINT modelType);
 		void StoreData(const aiScene* scene, UINT modelType);
 		void StoreMaterials(const aiScene* scene, UINT modelType);
-		void StoreVertices(const aiScene* scene, UINT modelType);
+		/* textures named "*<index>" are in aiScene::mTextures, they are decoded in parallel */
+		void StoreEmbeddedTextures(const aiScene* scene);
+		/* Walks the nodes and finds meshes with the same content. A mesh drawn at one place gets its
+		node transform baked, one drawn at more places is stored once with an instance per place.
+		Skinned meshes stay as they are, the bones place them. */
+		std::vector<AssimpMeshPlacement> PlaceMeshes(const aiScene* scene);
+		void StoreVertices(const aiScene* scene, UINT modelType, std::map<std::string, UINT>& boneIndices,
+			std::vector<AssimpMeshPlacement>& placements);
+		/* nodes with skinned vertices or animations and their ancestors become bones */
+		std::map<std::string, UINT> StoreBones(const aiScene* scene);
+		void StoreAnimations(const aiScene* scene, std::map<std::string, UINT>& boneIndices);
+		/* anim meshes have no names here, morph i of a mesh is called "<mesh name>.<i>" */
+		void StoreMorphs(const aiScene* scene, const std::vector<AssimpMeshPlacement>& placements);
 
 	public:
 		void LoadAssimp(LPCWSTR filename, UINT modelType);
+		/* Imports a file that is already in memory. filename tells the format and
+		the folder where the files it references (materials, textures) are looked up. */
+		void LoadAssimp(const char* data, size_t size, LPCWSTR filename, UINT modelType);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "imagedecoder.h"
+#include <wincodec.h>
+
+#pragma comment(lib, "windowscodecs.lib")
+
+namespace gfx
+{
+	void DecodeImage(const void* data, size_t size, std::vector<unsigned char>& pixels, int& width, int& height)
+	{
+		if (size > MAXDWORD)
+			throw std::exception("Image is too large to decode");
+
+		//worker threads have no COM apartment yet, threads that already have one keep theirs
+		HRESULT init = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+		HRESULT hr;
+		{
+			AutoReleasePtr<IWICImagingFactory> factory;
+			AutoReleasePtr<IWICStream> stream;
+			AutoReleasePtr<IWICBitmapDecoder> decoder;
+			AutoReleasePtr<IWICBitmapFrameDecode> frame;
+			AutoReleasePtr<IWICFormatConverter> converter;
+			UINT frameWidth = 0, frameHeight = 0;
+			hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory));
+			if (SUCCEEDED(hr))
+				hr = factory->CreateStream(&stream);
+			if (SUCCEEDED(hr))
+				hr = stream->InitializeFromMemory((BYTE*)data, (DWORD)size);
+			if (SUCCEEDED(hr))
+				hr = factory->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, &decoder);
+			if (SUCCEEDED(hr))
+				hr = decoder->GetFrame(0, &frame);
+			if (SUCCEEDED(hr))
+				hr = factory->CreateFormatConverter(&converter);
+			if (SUCCEEDED(hr))
+				hr = converter->Initialize(frame, GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom);
+			if (SUCCEEDED(hr))
+				hr = converter->GetSize(&frameWidth, &frameHeight);
+			if (SUCCEEDED(hr) && (UINT64)frameWidth * frameHeight * 4 > MAXDWORD)
+				hr = E_OUTOFMEMORY;
+			if (SUCCEEDED(hr))
+			{
+				pixels.resize((size_t)frameWidth * frameHeight * 4);
+				hr = converter->CopyPixels(nullptr, frameWidth * 4, (UINT)pixels.size(), pixels.data());
+				width = (int)frameWidth;
+				height = (int)frameHeight;
+			}
+		}
+		if (SUCCEEDED(init))
+			CoUninitialize();
+		if (FAILED(hr))
+			throw std::exception("Failed to decode image");
+	}
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "helpers.h"
+
+namespace gfx
+{
+	/* Decodes an image file held in memory (PNG, JPEG, BMP, GIF, TIFF or anything else WIC
+	has a codec for) into RGBA pixels, top row first, like TextureToLoad::data.
+	Can be called from any thread, throws if the data cannot be decoded. */
+	void DecodeImage(const void* data, size_t size, std::vector<unsigned char>& pixels, int& width, int& height);
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#include "loadprogress.h"
+
+namespace gfx
+{
+	LoadProgress::LoadProgress() :
+		m_stage(LoadStage::NONE),
+		m_done(0),
+		m_total(0),
+		m_canceled(false) {}
+
+	void LoadProgress::BeginStage(UINT stage, UINT64 total)
+	{
+		m_done = 0;
+		m_total = total;
+		m_stage = stage;
+	}
+	void LoadProgress::AddTotal(UINT64 count)
+	{
+		m_total += count;
+	}
+	void LoadProgress::Advance(UINT64 count)
+	{
+		m_done += count;
+	}
+	void LoadProgress::SetDone(UINT64 done)
+	{
+		m_done = done;
+	}
+	void LoadProgress::Cancel()
+	{
+		m_canceled = true;
+	}
+	void LoadProgress::Reset()
+	{
+		m_stage = LoadStage::NONE;
+		m_done = 0;
+		m_total = 0;
+		m_canceled = false;
+	}
+	float LoadProgress::getFraction()
+	{
+		UINT64 done = m_done;
+		UINT64 total = m_total;
+		if (total == 0)
+			return 0.0f;
+		return done >= total ? 1.0f : (float)((double)done / (double)total);
+	}
+}
\ No newline at end of file
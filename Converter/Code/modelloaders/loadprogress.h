@@ -0,0 +1,53 @@
+#pragma once
+
+#include "helpers.h"
+#include <atomic>
+
+namespace gfx
+{
+	/* What a load is doing, each stage counts its own unit. The loaders switch between
+	the stages as they go, so a stage can come again after an other one. */
+	namespace LoadStage
+	{
+		enum Stage :UINT
+		{
+			NONE = 0,
+			READ = 1,			//bytes of the file parsed, the files an Assimp import opens add to the total
+			SECTIONS = 2,		//sections of a binary OMD
+			VERTICES = 3,		//vertices converted from an Assimp scene
+			TEXTURES = 4,		//embedded textures decoded
+			POSTPROCESS = 5		//elements handled by the passes run on the loaded model
+		};
+	}
+
+	/* Progress and cancellation token of ModelLoader::LoadModel. The loading thread reports
+	into it, any other thread can read it and call Cancel. The loaders check the token at
+	every report, a canceled load throws from LoadModel and leaves an empty model with
+	its memory released. A token can be used for one load at a time. */
+	class LoadProgress
+	{
+		NO_COPY(LoadProgress)
+
+	private:
+		std::atomic<UINT> m_stage;
+		std::atomic<UINT64> m_done;
+		std::atomic<UINT64> m_total;
+		std::atomic<bool> m_canceled;
+
+	public:
+		LoadProgress();
+
+		void BeginStage(UINT stage, UINT64 total);
+		void AddTotal(UINT64 count);
+		void Advance(UINT64 count);		//safe from parallel tasks
+		void SetDone(UINT64 done);
+		void Cancel();
+		void Reset();	//for the next load, clears the cancellation too
+
+		inline bool isCanceled() { return m_canceled; }
+		inline UINT getStage() { return m_stage; }
+		inline UINT64 getDone() { return m_done; }
+		inline UINT64 getTotal() { return m_total; }
+		float getFraction();	//of the current stage, 0 to 1
+	};
+}
\ No newline at end of file
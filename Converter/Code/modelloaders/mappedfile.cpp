@@ -0,0 +1,61 @@
+#include "mappedfile.h"
+
+namespace gfx
+{
+	MappedFile::MappedFile() :
+		m_file(INVALID_HANDLE_VALUE),
+		m_mapping(nullptr),
+		m_data(nullptr),
+		m_size(0) {}
+	MappedFile::MappedFile(LPCWSTR filename) :
+		m_file(INVALID_HANDLE_VALUE),
+		m_mapping(nullptr),
+		m_data(nullptr),
+		m_size(0)
+	{
+		Open(filename);
+	}
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+
+	void MappedFile::Open(LPCWSTR filename)
+	{
+		Close();
+		m_file = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			throw std::exception(std::string("Failed to load file: " + ToStr(filename)).c_str());
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size))
+		{
+			Close();
+			throw std::exception(std::string("Failed to load file: " + ToStr(filename)).c_str());
+		}
+		m_size = (size_t)size.QuadPart;
+		if (m_size == 0)	//empty files cannot be mapped
+			return;
+		m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping)
+			m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		if (m_data == nullptr)
+		{
+			Close();
+			throw std::exception(std::string("Failed to map file: " + ToStr(filename)).c_str());
+		}
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = nullptr;
+		m_data = nullptr;
+		m_size = 0;
+	}
+}
\ No newline at end of file
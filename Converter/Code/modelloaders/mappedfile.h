@@ -0,0 +1,32 @@
+#pragma once
+
+#include "helpers.h"
+
+namespace gfx
+{
+	/* Read-only view of a whole file mapped into the address space.
+	Pages are only read from disk when they are first touched. */
+	class MappedFile
+	{
+		SMART_PTR(MappedFile)
+		NO_COPY(MappedFile)
+
+	private:
+		HANDLE m_file;
+		HANDLE m_mapping;
+		const char* m_data;
+		size_t m_size;
+
+	public:
+		MappedFile();
+		MappedFile(LPCWSTR filename);
+		~MappedFile();
+
+		void Open(LPCWSTR filename);
+		void Close();
+
+		inline bool isOpen() { return m_file != INVALID_HANDLE_VALUE; }
+		inline const char* getData() { return m_data; }
+		inline size_t getSize() { return m_size; }
+	};
+}
\ No newline at end of file
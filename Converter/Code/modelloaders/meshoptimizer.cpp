@@ -0,0 +1,655 @@
+#include "meshoptimizer.h"
+#include "helpers.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+
+namespace gfx
+{
+	namespace
+	{
+		const UINT ForsythCacheSize = 32;	//LRU entries the scores are made for
+		const UINT ForsythMaxValence = 64;	//vertices with more triangles left share the last valence score
+		const float CacheDecayPower = 1.5f;
+		const float LastTriangleScore = 0.75f;
+		const float ValenceBoostScale = 2.0f;
+		const float ValenceBoostPower = 0.5f;
+
+		struct ForsythScores
+		{
+			float cache[ForsythCacheSize];
+			float valence[ForsythMaxValence];
+
+			ForsythScores()
+			{
+				for (UINT i = 0; i < ForsythCacheSize; i++)
+					cache[i] = i < 3 ? LastTriangleScore :	//the last triangle's vertices get a fixed score, so it isn't repeated
+						powf(1.0f - (float)(i - 3) / (ForsythCacheSize - 3), CacheDecayPower);
+				valence[0] = 0.0f;
+				for (UINT i = 1; i < ForsythMaxValence; i++)
+					valence[i] = ValenceBoostScale * powf((float)i, -ValenceBoostPower);
+			}
+
+			inline float Score(int cachePosition, UINT trianglesLeft) const
+			{
+				if (trianglesLeft == 0)
+					return -1.0f;
+				return (cachePosition < 0 ? 0.0f : cache[cachePosition]) + valence[(std::min)(trianglesLeft, ForsythMaxValence - 1)];
+			}
+		};
+
+		const ForsythScores& Scores()
+		{
+			static const ForsythScores scores;
+			return scores;
+		}
+
+		/* smallest and largest index, the per vertex arrays only cover that range */
+		void IndexRange(const UINT* indices, size_t indexCount, UINT& first, UINT& last)
+		{
+			first = UINT_MAX;
+			last = 0;
+			for (size_t i = 0; i < indexCount; i++)
+			{
+				first = (std::min)(first, indices[i]);
+				last = (std::max)(last, indices[i]);
+			}
+		}
+
+		/* FIFO vertex cache that can start over, for the vertices first..first + vertexCount - 1 */
+		class FifoCache
+		{
+			std::vector<UINT64> m_loadedAt;
+			UINT64 m_transformed;
+			UINT64 m_resetAt;
+			UINT m_first;
+
+		public:
+			FifoCache(UINT first, UINT vertexCount) :
+				m_loadedAt(vertexCount, UINT64_MAX),
+				m_transformed(0),
+				m_resetAt(0),
+				m_first(first) {}
+
+			UINT AddTriangle(const UINT* triangle)	//returns the cache misses
+			{
+				UINT misses = 0;
+				for (UINT c = 0; c < 3; c++)
+				{
+					UINT64& loaded = m_loadedAt[triangle[c] - m_first];
+					if (loaded == UINT64_MAX || loaded < m_resetAt || m_transformed - loaded >= VertexCacheSize)
+					{
+						loaded = m_transformed++;
+						misses++;
+					}
+				}
+				return misses;
+			}
+			inline void Reset() { m_resetAt = m_transformed; }
+		};
+
+		struct OverdrawBuffer
+		{
+			std::vector<float> depth[2];	//seen from the smaller and from the larger depths
+			OverdrawStatistics statistics;
+
+			OverdrawBuffer() : statistics()
+			{
+				for (auto& d : depth)
+					d.assign(OverdrawGridSize * OverdrawGridSize, FLT_MAX);
+			}
+
+			void Rasterize(mth::float3 v0, mth::float3 v1, mth::float3 v2)	//x and y in grid cells, z the depth
+			{
+				float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+				if (area == 0.0f)
+					return;
+				bool front = area < 0.0f;	//clockwise seen from the smaller depths
+				std::vector<float>& buffer = depth[front ? 0 : 1];
+				if (front)
+				{
+					std::swap(v1, v2);
+					area = -area;
+				}
+				else
+				{
+					v0.z = -v0.z;
+					v1.z = -v1.z;
+					v2.z = -v2.z;
+				}
+				int minX = (std::max)((int)(std::min)({ v0.x, v1.x, v2.x }), 0);
+				int minY = (std::max)((int)(std::min)({ v0.y, v1.y, v2.y }), 0);
+				int maxX = (std::min)((int)(std::max)({ v0.x, v1.x, v2.x }), (int)OverdrawGridSize - 1);
+				int maxY = (std::min)((int)(std::max)({ v0.y, v1.y, v2.y }), (int)OverdrawGridSize - 1);
+				for (int y = minY; y <= maxY; y++)
+					for (int x = minX; x <= maxX; x++)
+					{
+						float px = x + 0.5f, py = y + 0.5f;
+						float w0 = (v2.x - v1.x) * (py - v1.y) - (v2.y - v1.y) * (px - v1.x);
+						float w1 = (v0.x - v2.x) * (py - v2.y) - (v0.y - v2.y) * (px - v2.x);
+						float w2 = (v1.x - v0.x) * (py - v0.y) - (v1.y - v0.y) * (px - v0.x);
+						if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+							continue;
+						float z = (w0 * v0.z + w1 * v1.z + w2 * v2.z) / area;
+						float& stored = buffer[y * OverdrawGridSize + x];
+						if (z < stored)
+						{
+							stored = z;
+							statistics.shadedPixels++;
+						}
+					}
+			}
+
+			void Finish()
+			{
+				for (auto& d : depth)
+				{
+					for (float z : d)
+						if (z != FLT_MAX)
+							statistics.coveredPixels++;
+					std::fill(d.begin(), d.end(), FLT_MAX);
+				}
+			}
+		};
+
+		const size_t WeldChunkSize = 1 << 14;
+		const float WeldGridLimit = 1e18f;	//largest cell coordinate, well inside INT64
+
+		inline UINT64 HashWords(const VertexElement* words, UINT count)	//FNV-1a over 32 bit words
+		{
+			UINT64 hash = 14695981039346656037ull;
+			for (UINT i = 0; i < count; i++)
+				hash = (hash ^ words[i].u) * 1099511628211ull;
+			return hash;
+		}
+
+		inline UINT64 HashCell(INT64 x, INT64 y, INT64 z)
+		{
+			return ((UINT64)x * 73856093ull) ^ ((UINT64)y * 19349663ull) ^ ((UINT64)z * 83492791ull);
+		}
+
+		/* Vertices sorted by a key, cells with the same key can come together, every vertex is checked */
+		class WeldGrid
+		{
+			std::vector<std::pair<UINT64, UINT>> m_entries;
+			std::vector<UINT> m_cellStart;	//of every vertex, the first entry with its key
+
+		public:
+			WeldGrid(const std::vector<UINT64>& keys) :
+				m_entries(keys.size()),
+				m_cellStart(keys.size())
+			{
+				for (size_t v = 0; v < keys.size(); v++)
+					m_entries[v] = { keys[v], (UINT)v };
+				std::sort(m_entries.begin(), m_entries.end());
+				for (size_t i = 0, start = 0; i < m_entries.size(); i++)
+				{
+					if (m_entries[i].first != m_entries[start].first)
+						start = i;
+					m_cellStart[m_entries[i].second] = (UINT)start;
+				}
+			}
+
+			/* smallest vertex below limit in the cell of key that accept takes, limit if none */
+			template <typename Accept>
+			UINT FindFirst(UINT64 key, UINT limit, Accept accept) const
+			{
+				auto entry = std::lower_bound(m_entries.begin(), m_entries.end(), std::pair<UINT64, UINT>(key, 0));
+				for (; entry != m_entries.end() && entry->first == key && entry->second < limit; ++entry)
+					if (accept(entry->second))
+						return entry->second;
+				return limit;
+			}
+
+			/* the same in the cell of vertex, below vertex, without searching */
+			template <typename Accept>
+			UINT FindFirstInCell(UINT vertex, Accept accept) const
+			{
+				for (size_t i = m_cellStart[vertex]; m_entries[i].second < vertex; i++)
+					if (accept(m_entries[i].second))
+						return m_entries[i].second;
+				return vertex;
+			}
+		};
+
+		inline mth::float3 ReadFloat3(const VertexElement* vertices, UINT vertexSize, UINT positionOffset, UINT index)
+		{
+			return mth::float3(&vertices[(size_t)index * vertexSize + positionOffset].f);
+		}
+	}
+
+	VertexCacheStatistics AnalyzeVertexCache(const UINT* indices, size_t indexCount, UINT cacheSize)
+	{
+		VertexCacheStatistics statistics = {};
+		indexCount -= indexCount % 3;
+		if (indexCount == 0)
+			return statistics;
+		UINT first, last;
+		IndexRange(indices, indexCount, first, last);
+
+		//a vertex is in the FIFO while fewer than cacheSize misses came after the one that loaded it
+		std::vector<UINT64> loadedAt(last - first + 1, UINT64_MAX);
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			UINT64& loaded = loadedAt[indices[i] - first];
+			if (loaded == UINT64_MAX)
+				statistics.vertexCount++;
+			if (loaded == UINT64_MAX || statistics.transformedCount - loaded >= cacheSize)
+				loaded = statistics.transformedCount++;
+		}
+		statistics.triangleCount = indexCount / 3;
+		return statistics;
+	}
+
+	void OptimizeVertexCache(UINT* indices, size_t indexCount)
+	{
+		const ForsythScores& scores = Scores();
+		size_t triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+			return;
+		UINT first, last;
+		IndexRange(indices, triangleCount * 3, first, last);
+		UINT vertexCount = last - first + 1;
+
+		/* triangles of every vertex, the ones not emitted yet are kept at the front of its list */
+		std::vector<UINT> trianglesLeft(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			trianglesLeft[indices[i] - first]++;
+		std::vector<UINT> adjacencyStart(vertexCount + 1, 0);
+		for (UINT v = 0; v < vertexCount; v++)
+			adjacencyStart[v + 1] = adjacencyStart[v] + trianglesLeft[v];
+		std::vector<UINT> adjacency(triangleCount * 3);
+		{
+			std::vector<UINT> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+			for (size_t i = 0; i < triangleCount * 3; i++)
+				adjacency[fill[indices[i] - first]++] = (UINT)(i / 3);
+		}
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (UINT v = 0; v < vertexCount; v++)
+			vertexScore[v] = scores.Score(-1, trianglesLeft[v]);
+		std::vector<float> triangleScore(triangleCount);
+		size_t best = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			triangleScore[t] = vertexScore[indices[t * 3] - first] + vertexScore[indices[t * 3 + 1] - first] + vertexScore[indices[t * 3 + 2] - first];
+			if (triangleScore[t] > triangleScore[best])
+				best = t;
+		}
+
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<UINT> output(triangleCount * 3);
+		UINT cache[ForsythCacheSize + 3];
+		UINT cacheCount = 0;
+		size_t nextUnemitted = 0;
+		for (size_t out = 0; out < triangleCount; out++)
+		{
+			if (best == SIZE_MAX)	//nothing left around the cached vertices, continue in the original order
+			{
+				while (emitted[nextUnemitted])
+					nextUnemitted++;
+				best = nextUnemitted;
+			}
+			emitted[best] = true;
+			UINT corner[3];
+			for (UINT c = 0; c < 3; c++)
+			{
+				output[out * 3 + c] = indices[best * 3 + c];
+				UINT v = corner[c] = indices[best * 3 + c] - first;
+				UINT* list = &adjacency[adjacencyStart[v]];
+				UINT* found = std::find(list, list + trianglesLeft[v], (UINT)best);
+				*found = list[--trianglesLeft[v]];
+			}
+
+			/* the triangle's vertices move to the front of the LRU cache, the rest shift back */
+			UINT newCache[ForsythCacheSize + 3];
+			UINT newCount = 0;
+			for (UINT c = 0; c < 3; c++)
+				if (std::find(newCache, newCache + newCount, corner[c]) == newCache + newCount)
+					newCache[newCount++] = corner[c];
+			for (UINT i = 0; i < cacheCount; i++)
+				if (cache[i] != corner[0] && cache[i] != corner[1] && cache[i] != corner[2])
+					newCache[newCount++] = cache[i];
+
+			for (UINT i = 0; i < newCount; i++)
+			{
+				UINT v = newCache[i];
+				cachePosition[v] = i < ForsythCacheSize ? (int)i : -1;
+				float score = scores.Score(cachePosition[v], trianglesLeft[v]);
+				float change = score - vertexScore[v];
+				vertexScore[v] = score;
+				const UINT* list = &adjacency[adjacencyStart[v]];
+				for (UINT t = 0; t < trianglesLeft[v]; t++)
+					triangleScore[list[t]] += change;
+			}
+			cacheCount = (std::min)(newCount, ForsythCacheSize);
+			std::copy(newCache, newCache + cacheCount, cache);
+
+			best = SIZE_MAX;
+			float bestScore = -1.0f;
+			for (UINT i = 0; i < cacheCount; i++)
+			{
+				UINT v = cache[i];
+				const UINT* list = &adjacency[adjacencyStart[v]];
+				for (UINT t = 0; t < trianglesLeft[v]; t++)
+					if (triangleScore[list[t]] > bestScore)
+					{
+						bestScore = triangleScore[list[t]];
+						best = list[t];
+					}
+			}
+		}
+		std::copy(output.begin(), output.end(), indices);
+	}
+	OverdrawStatistics AnalyzeOverdraw(const UINT* indices, size_t indexCount, const VertexElement* vertices, UINT modelType)
+	{
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		UINT positionOffset = ModelType::PositionOffset(modelType);
+		indexCount -= indexCount % 3;
+		if (indexCount == 0)
+			return OverdrawStatistics();
+
+		mth::float3 minimum(FLT_MAX), maximum(-FLT_MAX);
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			mth::float3 p = ReadFloat3(vertices, vertexSize, positionOffset, indices[i]);
+			minimum = mth::float3((std::min)(minimum.x, p.x), (std::min)(minimum.y, p.y), (std::min)(minimum.z, p.z));
+			maximum = mth::float3((std::max)(maximum.x, p.x), (std::max)(maximum.y, p.y), (std::max)(maximum.z, p.z));
+		}
+		mth::float3 extent = maximum - minimum;
+		float largest = (std::max)({ extent.x, extent.y, extent.z });
+		float scale = largest > 0.0f ? (OverdrawGridSize - 1) / largest : 0.0f;
+
+		OverdrawBuffer buffer;
+		for (UINT axis = 0; axis < 3; axis++)	//the depth along the axis, the other two on the grid
+		{
+			for (size_t i = 0; i < indexCount; i += 3)
+			{
+				mth::float3 corner[3];
+				for (UINT c = 0; c < 3; c++)
+				{
+					mth::float3 p = (ReadFloat3(vertices, vertexSize, positionOffset, indices[i + c]) - minimum) * scale;
+					corner[c] = mth::float3(p((axis + 1) % 3), p((axis + 2) % 3), p(axis));
+				}
+				buffer.Rasterize(corner[0], corner[1], corner[2]);
+			}
+			buffer.Finish();
+		}
+		return buffer.statistics;
+	}
+
+	void OptimizeOverdraw(UINT* indices, size_t indexCount, const VertexElement* vertices, UINT modelType, float threshold)
+	{
+		size_t triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+			return;
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		UINT positionOffset = ModelType::PositionOffset(modelType);
+		bool hasNormals = ModelType::HasNormals(modelType);
+		UINT normalOffset = hasNormals ? ModelType::NormalOffset(modelType) : 0;
+		UINT first, last;
+		IndexRange(indices, triangleCount * 3, first, last);
+
+		/* the cache starts over where a triangle misses with all of its vertices, these cut the hard clusters */
+		std::vector<size_t> hardStarts;
+		{
+			FifoCache cache(first, last - first + 1);
+			for (size_t t = 0; t < triangleCount; t++)
+				if (cache.AddTriangle(&indices[t * 3]) == 3 || t == 0)
+					hardStarts.push_back(t);
+			hardStarts.push_back(triangleCount);
+		}
+
+		/* a hard cluster is cut again after each piece that reaches its ACMR within the threshold,
+		the cache starts over at every cut. The rest after the last cut joins the piece before,
+		as a few leftover triangles would have a poor ACMR on their own, and the pieces before
+		that too while the joined one is above the threshold. The whole cluster is within it. */
+		std::vector<size_t> clusterStarts;
+		{
+			FifoCache cache(first, last - first + 1);
+			for (size_t h = 0; h + 1 < hardStarts.size(); h++)
+			{
+				size_t start = hardStarts[h], end = hardStarts[h + 1];
+				cache.Reset();
+				UINT64 clusterMisses = 0;
+				for (size_t t = start; t < end; t++)
+					clusterMisses += cache.AddTriangle(&indices[t * 3]);
+				double clusterThreshold = threshold * (double)clusterMisses / (end - start);
+
+				clusterStarts.push_back(start);
+				cache.Reset();
+				UINT64 misses = 0, triangles = 0;
+				for (size_t t = start; t < end; t++)
+				{
+					misses += cache.AddTriangle(&indices[t * 3]);
+					triangles++;
+					if (misses <= clusterThreshold * triangles)
+					{
+						clusterStarts.push_back(t + 1);
+						cache.Reset();
+						misses = 0;
+						triangles = 0;
+					}
+				}
+				if (clusterStarts.back() != start)
+					clusterStarts.pop_back();
+				while (clusterStarts.back() != start)
+				{
+					size_t from = clusterStarts.back();
+					cache.Reset();
+					misses = 0;
+					for (size_t t = from; t < end; t++)
+						misses += cache.AddTriangle(&indices[t * 3]);
+					if (misses <= clusterThreshold * (end - from))
+						break;
+					clusterStarts.pop_back();
+				}
+			}
+			clusterStarts.push_back(triangleCount);
+		}
+		size_t clusterCount = clusterStarts.size() - 1;
+		if (clusterCount < 2)
+			return;
+
+		/* area weighted centroids and normals of the clusters and of the whole list */
+		std::vector<mth::float3> clusterCentroid(clusterCount), clusterNormal(clusterCount);
+		mth::float3 centroid(0.0f);
+		float totalArea = 0.0f;
+		for (size_t k = 0; k < clusterCount; k++)
+		{
+			mth::float3 weightedCentroid(0.0f), normal(0.0f);
+			float clusterArea = 0.0f;
+			for (size_t t = clusterStarts[k]; t < clusterStarts[k + 1]; t++)
+			{
+				const UINT* triangle = &indices[t * 3];
+				mth::float3 p0 = ReadFloat3(vertices, vertexSize, positionOffset, triangle[0]);
+				mth::float3 p1 = ReadFloat3(vertices, vertexSize, positionOffset, triangle[1]);
+				mth::float3 p2 = ReadFloat3(vertices, vertexSize, positionOffset, triangle[2]);
+				mth::float3 faceNormal = (p1 - p0).Cross(p2 - p0);
+				float area = faceNormal.Length() * 0.5f;
+				weightedCentroid += (p0 + p1 + p2) * (area / 3.0f);
+				clusterArea += area;
+				if (hasNormals)
+				{
+					mth::float3 vertexNormal(0.0f);
+					for (UINT c = 0; c < 3; c++)
+						vertexNormal += ReadFloat3(vertices, vertexSize, normalOffset, triangle[c]);
+					normal += vertexNormal * (area / 3.0f);
+				}
+				else
+				{
+					normal += faceNormal * 0.5f;
+				}
+			}
+			centroid += weightedCentroid;
+			totalArea += clusterArea;
+			clusterCentroid[k] = clusterArea > 0.0f ? weightedCentroid / clusterArea : weightedCentroid;
+			clusterNormal[k] = normal;
+		}
+		if (totalArea > 0.0f)
+			centroid /= totalArea;
+
+		std::vector<float> occlusion(clusterCount);
+		for (size_t k = 0; k < clusterCount; k++)
+		{
+			float length = clusterNormal[k].Length();
+			occlusion[k] = length > 0.0f ? (clusterCentroid[k] - centroid).Dot(clusterNormal[k]) / length : 0.0f;
+		}
+		std::vector<size_t> order(clusterCount);
+		for (size_t k = 0; k < clusterCount; k++)
+			order[k] = k;
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return occlusion[a] > occlusion[b]; });
+
+		std::vector<UINT> output;
+		output.reserve(triangleCount * 3);
+		for (size_t k : order)
+			output.insert(output.end(), indices + clusterStarts[k] * 3, indices + clusterStarts[k + 1] * 3);
+		std::copy(output.begin(), output.end(), indices);
+	}
+	size_t BuildVertexFetchRemap(const UINT* indices, size_t indexCount, size_t vertexCount, std::vector<UINT>& remap)
+	{
+		remap.assign(vertexCount, UINT_MAX);
+		UINT next = 0;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			if (indices[i] >= vertexCount)
+				throw std::exception("Vertex index out of range");
+			if (remap[indices[i]] == UINT_MAX)
+				remap[indices[i]] = next++;
+		}
+		return next;
+	}
+	size_t BuildWeldRemap(const VertexElement* vertices, size_t vertexCount, UINT modelType,
+		const WeldTolerance* tolerance, const std::vector<bool>* locked, std::vector<UINT>& remap)
+	{
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		UINT positionOffset = ModelType::PositionOffset(modelType);
+		bool hasPositions = ModelType::HasPositions(modelType);
+		UINT chunkCount = (UINT)((vertexCount + WeldChunkSize - 1) / WeldChunkSize);
+		auto vertex = [&](size_t v) { return vertices + v * vertexSize; };
+		auto isLocked = [&](size_t v) { return locked && (*locked)[v]; };
+
+		/* tolerance of every element, negative ones compare the bits */
+		std::vector<float> elementTolerance(vertexSize, -1.0f);
+		float cellSize = 0.0f;
+		if (tolerance)
+		{
+			auto setTolerance = [&](bool has, UINT offset, UINT count, float value) {
+				if (has)
+					std::fill(elementTolerance.begin() + offset, elementTolerance.begin() + offset + count, value); };
+			setTolerance(hasPositions, positionOffset, 3, tolerance->position);
+			setTolerance(ModelType::HasTexcoords(modelType), ModelType::TexCoordOffset(modelType), 2, tolerance->texcoord);
+			setTolerance(ModelType::HasNormals(modelType), ModelType::NormalOffset(modelType), 3, tolerance->normal);
+			setTolerance(ModelType::HasTangentsBinormals(modelType), ModelType::TangentOffset(modelType), 6, tolerance->normal);
+			setTolerance(ModelType::HasBones(modelType), ModelType::BoneWeightsOffset(modelType), 4, tolerance->boneWeight);
+			if (!(tolerance->position < FLT_MAX / 2.0f))
+				throw std::exception("Weld position tolerance is not finite");
+			if (hasPositions && tolerance->position > 0.0f)
+				cellSize = tolerance->position * 2.0f;	//the positions in reach of a vertex lie in 2 cells per axis at most
+		}
+		auto matches = [&](size_t a, size_t b) {
+			const VertexElement* va = vertex(a);
+			const VertexElement* vb = vertex(b);
+			if (!tolerance)
+				return memcmp(va, vb, vertexSize * sizeof(VertexElement)) == 0;
+			for (UINT i = 0; i < vertexSize; i++)
+				if (elementTolerance[i] < 0.0f ? va[i].u != vb[i].u : !(fabsf(va[i].f - vb[i].f) <= elementTolerance[i]))
+					return false;
+			return true;
+		};
+		auto cellOf = [&](float position) { return (INT64)floorf(position / cellSize); };
+		/* NaN, infinite or too far for a cell coordinate, such a vertex stays on its own */
+		auto offGrid = [&](size_t v) {
+			const VertexElement* p = vertex(v) + positionOffset;
+			for (int axis = 0; axis < 3; axis++)
+				if (!(fabsf(p[axis].f / cellSize) < WeldGridLimit))
+					return true;
+			return false;
+		};
+
+		/* the whole vertex, the grid cell or the exact position is the key */
+		std::vector<UINT64> keys(vertexCount);
+		std::vector<BYTE> alone(vertexCount, 0);
+		ParallelFor(chunkCount, [&](UINT chunk) {
+			size_t end = (std::min)((chunk + 1) * WeldChunkSize, vertexCount);
+			for (size_t v = chunk * WeldChunkSize; v < end; v++)
+			{
+				if (!tolerance)
+					keys[v] = HashWords(vertex(v), vertexSize);
+				else if (cellSize > 0.0f && offGrid(v))
+				{
+					alone[v] = 1;
+					keys[v] = 0;
+				}
+				else if (cellSize > 0.0f)
+				{
+					const VertexElement* p = vertex(v) + positionOffset;
+					keys[v] = HashCell(cellOf(p[0].f), cellOf(p[1].f), cellOf(p[2].f));
+				}
+				else
+					keys[v] = hasPositions ? HashWords(vertex(v) + positionOffset, 3) : 0;
+			}
+			});
+		WeldGrid grid(keys);
+
+		/* the first earlier vertex that accept takes among the ones v can be welded to, v if none */
+		auto findFirst = [&](size_t v, auto accept) {
+			UINT found = (UINT)v;
+			if (isLocked(v) || alone[v])
+				return found;
+			if (cellSize > 0.0f)
+			{
+				const VertexElement* p = vertex(v) + positionOffset;
+				INT64 low[3], high[3];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					low[axis] = cellOf(p[axis].f - tolerance->position);
+					high[axis] = cellOf(p[axis].f + tolerance->position);
+				}
+				for (INT64 z = low[2]; z <= high[2]; z++)
+					for (INT64 y = low[1]; y <= high[1]; y++)
+						for (INT64 x = low[0]; x <= high[0]; x++)
+							found = grid.FindFirst(HashCell(x, y, z), found, accept);
+			}
+			else
+			{
+				found = grid.FindFirstInCell((UINT)v, accept);
+			}
+			return found;
+		};
+
+		/* the first earlier vertex each one matches */
+		std::vector<UINT> candidate(vertexCount);
+		ParallelFor(chunkCount, [&](UINT chunk) {
+			size_t end = (std::min)((chunk + 1) * WeldChunkSize, vertexCount);
+			for (size_t v = chunk * WeldChunkSize; v < end; v++)
+				candidate[v] = findFirst(v, [&](UINT u) { return !isLocked(u) && !alone[u] && matches(u, v); });
+			});
+
+		/* A vertex joins the first earlier kept vertex that matches. That is the candidate if it was
+		kept, else the candidate's kept vertex if that still matches, as nothing before the candidate
+		does. Otherwise the cells are searched again for a kept one, in order as it depends on the
+		vertices before. The vertex is kept if there is none. Identical bits always give a kept candidate. */
+		remap.resize(vertexCount);
+		std::vector<UINT> kept(vertexCount);
+		UINT next = 0;
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			UINT u = candidate[v];
+			if (u != v && kept[u] != u)
+			{
+				if (matches(kept[u], v))
+					u = kept[u];
+				else
+					u = findFirst(v, [&](UINT w) { return kept[w] == w && !isLocked(w) && !alone[w] && matches(w, v); });
+			}
+			kept[v] = u;
+			remap[v] = u == v ? next++ : remap[u];
+		}
+		return next;
+	}
+}
\ No newline at end of file
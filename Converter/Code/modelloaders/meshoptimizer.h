@@ -0,0 +1,91 @@
+#pragma once
+
+#include "graphics/shaderbase.h"
+
+namespace gfx
+{
+	/* Post-transform vertex cache behaviour of triangle lists, simulated with a FIFO cache.
+	ACMR is the vertices transformed per triangle (0.5 at best, 3 at worst),
+	ATVR the vertices transformed per distinct vertex referenced (1 at best). */
+	struct VertexCacheStatistics
+	{
+		UINT64 triangleCount;
+		UINT64 vertexCount;			//distinct vertices referenced
+		UINT64 transformedCount;	//cache misses
+
+		inline double getACMR() { return triangleCount ? (double)transformedCount / triangleCount : 0.0; }
+		inline double getATVR() { return vertexCount ? (double)transformedCount / vertexCount : 0.0; }
+		inline void Add(const VertexCacheStatistics& other)
+		{
+			triangleCount += other.triangleCount;
+			vertexCount += other.vertexCount;
+			transformedCount += other.transformedCount;
+		}
+	};
+
+	const UINT VertexCacheSize = 16;	//FIFO entries of the simulated cache
+
+	VertexCacheStatistics AnalyzeVertexCache(const UINT* indices, size_t indexCount, UINT cacheSize = VertexCacheSize);
+	/* Reorders the triangles of a triangle list for the post-transform vertex cache with Forsyth's
+	algorithm. Triangles are taken greedily by a score of their vertices, which favours vertices
+	recently used in a simulated LRU cache and vertices with few triangles left. Runs in linear time,
+	the vertex indices can be anywhere, the memory used follows the range they span. */
+	void OptimizeVertexCache(UINT* indices, size_t indexCount);
+
+	/* Overdraw of triangle lists, estimated by rasterizing the triangles in their order with a depth
+	test from the six axis directions onto a grid fitted to their bounds. Each direction only
+	draws the triangles facing it, clockwise ones are front faces as Direct3D culls by default. */
+	struct OverdrawStatistics
+	{
+		UINT64 coveredPixels;	//grid cells that a triangle reached
+		UINT64 shadedPixels;	//fragments that passed the depth test
+
+		inline double getOverdraw() { return coveredPixels ? (double)shadedPixels / coveredPixels : 0.0; }
+		inline void Add(const OverdrawStatistics& other)
+		{
+			coveredPixels += other.coveredPixels;
+			shadedPixels += other.shadedPixels;
+		}
+	};
+
+	const UINT OverdrawGridSize = 256;
+	const float OverdrawThreshold = 1.05f;	//default of the ACMR a cluster may lose against its part of the input
+
+	/* vertices are in the layout of modelType, which needs positions */
+	OverdrawStatistics AnalyzeOverdraw(const UINT* indices, size_t indexCount, const VertexElement* vertices, UINT modelType);
+	/* Reorders the triangles so that the outward facing parts are drawn first and hide the rest
+	(Sander et al., Fast Triangle Reordering for Vertex Locality and Reduced Overdraw).
+	The order is cut into clusters where the simulated vertex cache starts over, these are split
+	further while each piece keeps an ACMR within threshold times the one of the cluster, then the
+	pieces are sorted by how far their centroid lies out along their normal from the centroid of
+	the whole list. The normals are the vertex normals if the layout has them, else the face normals.
+	Expects a vertex cache optimized order, each piece keeps its triangles in order. */
+	void OptimizeOverdraw(UINT* indices, size_t indexCount, const VertexElement* vertices, UINT modelType, float threshold = OverdrawThreshold);
+
+	/* Numbers the vertices in the order the indices first reference them, so that the vertex
+	fetches of a reordered index list walk forward through memory. remap gets an element per
+	vertex, UINT_MAX for the ones no index references. Returns the referenced vertex count. */
+	size_t BuildVertexFetchRemap(const UINT* indices, size_t indexCount, size_t vertexCount, std::vector<UINT>& remap);
+
+	/* Largest difference per component between vertices welded by tolerance */
+	struct WeldTolerance
+	{
+		float position;		//also the cell size of the grid the vertices are searched in
+		float texcoord;
+		float normal;		//tangents and binormals too
+		float boneWeight;	//bone indices always have to be equal
+	};
+
+	const WeldTolerance DefaultWeldTolerance = { 1e-5f, 1e-5f, 1e-3f, 1e-3f };
+
+	/* Numbers equal vertices together, in the order of the first vertex of each, which is
+	the one kept. Without a tolerance the vertices need identical bits, they are looked up by a hash
+	of the whole vertex. With one a vertex joins the first earlier kept vertex within the tolerances,
+	searched in the cells around it of a hash grid over the positions, so a welded vertex is never
+	further than the tolerances from the kept one. locked is optional with an element per vertex,
+	the vertices set in it stay on their own. The hashing and the searches run in parallel, only a
+	vertex whose first match was welded to one out of its reach searches again in order.
+	remap gets an element per vertex, returns the count of vertices kept. */
+	size_t BuildWeldRemap(const VertexElement* vertices, size_t vertexCount, UINT modelType,
+		const WeldTolerance* tolerance, const std::vector<bool>* locked, std::vector<UINT>& remap);
+}
\ No newline at end of file
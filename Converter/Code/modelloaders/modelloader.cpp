@@ -2,17 +2,25 @@
 #include "pmxloader.h"
 #include "omdloader.h"
 #include "omdexporter.h"
+#include "omdarchive.h"
+#include "vertexlayout.h"
+#include "skinning.h"
+#include <chrono>
+#include <climits>
+#include <filesystem>
 
 namespace gfx
 {
 	void ModelLoader::OrganizeMaterials()
 	{
+		BeginProgress(LoadStage::POSTPROCESS, m_groups.size());
 		std::vector<TextureToLoad> textureNames, normalmapNames;
 		for (UINT i = 0; i < (UINT)m_groups.size(); i++)
 		{
 			textureNames.push_back(m_textures[m_groups[i].materialIndex]);
 			normalmapNames.push_back(m_normalmaps[m_groups[i].materialIndex]);
 			m_groups[i].materialIndex = i;
+			AdvanceProgress(1);
 		}
 		m_textures.swap(textureNames);
 		m_normalmaps.swap(normalmapNames);
@@ -20,53 +28,12 @@ namespace gfx
 
 	void ModelLoader::Create(Vertex_PTMB vertices[], UINT vertexCount, UINT indices[], UINT indexCount, UINT modelType)
 	{
-		int counter = 0;
+		static_assert(sizeof(Vertex_PTMB) == 22 * sizeof(VertexElement), "Vertex_PTMB must match the AllPart layout");
 		m_modelType = modelType;
 		m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
 		m_vertices.resize(vertexCount * getVertexSizeInFloats());
-		m_indices.resize(indexCount);
-		for (UINT v = 0; v < vertexCount; v++)
-		{
-			if (ModelType::HasPositions(modelType))
-			{
-				m_vertices[counter++] = vertices[v].position.x;
-				m_vertices[counter++] = vertices[v].position.y;
-				m_vertices[counter++] = vertices[v].position.z;
-			}
-			if (ModelType::HasTexcoords(modelType))
-			{
-				m_vertices[counter++] = vertices[v].texcoord.x;
-				m_vertices[counter++] = vertices[v].texcoord.y;
-			}
-			if (ModelType::HasNormals(modelType))
-			{
-				m_vertices[counter++] = vertices[v].normal.x;
-				m_vertices[counter++] = vertices[v].normal.y;
-				m_vertices[counter++] = vertices[v].normal.z;
-			}
-			if (ModelType::HasTangentsBinormals(modelType))
-			{
-				m_vertices[counter++] = vertices[v].tangent.x;
-				m_vertices[counter++] = vertices[v].tangent.y;
-				m_vertices[counter++] = vertices[v].tangent.z;
-				m_vertices[counter++] = vertices[v].binormal.x;
-				m_vertices[counter++] = vertices[v].binormal.y;
-				m_vertices[counter++] = vertices[v].binormal.z;
-			}
-			if (ModelType::HasBones(modelType))
-			{
-				m_vertices[counter++] = vertices[v].boneWeights[0];
-				m_vertices[counter++] = vertices[v].boneWeights[1];
-				m_vertices[counter++] = vertices[v].boneWeights[2];
-				m_vertices[counter++] = vertices[v].boneWeights[3];
-				m_vertices[counter++] = vertices[v].boneIndex[0];
-				m_vertices[counter++] = vertices[v].boneIndex[1];
-				m_vertices[counter++] = vertices[v].boneIndex[2];
-				m_vertices[counter++] = vertices[v].boneIndex[3];
-			}
-		}
-		for (UINT i = 0; i < indexCount; i++)
-			m_indices[i] = indices[i];
+		TranscodeVertices((const VertexElement*)vertices, ModelType::AllPart, m_vertices.data(), modelType, vertexCount);
+		m_indices.assign(indices, indices + indexCount);
 		m_groups.push_back({ 0, indexCount, 0 });
 		m_textures.push_back(TextureToLoad());
 		m_normalmaps.push_back(TextureToLoad());
@@ -76,11 +43,21 @@ namespace gfx
 		m_vertexSizeInBytes(0),
 		m_modelType(0),
 		m_boundingVolumeType(0),
-		m_bvSphereRadius(0.0f) {}
+		m_bvSphereRadius(0.0f),
+		m_loadStatistics(),
+		m_postProcessReport(),
+		m_overdrawThreshold(OverdrawThreshold),
+		m_weldTolerance(DefaultWeldTolerance),
+		m_progress(nullptr) {}
 	ModelLoader::ModelLoader(LPCWSTR filename, UINT modelType) :
 		m_vertexSizeInBytes(0),
 		m_modelType(0),
-		m_boundingVolumeType(0)
+		m_boundingVolumeType(0),
+		m_loadStatistics(),
+		m_postProcessReport(),
+		m_overdrawThreshold(OverdrawThreshold),
+		m_weldTolerance(DefaultWeldTolerance),
+		m_progress(nullptr)
 	{
 		LoadModel(filename, modelType);
 	}
@@ -100,52 +77,190 @@ namespace gfx
 		m_bvCuboidSize = mth::float3();
 		m_bvSphereRadius = 0.0f;
 		m_hitbox.clear();
+		m_bones.clear();
+		m_animations.clear();
+		m_morphs.clear();
+		m_instances.clear();
+		m_loadStatistics = LoadStatistics();
+		m_postProcessReport = PostProcessReport();
 	}
-	void ModelLoader::ExportOMD(LPCWSTR filename, UINT modelType, bool binary)
+	void ModelLoader::ExportOMD(LPCWSTR filename, UINT modelType, bool binary, UINT exportFlags, OMDExportReport* report)
 	{
+		UINT postProcess = 0;
+		if (exportFlags & OMDExport::VERTEX_CACHE)
+			postProcess |= PostProcess::VERTEX_CACHE;
+		if (exportFlags & OMDExport::OVERDRAW)
+			postProcess |= PostProcess::OVERDRAW;
+		if (exportFlags & OMDExport::VERTEX_FETCH)
+			postProcess |= PostProcess::VERTEX_FETCH;
+		if (exportFlags & OMDExport::WELD)
+			postProcess |= PostProcess::WELD;
+		if (exportFlags & OMDExport::WELD_TOLERANCE)
+			postProcess |= PostProcess::WELD_TOLERANCE;
+		PostProcessReport postProcessReport = PostProcessReport();
+		if (postProcess)
+			ApplyPostProcess(postProcess, report ? &postProcessReport : nullptr);
 		if (binary)
-			((OMDExporter*)this)->ExportOMDBinary(filename, modelType);
+			((OMDExporter*)this)->ExportOMDBinary(filename, modelType, exportFlags, report);
 		else
 			((OMDExporter*)this)->ExportOMDText(filename, modelType);
+		if (report)
+			report->postProcess = postProcessReport;	//the binary export starts its report over
 	}
-	void ModelLoader::LoadModel(LPCWSTR filename, UINT modelType)
+	void ModelLoader::RunLoad(LoadProgress* progress, const std::function<void()>& load)
 	{
-		std::wstring path;
-		for (int i = 0; filename[i]; i++)
+		m_progress = progress;
+		try
 		{
-			if (filename[i] != '\"')
-				path += filename[i];
+			load();
 		}
-		UINT lastSlashIndex = 0;
-		UINT lastDotIndex = 0;
-		UINT i;
-		for (i = 0; path[i]; i++)
+		catch (...)
 		{
-			if (path[i] == '/' || path[i] == '\\')
-				lastSlashIndex = i;
-			if (path[i] == '.')
-				lastDotIndex = i;
+			m_progress = nullptr;
+			if (progress && progress->isCanceled())
+			{
+				float overdrawThreshold = m_overdrawThreshold;
+				WeldTolerance weldTolerance = m_weldTolerance;
+				*this = ModelLoader();	//frees what the canceled load allocated, Clear keeps the capacity
+				m_overdrawThreshold = overdrawThreshold;
+				m_weldTolerance = weldTolerance;
+			}
+			throw;
 		}
-		for (i = 0; i <= lastSlashIndex; i++)
-			m_folder += path[i];
-		while (i < lastDotIndex)
-			m_filename += path[i++];
-
-		if (path[i + 0] == '.' &&
-			path[i + 1] == 'o' &&
-			path[i + 2] == 'm' &&
-			path[i + 3] == 'd' &&
-			path[i + 4] == '\0')
-			((OMDLoader*)this)->LoadOMD(path.c_str(), modelType);
-		else if (path[i + 0] == '.' &&
-			path[i + 1] == 'p' &&
-			path[i + 2] == 'm' &&
-			path[i + 3] == 'x' &&
-			path[i + 4] == '\0')
-			((PMXLoader*)this)->LoadPMX(path.c_str(), modelType);
-		else
-			((AssimpLoader*)this)->LoadAssimp(path.c_str(), modelType);
-		OrganizeMaterials();
+		m_progress = nullptr;
+	}
+	void ModelLoader::BeginProgress(UINT stage, UINT64 total)
+	{
+		if (m_progress)
+		{
+			CheckCanceled();
+			m_progress->BeginStage(stage, total);
+		}
+	}
+	void ModelLoader::AdvanceProgress(UINT64 count)
+	{
+		if (m_progress)
+		{
+			CheckCanceled();
+			m_progress->Advance(count);
+		}
+	}
+	void ModelLoader::SetProgress(UINT64 done)
+	{
+		if (m_progress)
+		{
+			CheckCanceled();
+			m_progress->SetDone(done);
+		}
+	}
+	void ModelLoader::CheckCanceled()
+	{
+		if (m_progress && m_progress->isCanceled())
+			throw std::exception("Loading was canceled");
+	}
+	void ModelLoader::LoadModel(LPCWSTR filename, UINT modelType, UINT postProcess, LoadProgress* progress)
+	{
+		RunLoad(progress, [&]() {
+			auto startTime = std::chrono::steady_clock::now();
+			std::wstring path;
+			for (int i = 0; filename[i]; i++)
+			{
+				if (filename[i] != '\"')
+					path += filename[i];
+			}
+			UINT lastSlashIndex = 0;
+			UINT lastDotIndex = 0;
+			UINT i;
+			for (i = 0; path[i]; i++)
+			{
+				if (path[i] == '/' || path[i] == '\\')
+					lastSlashIndex = i;
+				if (path[i] == '.')
+					lastDotIndex = i;
+			}
+			for (i = 0; i <= lastSlashIndex; i++)
+				m_folder += path[i];
+			while (i < lastDotIndex)
+				m_filename += path[i++];
+
+			if (path[i + 0] == '.' &&
+				path[i + 1] == 'o' &&
+				path[i + 2] == 'm' &&
+				path[i + 3] == 'd' &&
+				path[i + 4] == '\0')
+				((OMDLoader*)this)->LoadOMD(path.c_str(), modelType);
+			else if (path[i + 0] == '.' &&
+				path[i + 1] == 'p' &&
+				path[i + 2] == 'm' &&
+				path[i + 3] == 'x' &&
+				path[i + 4] == '\0')
+				((PMXLoader*)this)->LoadPMX(path.c_str(), modelType);
+			else
+				((AssimpLoader*)this)->LoadAssimp(path.c_str(), modelType);
+			OrganizeMaterials();
+			if (postProcess)
+				ApplyPostProcess(postProcess, &m_postProcessReport);
+
+			std::error_code error;
+			m_loadStatistics.fileSize = std::filesystem::file_size(path, error);
+			if (error)
+				m_loadStatistics.fileSize = 0;
+			m_loadStatistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			});
+	}
+	void ModelLoader::LoadModel(const char* data, size_t size, LPCWSTR filename, UINT modelType, UINT postProcess, LoadProgress* progress)
+	{
+		RunLoad(progress, [&]() {
+			auto startTime = std::chrono::steady_clock::now();
+			std::wstring path = filename;
+			size_t lastSlash = path.find_last_of(L"/\\");
+			size_t lastDot = path.find_last_of(L'.');
+			if (lastDot == std::wstring::npos || (lastSlash != std::wstring::npos && lastDot < lastSlash))
+				lastDot = path.length();
+			m_folder = path.substr(0, lastSlash + 1);
+			m_filename = path.substr(lastSlash + 1, lastDot - (lastSlash + 1));
+
+			std::wstring extension = path.substr((std::min)(lastDot + 1, path.length()));
+			if (extension == L"omd")
+				((OMDLoader*)this)->LoadOMD(data, size, modelType);
+			else if (extension == L"pmx")
+				((PMXLoader*)this)->LoadPMX(data, size, modelType);
+			else
+				((AssimpLoader*)this)->LoadAssimp(data, size, path.c_str(), modelType);
+			OrganizeMaterials();
+			if (postProcess)
+				ApplyPostProcess(postProcess, &m_postProcessReport);
+
+			m_loadStatistics.fileSize = size;
+			m_loadStatistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			});
+	}
+	void ModelLoader::LoadModel(OMDArchive& archive, UINT entry, UINT modelType, UINT postProcess, LoadProgress* progress)
+	{
+		RunLoad(progress, [&]() {
+			auto startTime = std::chrono::steady_clock::now();
+			if (entry >= archive.getEntryCount())
+				throw std::exception("OMD archive entry does not exist");
+			std::wstring name = archive.getEntryName(entry);
+			size_t lastSlash = name.find_last_of(L'/');
+			m_folder = archive.getFolderName() + name.substr(0, lastSlash + 1);
+			m_filename = name.substr(lastSlash + 1);
+
+			((OMDLoader*)this)->LoadOMD(archive.getEntryData(entry), archive.getEntrySize(entry), modelType);
+			OrganizeMaterials();
+			if (postProcess)
+				ApplyPostProcess(postProcess, &m_postProcessReport);
+
+			m_loadStatistics.fileSize = archive.getEntrySize(entry);
+			m_loadStatistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			});
+	}
+	void ModelLoader::LoadModel(OMDArchive& archive, LPCWSTR name, UINT modelType, UINT postProcess, LoadProgress* progress)
+	{
+		UINT entry = archive.FindEntry(name);
+		if (entry == OMDArchive::InvalidEntry)
+			throw std::exception(std::string("OMD archive entry not found: " + ToStr(name)).c_str());
+		LoadModel(archive, entry, modelType, postProcess, progress);
 	}
 
 #pragma region Create primitives
@@ -220,44 +335,151 @@ namespace gfx
 	{
 		mth::float3 maxpos, minpos;
 		m_hitbox.clear();
+		m_hitbox.reserve(m_indices.size() / 3);
 		m_boundingVolumeType = mth::BoundingVolume::CUBOID;
 		m_bvSphereRadius = 0.0f;
-		minpos.x = maxpos.x = m_vertices[0].f;
-		minpos.y = maxpos.y = m_vertices[1].f;
-		minpos.z = maxpos.z = m_vertices[2].f;
+		bool first = true;
 		UINT vertexSize = getVertexSizeInFloats();
-		m_hitbox.resize(m_indices.size() / 3);
-		mth::float3 tri[3];
-		for (UINT i = 0; i < (UINT)m_hitbox.size(); i++)
-		{
-			tri[0] = mth::float3(
-				m_vertices[vertexSize * m_indices[i * 3 + 0] + 0].f,
-				m_vertices[vertexSize * m_indices[i * 3 + 0] + 1].f,
-				m_vertices[vertexSize * m_indices[i * 3 + 0] + 2].f);
-			tri[1] = mth::float3(
-				m_vertices[vertexSize * m_indices[i * 3 + 1] + 0].f,
-				m_vertices[vertexSize * m_indices[i * 3 + 1] + 1].f,
-				m_vertices[vertexSize * m_indices[i * 3 + 1] + 2].f);
-			tri[2] = mth::float3(
-				m_vertices[vertexSize * m_indices[i * 3 + 2] + 0].f,
-				m_vertices[vertexSize * m_indices[i * 3 + 2] + 1].f,
-				m_vertices[vertexSize * m_indices[i * 3 + 2] + 2].f);
-			for (UINT v = 0; v < 3; v++)
+		auto addTriangles = [&](UINT startIndex, UINT indexCount, const mth::float4x4* transform) {
+			mth::float3 tri[3];
+			for (UINT i = startIndex; i + 3 <= startIndex + indexCount; i += 3)
 			{
-				if (minpos.x > tri[v].x) minpos.x = tri[v].x;
-				if (maxpos.x < tri[v].x) maxpos.x = tri[v].x;
-				if (minpos.y > tri[v].x) minpos.y = tri[v].x;
-				if (maxpos.y < tri[v].x) maxpos.y = tri[v].x;
-				if (minpos.z > tri[v].x) minpos.z = tri[v].x;
-				if (maxpos.z < tri[v].x) maxpos.z = tri[v].x;
+				for (UINT v = 0; v < 3; v++)
+				{
+					const VertexElement* position = &m_vertices[(size_t)vertexSize * m_indices[i + v]];
+					tri[v] = mth::float3(position[0].f, position[1].f, position[2].f);
+					if (transform)
+					{
+						mth::float4 p = *transform * mth::float4(tri[v].x, tri[v].y, tri[v].z, 1.0f);
+						tri[v] = mth::float3(p.x, p.y, p.z);
+					}
+					if (first)
+					{
+						minpos = maxpos = tri[v];
+						first = false;
+					}
+					if (minpos.x > tri[v].x) minpos.x = tri[v].x;
+					if (maxpos.x < tri[v].x) maxpos.x = tri[v].x;
+					if (minpos.y > tri[v].y) minpos.y = tri[v].y;
+					if (maxpos.y < tri[v].y) maxpos.y = tri[v].y;
+					if (minpos.z > tri[v].z) minpos.z = tri[v].z;
+					if (maxpos.z < tri[v].z) maxpos.z = tri[v].z;
+				}
+				m_hitbox.push_back(mth::Triangle(tri));
 			}
-			m_hitbox[i] = mth::Triangle(tri);
+		};
+		if (m_instances.empty())
+			addTriangles(0, (UINT)m_indices.size(), nullptr);
+		else
+		{
+			//instanced groups are added once per instance, where they are drawn
+			std::vector<bool> instanced(m_groups.size(), false);
+			for (MeshInstance& instance : m_instances)
+				instanced[instance.group] = true;
+			for (size_t g = 0; g < m_groups.size(); g++)
+				if (!instanced[g])
+					addTriangles(m_groups[g].startIndex, m_groups[g].indexCount, nullptr);
+			for (MeshInstance& instance : m_instances)
+				addTriangles(m_groups[instance.group].startIndex, m_groups[instance.group].indexCount, &instance.transform);
 		}
 		m_bvPosition = minpos;
 		m_bvCuboidSize = maxpos - minpos;
 	}
 
-	void ModelLoader::MakeVerticesFromHitbox()
+	void ModelLoader::FlattenInstances()
+	{
+		if (m_instances.empty())
+			return;
+		UINT vertexSize = getVertexSizeInFloats();
+		std::vector<bool> instanced(m_groups.size(), false);
+		for (MeshInstance& instance : m_instances)
+			instanced[instance.group] = true;
+
+		//materials belong to their group, every copy gets its own
+		std::vector<UINT> indices;
+		std::vector<VertexGroup> groups;
+		std::vector<TextureToLoad> textures, normalmaps;
+		auto addGroup = [&](const VertexGroup& group) {
+			groups.push_back({ (UINT)indices.size(), group.indexCount, (int)groups.size() });
+			textures.push_back(m_textures[group.materialIndex]);
+			normalmaps.push_back(m_normalmaps[group.materialIndex]);
+		};
+		for (size_t g = 0; g < m_groups.size(); g++)
+			if (!instanced[g])
+			{
+				addGroup(m_groups[g]);
+				indices.insert(indices.end(), m_indices.begin() + m_groups[g].startIndex,
+					m_indices.begin() + m_groups[g].startIndex + m_groups[g].indexCount);
+			}
+
+		for (MeshInstance& instance : m_instances)
+		{
+			const VertexGroup& group = m_groups[instance.group];
+			if (group.indexCount == 0)
+				continue;
+			UINT first = UINT_MAX, last = 0;
+			for (UINT i = group.startIndex; i < group.startIndex + group.indexCount; i++)
+			{
+				first = (std::min)(first, m_indices[i]);
+				last = (std::max)(last, m_indices[i]);
+			}
+			UINT base = getVertexCount();
+			size_t start = m_vertices.size();
+			m_vertices.resize(start + (size_t)(last - first + 1) * vertexSize);
+			std::copy(m_vertices.begin() + (size_t)first * vertexSize, m_vertices.begin() + (size_t)(last + 1) * vertexSize, m_vertices.begin() + start);
+
+			mth::float4x4 normalTransform = instance.transform.Inverse();
+			normalTransform.Transpose();
+			auto transform = [](const mth::float4x4& m, VertexElement* v, float w) {
+				mth::float4 r = m * mth::float4(v[0].f, v[1].f, v[2].f, w);
+				mth::float3 result(r.x, r.y, r.z);
+				if (w == 0.0f)
+					result.Normalize();
+				v[0] = result.x;
+				v[1] = result.y;
+				v[2] = result.z;
+			};
+			for (size_t v = start; v < m_vertices.size(); v += vertexSize)
+			{
+				if (ModelType::HasPositions(m_modelType))
+					transform(instance.transform, &m_vertices[v + ModelType::PositionOffset(m_modelType)], 1.0f);
+				if (ModelType::HasNormals(m_modelType))
+					transform(normalTransform, &m_vertices[v + ModelType::NormalOffset(m_modelType)], 0.0f);
+				if (ModelType::HasTangentsBinormals(m_modelType))
+				{
+					transform(instance.transform, &m_vertices[v + ModelType::TangentOffset(m_modelType)], 0.0f);
+					transform(instance.transform, &m_vertices[v + ModelType::BinormalOffset(m_modelType)], 0.0f);
+				}
+			}
+
+			addGroup(group);
+			size_t startIndex = indices.size();
+			for (UINT i = group.startIndex; i < group.startIndex + group.indexCount; i++)
+				indices.push_back(m_indices[i] - first + base);
+			//a mirroring transform turns the triangles inside out, the winding has to follow
+			if (instance.transform.Determinant() < 0.0f)
+				for (size_t i = startIndex; i + 3 <= indices.size(); i += 3)
+					std::swap(indices[i + 1], indices[i + 2]);
+		}
+		m_indices.swap(indices);
+		m_groups.swap(groups);
+		m_textures.swap(textures);
+		m_normalmaps.swap(normalmaps);
+		m_instances.clear();
+
+		//the vertices only the instances used are not referenced anymore
+		std::vector<UINT> remap(getVertexCount(), UINT_MAX);
+		for (UINT index : m_indices)
+			remap[index] = 0;
+		UINT vertexCount = 0;
+		for (UINT& place : remap)
+			if (place == 0)
+				place = vertexCount++;
+		if (vertexCount < getVertexCount())
+			RemapVertices(remap, vertexCount);
+	}
+
+	void ModelLoader::MakeVerticesFromHitbox(bool weld)
 	{
 		m_modelType = ModelType::P;
 		m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
@@ -279,10 +501,14 @@ namespace gfx
 			m_indices[i] = i;
 		m_groups.clear();
 		m_groups.push_back({ 0, (UINT)m_indices.size() , 0 });
+		m_instances.clear();
+		m_morphs.clear();	//their deltas were made for the replaced vertices
 		m_textures.clear();
 		m_textures.push_back(TextureToLoad());
 		m_normalmaps.clear();
 		m_normalmaps.push_back(TextureToLoad());
+		if (weld)
+			WeldVertices();
 	}
 
 	bool ModelLoader::HasHitbox()
@@ -393,7 +619,230 @@ namespace gfx
 				m_vertices[i * vertexSize + offset2 + 2] = v.z;
 			}
 		}
+		if (!m_instances.empty())
+		{
+			//the groups were transformed in their own space, the instances have to follow
+			mth::float4x4 inverse = transform.Inverse();
+			for (MeshInstance& instance : m_instances)
+				instance.transform = transform * instance.transform * inverse;
+		}
+	}
+	void ModelLoader::BakePose(const BonePose* pose, SkinningStatistics* statistics)
+	{
+		std::vector<mth::float4x4> inverseBind(m_bones.size());
+		std::vector<mth::float4x4> palette(m_bones.size());
+		InverseBindMatrices(m_bones, inverseBind.data());
+		SkinningMatrices(m_bones, pose, inverseBind.data(), palette.data());
+		SkinVertices(m_vertices.data(), m_vertices.data(), m_modelType, getVertexCount(), palette.data(), (UINT)palette.size(), statistics);
+	}
+
+	UINT ModelLoader::ChooseIndexSize(std::vector<UINT>& baseVertices)
+	{
+		baseVertices.assign(m_groups.size(), 0);
+		if (getVertexCount() <= 0x10000)
+			return sizeof(USHORT);
+
+		//per group base vertices only work if every index belongs to exactly one group
+		std::vector<const VertexGroup*> sorted;
+		for (VertexGroup& g : m_groups)
+			if (g.indexCount)
+				sorted.push_back(&g);
+		std::sort(sorted.begin(), sorted.end(), [](const VertexGroup* a, const VertexGroup* b) { return a->startIndex < b->startIndex; });
+		UINT covered = 0;
+		for (const VertexGroup* g : sorted)
+		{
+			if (g->startIndex != covered)
+				return sizeof(UINT);
+			covered += g->indexCount;
+		}
+		if (covered != m_indices.size())
+			return sizeof(UINT);
+
+		for (size_t g = 0; g < m_groups.size(); g++)
+		{
+			if (m_groups[g].indexCount == 0)
+				continue;
+			auto range = std::minmax_element(m_indices.begin() + m_groups[g].startIndex,
+				m_indices.begin() + m_groups[g].startIndex + m_groups[g].indexCount);
+			if (*range.second - *range.first > 0xffff)
+			{
+				baseVertices.assign(m_groups.size(), 0);
+				return sizeof(UINT);
+			}
+			baseVertices[g] = *range.first;
+		}
+		return sizeof(USHORT);
+	}
+
+	void ModelLoader::CopyIndices16(USHORT* dst, const std::vector<UINT>& baseVertices)
+	{
+		if (std::all_of(baseVertices.begin(), baseVertices.end(), [](UINT base) { return base == 0; }))
+		{
+			for (size_t i = 0; i < m_indices.size(); i++)
+				dst[i] = (USHORT)m_indices[i];
+			return;
+		}
+		for (size_t g = 0; g < m_groups.size(); g++)
+			for (UINT i = m_groups[g].startIndex; i < m_groups[g].startIndex + m_groups[g].indexCount; i++)
+				dst[i] = (USHORT)(m_indices[i] - baseVertices[g]);
+	}
+#pragma region Post-processing
+
+	void ModelLoader::ApplyPostProcess(UINT flags, PostProcessReport* report)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		UINT groupCount = (UINT)m_groups.size();
+		bool overdraw = (flags & PostProcess::OVERDRAW) && ModelType::HasPositions(m_modelType);
+		std::vector<VertexCacheStatistics> cacheBefore(groupCount), cacheAfter(groupCount);
+		std::vector<OverdrawStatistics> overdrawBefore(groupCount), overdrawAfter(groupCount);
+		bool weld = (flags & (PostProcess::WELD | PostProcess::WELD_TOLERANCE)) && !m_vertices.empty();
+		bool vertexFetch = (flags & PostProcess::VERTEX_FETCH) && !m_vertices.empty();
+		size_t vertexCount = m_vertices.empty() ? 0 : m_vertices.size() / getVertexSizeInFloats();
+		/* the passes count the vertices and group indices they start with. Only this thread reports
+		the progress and checks the cancellation, between the passes and the batches of groups. */
+		size_t startVertexCount = vertexCount;
+		UINT64 groupIndexCount = 0;
+		for (VertexGroup& group : m_groups)
+			groupIndexCount += group.indexCount;
+		BeginProgress(LoadStage::POSTPROCESS, groupIndexCount + startVertexCount * ((weld ? 1 : 0) + (vertexFetch ? 1 : 0)));
+
+		size_t weldedVertices = 0;
+		if (weld)
+		{
+			weldedVertices = WeldVertices((flags & PostProcess::WELD_TOLERANCE) ? &m_weldTolerance : nullptr);
+			AdvanceProgress(startVertexCount);
+			vertexCount -= weldedVertices;
+		}
+
+		const UINT GroupBatchSize = 64;	//groups between two progress reports
+		for (UINT batch = 0; batch < groupCount; batch += GroupBatchSize)
+		{
+			UINT batchEnd = (std::min)(batch + GroupBatchSize, groupCount);
+			ParallelFor(batchEnd - batch, [&](UINT task) {
+				UINT g = batch + task;
+				UINT* indices = m_indices.data() + m_groups[g].startIndex;
+				UINT indexCount = m_groups[g].indexCount;
+				if (report)
+				{
+					cacheBefore[g] = AnalyzeVertexCache(indices, indexCount);
+					if (overdraw)
+						overdrawBefore[g] = AnalyzeOverdraw(indices, indexCount, m_vertices.data(), m_modelType);
+				}
+				if (flags & PostProcess::VERTEX_CACHE)
+					OptimizeVertexCache(indices, indexCount);
+				if (overdraw)
+					OptimizeOverdraw(indices, indexCount, m_vertices.data(), m_modelType, m_overdrawThreshold);
+				if (report)
+				{
+					cacheAfter[g] = AnalyzeVertexCache(indices, indexCount);
+					if (overdraw)
+						overdrawAfter[g] = AnalyzeOverdraw(indices, indexCount, m_vertices.data(), m_modelType);
+				}
+				});
+			UINT64 batchIndexCount = 0;
+			for (UINT g = batch; g < batchEnd; g++)
+				batchIndexCount += m_groups[g].indexCount;
+			AdvanceProgress(batchIndexCount);
+		}
+
+		/* the vertices follow the triangle order once it is final */
+		size_t droppedVertices = 0;
+		if (vertexFetch)
+		{
+			std::vector<UINT> remap;
+			size_t usedCount = BuildVertexFetchRemap(m_indices.data(), m_indices.size(), vertexCount, remap);
+			RemapVertices(remap, usedCount);
+			AdvanceProgress(startVertexCount);
+			droppedVertices = vertexCount - usedCount;
+		}
+
+		if (report)
+		{
+			*report = PostProcessReport();
+			report->droppedVertices = droppedVertices;
+			report->weldedVertices = weldedVertices;
+			for (UINT g = 0; g < groupCount; g++)
+			{
+				report->cacheBefore.Add(cacheBefore[g]);
+				report->cacheAfter.Add(cacheAfter[g]);
+				report->overdrawBefore.Add(overdrawBefore[g]);
+				report->overdrawAfter.Add(overdrawAfter[g]);
+			}
+			report->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		}
 	}
+
+	size_t ModelLoader::WeldVertices(const WeldTolerance* tolerance, std::vector<UINT>* remap)
+	{
+		std::vector<UINT> ownRemap;
+		std::vector<UINT>& weldRemap = remap ? *remap : ownRemap;
+		weldRemap.clear();
+		if (m_vertices.empty())
+			return 0;
+		size_t vertexCount = m_vertices.size() / getVertexSizeInFloats();
+		std::vector<bool> locked;	//a morph would pull them apart again
+		if (!m_morphs.empty())
+		{
+			locked.assign(vertexCount, false);
+			for (Morph& morph : m_morphs)
+				for (MorphDelta& delta : morph.deltas)
+					if (delta.vertex < vertexCount)
+						locked[delta.vertex] = true;
+		}
+		size_t keptCount = BuildWeldRemap(m_vertices.data(), vertexCount, m_modelType, tolerance, locked.empty() ? nullptr : &locked, weldRemap);
+		if (keptCount < vertexCount)
+			RemapVertices(weldRemap, keptCount);
+		return vertexCount - keptCount;
+	}
+
+	void ModelLoader::RemapVertices(const std::vector<UINT>& remap, size_t newVertexCount)
+	{
+		UINT vertexSize = getVertexSizeInFloats();
+		size_t vertexCount = remap.size();
+		//checked before anything moves, a bad remap leaves the model as it was
+		if (vertexCount * vertexSize != m_vertices.size())
+			throw std::exception("Vertex remap does not cover every vertex");
+		std::vector<UINT> source(newVertexCount, UINT_MAX);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			if (remap[v] == UINT_MAX)
+				continue;
+			if (remap[v] >= newVertexCount)
+				throw std::exception("Vertex remap points past the new vertex count");
+			if (source[remap[v]] == UINT_MAX)
+				source[remap[v]] = (UINT)v;
+		}
+		for (UINT v : source)
+			if (v == UINT_MAX)
+				throw std::exception("Vertex remap leaves a new vertex empty");
+		for (UINT index : m_indices)
+			if (index >= vertexCount || remap[index] == UINT_MAX)
+				throw std::exception("Vertex remap drops a vertex that is still indexed");
+
+		/* copied in parallel chunks of the new vertices */
+		std::vector<VertexElement> vertices(newVertexCount * vertexSize);
+		const size_t chunkSize = 1 << 14;
+		ParallelFor((UINT)((newVertexCount + chunkSize - 1) / chunkSize), [&](UINT chunk) {
+			size_t end = (std::min)((chunk + 1) * chunkSize, newVertexCount);
+			for (size_t v = chunk * chunkSize; v < end; v++)
+				memcpy(&vertices[v * vertexSize], &m_vertices[(size_t)source[v] * vertexSize], vertexSize * sizeof(VertexElement));
+			});
+		m_vertices.swap(vertices);
+		for (UINT& index : m_indices)
+			index = remap[index];
+		for (Morph& morph : m_morphs)
+		{
+			auto end = std::remove_if(morph.deltas.begin(), morph.deltas.end(), [&](const MorphDelta& delta) {
+				return delta.vertex >= vertexCount || remap[delta.vertex] == UINT_MAX; });
+			morph.deltas.erase(end, morph.deltas.end());
+			for (MorphDelta& delta : morph.deltas)
+				delta.vertex = remap[delta.vertex];
+			SortMorphDeltas(morph);
+		}
+	}
+
+#pragma endregion
+
 	TextureToLoad::TextureToLoad() :
 		filename(),
 		width(0),
@@ -411,7 +860,7 @@ namespace gfx
 		filename.clear();
 		width = 0;
 		height = 0;
-		data.clear();
+		data.reset();
 		loaded = false;
 	}
 }
\ No newline at end of file
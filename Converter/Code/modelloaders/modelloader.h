@@ -3,7 +3,13 @@
 #include "graphics/shaderbase.h"
 #include "math/geometry.h"
 #include "math/boundingvolume.h"
+#include "vertexquantizer.h"
+#include "animation.h"
+#include "morph.h"
+#include "loadprogress.h"
+#include "meshoptimizer.h"
 #include <fstream>
+#include <algorithm>
 
 namespace gfx
 {
@@ -14,15 +20,27 @@ namespace gfx
 		UINT materialIndex;
 	};
 
+	/* Placement of a vertex group in the model. Groups that have instances are drawn once per
+	instance with its transform, the other groups once as they are. A transform with a negative
+	determinant mirrors the group, its triangles have to be drawn with the opposite winding. */
+	struct MeshInstance
+	{
+		UINT group;
+		mth::float4x4 transform;
+	};
+
+	static_assert(sizeof(MeshInstance) == 68, "MeshInstance is stored in OMD files as it is");
+
 	struct TextureToLoad
 	{
 		std::wstring filename;
 		int width;
 		int height;
 
-		/* pixel (x,y) can be accessed: data[(x+y*width)*4+component]
-		where component is: 0 for red, 1 for green, 2 for blue, 3 for alpha */
-		std::vector<unsigned char> data;
+		/* pixel (x,y) can be accessed: (*data)[(x+y*width)*4+component]
+		where component is: 0 for red, 1 for green, 2 for blue, 3 for alpha
+		copies of the texture share the pixels, a material per group does not copy the image */
+		std::shared_ptr<const std::vector<unsigned char>> data;
 		bool loaded;	//if true, texture can be created from data, if false, texture can be loaded from <filename> file
 
 		TextureToLoad();
@@ -30,6 +48,65 @@ namespace gfx
 		void Clear();
 	};
 
+	/* Passes over a loaded model, run by LoadModel, ExportOMD or ApplyPostProcess */
+	namespace PostProcess
+	{
+		enum Flag :UINT
+		{
+			VERTEX_CACHE = 1 << 0,	//reorders the triangles of every group for the post-transform vertex cache
+			OVERDRAW = 1 << 1,		//then sorts clusters of them to draw the outer ones first, see setOverdrawThreshold
+			VERTEX_FETCH = 1 << 2,	//last, orders the vertices by first use in m_indices and drops unused ones
+			WELD = 1 << 3,			//first, merges the vertices with identical bits, see WeldVertices
+			WELD_TOLERANCE = 1 << 4	//first, merges the vertices within setWeldTolerance instead
+		};
+	}
+
+	struct PostProcessReport
+	{
+		VertexCacheStatistics cacheBefore;	//of all groups, the cache starts empty at every group
+		VertexCacheStatistics cacheAfter;
+		OverdrawStatistics overdrawBefore;	//every group on its own grid, only filled by PostProcess::OVERDRAW
+		OverdrawStatistics overdrawAfter;
+		UINT64 droppedVertices;		//by PostProcess::VERTEX_FETCH
+		UINT64 weldedVertices;		//by PostProcess::WELD or WELD_TOLERANCE
+		double seconds;
+	};
+
+	namespace OMDExport
+	{
+		enum Flag :UINT
+		{
+			QUANTIZE = 1 << 0,		//binary only, compact vertex format described in vertexquantizer.h
+			COMPRESS = 1 << 1,		//binary only, compressed sections described in omdcodec.h
+			VERTEX_CACHE = 1 << 2,	//PostProcess::VERTEX_CACHE before writing, the model keeps the new order
+			OVERDRAW = 1 << 3,		//the same with PostProcess::OVERDRAW
+			VERTEX_FETCH = 1 << 4,	//and PostProcess::VERTEX_FETCH
+			WELD = 1 << 5,			//PostProcess::WELD
+			WELD_TOLERANCE = 1 << 6	//PostProcess::WELD_TOLERANCE
+		};
+	}
+
+	struct OMDExportReport
+	{
+		UINT64 vertexBytes;				//size of the vertex data written
+		UINT64 indexBytes;				//size of the index data written
+		UINT64 uncompressedVertexBytes;	//the same before compression
+		UINT64 uncompressedIndexBytes;
+		QuantizationError quantizationError;
+		PostProcessReport postProcess;
+	};
+
+	struct LoadStatistics
+	{
+		UINT64 fileSize;	//bytes of the loaded file
+		double seconds;		//time spent in LoadModel
+
+		inline double getMegabytesPerSecond() { return seconds > 0.0 ? fileSize / seconds / 1e6 : 0.0; }
+	};
+
+	class OMDArchive;
+	struct SkinningStatistics;
+
 	class ModelLoader
 	{
 	protected:
@@ -49,31 +126,84 @@ namespace gfx
 		mth::float3 m_bvCuboidSize;
 		float m_bvSphereRadius;
 		std::vector<mth::Triangle> m_hitbox;
+		std::vector<Bone> m_bones;
+		std::vector<Animation> m_animations;
+		std::vector<Morph> m_morphs;
+		std::vector<MeshInstance> m_instances;
+		LoadStatistics m_loadStatistics;
+		PostProcessReport m_postProcessReport;
+		float m_overdrawThreshold;	//ACMR a cluster of PostProcess::OVERDRAW may lose, 1.05 allows 5 percent
+		WeldTolerance m_weldTolerance;	//of PostProcess::WELD_TOLERANCE
+		LoadProgress* m_progress;	//set while LoadModel runs with a token, null otherwise
+
+	private:
+		/* runs load with m_progress set, a canceled load is cleared and its memory freed */
+		void RunLoad(LoadProgress* progress, const std::function<void()>& load);
 
 	protected:
 		void OrganizeMaterials();
 		void Create(Vertex_PTMB vertices[], UINT vertexCount, UINT indices[], UINT indexCount, UINT modelType);
+		/* report to m_progress if there is one, they throw when the load was canceled */
+		void BeginProgress(UINT stage, UINT64 total);
+		void AdvanceProgress(UINT64 count);
+		void SetProgress(UINT64 done);
+		void CheckCanceled();
+		/* moves the vertices to the place remap gives, the first of the ones sharing a place is kept,
+		UINT_MAX drops a vertex. The indices and the morph deltas follow. */
+		void RemapVertices(const std::vector<UINT>& remap, size_t newVertexCount);
 
 	public:
 		ModelLoader();
 		ModelLoader(LPCWSTR filename, UINT modelType = ModelType::AllPart);
 
 		void Clear();
-		void ExportOMD(LPCWSTR filename, UINT modelType, bool binary = true);
+		void ExportOMD(LPCWSTR filename, UINT modelType, bool binary = true, UINT exportFlags = 0, OMDExportReport* report = nullptr);
 
-		void LoadModel(LPCWSTR filename, UINT modelType = ModelType::AllPart);
+		/* postProcess has PostProcess flags, the passes run after loading and report to getPostProcessReport.
+		progress is optional, another thread can watch it and cancel the load with it. */
+		void LoadModel(LPCWSTR filename, UINT modelType = ModelType::AllPart, UINT postProcess = 0, LoadProgress* progress = nullptr);
+		/* Loads a file that was already read into memory, filename gives the format by its
+		extension and the folder where textures and other referenced files are looked up */
+		void LoadModel(const char* data, size_t size, LPCWSTR filename, UINT modelType = ModelType::AllPart,
+			UINT postProcess = 0, LoadProgress* progress = nullptr);
+		/* Loads an entry of an open archive straight from its mapping,
+		textures are looked up next to the archive in the folder of the entry name */
+		void LoadModel(OMDArchive& archive, UINT entry, UINT modelType = ModelType::AllPart, UINT postProcess = 0, LoadProgress* progress = nullptr);
+		void LoadModel(OMDArchive& archive, LPCWSTR name, UINT modelType = ModelType::AllPart, UINT postProcess = 0, LoadProgress* progress = nullptr);
+		/* Runs the PostProcess passes given in flags, the groups are processed in parallel */
+		void ApplyPostProcess(UINT flags, PostProcessReport* report = nullptr);
+		/* Merges equal vertices (see BuildWeldRemap), by identical bits without a tolerance. The vertices
+		morph deltas move are left alone. remap receives the new index of every old vertex if given.
+		Returns the count of vertices removed. */
+		size_t WeldVertices(const WeldTolerance* tolerance = nullptr, std::vector<UINT>* remap = nullptr);
 		void CreateCube(mth::float3 position, mth::float3 size, UINT modelType);
 		void CreateFullScreenQuad();
 		void CreateScreenQuad(mth::float2 pos, mth::float2 size);
 		void CreateQuad(mth::float2 pos, mth::float2 size, UINT modelType);
 		void CreateQuad(mth::float2 pos, mth::float2 size, mth::float2 tpos, mth::float2 tsize, UINT modelType);
 
+		/* groups that have instances are added once per instance */
 		void MakeHitboxFromVertices();
-		void MakeVerticesFromHitbox();
+		/* A vertex per triangle corner, with weld the corners the triangles share become one vertex.
+		The morphs are dropped either way, their deltas were made for the replaced vertices. */
+		void MakeVerticesFromHitbox(bool weld = false);
+		/* Adds the vertices of every instanced group once more per instance with its transform applied
+		and replaces the instances with plain groups, for renderers that draw every group as it is.
+		Mirroring transforms get the opposite winding, vertices no group uses anymore are dropped. */
+		void FlattenInstances();
 		bool HasHitbox();
 		void SwapHitboxes(ModelLoader& other);
 		void FlipInsideOut();
 		void Transform(mth::float4x4 transform);
+		/* Skins the vertices into pose, which has an element per bone, so the model becomes a posed copy.
+		The bone data stays, MakeHitboxFromVertices afterwards gives the hitbox of the pose. */
+		void BakePose(const BonePose* pose, SkinningStatistics* statistics = nullptr);
+
+		/* Returns the narrowest index size in bytes (2 or 4). Models with at most 65536 vertices
+		always get 16 bit indices, larger ones too if every group references a range of at most
+		65536 vertices, then baseVertices holds the value to add to the indices of each group. */
+		UINT ChooseIndexSize(std::vector<UINT>& baseVertices);
+		void CopyIndices16(USHORT* dst, const std::vector<UINT>& baseVertices);
 
 		inline std::wstring& getFolderName() { return m_folder; }
 		inline std::wstring& getFilename() { return m_filename; }
@@ -89,5 +219,22 @@ namespace gfx
 		inline UINT getMaterialCount() { return (UINT)m_textures.size(); }
 		inline TextureToLoad& getTexture(UINT index) { return m_textures[index]; }
 		inline TextureToLoad& getNormalmap(UINT index) { return m_normalmaps[index]; }
+		inline UINT getBoneCount() { return (UINT)m_bones.size(); }
+		inline Bone& getBone(UINT index) { return m_bones[index]; }
+		inline std::vector<Bone>& getBones() { return m_bones; }
+		inline UINT getAnimationCount() { return (UINT)m_animations.size(); }
+		inline Animation& getAnimation(UINT index) { return m_animations[index]; }
+		inline UINT getMorphCount() { return (UINT)m_morphs.size(); }
+		inline Morph& getMorph(UINT index) { return m_morphs[index]; }
+		inline std::vector<Morph>& getMorphs() { return m_morphs; }
+		inline UINT getInstanceCount() { return (UINT)m_instances.size(); }
+		inline MeshInstance& getInstance(UINT index) { return m_instances[index]; }
+		inline std::vector<MeshInstance>& getInstances() { return m_instances; }
+		inline LoadStatistics& getLoadStatistics() { return m_loadStatistics; }
+		inline PostProcessReport& getPostProcessReport() { return m_postProcessReport; }
+		inline float getOverdrawThreshold() { return m_overdrawThreshold; }
+		inline void setOverdrawThreshold(float threshold) { m_overdrawThreshold = threshold; }
+		inline WeldTolerance& getWeldTolerance() { return m_weldTolerance; }
+		inline void setWeldTolerance(const WeldTolerance& tolerance) { m_weldTolerance = tolerance; }
 	};
 }
\ No newline at end of file
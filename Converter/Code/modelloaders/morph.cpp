@@ -0,0 +1,157 @@
+#include "morph.h"
+#include "simd.h"
+#include <algorithm>
+
+namespace gfx
+{
+	namespace
+	{
+		const UINT MorphChunkSize = 4096;	//vertices per parallel range
+		const size_t MorphSerialDeltaCount = 16384;	//fewer deltas are applied on the calling thread
+
+		inline bool IsZero(const MorphDelta& delta)
+		{
+			return delta.position.x == 0.0f && delta.position.y == 0.0f && delta.position.z == 0.0f &&
+				delta.normal.x == 0.0f && delta.normal.y == 0.0f && delta.normal.z == 0.0f &&
+				delta.texcoord.x == 0.0f && delta.texcoord.y == 0.0f;
+		}
+		inline const MorphDelta* FirstDelta(const Morph& morph, UINT vertex)
+		{
+			return morph.deltas.data() + (std::lower_bound(morph.deltas.begin(), morph.deltas.end(), vertex,
+				[](const MorphDelta& delta, UINT v) { return delta.vertex < v; }) - morph.deltas.begin());
+		}
+	}
+
+	void SortMorphDeltas(Morph& morph)
+	{
+		std::vector<MorphDelta>& deltas = morph.deltas;
+		std::stable_sort(deltas.begin(), deltas.end(), [](const MorphDelta& a, const MorphDelta& b) { return a.vertex < b.vertex; });
+		size_t count = 0;
+		for (size_t i = 0; i < deltas.size(); i++)
+		{
+			if (count > 0 && deltas[count - 1].vertex == deltas[i].vertex)
+			{
+				deltas[count - 1].position += deltas[i].position;
+				deltas[count - 1].normal += deltas[i].normal;
+				deltas[count - 1].texcoord += deltas[i].texcoord;
+			}
+			else
+				deltas[count++] = deltas[i];
+		}
+		deltas.resize(count);
+		deltas.erase(std::remove_if(deltas.begin(), deltas.end(), IsZero), deltas.end());
+	}
+
+	MorphEvaluator::MorphEvaluator() {}
+
+	void MorphEvaluator::Apply(const VertexElement* base, VertexElement* dst, UINT modelType,
+		const std::vector<Morph>& morphs, const float* weights)
+	{
+		m_applied.resize(morphs.size(), false);
+		std::vector<UINT> dirty;
+		std::vector<UINT> active;
+		UINT vertexEnd = 0;
+		size_t deltaCount = 0;
+		for (UINT m = 0; m < (UINT)morphs.size(); m++)
+		{
+			bool isActive = weights[m] != 0.0f && !morphs[m].deltas.empty();
+			if (isActive)
+				active.push_back(m);
+			if ((isActive || m_applied[m]) && !morphs[m].deltas.empty())
+			{
+				dirty.push_back(m);
+				deltaCount += morphs[m].deltas.size();
+				vertexEnd = (std::max)(vertexEnd, morphs[m].deltas.back().vertex + 1);
+			}
+			m_applied[m] = isActive;
+		}
+		if (dirty.empty())
+			return;
+
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		bool hasPositions = ModelType::HasPositions(modelType);
+		bool hasTexcoords = ModelType::HasTexcoords(modelType);
+		bool hasNormals = ModelType::HasNormals(modelType);
+		UINT positionOffset = ModelType::PositionOffset(modelType);
+		UINT texcoordOffset = ModelType::TexCoordOffset(modelType);
+		UINT normalOffset = ModelType::NormalOffset(modelType);
+
+		auto applyRange = [&](UINT first, UINT last) {
+			//every vertex a morph moved now or at the previous call starts from the base again
+			for (UINT m : dirty)
+			{
+				const MorphDelta* end = morphs[m].deltas.data() + morphs[m].deltas.size();
+				for (const MorphDelta* d = FirstDelta(morphs[m], first); d != end && d->vertex < last; d++)
+				{
+					const VertexElement* src = base + (size_t)d->vertex * vertexSize;
+					VertexElement* v = dst + (size_t)d->vertex * vertexSize;
+					if (hasPositions)
+						simd::Store3(&v[positionOffset].f, simd::Load3(&src[positionOffset].f));
+					if (hasTexcoords)
+						simd::Store2(&v[texcoordOffset].f, simd::Load2(&src[texcoordOffset].f));
+					if (hasNormals)
+						simd::Store3(&v[normalOffset].f, simd::Load3(&src[normalOffset].f));
+				}
+			}
+
+			for (UINT m : active)
+			{
+				__m128 weight = _mm_set1_ps(weights[m]);
+				const MorphDelta* end = morphs[m].deltas.data() + morphs[m].deltas.size();
+				for (const MorphDelta* d = FirstDelta(morphs[m], first); d != end && d->vertex < last; d++)
+				{
+					float* v = &dst[(size_t)d->vertex * vertexSize].f;
+					if (hasPositions)
+						simd::Store3(v + positionOffset, _mm_add_ps(simd::Load3(v + positionOffset), _mm_mul_ps(simd::Load3(&d->position.x), weight)));
+					if (hasTexcoords)
+						simd::Store2(v + texcoordOffset, _mm_add_ps(simd::Load2(v + texcoordOffset), _mm_mul_ps(simd::Load2(&d->texcoord.x), weight)));
+					if (hasNormals)
+						simd::Store3(v + normalOffset, _mm_add_ps(simd::Load3(v + normalOffset), _mm_mul_ps(simd::Load3(&d->normal.x), weight)));
+				}
+			}
+
+			if (hasNormals)
+				for (UINT m : active)
+				{
+					const MorphDelta* end = morphs[m].deltas.data() + morphs[m].deltas.size();
+					for (const MorphDelta* d = FirstDelta(morphs[m], first); d != end && d->vertex < last; d++)
+					{
+						float* normal = &dst[(size_t)d->vertex * vertexSize + normalOffset].f;
+						simd::Store3(normal, simd::Normalize3(simd::Load3(normal)));
+					}
+				}
+		};
+
+		//a few sliders on a small morph cost less than waking the workers
+		if (deltaCount < MorphSerialDeltaCount)
+			applyRange(0, vertexEnd);
+		else
+			ParallelFor((vertexEnd + MorphChunkSize - 1) / MorphChunkSize, [&](UINT chunk) {
+				UINT first = chunk * MorphChunkSize;
+				applyRange(first, (std::min)(first + MorphChunkSize, vertexEnd));
+				});
+	}
+
+	void MorphEvaluator::Reset()
+	{
+		m_applied.clear();
+	}
+
+	void ApplyMorphBones(const std::vector<Morph>& morphs, const float* weights, BonePose* pose, UINT boneCount)
+	{
+		for (size_t m = 0; m < morphs.size(); m++)
+		{
+			float weight = weights[m];
+			if (weight == 0.0f)
+				continue;
+			for (const MorphBoneDelta& delta : morphs[m].boneDeltas)
+			{
+				if (delta.bone >= boneCount)
+					continue;
+				BonePose& bone = pose[delta.bone];
+				bone.translation += delta.translation * weight;
+				bone.rotation = bone.rotation * NormalizedLerp(mth::quaternion(1.0f), delta.rotation, weight);
+			}
+		}
+	}
+}
\ No newline at end of file
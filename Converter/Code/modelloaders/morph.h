@@ -0,0 +1,62 @@
+#pragma once
+
+#include "graphics/shaderbase.h"
+#include "animation.h"
+
+namespace gfx
+{
+	/* Offset of one vertex in a morph target, stored in OMD files as it is */
+	struct MorphDelta
+	{
+		UINT vertex;
+		mth::float3 position;
+		mth::float3 normal;
+		mth::float2 texcoord;
+	};
+
+	/* Offset of one bone in a morph, added to the pose of the bone */
+	struct MorphBoneDelta
+	{
+		UINT bone;
+		mth::float3 translation;
+		mth::quaternion rotation;
+	};
+
+	static_assert(sizeof(MorphDelta) == 36, "MorphDelta must be 36 bytes");
+	static_assert(sizeof(MorphBoneDelta) == 32, "MorphBoneDelta must be 32 bytes");
+
+	/* Blend shape stored as sparse deltas. The vertex deltas are sorted by vertex
+	and hold every vertex at most once, see SortMorphDeltas. */
+	struct Morph
+	{
+		std::wstring name;
+		std::vector<MorphDelta> deltas;
+		std::vector<MorphBoneDelta> boneDeltas;
+	};
+
+	/* Sorts the vertex deltas, merges the ones of the same vertex and drops zero deltas */
+	void SortMorphDeltas(Morph& morph);
+
+	/* Applies weighted morphs to a vertex buffer. Only the vertices of morphs with a nonzero
+	weight in this or the previous call are written, so the cost follows the active morphs
+	rather than the model size. The deltas are accumulated with SSE, in parallel vertex ranges
+	when there are enough of them. */
+	class MorphEvaluator
+	{
+	private:
+		std::vector<bool> m_applied;	//morphs with a nonzero weight at the previous call
+
+	public:
+		MorphEvaluator();
+
+		/* weights has an element per morph. dst must hold a copy of base at the first call,
+		later it has to keep the result of the previous call. */
+		void Apply(const VertexElement* base, VertexElement* dst, UINT modelType,
+			const std::vector<Morph>& morphs, const float* weights);
+		/* Forgets the previous call, for a dst that was copied from base again */
+		void Reset();
+	};
+
+	/* Adds the weighted bone deltas of the morphs to pose, which has an element per bone */
+	void ApplyMorphBones(const std::vector<Morph>& morphs, const float* weights, BonePose* pose, UINT boneCount);
+}
\ No newline at end of file
@@ -0,0 +1,329 @@
+#include "omdarchive.h"
+#include "omdexporter.h"
+#include <filesystem>
+#include <sstream>
+
+namespace gfx
+{
+#pragma region OMDArchive
+
+	OMDArchive::OMDArchive() :
+		m_entries(nullptr),
+		m_names(nullptr),
+		m_entryCount(0) {}
+	OMDArchive::OMDArchive(LPCWSTR filename) :
+		m_entries(nullptr),
+		m_names(nullptr),
+		m_entryCount(0)
+	{
+		Open(filename);
+	}
+
+	void OMDArchive::Open(LPCWSTR filename)
+	{
+		Close();
+		m_file.Open(filename);
+		const char* data = m_file.getData();
+		size_t size = m_file.getSize();
+		try
+		{
+			OMDArchiveHeader header;
+			if (size < sizeof(header))
+				throw std::exception("Corrupted OMD archive: file is too small");
+			memcpy(&header, data, sizeof(header));
+			if (memcmp(header.magic, "OMDA", 4) != 0)
+				throw std::exception("Corrupted OMD archive: not an OMD archive");
+			if (header.version != OMDArchiveFlag::Version)
+				throw std::exception("Unsupported OMD archive version");
+			if (header.tocOffset % OMDArchiveFlag::TableAlignment || header.namesOffset % sizeof(WCHAR) ||
+				header.tocOffset > size || header.entryCount > (size - header.tocOffset) / sizeof(OMDArchiveEntry) ||
+				header.namesOffset > size || header.namesSize > (size - header.namesOffset) / sizeof(WCHAR))
+				throw std::exception("Corrupted OMD archive: table of contents out of range");
+			m_entries = (const OMDArchiveEntry*)(data + header.tocOffset);
+			m_names = (const WCHAR*)(data + header.namesOffset);
+			m_entryCount = header.entryCount;
+
+			for (UINT i = 0; i < m_entryCount; i++)
+			{
+				const OMDArchiveEntry& entry = m_entries[i];
+				if (entry.offset > size || entry.size > size - entry.offset ||
+					entry.nameOffset > header.namesSize || entry.nameLength > header.namesSize - entry.nameOffset)
+					throw std::exception("Corrupted OMD archive: entry out of range");
+				if (i > 0 && m_entries[i - 1].nameHash > entry.nameHash)
+					throw std::exception("Corrupted OMD archive: table of contents is not sorted");
+			}
+		}
+		catch (...)
+		{
+			Close();
+			throw;
+		}
+		std::wstring path = filename;
+		size_t lastSlash = path.find_last_of(L"/\\");
+		m_folder = lastSlash == std::wstring::npos ? std::wstring() : path.substr(0, lastSlash + 1);
+	}
+
+	void OMDArchive::Close()
+	{
+		m_file.Close();
+		m_folder.clear();
+		m_entries = nullptr;
+		m_names = nullptr;
+		m_entryCount = 0;
+	}
+
+	UINT OMDArchive::FindEntry(LPCWSTR name)
+	{
+		std::wstring normalized = NormalizeName(name);
+		UINT64 hash = HashName(normalized);
+		const OMDArchiveEntry* entry = std::lower_bound(m_entries, m_entries + m_entryCount, hash,
+			[](const OMDArchiveEntry& e, UINT64 h) { return e.nameHash < h; });
+		for (; entry != m_entries + m_entryCount && entry->nameHash == hash; entry++)
+		{
+			if (entry->nameLength == normalized.length() &&
+				std::equal(normalized.begin(), normalized.end(), m_names + entry->nameOffset))
+				return (UINT)(entry - m_entries);
+		}
+		return InvalidEntry;
+	}
+
+	bool OMDArchive::VerifyEntry(UINT entry)
+	{
+		return HashData(getEntryData(entry), getEntrySize(entry)) == m_entries[entry].dataHash;
+	}
+
+	std::wstring OMDArchive::NormalizeName(LPCWSTR name)
+	{
+		std::wstring normalized;
+		for (UINT i = 0; name[i]; i++)
+		{
+			WCHAR c = name[i];
+			if (c == L'\\')
+				c = L'/';
+			else if (c >= L'A' && c <= L'Z')
+				c += L'a' - L'A';
+			normalized += c;
+		}
+		size_t start = 0;
+		while (true)
+		{
+			if (normalized.compare(start, 2, L"./") == 0)
+				start += 2;
+			else if (normalized.compare(start, 1, L"/") == 0)
+				start += 1;
+			else
+				break;
+		}
+		return normalized.substr(start);
+	}
+
+	UINT64 OMDArchive::HashName(const std::wstring& normalizedName)
+	{
+		UINT64 hash = 14695981039346656037ull;	//FNV-1a
+		for (WCHAR c : normalizedName)
+		{
+			hash = (hash ^ (c & 0xff)) * 1099511628211ull;
+			hash = (hash ^ (c >> 8)) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	UINT64 OMDArchive::HashData(const char* data, size_t size)
+	{
+		//FNV-1a over 8 byte words, the tail byte by byte
+		UINT64 hash = 14695981039346656037ull;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			UINT64 word;
+			memcpy(&word, data + i, sizeof(word));
+			hash = (hash ^ word) * 1099511628211ull;
+		}
+		for (; i < size; i++)
+			hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+		return hash;
+	}
+
+#pragma endregion
+
+#pragma region OMDArchivePacker
+
+	static const WCHAR* SourceExtensions[] = {
+		L".pmx", L".obj", L".fbx", L".dae", L".3ds", L".blend", L".x", L".gltf", L".glb", L".ply", L".stl" };
+
+	static std::wstring LowerExtension(const std::filesystem::path& path)
+	{
+		std::wstring extension = path.extension().wstring();
+		for (WCHAR& c : extension)
+			if (c >= L'A' && c <= L'Z')
+				c += L'a' - L'A';
+		return extension;
+	}
+
+	static bool IsSourceExtension(const std::wstring& extension)
+	{
+		for (const WCHAR* source : SourceExtensions)
+			if (extension == source)
+				return true;
+		return false;
+	}
+
+	OMDArchivePacker::OMDArchivePacker(UINT modelType, UINT exportFlags) :
+		m_modelType(modelType),
+		m_exportFlags(exportFlags) {}
+
+	void OMDArchivePacker::AddData(LPCWSTR name, const char* data, size_t size, UINT flags)
+	{
+		m_entries.push_back({ OMDArchive::NormalizeName(name), std::vector<char>(data, data + size), flags });
+	}
+
+	void OMDArchivePacker::AddModel(LPCWSTR name, ModelLoader& model)
+	{
+		m_entries.push_back({ OMDArchive::NormalizeName(name), ExportModel(model), OMDArchiveFlag::CONVERTED });
+	}
+
+	std::vector<char> OMDArchivePacker::ExportModel(ModelLoader& model)
+	{
+		std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+		((OMDExporter*)&model)->ExportOMDBinary(stream, m_modelType, m_exportFlags);
+		std::string data = stream.str();
+		return std::vector<char>(data.begin(), data.end());
+	}
+
+	void OMDArchivePacker::AddFile(LPCWSTR filename, LPCWSTR name)
+	{
+		m_entries.push_back(MakeFileEntry(filename, name));
+	}
+
+	OMDArchivePacker::Entry OMDArchivePacker::MakeFileEntry(LPCWSTR filename, LPCWSTR name)
+	{
+		Entry entry;
+		entry.name = OMDArchive::NormalizeName(name);
+		MappedFile file(filename);
+		if (OMDLoader::IsOMD(file.getData(), file.getSize()))
+		{
+			entry.data.assign(file.getData(), file.getData() + file.getSize());
+			entry.flags = (file.getData()[0] == 't' || file.getData()[0] == 'T') ? OMDArchiveFlag::TEXT : 0;
+			return entry;
+		}
+		file.Close();
+		ModelLoader model(filename, m_modelType);
+		entry.data = ExportModel(model);
+		entry.flags = OMDArchiveFlag::CONVERTED;
+		return entry;
+	}
+
+	void OMDArchivePacker::AddDirectory(LPCWSTR folder, bool convertSources)
+	{
+		std::vector<std::filesystem::path> files;
+		std::vector<std::wstring> names;
+		std::vector<std::wstring> omdNames;
+		for (const std::filesystem::directory_entry& item : std::filesystem::recursive_directory_iterator(folder))
+		{
+			if (!item.is_regular_file())
+				continue;
+			std::wstring extension = LowerExtension(item.path());
+			bool omd = extension == L".omd";
+			if (!omd && !(convertSources && IsSourceExtension(extension)))
+				continue;
+			std::filesystem::path relative = item.path().lexically_relative(folder);
+			files.push_back(item.path());
+			names.push_back(OMDArchive::NormalizeName(relative.replace_extension().wstring().c_str()));
+			if (omd)
+				omdNames.push_back(names.back());
+		}
+		std::sort(omdNames.begin(), omdNames.end());
+
+		std::vector<UINT> selected;
+		for (UINT i = 0; i < (UINT)files.size(); i++)
+		{
+			if (LowerExtension(files[i]) == L".omd" || !std::binary_search(omdNames.begin(), omdNames.end(), names[i]))
+				selected.push_back(i);
+		}
+		//one file per task, the loads of converted sources run their own parallel loops serially inside it
+		std::vector<Entry> entries(selected.size());
+		ParallelFor((UINT)selected.size(), [&](UINT i) {
+			entries[i] = MakeFileEntry(files[selected[i]].wstring().c_str(), names[selected[i]].c_str());
+		});
+		for (Entry& entry : entries)
+			m_entries.push_back(std::move(entry));
+	}
+
+	void OMDArchivePacker::Write(LPCWSTR filename)
+	{
+		auto alignUp = [](UINT64 offset, UINT64 alignment) { return (offset + alignment - 1) / alignment * alignment; };
+
+		std::vector<UINT64> hashes(m_entries.size());
+		std::vector<UINT> order(m_entries.size());
+		for (UINT i = 0; i < (UINT)m_entries.size(); i++)
+		{
+			hashes[i] = OMDArchive::HashName(m_entries[i].name);
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&](UINT a, UINT b) {
+			if (hashes[a] != hashes[b])
+				return hashes[a] < hashes[b];
+			return m_entries[a].name < m_entries[b].name;
+		});
+
+		std::vector<OMDArchiveEntry> toc(m_entries.size());
+		std::vector<WCHAR> names;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			Entry& entry = m_entries[order[i]];
+			if (i > 0 && entry.name == m_entries[order[i - 1]].name)
+				throw std::exception(std::string("Duplicate OMD archive entry: " + ToStr(entry.name.c_str())).c_str());
+			toc[i] = {};
+			toc[i].nameHash = hashes[order[i]];
+			toc[i].dataHash = OMDArchive::HashData(entry.data.data(), entry.data.size());
+			toc[i].size = entry.data.size();
+			toc[i].nameOffset = (UINT)names.size();
+			toc[i].nameLength = (UINT)entry.name.length();
+			toc[i].flags = entry.flags;
+			names.insert(names.end(), entry.name.begin(), entry.name.end());
+			names.push_back(0);
+		}
+
+		OMDArchiveHeader header = {};
+		memcpy(header.magic, "OMDA", 4);
+		header.version = OMDArchiveFlag::Version;
+		header.entryCount = (UINT)toc.size();
+		header.tocOffset = alignUp(sizeof(header), OMDArchiveFlag::TableAlignment);
+		header.namesOffset = header.tocOffset + toc.size() * sizeof(OMDArchiveEntry);
+		header.namesSize = names.size();
+		UINT64 offset = header.namesOffset + names.size() * sizeof(WCHAR);
+		for (OMDArchiveEntry& entry : toc)
+		{
+			offset = alignUp(offset, OMDArchiveFlag::EntryAlignment);
+			entry.offset = offset;
+			offset += entry.size;
+		}
+
+		std::ofstream outfile(filename, std::ios::out | std::ios::binary);
+		if (!outfile.good())
+			throw std::exception(std::string("Failed to create file: " + ToStr(filename)).c_str());
+		const char padding[OMDArchiveFlag::EntryAlignment] = {};
+		outfile.write((const char*)&header, sizeof(header));
+		outfile.write(padding, header.tocOffset - sizeof(header));
+		outfile.write((const char*)toc.data(), toc.size() * sizeof(OMDArchiveEntry));
+		outfile.write((const char*)names.data(), names.size() * sizeof(WCHAR));
+		UINT64 position = header.namesOffset + names.size() * sizeof(WCHAR);
+		for (size_t i = 0; i < toc.size(); i++)
+		{
+			outfile.write(padding, toc[i].offset - position);
+			std::vector<char>& data = m_entries[order[i]].data;
+			outfile.write(data.data(), data.size());
+			position = toc[i].offset + toc[i].size;
+		}
+		if (!outfile.good())
+			throw std::exception(std::string("Failed to write file: " + ToStr(filename)).c_str());
+		outfile.close();
+	}
+
+	void OMDArchivePacker::Clear()
+	{
+		m_entries.clear();
+	}
+
+#pragma endregion
+}
\ No newline at end of file
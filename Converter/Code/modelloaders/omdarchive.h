@@ -0,0 +1,133 @@
+#pragma once
+
+#include "omdloader.h"
+
+namespace gfx
+{
+	/* OMD archive
+	Many OMDs packed in one file, so a level can load all of its models through one mapping.
+	The file starts with OMDArchiveHeader, the table of contents is an OMDArchiveEntry array
+	sorted by name hash, the names are null terminated WCHAR strings. Every entry holds a
+	complete OMD file at a 64 byte aligned offset, so the sections of binary OMDs keep
+	their alignment. Entry ids are indices into the table of contents. */
+	namespace OMDArchiveFlag
+	{
+		enum Flag :UINT
+		{
+			CONVERTED = 1 << 0,	//exported from a source model when the archive was packed
+			TEXT = 1 << 1		//text OMD
+		};
+
+		const UINT Version = 1;
+		const UINT EntryAlignment = 64;
+		const UINT TableAlignment = 16;
+	}
+
+	struct OMDArchiveHeader
+	{
+		char magic[4];			//"OMDA"
+		UINT version;
+		UINT entryCount;
+		UINT reserved;
+		UINT64 tocOffset;
+		UINT64 namesOffset;
+		UINT64 namesSize;		//in characters
+		UINT64 reserved2;
+	};
+
+	struct OMDArchiveEntry
+	{
+		UINT64 nameHash;		//OMDArchive::HashName of the normalized name
+		UINT64 dataHash;		//OMDArchive::HashData of the payload
+		UINT64 offset;			//from the start of the archive
+		UINT64 size;
+		UINT nameOffset;		//in characters from namesOffset
+		UINT nameLength;
+		UINT flags;				//OMDArchiveFlag::Flag
+		UINT reserved;
+	};
+
+	static_assert(sizeof(OMDArchiveHeader) == 48, "OMDArchiveHeader must be 48 bytes");
+	static_assert(sizeof(OMDArchiveEntry) == 48, "OMDArchiveEntry must be 48 bytes");
+
+	/* Memory mapped OMD archive. The table of contents is validated on Open,
+	entries are pointers into the mapping and are read from disk when they are loaded. */
+	class OMDArchive
+	{
+		SMART_PTR(OMDArchive)
+		NO_COPY(OMDArchive)
+
+	public:
+		static const UINT InvalidEntry = 0xffffffff;
+
+	private:
+		MappedFile m_file;
+		std::wstring m_folder;
+		const OMDArchiveEntry* m_entries;
+		const WCHAR* m_names;
+		UINT m_entryCount;
+
+	public:
+		OMDArchive();
+		OMDArchive(LPCWSTR filename);
+
+		void Open(LPCWSTR filename);
+		void Close();
+
+		/* name is a path relative to the packed folder without extension,
+		case and slash direction do not matter */
+		UINT FindEntry(LPCWSTR name);
+		bool VerifyEntry(UINT entry);	//compares the payload with its hash
+
+		/* lower case, '/' separators, no leading "./" or '/' */
+		static std::wstring NormalizeName(LPCWSTR name);
+		static UINT64 HashName(const std::wstring& normalizedName);
+		static UINT64 HashData(const char* data, size_t size);
+
+		inline bool isOpen() { return m_file.isOpen(); }
+		inline std::wstring& getFolderName() { return m_folder; }
+		inline UINT getEntryCount() { return m_entryCount; }
+		inline const OMDArchiveEntry& getEntry(UINT entry) { return m_entries[entry]; }
+		inline std::wstring getEntryName(UINT entry) { return std::wstring(m_names + m_entries[entry].nameOffset, m_entries[entry].nameLength); }
+		inline const char* getEntryData(UINT entry) { return m_file.getData() + m_entries[entry].offset; }
+		inline size_t getEntrySize(UINT entry) { return (size_t)m_entries[entry].size; }
+	};
+
+	/* Builds an OMD archive. OMD files are stored as they are, source models are loaded
+	and exported as binary OMD with the packer's model type and OMDExport flags. */
+	class OMDArchivePacker
+	{
+		SMART_PTR(OMDArchivePacker)
+
+	private:
+		struct Entry
+		{
+			std::wstring name;
+			std::vector<char> data;
+			UINT flags;
+		};
+
+		UINT m_modelType;
+		UINT m_exportFlags;
+		std::vector<Entry> m_entries;
+
+	private:
+		std::vector<char> ExportModel(ModelLoader& model);
+		Entry MakeFileEntry(LPCWSTR filename, LPCWSTR name);
+
+	public:
+		OMDArchivePacker(UINT modelType = ModelType::AllPart, UINT exportFlags = 0);
+
+		void AddData(LPCWSTR name, const char* data, size_t size, UINT flags = 0);
+		void AddModel(LPCWSTR name, ModelLoader& model);
+		void AddFile(LPCWSTR filename, LPCWSTR name);
+		/* Adds the .omd files of folder and its subfolders, named by their relative path.
+		With convertSources the source models are converted in parallel too,
+		a source is skipped if an OMD of the same name exists. */
+		void AddDirectory(LPCWSTR folder, bool convertSources = false);
+		void Write(LPCWSTR filename);
+		void Clear();
+
+		inline UINT getEntryCount() { return (UINT)m_entries.size(); }
+	};
+}
\ No newline at end of file
@@ -0,0 +1,592 @@
+#include "omdcodec.h"
+#include "graphics/shaderbase.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <climits>
+
+namespace gfx
+{
+#pragma region LZ stage
+
+	void LZCompress(const char* src, size_t srcSize, std::vector<char>& dst)
+	{
+		const UINT HashBits = 16;
+		const size_t MinMatch = 4;
+		const size_t MaxOffset = 0xffff;
+
+		std::vector<UINT64> table(1 << HashBits, 0);	//position + 1 of the last occurrence, 0 if none
+		auto read32 = [src](size_t position) { UINT v; memcpy(&v, src + position, sizeof(v)); return v; };
+		auto hash = [HashBits](UINT v) { return (v * 2654435761u) >> (32 - HashBits); };
+		auto writeLength = [&dst](size_t length) {
+			for (; length >= 255; length -= 255)
+				dst.push_back((char)255);
+			dst.push_back((char)length);
+		};
+		auto writeToken = [&dst](size_t literals, size_t matchLength) {
+			dst.push_back((char)(((literals < 15 ? literals : 15) << 4) | (matchLength < 15 ? matchLength : 15)));
+		};
+
+		dst.reserve(dst.size() + srcSize / 2 + 16);
+		size_t anchor = 0;
+		size_t position = 0;
+		while (position + MinMatch <= srcSize)
+		{
+			UINT v = read32(position);
+			UINT64& entry = table[hash(v)];
+			size_t candidate = (size_t)entry;
+			entry = position + 1;
+			if (candidate == 0 || position - (candidate - 1) > MaxOffset || read32(candidate - 1) != v)
+			{
+				position += 1 + ((position - anchor) >> 6);	//skip faster through data that does not compress
+				continue;
+			}
+			size_t match = candidate - 1;
+			size_t length = MinMatch;
+			while (position + length < srcSize && src[match + length] == src[position + length])
+				length++;
+
+			size_t literals = position - anchor;
+			writeToken(literals, length - MinMatch);
+			if (literals >= 15)
+				writeLength(literals - 15);
+			dst.insert(dst.end(), src + anchor, src + position);
+			size_t offset = position - match;
+			dst.push_back((char)(offset & 0xff));
+			dst.push_back((char)(offset >> 8));
+			if (length - MinMatch >= 15)
+				writeLength(length - MinMatch - 15);
+
+			position += length;
+			anchor = position;
+			if (position + 2 <= srcSize)
+				table[hash(read32(position - 2))] = position - 2 + 1;
+		}
+
+		size_t literals = srcSize - anchor;
+		writeToken(literals, 0);
+		if (literals >= 15)
+			writeLength(literals - 15);
+		dst.insert(dst.end(), src + anchor, src + srcSize);
+	}
+
+	void LZDecompress(const char* src, size_t srcSize, char* dst, size_t dstSize)
+	{
+		const unsigned char* ip = (const unsigned char*)src;
+		const unsigned char* iend = ip + srcSize;
+		char* op = dst;
+		char* oend = dst + dstSize;
+		auto readLength = [&ip, iend](size_t length) {
+			if (length == 15)
+			{
+				unsigned char b;
+				do
+				{
+					if (ip >= iend)
+						throw std::exception("Corrupted OMD data: truncated compressed stream");
+					b = *ip++;
+					length += b;
+				} while (b == 255);
+			}
+			return length;
+		};
+
+		while (true)
+		{
+			if (ip >= iend)
+				throw std::exception("Corrupted OMD data: truncated compressed stream");
+			UINT token = *ip++;
+
+			size_t literals = readLength(token >> 4);
+			if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+				throw std::exception("Corrupted OMD data: compressed literals out of range");
+			if ((size_t)(iend - ip) >= literals + 16 && (size_t)(oend - op) >= literals + 16)
+			{
+				//16 byte copies may run past the literals, there is room for that on both sides
+				for (size_t i = 0; i < literals; i += 16)
+					_mm_storeu_si128((__m128i*)(op + i), _mm_loadu_si128((const __m128i*)(ip + i)));
+			}
+			else if (literals)
+				memcpy(op, ip, literals);
+			ip += literals;
+			op += literals;
+			if (ip == iend)
+				break;
+
+			if (iend - ip < 2)
+				throw std::exception("Corrupted OMD data: truncated compressed stream");
+			size_t offset = ip[0] | ((size_t)ip[1] << 8);
+			ip += 2;
+			size_t length = readLength(token & 15) + 4;
+			if (offset == 0 || offset > (size_t)(op - dst) || length > (size_t)(oend - op))
+				throw std::exception("Corrupted OMD data: compressed match out of range");
+			const char* match = op - offset;
+			if (offset >= 16 && (size_t)(oend - op) >= length + 16)
+			{
+				//every 16 byte block is read before it gets overwritten
+				for (size_t i = 0; i < length; i += 16)
+					_mm_storeu_si128((__m128i*)(op + i), _mm_loadu_si128((const __m128i*)(match + i)));
+			}
+			else if ((size_t)(oend - op) >= length + 16)
+			{
+				//the bytes repeat every offset bytes, after the first multiple of it that reaches
+				//16 the copy can go on in 16 byte blocks from that far back
+				size_t period = (16 + offset - 1) / offset * offset;
+				size_t head = (std::min)(length, period);
+				for (size_t i = 0; i < head; i++)
+					op[i] = match[i];
+				for (size_t i = head; i < length; i += 16)
+					_mm_storeu_si128((__m128i*)(op + i), _mm_loadu_si128((const __m128i*)(op + i - period)));
+			}
+			else
+			{
+				for (size_t i = 0; i < length; i++)
+					op[i] = match[i];
+			}
+			op += length;
+		}
+		if (op != oend)
+			throw std::exception("Corrupted OMD data: compressed stream size mismatch");
+	}
+
+#pragma endregion
+
+#pragma region Filters
+
+	/* Prefix sum of the 16 bytes in x continuing from carry, which then holds the last sum in every byte */
+	static inline __m128i PrefixSum16(__m128i x, __m128i& carry)
+	{
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi8(x, carry);
+		__m128i last = _mm_srli_si128(x, 15);
+		last = _mm_unpacklo_epi8(last, last);
+		last = _mm_unpacklo_epi16(last, last);
+		carry = _mm_shuffle_epi32(last, 0);
+		return x;
+	}
+
+	static void SplitBytePlanes(const char* data, size_t size, UINT stride, std::vector<char>& planes)
+	{
+		size_t count = size / stride;
+		planes.resize(size);
+		const unsigned char* src = (const unsigned char*)data;
+		unsigned char* dst = (unsigned char*)planes.data();
+		for (UINT p = 0; p < stride; p++)
+		{
+			unsigned char previous = 0;
+			for (size_t i = 0; i < count; i++)
+			{
+				unsigned char b = src[i * stride + p];
+				dst[p * count + i] = b - previous;
+				previous = b;
+			}
+		}
+		if (size > count * stride)
+			memcpy(dst + count * stride, src + count * stride, size - count * stride);	//incomplete last element
+	}
+
+	/* Four planes at a time are summed and interleaved into 32 bit words with SSE2, 16 elements
+	per step. The elements are merged in blocks that stay in the cache while every plane writes
+	its bytes into them. Planes left over when the stride is not a multiple of 4 and elements
+	after the last 16 are done byte by byte. */
+	static void MergeBytePlanes(const std::vector<char>& planes, UINT stride, char* data)
+	{
+		const size_t BlockSize = 256;
+		size_t count = planes.size() / stride;
+		size_t vectorCount = count / 16 * 16;
+		UINT vectorPlanes = stride / 4 * 4;
+		const unsigned char* src = (const unsigned char*)planes.data();
+		std::vector<__m128i> carry(vectorPlanes, _mm_setzero_si128());
+		std::vector<unsigned char> sum(stride, 0);
+		for (size_t begin = 0; begin < vectorCount; begin += BlockSize)
+		{
+			size_t end = (std::min)(begin + BlockSize, vectorCount);
+			for (UINT p = 0; p < vectorPlanes; p += 4)
+			{
+				const unsigned char* plane = src + p * count;
+				for (size_t i = begin; i < end; i += 16)
+				{
+					__m128i b0 = PrefixSum16(_mm_loadu_si128((const __m128i*)(plane + i)), carry[p]);
+					__m128i b1 = PrefixSum16(_mm_loadu_si128((const __m128i*)(plane + count + i)), carry[p + 1]);
+					__m128i b2 = PrefixSum16(_mm_loadu_si128((const __m128i*)(plane + count * 2 + i)), carry[p + 2]);
+					__m128i b3 = PrefixSum16(_mm_loadu_si128((const __m128i*)(plane + count * 3 + i)), carry[p + 3]);
+					__m128i lo01 = _mm_unpacklo_epi8(b0, b1);
+					__m128i hi01 = _mm_unpackhi_epi8(b0, b1);
+					__m128i lo23 = _mm_unpacklo_epi8(b2, b3);
+					__m128i hi23 = _mm_unpackhi_epi8(b2, b3);
+					__m128i words[4] = {
+						_mm_unpacklo_epi16(lo01, lo23), _mm_unpackhi_epi16(lo01, lo23),
+						_mm_unpacklo_epi16(hi01, hi23), _mm_unpackhi_epi16(hi01, hi23) };
+					char* out = data + i * stride + p;
+					if (stride == 4)
+					{
+						for (UINT w = 0; w < 4; w++)
+							_mm_storeu_si128((__m128i*)(out + w * 16), words[w]);
+						continue;
+					}
+					for (UINT w = 0; w < 4; w++)
+					{
+						for (UINT k = 0; k < 4; k++)
+						{
+							int word = _mm_cvtsi128_si32(words[w]);
+							memcpy(out + (w * 4 + k) * stride, &word, sizeof(word));
+							words[w] = _mm_srli_si128(words[w], 4);
+						}
+					}
+				}
+			}
+			for (UINT p = vectorPlanes; p < stride; p++)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					sum[p] += src[p * count + i];
+					data[i * stride + p] = sum[p];
+				}
+			}
+		}
+		for (UINT p = 0; p < stride; p++)
+		{
+			unsigned char s = p < vectorPlanes ? (unsigned char)_mm_cvtsi128_si32(carry[p]) : sum[p];
+			for (size_t i = vectorCount; i < count; i++)
+			{
+				s += src[p * count + i];
+				data[i * stride + p] = s;
+			}
+		}
+		if (planes.size() > count * stride)
+			memcpy(data + count * stride, src + count * stride, planes.size() - count * stride);
+	}
+
+	/* Triangles mostly reference recently added vertices, so indices are stored as the
+	distance from the next vertex that has not been referenced yet. */
+	static void EncodeIndices(const char* data, size_t size, UINT stride, std::vector<char>& stream)
+	{
+		size_t count = size / stride;
+		stream.reserve(count);
+		UINT next = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			UINT index = 0;
+			memcpy(&index, data + i * stride, stride);
+			int delta = (int)(index - next);
+			UINT zigzag = ((UINT)delta << 1) ^ (UINT)(delta >> 31);
+			while (zigzag >= 0x80)
+			{
+				stream.push_back((char)(zigzag | 0x80));
+				zigzag >>= 7;
+			}
+			stream.push_back((char)zigzag);
+			if (index >= next)
+				next = index + 1;
+		}
+	}
+
+	static void DecodeIndices(const std::vector<char>& stream, UINT stride, char* data, size_t size)
+	{
+		const unsigned char* ip = (const unsigned char*)stream.data();
+		const unsigned char* iend = ip + stream.size();
+		size_t count = size / stride;
+		UINT next = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			UINT zigzag = 0;
+			for (UINT shift = 0;; shift += 7)
+			{
+				if (ip >= iend || shift > 28)
+					throw std::exception("Corrupted OMD data: invalid compressed index");
+				UINT b = *ip++;
+				zigzag |= (b & 0x7f) << shift;
+				if (b < 0x80)
+					break;
+			}
+			UINT index = next + ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+			memcpy(data + i * stride, &index, stride);
+			if (index >= next)
+				next = index + 1;
+		}
+	}
+
+	namespace
+	{
+		const UINT EdgeCacheSize = 16;
+		const UINT VertexCacheSize = 16;
+		const UINT VertexCodeExplicit = 1 + VertexCacheSize;
+		const unsigned char TriangleNoEdge = 0xff;
+
+		/* State shared by the encoder and the decoder of StreamFilter::TRIANGLES */
+		struct TriangleCoder
+		{
+			UINT edges[EdgeCacheSize][2];	//reversed edges of the last triangles
+			UINT vertices[VertexCacheSize];	//vertices coded without a cache hit
+			UINT edgeCount;
+			UINT vertexCount;
+			UINT next;		//next vertex that has not been referenced
+			UINT last;		//last vertex coded
+
+			/* entries counted from the newest one */
+			inline UINT* getEdge(UINT e) { return edges[(edgeCount - 1 - e) % EdgeCacheSize]; }
+			inline UINT getVertex(UINT v) { return vertices[(vertexCount - 1 - v) % VertexCacheSize]; }
+			inline UINT getEdgeCount() { return (std::min)(edgeCount, EdgeCacheSize); }
+			inline UINT getVertexCount() { return (std::min)(vertexCount, VertexCacheSize); }
+
+			void Reference(UINT vertex, bool cacheHit)
+			{
+				if (!cacheHit)
+					vertices[vertexCount++ % VertexCacheSize] = vertex;
+				if (vertex >= next)
+					next = vertex + 1;
+				last = vertex;
+			}
+			void AddTriangle(const UINT t[3])
+			{
+				for (UINT i = 0; i < 3; i++)
+				{
+					UINT* edge = edges[edgeCount++ % EdgeCacheSize];
+					edge[0] = t[(i + 1) % 3];
+					edge[1] = t[i];
+				}
+			}
+		};
+
+		inline void WriteVarint(UINT64 value, std::vector<char>& stream)
+		{
+			for (; value >= 0x80; value >>= 7)
+				stream.push_back((char)(value | 0x80));
+			stream.push_back((char)value);
+		}
+		inline UINT64 ReadVarint(const unsigned char*& ip, const unsigned char* iend)
+		{
+			UINT64 value = 0;
+			for (UINT shift = 0;; shift += 7)
+			{
+				if (ip >= iend || shift > 35)
+					throw std::exception("Corrupted OMD data: invalid compressed index");
+				UINT64 b = *ip++;
+				value |= (b & 0x7f) << shift;
+				if (b < 0x80)
+					return value;
+			}
+		}
+
+		void WriteVertex(TriangleCoder& coder, UINT vertex, std::vector<char>& stream)
+		{
+			UINT64 code = 0;
+			if (vertex != coder.next)
+			{
+				for (UINT v = 0; v < coder.getVertexCount() && code == 0; v++)
+					if (coder.getVertex(v) == vertex)
+						code = 1 + v;
+				if (code == 0)
+				{
+					INT64 delta = (INT64)vertex - (INT64)coder.last;
+					code = VertexCodeExplicit + (((UINT64)delta << 1) ^ (UINT64)(delta >> 63));
+				}
+			}
+			WriteVarint(code, stream);
+			coder.Reference(vertex, code > 0 && code < VertexCodeExplicit);
+		}
+		UINT ReadVertex(TriangleCoder& coder, const unsigned char*& ip, const unsigned char* iend)
+		{
+			UINT64 code = ReadVarint(ip, iend);
+			UINT vertex;
+			if (code == 0)
+				vertex = coder.next;
+			else if (code < VertexCodeExplicit)
+			{
+				if (code > coder.getVertexCount())
+					throw std::exception("Corrupted OMD data: invalid compressed index");
+				vertex = coder.getVertex((UINT)code - 1);
+			}
+			else
+			{
+				UINT64 zigzag = code - VertexCodeExplicit;
+				INT64 value = (INT64)coder.last + ((INT64)(zigzag >> 1) ^ -(INT64)(zigzag & 1));
+				if (value < 0 || value > (INT64)UINT_MAX)
+					throw std::exception("Corrupted OMD data: invalid compressed index");
+				vertex = (UINT)value;
+			}
+			coder.Reference(vertex, code > 0 && code < VertexCodeExplicit);
+			return vertex;
+		}
+	}
+
+	/* Edge cache coding of triangle lists. A triangle that shares an edge with one of the last
+	triangles has it in the opposite direction, so the reversed edges of the last triangles are
+	kept in a FIFO. Each triangle gets a code byte:
+	- below 96 it is (kind * 3 + rotation) * 16 + edge: the triangle starts at its vertex
+	  number rotation with the cached edge, the third vertex is the next unreferenced one for
+	  kind 0, a vertex code follows for kind 1
+	- TriangleNoEdge: three vertex codes follow
+	A vertex code is a varint, 0 for the next unreferenced vertex, 1 + n for entry n of the
+	FIFO of recent vertices, VertexCodeExplicit + the zigzag distance from the last vertex
+	otherwise. Indices after the last whole triangle are stored as vertex codes. */
+	static void EncodeTriangles(const char* data, size_t size, UINT stride, std::vector<char>& stream)
+	{
+		size_t count = size / stride;
+		stream.reserve(count / 2);
+		TriangleCoder coder = {};
+		auto readIndex = [data, stride](size_t i) { UINT index = 0; memcpy(&index, data + i * stride, stride); return index; };
+		size_t i = 0;
+		for (; i + 3 <= count; i += 3)
+		{
+			UINT t[3] = { readIndex(i), readIndex(i + 1), readIndex(i + 2) };
+			UINT code = TriangleNoEdge;
+			for (UINT e = 0; e < coder.getEdgeCount() && code == TriangleNoEdge; e++)
+			{
+				UINT* edge = coder.getEdge(e);
+				for (UINT r = 0; r < 3; r++)
+				{
+					if (t[r] == edge[0] && t[(r + 1) % 3] == edge[1])
+					{
+						UINT third = t[(r + 2) % 3];
+						code = ((third == coder.next ? 0 : 3) + r) * EdgeCacheSize + e;
+						break;
+					}
+				}
+			}
+			stream.push_back((char)code);
+			if (code == TriangleNoEdge)
+			{
+				for (UINT v = 0; v < 3; v++)
+					WriteVertex(coder, t[v], stream);
+			}
+			else
+			{
+				UINT third = t[(code / EdgeCacheSize % 3 + 2) % 3];
+				if (code < 3 * EdgeCacheSize)
+					coder.Reference(third, false);
+				else
+					WriteVertex(coder, third, stream);
+			}
+			coder.AddTriangle(t);
+		}
+		for (; i < count; i++)
+			WriteVertex(coder, readIndex(i), stream);
+	}
+
+	static void DecodeTriangles(const std::vector<char>& stream, UINT stride, char* data, size_t size)
+	{
+		const unsigned char* ip = (const unsigned char*)stream.data();
+		const unsigned char* iend = ip + stream.size();
+		size_t count = size / stride;
+		TriangleCoder coder = {};
+		auto writeIndex = [data, stride](size_t i, UINT index) { memcpy(data + i * stride, &index, stride); };
+		size_t i = 0;
+		for (; i + 3 <= count; i += 3)
+		{
+			if (ip >= iend)
+				throw std::exception("Corrupted OMD data: invalid compressed index");
+			UINT code = *ip++;
+			UINT t[3];
+			if (code == TriangleNoEdge)
+			{
+				for (UINT v = 0; v < 3; v++)
+					t[v] = ReadVertex(coder, ip, iend);
+			}
+			else
+			{
+				UINT e = code % EdgeCacheSize;
+				UINT r = code / EdgeCacheSize % 3;
+				if (code >= 6 * EdgeCacheSize || e >= coder.getEdgeCount())
+					throw std::exception("Corrupted OMD data: invalid compressed index");
+				UINT* edge = coder.getEdge(e);
+				t[r] = edge[0];
+				t[(r + 1) % 3] = edge[1];
+				if (code < 3 * EdgeCacheSize)
+				{
+					t[(r + 2) % 3] = coder.next;
+					coder.Reference(coder.next, false);
+				}
+				else
+					t[(r + 2) % 3] = ReadVertex(coder, ip, iend);
+			}
+			coder.AddTriangle(t);
+			for (UINT v = 0; v < 3; v++)
+				writeIndex(i + v, t[v]);
+		}
+		for (; i < count; i++)
+			writeIndex(i, ReadVertex(coder, ip, iend));
+	}
+
+#pragma endregion
+
+	std::vector<char> CompressStream(const char* data, size_t size, UINT filter, UINT stride)
+	{
+		std::vector<char> filtered;
+		const char* stream = data;
+		size_t streamSize = size;
+		if (filter == StreamFilter::BYTE_PLANES && stride > 1 && stride <= ModelType::VertexSizeInBytes(ModelType::AllPart) && size % stride == 0)
+		{
+			SplitBytePlanes(data, size, stride, filtered);
+			stream = filtered.data();
+		}
+		else if ((filter == StreamFilter::INDICES || filter == StreamFilter::TRIANGLES) && (stride == 2 || stride == 4) && size % stride == 0)
+		{
+			if (filter == StreamFilter::INDICES)
+				EncodeIndices(data, size, stride, filtered);
+			else
+				EncodeTriangles(data, size, stride, filtered);
+			stream = filtered.data();
+			streamSize = filtered.size();
+		}
+		else
+		{
+			filter = StreamFilter::NONE;
+			stride = 1;
+		}
+
+		OMDCompressedHeader header = { filter, stride, size, streamSize };
+		std::vector<char> compressed(sizeof(header));
+		memcpy(compressed.data(), &header, sizeof(header));
+		LZCompress(stream, streamSize, compressed);
+		return compressed;
+	}
+
+	std::vector<char> DecompressStream(const char* data, size_t size)
+	{
+		OMDCompressedHeader header;
+		if (size < sizeof(header))
+			throw std::exception("Corrupted OMD data: truncated compressed stream");
+		memcpy(&header, data, sizeof(header));
+		//a compressed byte expands to at most 255 bytes, an index takes at least one byte
+		UINT64 payloadSize = size - sizeof(header);
+		if (header.filteredSize > payloadSize * 255 + 15)
+			throw std::exception("Corrupted OMD data: invalid compressed stream size");
+		//the planes are sized from the stride, no element is larger than a vertex with every part
+		if (header.stride == 0 || header.stride > ModelType::VertexSizeInBytes(ModelType::AllPart) ||
+			header.decodedSize % header.stride != 0 || (header.decodedSize != 0 && header.stride > header.decodedSize))
+			throw std::exception("Corrupted OMD data: invalid compressed stream stride");
+		switch (header.filter)
+		{
+		case StreamFilter::NONE:
+		case StreamFilter::BYTE_PLANES:
+			if (header.decodedSize != header.filteredSize)
+				throw std::exception("Corrupted OMD data: invalid compressed stream size");
+			break;
+		case StreamFilter::INDICES:
+		case StreamFilter::TRIANGLES:
+			//at least a byte per index, or per triangle for TRIANGLES
+			if ((header.stride != 2 && header.stride != 4) || header.decodedSize % header.stride ||
+				header.decodedSize / header.stride / (header.filter == StreamFilter::TRIANGLES ? 3 : 1) > header.filteredSize)
+				throw std::exception("Corrupted OMD data: invalid compressed stream size");
+			break;
+		default:
+			throw std::exception("Corrupted OMD data: unknown stream filter");
+		}
+
+		std::vector<char> filtered((size_t)header.filteredSize);
+		LZDecompress(data + sizeof(header), (size_t)payloadSize, filtered.data(), filtered.size());
+		if (header.filter == StreamFilter::NONE)
+			return filtered;
+		std::vector<char> decoded((size_t)header.decodedSize);
+		if (header.filter == StreamFilter::BYTE_PLANES)
+			MergeBytePlanes(filtered, header.stride, decoded.data());
+		else if (header.filter == StreamFilter::INDICES)
+			DecodeIndices(filtered, header.stride, decoded.data(), decoded.size());
+		else
+			DecodeTriangles(filtered, header.stride, decoded.data(), decoded.size());
+		return decoded;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "helpers.h"
+
+namespace gfx
+{
+	/* Compressed OMD section payload:
+	OMDCompressedHeader, followed by the filtered stream compressed with the LZ stage.
+	The filter makes the stream easier to compress, decoding gives back the exact bytes
+	the section would store without compression (raw, quantized or 16 bit indices). */
+	namespace StreamFilter
+	{
+		enum Filter :UINT
+		{
+			NONE = 0,
+			BYTE_PLANES = 1,	//byte n of every element goes to plane n, planes are delta coded
+			INDICES = 2,		//zigzag varint distance from the next unused vertex, written by earlier exporters
+			TRIANGLES = 3		//edge cache coded triangle lists, see EncodeTriangles in omdcodec.cpp
+		};
+	}
+
+	struct OMDCompressedHeader
+	{
+		UINT filter;
+		UINT stride;			//element size in bytes dividing decodedSize, 2 or 4 for INDICES and TRIANGLES,
+								//at most the size of a vertex with every part for BYTE_PLANES
+		UINT64 decodedSize;		//bytes after unfiltering
+		UINT64 filteredSize;	//bytes after the LZ stage
+	};
+
+	static_assert(sizeof(OMDCompressedHeader) == 24, "OMDCompressedHeader must be 24 bytes");
+
+	std::vector<char> CompressStream(const char* data, size_t size, UINT filter, UINT stride);
+	/* throws on corrupted data */
+	std::vector<char> DecompressStream(const char* data, size_t size);
+
+	/* LZ77 stage with byte aligned sequences:
+	token (literal length << 4 | match length - 4), extra length bytes while 255,
+	literals, 2 byte offset. The last sequence has no match. */
+	void LZCompress(const char* src, size_t srcSize, std::vector<char>& dst);
+	/* Writes exactly dstSize bytes or throws, the copies use SSE2 */
+	void LZDecompress(const char* src, size_t srcSize, char* dst, size_t dstSize);
+}
\ No newline at end of file
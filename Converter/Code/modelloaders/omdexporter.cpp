@@ -1,14 +1,16 @@
 #include "omdexporter.h"
+#include "vertexlayout.h"
+#include <charconv>
 
 namespace gfx
 {
 
 #pragma region Export binary
 
-	void OMDExporter::ExportOMDBinary(LPCWSTR filename, UINT modelType)
+	OMDHeader OMDExporter::MakeHeader(char fileFormat, UINT modelType)
 	{
 		OMDHeader header;
-		header.fileFormat = 'B';
+		header.fileFormat = fileFormat;
 		header.extension[0] = 'O';
 		header.extension[1] = 'M';
 		header.extension[2] = 'D';
@@ -19,124 +21,392 @@ namespace gfx
 		header.materialCount = (UINT)m_textures.size();
 		header.boundingVolumePrimitive = m_boundingVolumeType;
 		header.hitboxTriangleCount = (UINT)m_hitbox.size();
-		header.boneCount = 0;
-		header.animationCount = 0;
-
+		header.boneCount = (UINT)m_bones.size();
+		header.animationCount = (UINT)m_animations.size();
+		return header;
+	}
+	void OMDExporter::ExportOMDBinary(LPCWSTR filename, UINT modelType, UINT exportFlags, OMDExportReport* report)
+	{
 		std::ofstream outfile(filename, std::ios::out | std::ios::binary);
-		WriteHeaderBinary(outfile, header);
-		WriteVerticesBinary(outfile, header);
-		WriteIndicesBinary(outfile, header);
-		WriteGroupsBinary(outfile, header);
-		WriteMaterialsBinary(outfile, header);
-		WriteHitboxBinary(outfile, header);
-		WriteBonesBinary(outfile, header);
-		WriteAnimationsBinary(outfile, header);
+		if (!outfile.good())
+			throw std::exception(std::string("Failed to create file: " + ToStr(filename)).c_str());
+		ExportOMDBinary(outfile, modelType, exportFlags, report);
 		outfile.close();
 	}
-	void OMDExporter::WriteHeaderBinary(std::ofstream& outfile, OMDHeader& header)
+	void OMDExporter::ExportOMDBinary(std::ostream& outfile, UINT modelType, UINT exportFlags, OMDExportReport* report)
 	{
-		outfile.write((char*)& header, sizeof(header));
+		OMDHeader header = MakeHeader('V', modelType);
+		std::vector<SectionData> sections;
+		if (report)
+			*report = OMDExportReport{};
+		WriteVerticesBinary(sections, header);
+		if (exportFlags & OMDExport::QUANTIZE)
+			QuantizeVerticesBinary(sections, header, report);
+		WriteIndicesBinary(sections, header);
+		WriteGroupsBinary(sections, header);
+		WriteMaterialsBinary(sections, header);
+		WriteHitboxBinary(sections, header);
+		WriteBonesBinary(sections, header);
+		WriteAnimationsBinary(sections, header);
+		WriteMorphsBinary(sections);
+		WriteInstancesBinary(sections);
+
+		auto sectionSize = [&sections](UINT kind) {
+			for (SectionData& section : sections)
+				if (section.entry.kind == kind)
+					return section.entry.size;
+			return (UINT64)0;
+		};
+		if (report)
+		{
+			report->uncompressedVertexBytes = sectionSize(OMDSection::VERTICES);
+			report->uncompressedIndexBytes = sectionSize(OMDSection::INDICES);
+		}
+		if (exportFlags & OMDExport::COMPRESS)
+			CompressSectionsBinary(sections);
+		if (report)
+		{
+			report->vertexBytes = sectionSize(OMDSection::VERTICES);
+			report->indexBytes = sectionSize(OMDSection::INDICES);
+		}
+		WriteSectionsBinary(outfile, header, sections);
+	}
+	void OMDExporter::AddSection(std::vector<SectionData>& sections, UINT kind, const void* data, UINT elementCount, UINT elementSize)
+	{
+		SectionData section;
+		section.entry.kind = kind;
+		section.entry.encoding = 0;
+		section.entry.offset = 0;
+		section.entry.size = (UINT64)elementCount * elementSize;
+		section.entry.elementCount = elementCount;
+		section.entry.elementSize = elementSize;
+		section.data = (const char*)data;
+		sections.push_back(std::move(section));
+	}
+	void OMDExporter::WriteSectionsBinary(std::ostream& outfile, OMDHeader& header, std::vector<SectionData>& sections)
+	{
+		auto align = [](UINT64 offset, UINT64 alignment) { return (offset + alignment - 1) / alignment * alignment; };
+
+		OMDHeaderV2 fileHeader{};
+		fileHeader.header = header;
+		fileHeader.version = OMDSection::Version;
+		fileHeader.sectionCount = (UINT)sections.size();
+		fileHeader.sectionTableOffset = align(sizeof(OMDHeaderV2), OMDSection::TableAlignment);
+		UINT64 offset = fileHeader.sectionTableOffset + sections.size() * sizeof(OMDSectionEntry);
+		for (SectionData& section : sections)
+		{
+			offset = align(offset, OMDSection::SectionAlignment);
+			section.entry.offset = offset;
+			offset += section.entry.size;
+		}
+
+		static const char padding[OMDSection::SectionAlignment] = {};
+		UINT64 position = 0;
+		auto write = [&outfile, &position](const char* data, UINT64 size) {
+			outfile.write(data, (std::streamsize)size);
+			position += size;
+		};
+		write((const char*)&fileHeader, sizeof(fileHeader));
+		write(padding, fileHeader.sectionTableOffset - position);
+		for (SectionData& section : sections)
+			write((const char*)&section.entry, sizeof(OMDSectionEntry));
+		for (SectionData& section : sections)
+		{
+			write(padding, section.entry.offset - position);
+			write(section.getData(), section.entry.size);
+		}
 	}
-	void OMDExporter::WriteVerticesBinary(std::ofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteVerticesBinary(std::vector<SectionData>& sections, OMDHeader& header)
 	{
+		UINT vertexSize = ModelType::VertexSizeInBytes(header.modelType);
 		if (ModelType::VertexLayout(m_modelType) == ModelType::VertexLayout(header.modelType))
-			outfile.write((char*)m_vertices.data(), header.vertexCount * m_vertexSizeInBytes);
-		else
 		{
-			UINT vertexCounter = 0;
-			for (UINT i = 0; i < header.vertexCount; i++)
+			AddSection(sections, OMDSection::VERTICES, m_vertices.data(), header.vertexCount, vertexSize);
+			return;
+		}
+		AddSection(sections, OMDSection::VERTICES, nullptr, header.vertexCount, vertexSize);
+		std::vector<char>& storage = sections.back().storage;
+		storage.resize((size_t)header.vertexCount * vertexSize);
+		TranscodeVertices(m_vertices.data(), m_modelType, (VertexElement*)storage.data(), header.modelType, header.vertexCount);
+	}
+	void OMDExporter::QuantizeVerticesBinary(std::vector<SectionData>& sections, OMDHeader& header, OMDExportReport* report)
+	{
+		SectionData& vertices = sections.back();
+		const VertexElement* src = (const VertexElement*)vertices.getData();
+		std::vector<QuantizationBlock> blocks = MakeQuantizationBlocks(src, header.vertexCount, header.modelType,
+			m_indices.data(), m_groups.data(), header.groupCount);
+		std::vector<char> quantized((size_t)header.vertexCount * QuantizedVertexSizeInBytes(header.modelType));
+		QuantizeVertices(src, header.vertexCount, header.modelType, blocks.data(), (UINT)blocks.size(),
+			quantized.data(), report ? &report->quantizationError : nullptr);
+
+		vertices.storage = std::move(quantized);
+		vertices.entry.encoding = OMDSection::QUANTIZED;
+		vertices.entry.size = vertices.storage.size();	//elementSize stays the decoded vertex size
+		AddSection(sections, OMDSection::QUANTIZATION, nullptr, (UINT)blocks.size(), sizeof(QuantizationBlock));
+		sections.back().storage.assign((const char*)blocks.data(), (const char*)(blocks.data() + blocks.size()));
+	}
+	void OMDExporter::CompressSectionsBinary(std::vector<SectionData>& sections)
+	{
+		for (SectionData& section : sections)
+		{
+			UINT filter;
+			UINT stride;
+			switch (section.entry.kind)
 			{
-				if (ModelType::HasPositions(header.modelType))
-					outfile.write((char*)& m_vertices[vertexCounter], 3 * sizeof(VertexElement));
-				if (ModelType::HasPositions(m_modelType))
-					vertexCounter += 3;
-				if (ModelType::HasTexcoords(header.modelType))
-					outfile.write((char*)& m_vertices[vertexCounter], 2 * sizeof(VertexElement));
-				if (ModelType::HasTexcoords(m_modelType))
-					vertexCounter += 2;
-				if (ModelType::HasNormals(header.modelType))
-					outfile.write((char*)& m_vertices[vertexCounter], 3 * sizeof(VertexElement));
-				if (ModelType::HasNormals(m_modelType))
-					vertexCounter += 3;
-				if (ModelType::HasTangentsBinormals(header.modelType))
-					outfile.write((char*)& m_vertices[vertexCounter], 6 * sizeof(VertexElement));
-				if (ModelType::HasTangentsBinormals(m_modelType))
-					vertexCounter += 6;
-				if (ModelType::HasBones(header.modelType))
-					outfile.write((char*)& m_vertices[vertexCounter], 8 * sizeof(VertexElement));
-				if (ModelType::HasBones(m_modelType))
-					vertexCounter += 8;
+			case OMDSection::VERTICES:
+				filter = StreamFilter::BYTE_PLANES;
+				stride = section.entry.elementCount ? (UINT)(section.entry.size / section.entry.elementCount) : 1;
+				break;
+			case OMDSection::INDICES:
+				filter = StreamFilter::TRIANGLES;
+				stride = (section.entry.encoding & OMDSection::INDEX16) ? sizeof(USHORT) : sizeof(UINT);
+				break;
+			case OMDSection::HITBOX:
+				filter = StreamFilter::BYTE_PLANES;
+				stride = sizeof(float);
+				break;
+			default:
+				continue;
 			}
+			std::vector<char> compressed = CompressStream(section.getData(), (size_t)section.entry.size, filter, stride);
+			if (compressed.size() >= section.entry.size)
+				continue;
+			section.storage = std::move(compressed);
+			section.entry.size = section.storage.size();
+			section.entry.encoding |= OMDSection::COMPRESSED;
 		}
 	}
-	void OMDExporter::WriteIndicesBinary(std::ofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteIndicesBinary(std::vector<SectionData>& sections, OMDHeader& header)
 	{
-		outfile.write((char*)m_indices.data(), sizeof(UINT) * m_indices.size());
+		std::vector<UINT> baseVertices;
+		if (ChooseIndexSize(baseVertices) == sizeof(UINT))
+		{
+			AddSection(sections, OMDSection::INDICES, m_indices.data(), header.indexCount, sizeof(UINT));
+			return;
+		}
+		AddSection(sections, OMDSection::INDICES, nullptr, header.indexCount, sizeof(UINT));
+		SectionData& indices = sections.back();
+		indices.entry.encoding = OMDSection::INDEX16;
+		indices.entry.size = (UINT64)header.indexCount * sizeof(USHORT);
+		indices.storage.resize((size_t)indices.entry.size);
+		CopyIndices16((USHORT*)indices.storage.data(), baseVertices);
+		if (std::any_of(baseVertices.begin(), baseVertices.end(), [](UINT base) { return base != 0; }))
+		{
+			AddSection(sections, OMDSection::BASE_VERTICES, nullptr, header.groupCount, sizeof(UINT));
+			sections.back().storage.assign((const char*)baseVertices.data(), (const char*)(baseVertices.data() + baseVertices.size()));
+		}
 	}
-	void OMDExporter::WriteGroupsBinary(std::ofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteGroupsBinary(std::vector<SectionData>& sections, OMDHeader& header)
 	{
-		outfile.write((char*)m_groups.data(), m_groups.size() * sizeof(VertexGroup));
+		AddSection(sections, OMDSection::GROUPS, m_groups.data(), header.groupCount, sizeof(VertexGroup));
 	}
-	void OMDExporter::WriteMaterialsBinary(std::ofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteMaterialsBinary(std::vector<SectionData>& sections, OMDHeader& header)
 	{
+		AddSection(sections, OMDSection::MATERIALS, nullptr, header.materialCount, 0);
+		std::vector<char>& storage = sections.back().storage;
+		auto append = [&storage](const std::wstring& str) {
+			const char* data = (const char*)str.c_str();
+			storage.insert(storage.end(), data, data + (str.length() + 1) * sizeof(WCHAR));
+		};
 		for (UINT i = 0; i < header.materialCount; i++)
 		{
-			WCHAR nul = 0;
-			if (ModelType::HasTexture(header.modelType))
-				outfile.write((char*)m_textures[i].filename.c_str(), (m_textures[i].filename.length() + 1) * sizeof(WCHAR));
-			else
-				outfile.write((char*)& nul, sizeof(WCHAR));
-			if (ModelType::HasNormalmap(header.modelType))
-				outfile.write((char*)m_normalmaps[i].filename.c_str(), (m_normalmaps[i].filename.length() + 1) * sizeof(WCHAR));
-			else
-				outfile.write((char*)& nul, sizeof(WCHAR));
+			append(ModelType::HasTexture(header.modelType) ? m_textures[i].filename : std::wstring());
+			append(ModelType::HasNormalmap(header.modelType) ? m_normalmaps[i].filename : std::wstring());
 		}
+		sections.back().entry.size = storage.size();
 	}
-	void OMDExporter::WriteHitboxBinary(std::ofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteHitboxBinary(std::vector<SectionData>& sections, OMDHeader& header)
 	{
-		switch (header.boundingVolumePrimitive)
+		if (header.boundingVolumePrimitive == mth::BoundingVolume::CUBOID ||
+			header.boundingVolumePrimitive == mth::BoundingVolume::SPHERE)
 		{
-		case mth::BoundingVolume::CUBOID:
-			outfile.write((char*)& m_bvPosition, sizeof(m_bvPosition));
-			outfile.write((char*)& m_bvCuboidSize, sizeof(m_bvCuboidSize));
-			break;
-		case mth::BoundingVolume::SPHERE:
-			outfile.write((char*)& m_bvPosition, sizeof(m_bvPosition));
-			outfile.write((char*)& m_bvSphereRadius, sizeof(m_bvSphereRadius));
-			break;
+			OMDBoundingVolumeV2 bv;
+			bv.position = m_bvPosition;
+			bv.cuboidSize = m_bvCuboidSize;
+			bv.sphereRadius = m_bvSphereRadius;
+			AddSection(sections, OMDSection::BOUNDING_VOLUME, nullptr, 1, sizeof(bv));
+			sections.back().storage.assign((const char*)&bv, (const char*)&bv + sizeof(bv));
 		}
+		else
+			header.boundingVolumePrimitive = mth::BoundingVolume::NO_TYPE;
 		if (header.hitboxTriangleCount)
-			outfile.write((char*)m_hitbox.data(), header.hitboxTriangleCount * sizeof(mth::Triangle));
+			AddSection(sections, OMDSection::HITBOX, m_hitbox.data(), header.hitboxTriangleCount, sizeof(mth::Triangle));
 	}
-	void OMDExporter::WriteBonesBinary(std::ofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteBonesBinary(std::vector<SectionData>& sections, OMDHeader& header)
 	{
+		if (header.boneCount == 0)
+			return;
+		AddSection(sections, OMDSection::BONES, nullptr, header.boneCount, sizeof(OMDBone));
+		std::vector<char>& storage = sections.back().storage;
+		storage.resize((size_t)header.boneCount * sizeof(OMDBone));
+		for (UINT i = 0; i < header.boneCount; i++)
+		{
+			Bone& src = m_bones[i];
+			OMDBone bone{};
+			bone.parent = src.parent;
+			bone.nameOffset = (UINT)storage.size();
+			bone.nameLength = (UINT)src.name.length();
+			bone.translation = src.translation;
+			bone.rotation = src.rotation;
+			bone.scale = src.scale;
+			memcpy(storage.data() + (size_t)i * sizeof(OMDBone), &bone, sizeof(OMDBone));
+			storage.insert(storage.end(), (const char*)src.name.data(), (const char*)(src.name.data() + src.name.length()));
+		}
+		sections.back().entry.size = storage.size();
+
+		std::vector<OMDBoneOffset> offsets;
+		for (UINT i = 0; i < header.boneCount; i++)
+			if (m_bones[i].hasOffset)
+				offsets.push_back({ i, m_bones[i].offset });
+		if (offsets.empty())
+			return;
+		AddSection(sections, OMDSection::BONE_OFFSETS, nullptr, (UINT)offsets.size(), sizeof(OMDBoneOffset));
+		sections.back().storage.assign((const char*)offsets.data(), (const char*)(offsets.data() + offsets.size()));
 	}
-	void OMDExporter::WriteAnimationsBinary(std::ofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteAnimationsBinary(std::vector<SectionData>& sections, OMDHeader& header)
 	{
+		if (header.animationCount == 0)
+			return;
+		AddSection(sections, OMDSection::ANIMATIONS, nullptr, header.animationCount, sizeof(OMDAnimation));
+		std::vector<char>& storage = sections.back().storage;
+		storage.resize((size_t)header.animationCount * sizeof(OMDAnimation));
+		auto append = [&storage](const void* data, size_t size) {
+			UINT64 offset = storage.size();
+			storage.insert(storage.end(), (const char*)data, (const char*)data + size);
+			storage.resize((storage.size() + 3) & ~(size_t)3);	//channels stay 4 byte aligned
+			return offset;
+		};
+		for (UINT i = 0; i < header.animationCount; i++)
+		{
+			Animation& src = m_animations[i];
+			OMDAnimation animation{};
+			animation.duration = src.getDuration();
+			animation.channelCount = src.getChannelCount();
+			animation.nameLength = (UINT)src.getName().length();
+			animation.channelOffset = append(src.getChannels().data(), src.getChannels().size() * sizeof(AnimationChannelHeader));
+			animation.keyDataOffset = append(src.getKeyData().data(), src.getKeyData().size());
+			animation.keyDataSize = src.getKeyData().size();
+			animation.nameOffset = append(src.getName().data(), src.getName().length() * sizeof(WCHAR));
+			memcpy(storage.data() + (size_t)i * sizeof(OMDAnimation), &animation, sizeof(OMDAnimation));
+		}
+		sections.back().entry.size = storage.size();
+	}
+	void OMDExporter::WriteMorphsBinary(std::vector<SectionData>& sections)
+	{
+		if (m_morphs.empty())
+			return;
+		AddSection(sections, OMDSection::MORPHS, nullptr, (UINT)m_morphs.size(), sizeof(OMDMorph));
+		std::vector<char>& storage = sections.back().storage;
+		storage.resize(m_morphs.size() * sizeof(OMDMorph));
+		auto append = [&storage](const void* data, size_t size) {
+			UINT64 offset = storage.size();
+			storage.insert(storage.end(), (const char*)data, (const char*)data + size);
+			storage.resize((storage.size() + 3) & ~(size_t)3);
+			return offset;
+		};
+		for (size_t i = 0; i < m_morphs.size(); i++)
+		{
+			Morph& src = m_morphs[i];
+			OMDMorph morph{};
+			morph.deltaCount = (UINT)src.deltas.size();
+			morph.boneDeltaCount = (UINT)src.boneDeltas.size();
+			morph.nameLength = (UINT)src.name.length();
+			morph.deltaOffset = append(src.deltas.data(), src.deltas.size() * sizeof(MorphDelta));
+			morph.boneDeltaOffset = append(src.boneDeltas.data(), src.boneDeltas.size() * sizeof(MorphBoneDelta));
+			morph.nameOffset = append(src.name.data(), src.name.length() * sizeof(WCHAR));
+			memcpy(storage.data() + i * sizeof(OMDMorph), &morph, sizeof(OMDMorph));
+		}
+		sections.back().entry.size = storage.size();
+	}
+	void OMDExporter::WriteInstancesBinary(std::vector<SectionData>& sections)
+	{
+		if (m_instances.empty())
+			return;
+		AddSection(sections, OMDSection::INSTANCES, m_instances.data(), (UINT)m_instances.size(), sizeof(MeshInstance));
 	}
 
 #pragma endregion
 
 #pragma region Export text
 
+	/* Text output is formatted into narrow char buffers, floats in their shortest form that
+	still reads back to the same bits. Large sections are formatted in parallel chunks. */
+	const size_t MaxNumberLength = 16;	//longest float or UINT from to_chars, with the separator
+
+	static inline char* WriteNumber(char* p, float value)
+	{
+		p = std::to_chars(p, p + MaxNumberLength - 1, value).ptr;
+		*p++ = ' ';
+		return p;
+	}
+	static inline char* WriteNumber(char* p, UINT value)
+	{
+		p = std::to_chars(p, p + MaxNumberLength - 1, value).ptr;
+		*p++ = ' ';
+		return p;
+	}
+	static void AppendLine(std::string& text, const char* label, UINT value)
+	{
+		text += label;
+		text += std::to_string(value);
+		text += '\n';
+	}
+	static void AppendLine(std::string& text, const char* label, int value)
+	{
+		text += label;
+		text += std::to_string(value);
+		text += '\n';
+	}
+	static void AppendNumbers(std::string& text, const float* values, UINT count)
+	{
+		char buffer[MaxNumberLength * 16];
+		char* p = buffer;
+		for (UINT i = 0; i < count; i++)
+			p = WriteNumber(p, values[i]);
+		*p++ = '\n';
+		text.append(buffer, p);
+	}
+	static void AppendNumbers(std::string& text, const USHORT* values, size_t count)
+	{
+		size_t start = text.size();
+		text.resize(start + count * MaxNumberLength + 1);
+		char* begin = &text[start];
+		char* p = begin;
+		for (size_t i = 0; i < count; i++)
+			p = WriteNumber(p, (UINT)values[i]);
+		*p++ = '\n';
+		text.resize(start + (p - begin));
+	}
+
+	/* format(p, i) writes element i to p and returns the end, at most maxElementLength bytes */
+	template <typename Format>
+	static void WriteChunksText(std::ostream& outfile, UINT count, size_t maxElementLength, Format format)
+	{
+		const UINT ChunkSize = 8192;
+		UINT chunkCount = (count + ChunkSize - 1) / ChunkSize;
+		std::vector<std::string> chunks(chunkCount);
+		ParallelFor(chunkCount, [&](UINT chunk) {
+			UINT begin = chunk * ChunkSize;
+			UINT end = (std::min)(begin + ChunkSize, count);
+			std::string& text = chunks[chunk];
+			text.resize((end - begin) * maxElementLength);
+			char* start = &text[0];
+			char* p = start;
+			for (UINT i = begin; i < end; i++)
+				p = format(p, i);
+			text.resize(p - start);
+		});
+		for (std::string& text : chunks)
+			outfile.write(text.data(), text.size());
+	}
+
 	void OMDExporter::ExportOMDText(LPCWSTR filename, UINT modelType)
 	{
-		OMDHeader header;
-		header.fileFormat = 'T';
-		header.extension[0] = 'O';
-		header.extension[1] = 'M';
-		header.extension[2] = 'D';
-		header.modelType = ModelType::RemoveUnnecessary(m_modelType & modelType);
-		header.vertexCount = (UINT)m_vertices.size() / (m_vertexSizeInBytes / sizeof(VertexElement));
-		header.indexCount = (UINT)m_indices.size();
-		header.groupCount = (UINT)m_groups.size();
-		header.materialCount = (UINT)m_textures.size();
-		header.boundingVolumePrimitive = m_boundingVolumeType;
-		header.hitboxTriangleCount = (UINT)m_hitbox.size();
-		header.boneCount = 0;
-		header.animationCount = 0;
+		OMDHeader header = MakeHeader('T', modelType);
 
-		std::wofstream outfile(filename, std::ios::out);
+		std::ofstream outfile(filename, std::ios::out | std::ios::binary);
+		if (!outfile.good())
+			throw std::exception(std::string("Failed to create file: " + ToStr(filename)).c_str());
 		WriteHeaderText(outfile, header);
 		WriteVerticesText(outfile, header);
 		WriteIndicesText(outfile, header);
@@ -145,170 +415,273 @@ namespace gfx
 		WriteHitboxText(outfile, header);
 		WriteBonesText(outfile, header);
 		WriteAnimationsText(outfile, header);
+		WriteMorphsText(outfile);
+		WriteInstancesText(outfile);
+		WriteBoneOffsetsText(outfile);
 		outfile.close();
 	}
-	void OMDExporter::WriteHeaderText(std::wofstream& outfile, OMDHeader& header)
-	{
-		outfile << header.fileFormat;
-		outfile << header.extension[0];
-		outfile << header.extension[1];
-		outfile << header.extension[2];
-		outfile << std::endl;
-		outfile << L"Model type: " << header.modelType << std::endl;
-		outfile << L"Vertex count: " << header.vertexCount << std::endl;
-		outfile << L"Index count: " << header.indexCount << std::endl;
-		outfile << L"Group count: " << header.groupCount << std::endl;
-		outfile << L"Material count: " << header.materialCount << std::endl;
-		outfile << L"Bounding volume primitive: " << header.boundingVolumePrimitive << std::endl;
-		outfile << L"Hitbox triangle count: " << header.hitboxTriangleCount << std::endl;
-		outfile << L"Bone count: " << header.boneCount << std::endl;
-		outfile << L"Animation count: " << header.animationCount << std::endl;
-	}
-	void OMDExporter::WriteVerticesText(std::wofstream& outfile, OMDHeader& header)
-	{
-		outfile << std::endl << L"Vertices:" << std::endl;
-		UINT vertexCounter = 0;
-		for (UINT i = 0; i < header.vertexCount; i++)
-		{
-			if (ModelType::HasPositions(header.modelType))
-			{
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-			}
-			else if (ModelType::HasPositions(m_modelType))
-				vertexCounter += 3;
-			if (ModelType::HasTexcoords(header.modelType))
-			{
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-			}
-			else if (ModelType::HasTexcoords(m_modelType))
-				vertexCounter += 2;
-			if (ModelType::HasNormals(header.modelType))
-			{
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-			}
-			else if (ModelType::HasNormals(m_modelType))
-				vertexCounter += 3;
-			if (ModelType::HasTangentsBinormals(header.modelType))
-			{
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-			}
-			else if (ModelType::HasTangentsBinormals(m_modelType))
-				vertexCounter += 6;
-			if (ModelType::HasBones(header.modelType))
+	void OMDExporter::WriteHeaderText(std::ostream& outfile, OMDHeader& header)
+	{
+		std::string text;
+		text += header.fileFormat;
+		text.append(header.extension, 3);
+		text += '\n';
+		AppendLine(text, "Model type: ", header.modelType);
+		AppendLine(text, "Vertex count: ", header.vertexCount);
+		AppendLine(text, "Index count: ", header.indexCount);
+		AppendLine(text, "Group count: ", header.groupCount);
+		AppendLine(text, "Material count: ", header.materialCount);
+		AppendLine(text, "Bounding volume primitive: ", header.boundingVolumePrimitive);
+		AppendLine(text, "Hitbox triangle count: ", header.hitboxTriangleCount);
+		AppendLine(text, "Bone count: ", header.boneCount);
+		AppendLine(text, "Animation count: ", header.animationCount);
+		outfile.write(text.data(), text.size());
+	}
+	void OMDExporter::WriteVerticesText(std::ostream& outfile, OMDHeader& header)
+	{
+		outfile << "\nVertices:\n";
+		const VertexElement* vertices = m_vertices.data();
+		UINT vertexSize = getVertexSizeInFloats();
+		UINT exportType = header.modelType;
+		UINT positionOffset = ModelType::PositionOffset(m_modelType);
+		UINT texcoordOffset = ModelType::TexCoordOffset(m_modelType);
+		UINT normalOffset = ModelType::NormalOffset(m_modelType);
+		UINT tangentOffset = ModelType::TangentOffset(m_modelType);	//binormal follows the tangent
+		UINT boneWeightsOffset = ModelType::BoneWeightsOffset(m_modelType);
+		UINT boneIndexOffset = ModelType::BoneIndexOffset(m_modelType);
+		auto format = [=](char* p, UINT i) {
+			const VertexElement* v = vertices + (size_t)i * vertexSize;
+			if (ModelType::HasPositions(exportType))
+				for (UINT c = 0; c < 3; c++)
+					p = WriteNumber(p, v[positionOffset + c].f);
+			if (ModelType::HasTexcoords(exportType))
+				for (UINT c = 0; c < 2; c++)
+					p = WriteNumber(p, v[texcoordOffset + c].f);
+			if (ModelType::HasNormals(exportType))
+				for (UINT c = 0; c < 3; c++)
+					p = WriteNumber(p, v[normalOffset + c].f);
+			if (ModelType::HasTangentsBinormals(exportType))
+				for (UINT c = 0; c < 6; c++)
+					p = WriteNumber(p, v[tangentOffset + c].f);
+			if (ModelType::HasBones(exportType))
 			{
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].f << ' ';
-				outfile << m_vertices[vertexCounter++].u << ' ';
-				outfile << m_vertices[vertexCounter++].u << ' ';
-				outfile << m_vertices[vertexCounter++].u << ' ';
-				outfile << m_vertices[vertexCounter++].u << ' ';
+				for (UINT c = 0; c < 4; c++)
+					p = WriteNumber(p, v[boneWeightsOffset + c].f);
+				for (UINT c = 0; c < 4; c++)
+					p = WriteNumber(p, v[boneIndexOffset + c].u);
 			}
-			else if (ModelType::HasBones(m_modelType))
-				vertexCounter += 8;
-			outfile << std::endl;
-		}
+			*p++ = '\n';
+			return p;
+		};
+		WriteChunksText(outfile, header.vertexCount, vertexSize * MaxNumberLength + 1, format);
 	}
-	void OMDExporter::WriteIndicesText(std::wofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteIndicesText(std::ostream& outfile, OMDHeader& header)
 	{
-		outfile << std::endl << L"Indices:" << std::endl;
-		for (UINT i = 0; i < header.indexCount; i++)
-			outfile << m_indices[i] << ' ';
-		outfile << std::endl;
+		outfile << "\nIndices:\n";
+		const UINT* indices = m_indices.data();
+		WriteChunksText(outfile, header.indexCount, MaxNumberLength, [indices](char* p, UINT i) { return WriteNumber(p, indices[i]); });
+		outfile << '\n';
 	}
-	void OMDExporter::WriteGroupsText(std::wofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteGroupsText(std::ostream& outfile, OMDHeader& header)
 	{
-		outfile << std::endl << L"Groups:" << std::endl;
+		std::string text = "\nGroups:\n";
 		for (UINT i = 0; i < header.groupCount; i++)
 		{
-			outfile << L"New group" << std::endl;
-			outfile << L"\tStart index: " << m_groups[i].startIndex << std::endl;
-			outfile << L"\tIndex count: " << m_groups[i].indexCount << std::endl;
-			outfile << L"\tMaterial index: " << m_groups[i].materialIndex << std::endl;
+			text += "New group\n";
+			AppendLine(text, "\tStart index: ", m_groups[i].startIndex);
+			AppendLine(text, "\tIndex count: ", m_groups[i].indexCount);
+			AppendLine(text, "\tMaterial index: ", m_groups[i].materialIndex);
 		}
+		outfile.write(text.data(), text.size());
 	}
-	void OMDExporter::WriteMaterialsText(std::wofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteMaterialsText(std::ostream& outfile, OMDHeader& header)
 	{
-		outfile << std::endl << L"Materials:" << std::endl;
+		std::string text = "\nMaterials:\n";
 		for (UINT i = 0; i < header.materialCount; i++)
 		{
-			outfile << L"New material" << std::endl;
-			outfile << L"\tTexture name: ";
+			text += "New material\n";
+			text += "\tTexture name: ";
 			if (ModelType::HasTexture(header.modelType))
-				outfile << m_textures[i].filename;
-			outfile << std::endl;
-			outfile << L"\tNormalmap name: ";
+				text += ToUtf8(m_textures[i].filename.c_str());
+			text += '\n';
+			text += "\tNormalmap name: ";
 			if (ModelType::HasNormalmap(header.modelType))
-				outfile << m_normalmaps[i].filename;
-			outfile << std::endl;
+				text += ToUtf8(m_normalmaps[i].filename.c_str());
+			text += '\n';
 		}
+		outfile.write(text.data(), text.size());
 	}
-	void OMDExporter::WriteHitboxText(std::wofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteHitboxText(std::ostream& outfile, OMDHeader& header)
 	{
-		outfile << std::endl << L"Bounding volume:" << std::endl;
+		std::string text = "\nBounding volume:\n";
 		switch (header.boundingVolumePrimitive)
 		{
 		case mth::BoundingVolume::CUBOID:
-			outfile << m_bvPosition.x << ' ';
-			outfile << m_bvPosition.y << ' ';
-			outfile << m_bvPosition.z << ' ';
-			outfile << m_bvCuboidSize.x << ' ';
-			outfile << m_bvCuboidSize.y << ' ';
-			outfile << m_bvCuboidSize.z << ' ';
-			outfile << std::endl;
+		{
+			float values[] = { m_bvPosition.x, m_bvPosition.y, m_bvPosition.z, m_bvCuboidSize.x, m_bvCuboidSize.y, m_bvCuboidSize.z };
+			AppendNumbers(text, values, 6);
 			break;
+		}
 		case mth::BoundingVolume::SPHERE:
-			outfile << m_bvPosition.x << ' ';
-			outfile << m_bvPosition.y << ' ';
-			outfile << m_bvPosition.z << ' ';
-			outfile << m_bvSphereRadius << ' ';
-			outfile << std::endl;
+		{
+			float values[] = { m_bvPosition.x, m_bvPosition.y, m_bvPosition.z, m_bvSphereRadius };
+			AppendNumbers(text, values, 4);
 			break;
+		}
 		default:
 			header.boundingVolumePrimitive = mth::BoundingVolume::NO_TYPE;
 			break;
 		}
+		text += "Hitbox:\n";
+		outfile.write(text.data(), text.size());
 
-		outfile << L"Hitbox:" << std::endl;
-		if (header.hitboxTriangleCount)
+		mth::Triangle* hitbox = m_hitbox.data();
+		auto format = [hitbox](char* p, UINT i) {
+			mth::Triangle& tri = hitbox[i];
+			for (int v = 0; v < 3; v++)
+			{
+				p = WriteNumber(p, tri.getVertex(v).x);
+				p = WriteNumber(p, tri.getVertex(v).y);
+				p = WriteNumber(p, tri.getVertex(v).z);
+			}
+			p = WriteNumber(p, tri.getPlainNormal().x);
+			p = WriteNumber(p, tri.getPlainNormal().y);
+			p = WriteNumber(p, tri.getPlainNormal().z);
+			p = WriteNumber(p, tri.getPlainDistance());
+			*p++ = '\n';
+			return p;
+		};
+		WriteChunksText(outfile, header.hitboxTriangleCount, 13 * MaxNumberLength + 1, format);
+	}
+	void OMDExporter::WriteBonesText(std::ostream& outfile, OMDHeader& header)
+	{
+		std::string text = "\nBones:\n";
+		for (UINT i = 0; i < header.boneCount; i++)
 		{
-			for (UINT i = 0; i < header.hitboxTriangleCount; i++)
+			Bone& bone = m_bones[i];
+			text += "New bone\n";
+			text += "\tName: ";
+			text += ToUtf8(bone.name.c_str());
+			text += '\n';
+			AppendLine(text, "\tParent: ", bone.parent);
+			text += "\tTransform: ";
+			float values[] = { bone.translation.x, bone.translation.y, bone.translation.z,
+				bone.rotation.x, bone.rotation.y, bone.rotation.z, bone.rotation.w,
+				bone.scale.x, bone.scale.y, bone.scale.z };
+			AppendNumbers(text, values, 10);
+		}
+		outfile.write(text.data(), text.size());
+	}
+	void OMDExporter::WriteAnimationsText(std::ostream& outfile, OMDHeader& header)
+	{
+		outfile << "\nAnimations:\n";
+		for (UINT i = 0; i < header.animationCount; i++)
+		{
+			Animation& animation = m_animations[i];
+			std::string text = "New animation\n";
+			text += "\tName: ";
+			text += ToUtf8(animation.getName().c_str());
+			text += '\n';
+			text += "\tDuration: ";
+			float duration = animation.getDuration();
+			AppendNumbers(text, &duration, 1);
+			AppendLine(text, "\tChannel count: ", animation.getChannelCount());
+			for (AnimationChannelHeader& channel : animation.getChannels())
+			{
+				//bone, kind, key count, range, then the quantized key times and values
+				text += "\tChannel: ";
+				UINT counts[] = { channel.bone, channel.kind, channel.keyCount };
+				for (UINT value : counts)
+				{
+					text += std::to_string(value);
+					text += ' ';
+				}
+				float range[] = { channel.rangeMin[0], channel.rangeMin[1], channel.rangeMin[2],
+					channel.rangeExtent[0], channel.rangeExtent[1], channel.rangeExtent[2] };
+				AppendNumbers(text, range, 6);
+				AppendNumbers(text, (const USHORT*)(animation.getKeyData().data() + channel.dataOffset),
+					(size_t)channel.keyCount * AnimationChannel::KeySize / sizeof(USHORT));
+			}
+			outfile.write(text.data(), text.size());
+		}
+	}
+	void OMDExporter::WriteMorphsText(std::ostream& outfile)
+	{
+		if (m_morphs.empty())
+			return;
+		std::string text;
+		AppendLine(text, "\nMorphs: ", (UINT)m_morphs.size());
+		for (Morph& morph : m_morphs)
+		{
+			//vertex, position, normal and texcoord delta per line, then bone, translation and rotation
+			text += "New morph\n";
+			text += "\tName: ";
+			text += ToUtf8(morph.name.c_str());
+			text += '\n';
+			AppendLine(text, "\tDeltas: ", (UINT)morph.deltas.size());
+			for (MorphDelta& delta : morph.deltas)
+			{
+				text += std::to_string(delta.vertex);
+				text += ' ';
+				float values[] = { delta.position.x, delta.position.y, delta.position.z,
+					delta.normal.x, delta.normal.y, delta.normal.z, delta.texcoord.x, delta.texcoord.y };
+				AppendNumbers(text, values, 8);
+			}
+			AppendLine(text, "\tBone deltas: ", (UINT)morph.boneDeltas.size());
+			for (MorphBoneDelta& delta : morph.boneDeltas)
 			{
-				outfile << m_hitbox[i].getVertex(0).x << ' ';
-				outfile << m_hitbox[i].getVertex(0).y << ' ';
-				outfile << m_hitbox[i].getVertex(0).z << ' ';
-				outfile << m_hitbox[i].getVertex(1).x << ' ';
-				outfile << m_hitbox[i].getVertex(1).y << ' ';
-				outfile << m_hitbox[i].getVertex(1).z << ' ';
-				outfile << m_hitbox[i].getVertex(2).x << ' ';
-				outfile << m_hitbox[i].getVertex(2).y << ' ';
-				outfile << m_hitbox[i].getVertex(2).z << ' ';
-				outfile << m_hitbox[i].getPlainNormal().x << ' ';
-				outfile << m_hitbox[i].getPlainNormal().y << ' ';
-				outfile << m_hitbox[i].getPlainNormal().z << ' ';
-				outfile << m_hitbox[i].getPlainDistance() << ' ';
-				outfile << std::endl;
+				text += std::to_string(delta.bone);
+				text += ' ';
+				float values[] = { delta.translation.x, delta.translation.y, delta.translation.z,
+					delta.rotation.x, delta.rotation.y, delta.rotation.z, delta.rotation.w };
+				AppendNumbers(text, values, 7);
 			}
 		}
+		outfile.write(text.data(), text.size());
 	}
-	void OMDExporter::WriteBonesText(std::wofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteInstancesText(std::ostream& outfile)
 	{
-		outfile << std::endl << L"Bones:" << std::endl;
+		if (m_instances.empty())
+			return;
+		std::string text;
+		AppendLine(text, "\nInstances: ", (UINT)m_instances.size());
+		for (MeshInstance& instance : m_instances)
+		{
+			//group, then the transform row by row
+			text += std::to_string(instance.group);
+			text += ' ';
+			float values[16];
+			for (int row = 0; row < 4; row++)
+				for (int column = 0; column < 4; column++)
+					values[row * 4 + column] = instance.transform(row, column);
+			AppendNumbers(text, values, 16);
+		}
+		outfile.write(text.data(), text.size());
 	}
-	void OMDExporter::WriteAnimationsText(std::wofstream& outfile, OMDHeader& header)
+	void OMDExporter::WriteBoneOffsetsText(std::ostream& outfile)
 	{
-		outfile << std::endl << L"Animations:" << std::endl;
+		std::string text;
+		UINT offsetCount = 0;
+		for (UINT i = 0; i < (UINT)m_bones.size(); i++)
+		{
+			if (!m_bones[i].hasOffset)
+				continue;
+			//bone, then the offset matrix row by row
+			text += std::to_string(i);
+			text += ' ';
+			float values[16];
+			for (int row = 0; row < 4; row++)
+				for (int column = 0; column < 4; column++)
+					values[row * 4 + column] = m_bones[i].offset(row, column);
+			AppendNumbers(text, values, 16);
+			offsetCount++;
+		}
+		if (offsetCount == 0)
+			return;
+		std::string label;
+		AppendLine(label, "\nBone offsets: ", offsetCount);
+		outfile.write(label.data(), label.size());
+		outfile.write(text.data(), text.size());
 	}
 
 #pragma endregion
@@ -6,26 +6,46 @@ namespace gfx
 {
 	class OMDExporter :public ModelLoader
 	{
-		void WriteHeaderBinary(std::ofstream& outfile, OMDHeader& header);
-		void WriteVerticesBinary(std::ofstream& outfile, OMDHeader& header);
-		void WriteIndicesBinary(std::ofstream& outfile, OMDHeader& header);
-		void WriteGroupsBinary(std::ofstream& outfile, OMDHeader& header);
-		void WriteMaterialsBinary(std::ofstream& outfile, OMDHeader& header);
-		void WriteHitboxBinary(std::ofstream& outfile, OMDHeader& header);
-		void WriteBonesBinary(std::ofstream& outfile, OMDHeader& header);
-		void WriteAnimationsBinary(std::ofstream& outfile, OMDHeader& header);
+		struct SectionData
+		{
+			OMDSectionEntry entry;
+			const char* data;	//points to model data, or to storage when the section had to be built
+			std::vector<char> storage;
 
-		void WriteHeaderText(std::wofstream& outfile, OMDHeader& header);
-		void WriteVerticesText(std::wofstream& outfile, OMDHeader& header);
-		void WriteIndicesText(std::wofstream& outfile, OMDHeader& header);
-		void WriteGroupsText(std::wofstream& outfile, OMDHeader& header);
-		void WriteMaterialsText(std::wofstream& outfile, OMDHeader& header);
-		void WriteHitboxText(std::wofstream& outfile, OMDHeader& header);
-		void WriteBonesText(std::wofstream& outfile, OMDHeader& header);
-		void WriteAnimationsText(std::wofstream& outfile, OMDHeader& header);
+			inline const char* getData() { return storage.empty() ? data : storage.data(); }
+		};
+
+		OMDHeader MakeHeader(char fileFormat, UINT modelType);
+		void AddSection(std::vector<SectionData>& sections, UINT kind, const void* data, UINT elementCount, UINT elementSize);
+		void WriteSectionsBinary(std::ostream& outfile, OMDHeader& header, std::vector<SectionData>& sections);
+
+		void WriteVerticesBinary(std::vector<SectionData>& sections, OMDHeader& header);
+		void QuantizeVerticesBinary(std::vector<SectionData>& sections, OMDHeader& header, OMDExportReport* report);
+		void CompressSectionsBinary(std::vector<SectionData>& sections);
+		void WriteIndicesBinary(std::vector<SectionData>& sections, OMDHeader& header);
+		void WriteGroupsBinary(std::vector<SectionData>& sections, OMDHeader& header);
+		void WriteMaterialsBinary(std::vector<SectionData>& sections, OMDHeader& header);
+		void WriteHitboxBinary(std::vector<SectionData>& sections, OMDHeader& header);
+		void WriteBonesBinary(std::vector<SectionData>& sections, OMDHeader& header);
+		void WriteAnimationsBinary(std::vector<SectionData>& sections, OMDHeader& header);
+		void WriteMorphsBinary(std::vector<SectionData>& sections);
+		void WriteInstancesBinary(std::vector<SectionData>& sections);
+
+		void WriteHeaderText(std::ostream& outfile, OMDHeader& header);
+		void WriteVerticesText(std::ostream& outfile, OMDHeader& header);
+		void WriteIndicesText(std::ostream& outfile, OMDHeader& header);
+		void WriteGroupsText(std::ostream& outfile, OMDHeader& header);
+		void WriteMaterialsText(std::ostream& outfile, OMDHeader& header);
+		void WriteHitboxText(std::ostream& outfile, OMDHeader& header);
+		void WriteBonesText(std::ostream& outfile, OMDHeader& header);
+		void WriteAnimationsText(std::ostream& outfile, OMDHeader& header);
+		void WriteMorphsText(std::ostream& outfile);
+		void WriteInstancesText(std::ostream& outfile);
+		void WriteBoneOffsetsText(std::ostream& outfile);
 
 	public:
-		void ExportOMDBinary(LPCWSTR filename, UINT modelType);
+		void ExportOMDBinary(LPCWSTR filename, UINT modelType, UINT exportFlags = 0, OMDExportReport* report = nullptr);
+		void ExportOMDBinary(std::ostream& outfile, UINT modelType, UINT exportFlags = 0, OMDExportReport* report = nullptr);
 		void ExportOMDText(LPCWSTR filename, UINT modelType);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "omdhandle.h"
+
+namespace gfx
+{
+	OMDHandle::OMDHandle() :
+		m_modelType(0),
+		m_header(),
+		m_bvSphereRadius(0.0f),
+		m_residentParts(0) {}
+	OMDHandle::OMDHandle(LPCWSTR filename, UINT modelType) :
+		m_modelType(0),
+		m_header(),
+		m_bvSphereRadius(0.0f),
+		m_residentParts(0)
+	{
+		Open(filename, modelType);
+	}
+
+	void OMDHandle::Open(LPCWSTR filename, UINT modelType)
+	{
+		Close();
+		m_file.Open(filename);
+		try
+		{
+			const char* data = m_file.getData();
+			if (m_file.getSize() < 1 || data[0] == 't' || data[0] == 'T')
+				throw std::exception(std::string("OMD streaming needs a binary file: " + ToStr(filename)).c_str());
+			OMDView view(data, m_file.getSize());
+			m_header = view.getHeader();
+			m_bvPosition = view.getBoundingVolumePosition();
+			m_bvCuboidSize = view.getBoundingVolumeCuboidSize();
+			m_bvSphereRadius = view.getBoundingVolumeSphereRadius();
+		}
+		catch (...)
+		{
+			Close();
+			throw;
+		}
+		m_modelType = modelType;
+		std::wstring path = filename;
+		size_t lastSlash = path.find_last_of(L"/\\");
+		m_folder = lastSlash == std::wstring::npos ? std::wstring() : path.substr(0, lastSlash + 1);
+	}
+
+	void OMDHandle::Close()
+	{
+		m_file.Close();
+		m_folder.clear();
+		m_modelType = 0;
+		m_header = OMDHeader();
+		m_bvPosition = mth::float3();
+		m_bvCuboidSize = mth::float3();
+		m_bvSphereRadius = 0.0f;
+		m_residentParts = 0;
+		m_model.Clear();
+	}
+
+	void OMDHandle::Fetch(UINT parts)
+	{
+		parts &= OMDPart::ALL & ~m_residentParts;
+		if (parts == 0)
+			return;
+		if (!isOpen())
+			throw std::exception("OMD handle is not open");
+		//a new view for every fetch, so decoded compressed sections are freed after they are copied
+		OMDView view(m_file.getData(), m_file.getSize());
+		try
+		{
+			((OMDLoader*)&m_model)->LoadOMDSections(view, m_modelType, parts);
+		}
+		catch (...)
+		{
+			((OMDLoader*)&m_model)->ReleaseSections(parts);
+			throw;
+		}
+		m_residentParts |= parts;
+	}
+
+	void OMDHandle::Release(UINT parts)
+	{
+		parts &= m_residentParts;
+		((OMDLoader*)&m_model)->ReleaseSections(parts);
+		m_residentParts &= ~parts;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "omdloader.h"
+
+namespace gfx
+{
+	/* Streaming access to a binary OMD. Open reads only the header and the bounding volume,
+	the other sections are read when they are fetched and can be released again, so many
+	models can stay open while only the needed ones hold their data in memory.
+	The file stays mapped, its pages are read from disk when a fetch touches them. */
+	class OMDHandle
+	{
+		SMART_PTR(OMDHandle)
+		NO_COPY(OMDHandle)
+
+	private:
+		MappedFile m_file;
+		std::wstring m_folder;
+		UINT m_modelType;
+		OMDHeader m_header;
+		mth::float3 m_bvPosition;
+		mth::float3 m_bvCuboidSize;
+		float m_bvSphereRadius;
+		UINT m_residentParts;
+		ModelLoader m_model;
+
+	public:
+		OMDHandle();
+		OMDHandle(LPCWSTR filename, UINT modelType = ModelType::AllPart);
+
+		void Open(LPCWSTR filename, UINT modelType = ModelType::AllPart);
+		void Close();
+
+		/* Loads the OMDPart sections that are not resident yet */
+		void Fetch(UINT parts);
+		void Release(UINT parts);
+
+		inline bool isOpen() { return m_file.isOpen(); }
+		inline bool isResident(UINT parts) { return (m_residentParts & parts) == parts; }
+		inline UINT getResidentParts() { return m_residentParts; }
+		inline std::wstring& getFolderName() { return m_folder; }
+		inline OMDHeader& getHeader() { return m_header; }
+		inline UINT getModelType() { return ModelType::RemoveUnnecessary(m_header.modelType & m_modelType); }
+		inline UINT getVertexCount() { return m_header.vertexCount; }
+		inline UINT getIndexCount() { return m_header.indexCount; }
+		inline UINT getVertexGroupCount() { return m_header.groupCount; }
+		inline UINT getBoundingVolumeType() { return m_header.boundingVolumePrimitive; }
+		inline mth::float3 getBoundingVolumePosition() { return m_bvPosition; }
+		inline mth::float3 getBoundingVolumeCuboidSize() { return m_bvCuboidSize; }
+		inline float getBoundingVolumeSphereRadius() { return m_bvSphereRadius; }
+		/* holds the resident sections, the others are empty */
+		inline ModelLoader& getModel() { return m_model; }
+	};
+}
\ No newline at end of file
@@ -1,419 +1,1116 @@
 #include "omdloader.h"
+#include "vertexlayout.h"
+#include <charconv>
 
 namespace gfx
 {
+	OMDView::OMDView() :
+		m_data(nullptr),
+		m_size(0),
+		m_header(),
+		m_version(0),
+		m_bvSphereRadius(0.0f) {}
+	OMDView::OMDView(const char* data, size_t size) :OMDView()
+	{
+		Open(data, size);
+	}
+
+	void OMDView::Open(const char* data, size_t size)
+	{
+		m_data = data;
+		m_size = size;
+		m_sections.clear();
+		m_sectionData.clear();
+		m_decodedSections.clear();
+		if (size < sizeof(OMDHeader))
+			throw std::exception("Corrupted OMD data: file is smaller than the header");
+		memcpy(&m_header, data, sizeof(OMDHeader));
+		if ((m_header.extension[0] != 'o' && m_header.extension[0] != 'O') ||
+			(m_header.extension[1] != 'm' && m_header.extension[1] != 'M') ||
+			(m_header.extension[2] != 'd' && m_header.extension[2] != 'D'))
+			throw std::exception("Corrupted OMD data: not an OMD file");
+		if (m_header.fileFormat == 'b' || m_header.fileFormat == 'B')
+			ParseVersion1();
+		else if (m_header.fileFormat == 'v' || m_header.fileFormat == 'V')
+			ParseVersion2();
+		else
+			throw std::exception("Corrupted OMD data: not a binary OMD");
+		ParseMaterials();
+		ParseBoundingVolume();
+	}
+
+	void OMDView::ParseVersion1()
+	{
+		m_version = 1;
+		//sizes are summed in 64 bits, so corrupted counts cannot wrap around
+		UINT64 offset = sizeof(OMDHeader);
+		auto addSection = [this, &offset](UINT kind, UINT64 elementSize, UINT elementCount) {
+			OMDSectionEntry section{ kind, 0, offset, elementSize * elementCount, elementCount, (UINT)elementSize };
+			offset += section.size;
+			if (offset > m_size)
+				throw std::exception("Corrupted OMD data: header counts exceed the file size");
+			m_sections.push_back(section);
+		};
+		addSection(OMDSection::VERTICES, ModelType::VertexSizeInBytes(m_header.modelType), m_header.vertexCount);
+		addSection(OMDSection::INDICES, sizeof(UINT), m_header.indexCount);
+		addSection(OMDSection::GROUPS, sizeof(VertexGroup), m_header.groupCount);
+
+		UINT64 materialOffset = offset;
+		const UINT64 nameCount = (UINT64)m_header.materialCount * 2;	//a texture and a normalmap name each
+		if (nameCount * sizeof(WCHAR) > m_size - offset)
+			throw std::exception("Corrupted OMD data: header counts exceed the file size");
+		for (UINT64 i = 0; i < nameCount; i++)
+		{
+			do
+			{
+				if (offset + sizeof(WCHAR) > m_size)
+					throw std::exception("Corrupted OMD data: unterminated material name");
+				offset += sizeof(WCHAR);
+			} while (*(const WCHAR*)(m_data + offset - sizeof(WCHAR)));
+		}
+		m_sections.push_back({ OMDSection::MATERIALS, 0, materialOffset, offset - materialOffset, m_header.materialCount, 0 });
+
+		switch (m_header.boundingVolumePrimitive)
+		{
+		case mth::BoundingVolume::CUBOID:
+			addSection(OMDSection::BOUNDING_VOLUME, sizeof(mth::float3) + sizeof(mth::float3), 1);
+			break;
+		case mth::BoundingVolume::SPHERE:
+			addSection(OMDSection::BOUNDING_VOLUME, sizeof(mth::float3) + sizeof(float), 1);
+			break;
+		default:
+			m_header.boundingVolumePrimitive = mth::BoundingVolume::NO_TYPE;
+			break;
+		}
+		addSection(OMDSection::HITBOX, sizeof(mth::Triangle), m_header.hitboxTriangleCount);
+		m_header.boneCount = 0;	//version 1 has no skeleton
+		m_header.animationCount = 0;
+		for (OMDSectionEntry& section : m_sections)
+			m_sectionData.push_back(m_data + section.offset);
+	}
+
+	void OMDView::ParseVersion2()
+	{
+		OMDHeaderV2 header;
+		if (m_size < sizeof(header))
+			throw std::exception("Corrupted OMD data: file is smaller than the header");
+		memcpy(&header, m_data, sizeof(header));
+		if (header.version != OMDSection::Version)
+			throw std::exception("Unsupported OMD version");
+		m_version = header.version;
+		if (header.sectionTableOffset > m_size ||
+			(UINT64)header.sectionCount * sizeof(OMDSectionEntry) > m_size - header.sectionTableOffset)
+			throw std::exception("Corrupted OMD data: section table exceeds the file size");
+		m_sections.resize(header.sectionCount);
+		memcpy(m_sections.data(), m_data + header.sectionTableOffset, header.sectionCount * sizeof(OMDSectionEntry));
+		for (OMDSectionEntry& section : m_sections)
+		{
+			if (section.offset > m_size || section.size > m_size - section.offset)
+				throw std::exception("Corrupted OMD data: section exceeds the file size");
+			//the sections are handed out as typed pointers, every element type is made of 4 byte fields
+			if (section.offset % sizeof(UINT) != 0)
+				throw std::exception("Corrupted OMD data: section is not aligned");
+			//compressed sections are decoded and checked when they are first accessed
+			if (section.encoding & OMDSection::COMPRESSED)
+				m_sectionData.push_back(nullptr);
+			else
+			{
+				if (section.size < getStoredElementSize(section) * section.elementCount)
+					throw std::exception("Corrupted OMD data: section is too small");
+				m_sectionData.push_back(m_data + section.offset);
+			}
+		}
+
+		auto checkSection = [this](UINT kind, UINT64 elementSize, UINT elementCount) {
+			const OMDSectionEntry* section = FindSection(kind);
+			if (elementCount == 0)
+				return;
+			if (section == nullptr || section->elementCount != elementCount || section->elementSize != elementSize)
+				throw std::exception("Corrupted OMD data: section does not match the header");
+			if (getStoredElementSize(*section) == 0)
+				throw std::exception("Corrupted OMD data: unknown section encoding");
+		};
+		checkSection(OMDSection::VERTICES, ModelType::VertexSizeInBytes(m_header.modelType), m_header.vertexCount);
+		checkSection(OMDSection::INDICES, sizeof(UINT), m_header.indexCount);
+		checkSection(OMDSection::GROUPS, sizeof(VertexGroup), m_header.groupCount);
+		checkSection(OMDSection::HITBOX, sizeof(mth::Triangle), m_header.hitboxTriangleCount);
+		checkSection(OMDSection::BONES, sizeof(OMDBone), m_header.boneCount);
+		checkSection(OMDSection::ANIMATIONS, sizeof(OMDAnimation), m_header.animationCount);
+		if (m_header.boundingVolumePrimitive != mth::BoundingVolume::CUBOID &&
+			m_header.boundingVolumePrimitive != mth::BoundingVolume::SPHERE)
+			m_header.boundingVolumePrimitive = mth::BoundingVolume::NO_TYPE;
+		else
+			checkSection(OMDSection::BOUNDING_VOLUME, sizeof(OMDBoundingVolumeV2), 1);
+
+		const OMDSectionEntry* baseVertices = FindSection(OMDSection::BASE_VERTICES);
+		if (baseVertices && (baseVertices->elementCount != m_header.groupCount || baseVertices->elementSize != sizeof(UINT)))
+			throw std::exception("Corrupted OMD data: section does not match the header");
+
+		if (isQuantized())
+		{
+			//blocks have to cover the vertices in order, the decoder walks them sequentially
+			const OMDSectionEntry* section = FindSection(OMDSection::QUANTIZATION);
+			if (section == nullptr || section->elementSize != sizeof(QuantizationBlock))
+				throw std::exception("Corrupted OMD data: missing quantization blocks");
+			const QuantizationBlock* blocks = getQuantizationBlocks();
+			UINT64 next = 0;
+			for (UINT i = 0; i < section->elementCount; i++)
+			{
+				if (blocks[i].firstVertex != next)
+					throw std::exception("Corrupted OMD data: invalid quantization blocks");
+				next += blocks[i].vertexCount;
+			}
+			if (next != m_header.vertexCount)
+				throw std::exception("Corrupted OMD data: invalid quantization blocks");
+		}
+	}
+
+	void OMDView::ParseMaterials()
+	{
+		const OMDSectionEntry* section = FindSection(OMDSection::MATERIALS);
+		//checked before allocating, every material has two names of at least their terminating zero
+		UINT64 sectionSize = section ? section->size : 0;
+		if ((UINT64)m_header.materialCount * 2 * sizeof(WCHAR) > sectionSize)
+			throw std::exception("Corrupted OMD data: material count exceeds the material section");
+		m_textureNames.assign(m_header.materialCount, L"");
+		m_normalmapNames.assign(m_header.materialCount, L"");
+		if (section == nullptr)
+			return;
+		const char* data = getSectionData(*section);
+		UINT64 offset = 0;
+		for (UINT i = 0; i < m_header.materialCount; i++)
+		{
+			for (UINT n = 0; n < 2; n++)
+			{
+				const WCHAR* str = (const WCHAR*)(data + offset);
+				do
+				{
+					if (offset + sizeof(WCHAR) > section->size)
+						throw std::exception("Corrupted OMD data: unterminated material name");
+					offset += sizeof(WCHAR);
+				} while (*(const WCHAR*)(data + offset - sizeof(WCHAR)));
+				(n == 0 ? m_textureNames : m_normalmapNames)[i] = str;
+			}
+		}
+	}
+
+	void OMDView::ParseBoundingVolume()
+	{
+		const OMDSectionEntry* section = FindSection(OMDSection::BOUNDING_VOLUME);
+		if (section == nullptr || m_header.boundingVolumePrimitive == mth::BoundingVolume::NO_TYPE)
+			return;
+		const char* data = getSectionData(*section);
+		if (m_version == 1)
+		{
+			memcpy(&m_bvPosition, data, sizeof(m_bvPosition));
+			if (m_header.boundingVolumePrimitive == mth::BoundingVolume::CUBOID)
+				memcpy(&m_bvCuboidSize, data + sizeof(m_bvPosition), sizeof(m_bvCuboidSize));
+			else
+				memcpy(&m_bvSphereRadius, data + sizeof(m_bvPosition), sizeof(m_bvSphereRadius));
+		}
+		else
+		{
+			OMDBoundingVolumeV2 bv;
+			memcpy(&bv, data, sizeof(bv));
+			m_bvPosition = bv.position;
+			m_bvCuboidSize = bv.cuboidSize;
+			m_bvSphereRadius = bv.sphereRadius;
+		}
+	}
+
+	const OMDSectionEntry* OMDView::FindSection(UINT kind)
+	{
+		for (OMDSectionEntry& section : m_sections)
+			if (section.kind == kind)
+				return &section;
+		return nullptr;
+	}
+
+	UINT64 OMDView::getStoredElementSize(const OMDSectionEntry& section)
+	{
+		UINT encoding = section.encoding & ~OMDSection::COMPRESSED;
+		if (encoding == OMDSection::RAW)
+			return section.elementSize;
+		if (section.kind == OMDSection::VERTICES && encoding == OMDSection::QUANTIZED)
+			return QuantizedVertexSizeInBytes(m_header.modelType);
+		if (section.kind == OMDSection::INDICES && encoding == OMDSection::INDEX16)
+			return sizeof(USHORT);
+		return 0;
+	}
+
+	const char* OMDView::getSectionData(const OMDSectionEntry& section)
+	{
+		size_t index = &section - m_sections.data();
+		if (m_sectionData[index] == nullptr)
+		{
+			OMDSectionEntry& entry = m_sections[index];
+			std::vector<char> decoded = DecompressStream(m_data + entry.offset, (size_t)entry.size);
+			entry.encoding &= ~OMDSection::COMPRESSED;
+			entry.size = decoded.size();
+			if (entry.size < getStoredElementSize(entry) * entry.elementCount)
+				throw std::exception("Corrupted OMD data: section is too small");
+			m_decodedSections.push_back(std::move(decoded));
+			m_sectionData[index] = entry.size ? m_decodedSections.back().data() : m_data;
+		}
+		return m_sectionData[index];
+	}
+
+	const char* OMDView::getRawSection(UINT kind, UINT elementCount)
+	{
+		const OMDSectionEntry* section = FindSection(kind);
+		if (section == nullptr || elementCount == 0)
+			return nullptr;
+		const char* data = getSectionData(*section);
+		return section->encoding == OMDSection::RAW ? data : nullptr;
+	}
+
+	const char* OMDView::getQuantizedVertices()
+	{
+		const OMDSectionEntry* section = FindSection(OMDSection::VERTICES);
+		if (section == nullptr || !(section->encoding & OMDSection::QUANTIZED))
+			return nullptr;
+		return getSectionData(*section);
+	}
+
+	const USHORT* OMDView::getIndices16()
+	{
+		const OMDSectionEntry* section = FindSection(OMDSection::INDICES);
+		if (section == nullptr || !(section->encoding & OMDSection::INDEX16))
+			return nullptr;
+		return (const USHORT*)getSectionData(*section);
+	}
+
+	const UINT* OMDView::getBaseVertices()
+	{
+		const OMDSectionEntry* section = FindSection(OMDSection::BASE_VERTICES);
+		return section ? (const UINT*)getSectionData(*section) : nullptr;
+	}
+
+	const QuantizationBlock* OMDView::getQuantizationBlocks()
+	{
+		const OMDSectionEntry* section = FindSection(OMDSection::QUANTIZATION);
+		return section ? (const QuantizationBlock*)getSectionData(*section) : nullptr;
+	}
+
+	UINT OMDView::getQuantizationBlockCount()
+	{
+		const OMDSectionEntry* section = FindSection(OMDSection::QUANTIZATION);
+		return section ? section->elementCount : 0;
+	}
+
 	void OMDLoader::LoadOMD(LPCWSTR filename, UINT modelType)
 	{
-		std::ifstream infile(filename, std::ios::in | std::ios::binary);
-		if (!infile.good())
-			throw std::exception(std::string("Failed to load file: " + ToStr(filename)).c_str());
-		char filedata[4];
-		infile.read(filedata, sizeof(filedata));
-		infile.close();
-		if ((filedata[1] != 'o' && filedata[1] != 'O') ||
-			(filedata[2] != 'm' && filedata[2] != 'M') ||
-			(filedata[3] != 'd' && filedata[3] != 'D'))
+		MappedFile file(filename);
+		if (!IsOMD(file.getData(), file.getSize()))
 			throw std::exception(std::string("Corrupted file: " + ToStr(filename)).c_str());
-		if (filedata[0] == 't' || filedata[0] == 'T')
-			LoadOMDText(filename, modelType);
-		else if (filedata[0] == 'b' || filedata[0] == 'B')
-			LoadOMDBinary(filename, modelType);
+		LoadOMD(file.getData(), file.getSize(), modelType);
+	}
+	void OMDLoader::LoadOMD(const char* data, size_t size, UINT modelType)
+	{
+		if (!IsOMD(data, size))
+			throw std::exception("Corrupted OMD data: unknown file format");
+		if (data[0] == 't' || data[0] == 'T')
+			LoadOMDText(data, size, modelType);
 		else
-			throw std::exception(std::string("Corrupted file: " + ToStr(filename)).c_str());
+		{
+			OMDView view(data, size);
+			LoadOMDBinary(view, modelType);
+		}
+	}
+	bool OMDLoader::IsOMD(const char* data, size_t size)
+	{
+		return size >= 4 &&
+			(data[0] == 't' || data[0] == 'T' || data[0] == 'b' || data[0] == 'B' || data[0] == 'v' || data[0] == 'V') &&
+			(data[1] == 'o' || data[1] == 'O') &&
+			(data[2] == 'm' || data[2] == 'M') &&
+			(data[3] == 'd' || data[3] == 'D');
 	}
 
 #pragma region Load binary
 
 	void OMDLoader::LoadOMDBinary(LPCWSTR filename, UINT modelType)
 	{
-		std::ifstream infile(filename, std::ios::in | std::ios::binary);
-		OMDHeader header;
-		ReadHeaderBinary(infile, header, modelType);
-		ReadVerticesBinary(infile, header);
-		ReadIndicesBinary(infile, header);
-		ReadGroupsBinary(infile, header);
-		ReadMaterialsBinary(infile, header);
-		ReadHitboxBinary(infile, header);
-		ReadBonesBinary(infile, header);
-		ReadAnimationsBinary(infile, header);
-	}
-	void OMDLoader::ReadHeaderBinary(std::ifstream& infile, OMDHeader& header, UINT modelType)
-	{
-		infile.read((char*)& header, sizeof(header));
-		m_modelType = ModelType::RemoveUnnecessary(header.modelType & modelType);
-		m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
-		m_boundingVolumeType = header.boundingVolumePrimitive;
+		MappedFile file(filename);
+		OMDView view(file.getData(), file.getSize());
+		LoadOMDBinary(view, modelType);
 	}
-	void OMDLoader::ReadVerticesBinary(std::ifstream& infile, OMDHeader& header)
+	void OMDLoader::LoadOMDBinary(OMDView& view, UINT modelType)
 	{
-		m_vertices.resize(header.vertexCount * m_vertexSizeInBytes / sizeof(VertexElement));
-		if (ModelType::VertexLayout(m_modelType) == ModelType::VertexLayout(header.modelType))
-			infile.read((char*)m_vertices.data(), header.vertexCount * m_vertexSizeInBytes);
-		else
+		void (OMDLoader::*sections[])(OMDView&) = {
+			&OMDLoader::ReadVerticesBinary, &OMDLoader::ReadIndicesBinary, &OMDLoader::ReadGroupsBinary,
+			&OMDLoader::ReadMaterialsBinary, &OMDLoader::ReadHitboxBinary, &OMDLoader::ReadBonesBinary,
+			&OMDLoader::ReadAnimationsBinary, &OMDLoader::ReadMorphsBinary, &OMDLoader::ReadInstancesBinary };
+		BeginProgress(LoadStage::SECTIONS, sizeof(sections) / sizeof(sections[0]));
+		ReadHeaderBinary(view, modelType);
+		for (auto read : sections)
 		{
-			VertexElement tmp[8];
-			UINT vertexCounter = 0;
-			for (UINT i = 0; i < header.vertexCount; i++)
+			(this->*read)(view);
+			AdvanceProgress(1);
+		}
+	}
+	void OMDLoader::LoadOMDSections(OMDView& view, UINT modelType, UINT parts)
+	{
+		ReadHeaderBinary(view, modelType);
+		if (parts & OMDPart::VERTICES)
+			ReadVerticesBinary(view);
+		if (parts & OMDPart::INDICES)
+			ReadIndicesBinary(view);
+		if (parts & OMDPart::GROUPS)
+		{
+			ReadGroupsBinary(view);
+			for (UINT g = 0; g < (UINT)m_groups.size(); g++)
+				m_groups[g].materialIndex = g;
+		}
+		if (parts & OMDPart::MATERIALS)
+		{
+			ReadMaterialsBinary(view);
+			OMDHeader& header = view.getHeader();
+			const VertexGroup* groups = view.getGroups();
+			std::vector<TextureToLoad> textures, normalmaps;
+			for (UINT g = 0; g < header.groupCount; g++)
 			{
-				if (ModelType::HasPositions(header.modelType))
-				{
-					infile.read((char*)tmp, 3 * sizeof(VertexElement));
-					if (ModelType::HasPositions(m_modelType))
-					{
-						m_vertices[vertexCounter++] = tmp[0];
-						m_vertices[vertexCounter++] = tmp[1];
-						m_vertices[vertexCounter++] = tmp[2];
-					}
-				}
-				if (ModelType::HasTexcoords(header.modelType))
-				{
-					infile.read((char*)tmp, 2 * sizeof(VertexElement));
-					if (ModelType::HasTexcoords(m_modelType))
-					{
-						m_vertices[vertexCounter++] = tmp[0];
-						m_vertices[vertexCounter++] = tmp[1];
-					}
-				}
-				if (ModelType::HasNormals(header.modelType))
-				{
-					infile.read((char*)tmp, 3 * sizeof(VertexElement));
-					if (ModelType::HasNormals(m_modelType))
-					{
-						m_vertices[vertexCounter++] = tmp[0];
-						m_vertices[vertexCounter++] = tmp[1];
-						m_vertices[vertexCounter++] = tmp[2];
-					}
-				}
-				if (ModelType::HasTangentsBinormals(header.modelType))
-				{
-					infile.read((char*)tmp, 6 * sizeof(VertexElement));
-					if (ModelType::HasTangentsBinormals(m_modelType))
-					{
-						m_vertices[vertexCounter++] = tmp[0];
-						m_vertices[vertexCounter++] = tmp[1];
-						m_vertices[vertexCounter++] = tmp[2];
-						m_vertices[vertexCounter++] = tmp[3];
-						m_vertices[vertexCounter++] = tmp[4];
-						m_vertices[vertexCounter++] = tmp[5];
-					}
-				}
-				if (ModelType::HasBones(header.modelType))
-				{
-					infile.read((char*)tmp, 8 * sizeof(VertexElement));
-					if (ModelType::HasBones(m_modelType))
-					{
-						m_vertices[vertexCounter++] = tmp[0];
-						m_vertices[vertexCounter++] = tmp[1];
-						m_vertices[vertexCounter++] = tmp[2];
-						m_vertices[vertexCounter++] = tmp[3];
-						m_vertices[vertexCounter++] = tmp[4];
-						m_vertices[vertexCounter++] = tmp[5];
-						m_vertices[vertexCounter++] = tmp[6];
-						m_vertices[vertexCounter++] = tmp[7];
-					}
-				}
+				if (groups[g].materialIndex >= header.materialCount)
+					throw std::exception("Corrupted OMD data: group references a missing material");
+				textures.push_back(m_textures[groups[g].materialIndex]);
+				normalmaps.push_back(m_normalmaps[groups[g].materialIndex]);
 			}
+			m_textures.swap(textures);
+			m_normalmaps.swap(normalmaps);
 		}
+		if (parts & OMDPart::HITBOX)
+			ReadHitboxBinary(view);
+		if (parts & OMDPart::BONES)
+			ReadBonesBinary(view);
+		if (parts & OMDPart::ANIMATIONS)
+			ReadAnimationsBinary(view);
+		if (parts & OMDPart::MORPHS)
+			ReadMorphsBinary(view);
+		if (parts & OMDPart::INSTANCES)
+			ReadInstancesBinary(view);
 	}
-	void OMDLoader::ReadIndicesBinary(std::ifstream& infile, OMDHeader& header)
+	void OMDLoader::ReleaseSections(UINT parts)
 	{
-		m_indices.resize(header.indexCount);
-		infile.read((char*)m_indices.data(), header.indexCount * sizeof(UINT));
+		if (parts & OMDPart::VERTICES)
+			std::vector<VertexElement>().swap(m_vertices);
+		if (parts & OMDPart::INDICES)
+			std::vector<UINT>().swap(m_indices);
+		if (parts & OMDPart::GROUPS)
+			std::vector<VertexGroup>().swap(m_groups);
+		if (parts & OMDPart::MATERIALS)
+		{
+			std::vector<TextureToLoad>().swap(m_textures);
+			std::vector<TextureToLoad>().swap(m_normalmaps);
+		}
+		if (parts & OMDPart::HITBOX)
+			std::vector<mth::Triangle>().swap(m_hitbox);
+		if (parts & OMDPart::BONES)
+			std::vector<Bone>().swap(m_bones);
+		if (parts & OMDPart::ANIMATIONS)
+			std::vector<Animation>().swap(m_animations);
+		if (parts & OMDPart::MORPHS)
+			std::vector<Morph>().swap(m_morphs);
+		if (parts & OMDPart::INSTANCES)
+			std::vector<MeshInstance>().swap(m_instances);
 	}
-	void OMDLoader::ReadGroupsBinary(std::ifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadHeaderBinary(OMDView& view, UINT modelType)
 	{
-		m_groups.resize(header.groupCount);
-		infile.read((char*)m_groups.data(), header.groupCount * sizeof(VertexGroup));
+		OMDHeader& header = view.getHeader();
+		m_modelType = ModelType::RemoveUnnecessary(header.modelType & modelType);
+		m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
+		m_boundingVolumeType = header.boundingVolumePrimitive;
+		m_bvPosition = view.getBoundingVolumePosition();
+		m_bvCuboidSize = view.getBoundingVolumeCuboidSize();
+		m_bvSphereRadius = view.getBoundingVolumeSphereRadius();
 	}
-	void OMDLoader::ReadMaterialsBinary(std::ifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadVerticesBinary(OMDView& view)
 	{
-		WCHAR ch;
+		OMDHeader& header = view.getHeader();
+		m_vertices.resize((size_t)header.vertexCount * getVertexSizeInFloats());
+		if (view.isQuantized())
+			DequantizeVertices(view.getQuantizedVertices(), header.vertexCount, header.modelType,
+				view.getQuantizationBlocks(), view.getQuantizationBlockCount(), m_vertices.data(), m_modelType);
+		else
+			TranscodeVertices(view.getVertices(), header.modelType, m_vertices.data(), m_modelType, header.vertexCount);
+	}
+	void OMDLoader::ReadIndicesBinary(OMDView& view)
+	{
+		OMDHeader& header = view.getHeader();
+		if (!view.isIndex16())
+		{
+			m_indices.assign(view.getIndices(), view.getIndices() + header.indexCount);
+			return;
+		}
+		const USHORT* indices = view.getIndices16();
+		m_indices.assign(indices, indices + header.indexCount);
+		const UINT* baseVertices = view.getBaseVertices();
+		const VertexGroup* groups = view.getGroups();
+		if (baseVertices == nullptr || groups == nullptr)
+			return;
+		for (UINT g = 0; g < header.groupCount; g++)
+		{
+			if (groups[g].startIndex > header.indexCount || groups[g].indexCount > header.indexCount - groups[g].startIndex)
+				throw std::exception("Corrupted OMD data: group exceeds the index count");
+			for (UINT i = groups[g].startIndex; i < groups[g].startIndex + groups[g].indexCount; i++)
+				m_indices[i] += baseVertices[g];
+		}
+	}
+	void OMDLoader::ReadGroupsBinary(OMDView& view)
+	{
+		OMDHeader& header = view.getHeader();
+		m_groups.assign(view.getGroups(), view.getGroups() + header.groupCount);
+	}
+	void OMDLoader::ReadMaterialsBinary(OMDView& view)
+	{
+		OMDHeader& header = view.getHeader();
 		m_textures.resize(header.materialCount);
 		m_normalmaps.resize(header.materialCount);
 		for (UINT i = 0; i < header.materialCount; i++)
 		{
-			infile.read((char*)& ch, sizeof(WCHAR));
-			while (ch)
-			{
-				if (ModelType::HasTexture(m_modelType))
-					m_textures[i].filename += ch;
-				infile.read((char*)& ch, sizeof(WCHAR));
-			}
-			infile.read((char*)& ch, sizeof(WCHAR));
-			while (ch)
-			{
-				if (ModelType::HasNormalmap(m_modelType))
-					m_normalmaps[i].filename += ch;
-				infile.read((char*)& ch, sizeof(WCHAR));
-			}
+			if (ModelType::HasTexture(m_modelType))
+				m_textures[i].filename = view.getTextureName(i);
+			if (ModelType::HasNormalmap(m_modelType))
+				m_normalmaps[i].filename = view.getNormalmapName(i);
 		}
 	}
-	void OMDLoader::ReadHitboxBinary(std::ifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadHitboxBinary(OMDView& view)
 	{
-		switch (header.boundingVolumePrimitive)
-		{
-		case mth::BoundingVolume::CUBOID:
-			infile.read((char*)& m_bvPosition, sizeof(m_bvPosition));
-			infile.read((char*)& m_bvCuboidSize, sizeof(m_bvCuboidSize));
-			break;
-		case mth::BoundingVolume::SPHERE:
-			infile.read((char*)& m_bvPosition, sizeof(m_bvPosition));
-			infile.read((char*)& m_bvSphereRadius, sizeof(m_bvSphereRadius));
-			break;
-		default:
-			header.boundingVolumePrimitive = mth::BoundingVolume::NO_TYPE;
-			break;
-		}
+		OMDHeader& header = view.getHeader();
 		if (header.hitboxTriangleCount)
 		{
 			m_hitbox.resize(header.hitboxTriangleCount);
-			infile.read((char*)m_hitbox.data(), header.hitboxTriangleCount * sizeof(mth::Triangle));
+			memcpy(m_hitbox.data(), view.getHitbox(), header.hitboxTriangleCount * sizeof(mth::Triangle));
+		}
+	}
+	void OMDLoader::ReadBonesBinary(OMDView& view)
+	{
+		OMDHeader& header = view.getHeader();
+		m_bones.assign(header.boneCount, Bone());
+		if (header.boneCount == 0)
+			return;
+		const OMDSectionEntry* section = view.FindSection(OMDSection::BONES);
+		const char* data = view.getSectionData(*section);
+		for (UINT i = 0; i < header.boneCount; i++)
+		{
+			OMDBone bone;
+			memcpy(&bone, data + (size_t)i * sizeof(OMDBone), sizeof(OMDBone));
+			if (bone.parent < -1 || bone.parent >= (int)i)
+				throw std::exception("Corrupted OMD data: bone parent does not precede the bone");
+			if (bone.nameOffset % sizeof(WCHAR) || (UINT64)bone.nameOffset + (UINT64)bone.nameLength * sizeof(WCHAR) > section->size)
+				throw std::exception("Corrupted OMD data: bone name out of range");
+			m_bones[i].name.assign((const WCHAR*)(data + bone.nameOffset), bone.nameLength);
+			m_bones[i].parent = bone.parent;
+			m_bones[i].translation = bone.translation;
+			m_bones[i].rotation = bone.rotation;
+			m_bones[i].scale = bone.scale;
+		}
+
+		const OMDSectionEntry* offsets = view.FindSection(OMDSection::BONE_OFFSETS);
+		if (offsets == nullptr || offsets->elementCount == 0)
+			return;
+		if (offsets->elementSize != sizeof(OMDBoneOffset) || view.getStoredElementSize(*offsets) == 0)
+			throw std::exception("Corrupted OMD data: invalid bone offset section");
+		data = view.getSectionData(*offsets);
+		for (UINT i = 0; i < offsets->elementCount; i++)
+		{
+			OMDBoneOffset offset;
+			memcpy(&offset, data + (size_t)i * sizeof(OMDBoneOffset), sizeof(OMDBoneOffset));
+			if (offset.bone >= header.boneCount)
+				throw std::exception("Corrupted OMD data: offset of a missing bone");
+			m_bones[offset.bone].hasOffset = true;
+			m_bones[offset.bone].offset = offset.offset;
 		}
 	}
-	void OMDLoader::ReadBonesBinary(std::ifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadAnimationsBinary(OMDView& view)
 	{
+		OMDHeader& header = view.getHeader();
+		m_animations.clear();
+		if (header.animationCount == 0)
+			return;
+		const OMDSectionEntry* section = view.FindSection(OMDSection::ANIMATIONS);
+		const char* data = view.getSectionData(*section);
+		for (UINT i = 0; i < header.animationCount; i++)
+		{
+			OMDAnimation animation;
+			memcpy(&animation, data + (size_t)i * sizeof(OMDAnimation), sizeof(OMDAnimation));
+			auto inSection = [section](UINT64 offset, UINT64 size) { return offset <= section->size && size <= section->size - offset; };
+			if (animation.nameOffset % sizeof(WCHAR) || animation.channelOffset % sizeof(float) ||
+				!inSection(animation.nameOffset, (UINT64)animation.nameLength * sizeof(WCHAR)) ||
+				!inSection(animation.channelOffset, (UINT64)animation.channelCount * sizeof(AnimationChannelHeader)) ||
+				!inSection(animation.keyDataOffset, animation.keyDataSize))
+				throw std::exception("Corrupted OMD data: animation out of range");
+			m_animations.push_back(Animation(
+				std::wstring((const WCHAR*)(data + animation.nameOffset), animation.nameLength), animation.duration,
+				(const AnimationChannelHeader*)(data + animation.channelOffset), animation.channelCount,
+				data + animation.keyDataOffset, (size_t)animation.keyDataSize, header.boneCount));
+		}
 	}
-	void OMDLoader::ReadAnimationsBinary(std::ifstream& infile, OMDHeader& header)
+	/* the evaluator relies on sorted deltas with valid vertices */
+	static void CheckMorph(const Morph& morph, UINT vertexCount, UINT boneCount)
 	{
+		for (size_t i = 0; i < morph.deltas.size(); i++)
+			if (morph.deltas[i].vertex >= vertexCount || (i > 0 && morph.deltas[i].vertex <= morph.deltas[i - 1].vertex))
+				throw std::exception("Corrupted OMD data: invalid morph delta");
+		for (const MorphBoneDelta& delta : morph.boneDeltas)
+			if (delta.bone >= boneCount)
+				throw std::exception("Corrupted OMD data: invalid morph bone");
+	}
+	void OMDLoader::ReadMorphsBinary(OMDView& view)
+	{
+		OMDHeader& header = view.getHeader();
+		m_morphs.clear();
+		const OMDSectionEntry* section = view.FindSection(OMDSection::MORPHS);
+		if (section == nullptr || section->elementCount == 0)
+			return;
+		if (section->elementSize != sizeof(OMDMorph) || view.getStoredElementSize(*section) == 0)
+			throw std::exception("Corrupted OMD data: invalid morph section");
+		const char* data = view.getSectionData(*section);
+		for (UINT i = 0; i < section->elementCount; i++)
+		{
+			OMDMorph morph;
+			memcpy(&morph, data + (size_t)i * sizeof(OMDMorph), sizeof(OMDMorph));
+			auto inSection = [section](UINT64 offset, UINT64 size) { return offset <= section->size && size <= section->size - offset; };
+			if (morph.nameOffset % sizeof(WCHAR) ||
+				!inSection(morph.nameOffset, (UINT64)morph.nameLength * sizeof(WCHAR)) ||
+				!inSection(morph.deltaOffset, (UINT64)morph.deltaCount * sizeof(MorphDelta)) ||
+				!inSection(morph.boneDeltaOffset, (UINT64)morph.boneDeltaCount * sizeof(MorphBoneDelta)))
+				throw std::exception("Corrupted OMD data: morph out of range");
+			Morph& dst = m_morphs.emplace_back();
+			dst.name.assign((const WCHAR*)(data + morph.nameOffset), morph.nameLength);
+			dst.deltas.resize(morph.deltaCount);
+			memcpy(dst.deltas.data(), data + morph.deltaOffset, (size_t)morph.deltaCount * sizeof(MorphDelta));
+			dst.boneDeltas.resize(morph.boneDeltaCount);
+			memcpy(dst.boneDeltas.data(), data + morph.boneDeltaOffset, (size_t)morph.boneDeltaCount * sizeof(MorphBoneDelta));
+			CheckMorph(dst, header.vertexCount, header.boneCount);
+		}
+	}
+	void OMDLoader::ReadInstancesBinary(OMDView& view)
+	{
+		OMDHeader& header = view.getHeader();
+		m_instances.clear();
+		const OMDSectionEntry* section = view.FindSection(OMDSection::INSTANCES);
+		if (section == nullptr || section->elementCount == 0)
+			return;
+		if (section->elementSize != sizeof(MeshInstance) || view.getStoredElementSize(*section) == 0)
+			throw std::exception("Corrupted OMD data: invalid instance section");
+		m_instances.resize(section->elementCount);
+		memcpy(m_instances.data(), view.getSectionData(*section), m_instances.size() * sizeof(MeshInstance));
+		for (MeshInstance& instance : m_instances)
+			if (instance.group >= header.groupCount)
+				throw std::exception("Corrupted OMD data: instance references a missing group");
 	}
 
 #pragma endregion
 
 #pragma region Load text
 
-	void OMDLoader::LoadOMDText(LPCWSTR filename, UINT modelType)
+	static inline bool IsSpace(char c)
 	{
-		std::wifstream infile(filename, std::ios::in);
-		OMDHeader header;
-		ReadHeaderText(infile, header, modelType);
-		ReadVerticesText(infile, header);
-		ReadIndicesText(infile, header);
-		ReadGroupsText(infile, header);
-		ReadMaterialsText(infile, header);
-		ReadHitboxText(infile, header);
-		ReadBonesText(infile, header);
-		ReadAnimationsText(infile, header);
-	}
-	void OMDLoader::ReadHeaderText(std::wifstream& infile, OMDHeader& header, UINT modelType)
-	{
-		WCHAR ch;
-		infile >> ch;
-		header.fileFormat = (char)ch;
-		infile >> ch;
-		header.extension[0] = (char)ch;
-		infile >> ch;
-		header.extension[1] = (char)ch;
-		infile >> ch;
-		header.extension[2] = (char)ch;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.modelType;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.vertexCount;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.indexCount;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.groupCount;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.materialCount;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.boundingVolumePrimitive;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.hitboxTriangleCount;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.boneCount;
-		do { infile >> ch; } while (ch != ':');
-		infile >> header.animationCount;
-		m_modelType = ModelType::RemoveUnnecessary(header.modelType & modelType);
-		m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
-		m_boundingVolumeType = header.boundingVolumePrimitive;
+		return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+	}
+
+	void OMDTextCursor::SkipWhitespace()
+	{
+		while (position < end && IsSpace(*position))
+			position++;
+	}
+	void OMDTextCursor::SkipPast(char c)
+	{
+		const char* found = (const char*)memchr(position, c, end - position);
+		if (found == nullptr)
+			throw std::exception("Corrupted OMD data: unexpected end of file");
+		position = found + 1;
+	}
+	const char* OMDTextCursor::FindLabel(const char* label)
+	{
+		return std::search(position, end, label, label + strlen(label));
+	}
+	UINT OMDTextCursor::ReadUInt()
+	{
+		UINT value = 0;
+		SkipWhitespace();
+		std::from_chars_result result = std::from_chars(position, end, value);
+		if (result.ec != std::errc())
+			throw std::exception("Corrupted OMD data: invalid number");
+		position = result.ptr;
+		return value;
+	}
+	int OMDTextCursor::ReadInt()
+	{
+		int value = 0;
+		SkipWhitespace();
+		std::from_chars_result result = std::from_chars(position, end, value);
+		if (result.ec != std::errc())
+			throw std::exception("Corrupted OMD data: invalid number");
+		position = result.ptr;
+		return value;
+	}
+	float OMDTextCursor::ReadFloat()
+	{
+		float value = 0.0f;
+		SkipWhitespace();
+		std::from_chars_result result = std::from_chars(position, end, value);
+		if (result.ec != std::errc())
+			throw std::exception("Corrupted OMD data: invalid number");
+		position = result.ptr;
+		return value;
 	}
-	void OMDLoader::ReadVerticesText(std::wifstream& infile, OMDHeader& header)
+	std::wstring OMDTextCursor::ReadName()
 	{
-		WCHAR ch;
-		do { infile >> ch; } while (ch != ':');
-		m_vertices.resize(header.vertexCount * m_vertexSizeInBytes / sizeof(VertexElement));
-		VertexElement tmp[8];
-		UINT vertexCounter = 0;
-		for (UINT i = 0; i < header.vertexCount; i++)
+		while (position < end && *position == ' ')
+			position++;
+		const char* lineEnd = (const char*)memchr(position, '\n', end - position);
+		if (lineEnd == nullptr)
+			lineEnd = end;
+		std::string name(position, lineEnd);
+		if (!name.empty() && name.back() == '\r')
+			name.pop_back();
+		position = lineEnd;
+		//names are UTF-8, older files stored the low byte of every character, those are read back as they were
+		if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, name.c_str(), -1, nullptr, 0) == 0)
 		{
-			if (ModelType::HasPositions(header.modelType))
-			{
-				infile >> tmp[0].f;
-				infile >> tmp[1].f;
-				infile >> tmp[2].f;
-				if (ModelType::HasPositions(m_modelType))
-				{
-					m_vertices[vertexCounter++] = tmp[0];
-					m_vertices[vertexCounter++] = tmp[1];
-					m_vertices[vertexCounter++] = tmp[2];
-				}
-			}
-			if (ModelType::HasTexcoords(header.modelType))
-			{
-				infile >> tmp[0].f;
-				infile >> tmp[1].f;
-				if (ModelType::HasTexcoords(m_modelType))
-				{
-					m_vertices[vertexCounter++] = tmp[0];
-					m_vertices[vertexCounter++] = tmp[1];
-				}
-			}
-			if (ModelType::HasNormals(header.modelType))
+			std::wstring bytes(name.size(), L'\0');
+			for (size_t i = 0; i < name.size(); i++)
+				bytes[i] = (unsigned char)name[i];
+			return bytes;
+		}
+		return Utf8ToWStr(name.c_str());
+	}
+	void OMDTextCursor::SkipLine()
+	{
+		const char* lineEnd = (const char*)memchr(position, '\n', end - position);
+		position = lineEnd ? lineEnd : end;
+	}
+
+	struct TextSlot
+	{
+		bool integer;
+		int offset;		//in the destination element, -1 to skip the number
+	};
+
+	/* Checked before the destination is allocated, count numbers take at least 2 * count - 1 characters */
+	static void CheckNumberCount(const char* begin, const char* end, UINT64 count)
+	{
+		if (count > (UINT64)(end - begin) / 2 + 1)
+			throw std::exception("Corrupted OMD data: section has fewer numbers than the header says");
+	}
+
+	/* Parses elementCount * slots.size() whitespace separated numbers from [begin, end) into dst.
+	The text is split at whitespace, the chunks count their numbers first, so each chunk knows
+	which element and slot it starts at, and then they are parsed in parallel.
+	advance gets the bytes of every parsed chunk, from the parallel tasks. */
+	static void ParseElementsText(const char* begin, const char* end, UINT elementCount,
+		const std::vector<TextSlot>& slots, char* dst, UINT dstElementSize, const std::function<void(UINT64 bytes)>& advance)
+	{
+		const size_t ChunkSize = 1 << 18;
+		const UINT64 numberCount = (UINT64)elementCount * slots.size();
+		if (numberCount == 0)
+			return;
+
+		UINT chunkCount = (UINT)((end - begin) / ChunkSize + 1);
+		std::vector<const char*> bounds(chunkCount + 1);
+		bounds[0] = begin;
+		bounds[chunkCount] = end;
+		for (UINT c = 1; c < chunkCount; c++)
+		{
+			//any whitespace, the index section is a single line
+			const char* p = (std::max)(begin + (end - begin) / chunkCount * c, bounds[c - 1]);
+			while (p < end && !IsSpace(*p))
+				p++;
+			bounds[c] = p;
+		}
+
+		std::vector<UINT64> counts(chunkCount + 1, 0);
+		ParallelFor(chunkCount, [&](UINT c) {
+			UINT64 count = 0;
+			bool space = true;
+			for (const char* p = bounds[c]; p < bounds[c + 1]; p++)
 			{
-				infile >> tmp[0].f;
-				infile >> tmp[1].f;
-				infile >> tmp[2].f;
-				if (ModelType::HasNormals(m_modelType))
-				{
-					m_vertices[vertexCounter++] = tmp[0];
-					m_vertices[vertexCounter++] = tmp[1];
-					m_vertices[vertexCounter++] = tmp[2];
-				}
+				bool s = IsSpace(*p);
+				count += space && !s;
+				space = s;
 			}
-			if (ModelType::HasTangentsBinormals(header.modelType))
+			counts[c + 1] = count;
+		});
+		for (UINT c = 0; c < chunkCount; c++)
+			counts[c + 1] += counts[c];	//first number of each chunk
+		if (counts[chunkCount] < numberCount)
+			throw std::exception("Corrupted OMD data: section has fewer numbers than the header says");
+
+		const UINT slotCount = (UINT)slots.size();
+		ParallelFor(chunkCount, [&](UINT c) {
+			UINT64 number = counts[c];
+			UINT64 last = (std::min)(counts[c + 1], numberCount);
+			advance(bounds[c + 1] - bounds[c]);
+			if (number >= last)
+				return;
+			size_t element = (size_t)(number / slotCount);
+			UINT slot = (UINT)(number % slotCount);
+			const char* p = bounds[c];
+			const char* chunkEnd = bounds[c + 1];
+			for (; number < last; number++)
 			{
-				infile >> tmp[0].f;
-				infile >> tmp[1].f;
-				infile >> tmp[2].f;
-				infile >> tmp[3].f;
-				infile >> tmp[4].f;
-				infile >> tmp[5].f;
-				if (ModelType::HasTangentsBinormals(m_modelType))
+				while (IsSpace(*p))
+					p++;
+				if (slots[slot].offset < 0)
 				{
-					m_vertices[vertexCounter++] = tmp[0];
-					m_vertices[vertexCounter++] = tmp[1];
-					m_vertices[vertexCounter++] = tmp[2];
-					m_vertices[vertexCounter++] = tmp[3];
-					m_vertices[vertexCounter++] = tmp[4];
-					m_vertices[vertexCounter++] = tmp[5];
+					while (p < chunkEnd && !IsSpace(*p))	//not requested, stepped over without parsing
+						p++;
+					if (++slot == slotCount)
+					{
+						slot = 0;
+						element++;
+					}
+					continue;
 				}
-			}
-			if (ModelType::HasBones(header.modelType))
-			{
-				infile >> tmp[0].f;
-				infile >> tmp[1].f;
-				infile >> tmp[2].f;
-				infile >> tmp[3].f;
-				infile >> tmp[4].u;
-				infile >> tmp[5].u;
-				infile >> tmp[6].u;
-				infile >> tmp[7].u;
-				if (ModelType::HasBones(m_modelType))
+				VertexElement value;
+				std::from_chars_result result = slots[slot].integer ?
+					std::from_chars(p, chunkEnd, value.u) : std::from_chars(p, chunkEnd, value.f);
+				if (result.ec != std::errc() || (result.ptr < chunkEnd && !IsSpace(*result.ptr)))
+					throw std::exception("Corrupted OMD data: invalid number");
+				p = result.ptr;
+				memcpy(dst + (element * dstElementSize + slots[slot].offset) * sizeof(VertexElement), &value, sizeof(value));
+				if (++slot == slotCount)
 				{
-					m_vertices[vertexCounter++] = tmp[0];
-					m_vertices[vertexCounter++] = tmp[1];
-					m_vertices[vertexCounter++] = tmp[2];
-					m_vertices[vertexCounter++] = tmp[3];
-					m_vertices[vertexCounter++] = tmp[4];
-					m_vertices[vertexCounter++] = tmp[5];
-					m_vertices[vertexCounter++] = tmp[6];
-					m_vertices[vertexCounter++] = tmp[7];
+					slot = 0;
+					element++;
 				}
 			}
+		});
+	}
+
+	void OMDLoader::LoadOMDText(LPCWSTR filename, UINT modelType)
+	{
+		MappedFile file(filename);
+		LoadOMDText(file.getData(), file.getSize(), modelType);
+	}
+	void OMDLoader::LoadOMDText(const char* data, size_t size, UINT modelType)
+	{
+		/* the sections set the progress to where they end, the parallel parsing adds its chunks in between */
+		BeginProgress(LoadStage::READ, size);
+		OMDTextCursor text = { data, data + size };
+		OMDHeader header;
+		ReadHeaderText(text, header, modelType);
+		void (OMDLoader::*sections[])(OMDTextCursor&, OMDHeader&) = {
+			&OMDLoader::ReadVerticesText, &OMDLoader::ReadIndicesText, &OMDLoader::ReadGroupsText,
+			&OMDLoader::ReadMaterialsText, &OMDLoader::ReadHitboxText, &OMDLoader::ReadBonesText,
+			&OMDLoader::ReadAnimationsText, &OMDLoader::ReadMorphsText, &OMDLoader::ReadInstancesText,
+			&OMDLoader::ReadBoneOffsetsText };
+		for (auto read : sections)
+		{
+			SetProgress(text.position - data);
+			(this->*read)(text, header);
 		}
+		SetProgress(size);
+	}
+	void OMDLoader::ReadHeaderText(OMDTextCursor& text, OMDHeader& header, UINT modelType)
+	{
+		text.SkipWhitespace();
+		if (text.end - text.position < 4)
+			throw std::exception("Corrupted OMD data: file is smaller than the header");
+		header.fileFormat = text.position[0];
+		header.extension[0] = text.position[1];
+		header.extension[1] = text.position[2];
+		header.extension[2] = text.position[3];
+		text.SkipPast(':');
+		header.modelType = text.ReadUInt();
+		text.SkipPast(':');
+		header.vertexCount = text.ReadUInt();
+		text.SkipPast(':');
+		header.indexCount = text.ReadUInt();
+		text.SkipPast(':');
+		header.groupCount = text.ReadUInt();
+		text.SkipPast(':');
+		header.materialCount = text.ReadUInt();
+		text.SkipPast(':');
+		header.boundingVolumePrimitive = text.ReadUInt();
+		text.SkipPast(':');
+		header.hitboxTriangleCount = text.ReadUInt();
+		text.SkipPast(':');
+		header.boneCount = text.ReadUInt();
+		text.SkipPast(':');
+		header.animationCount = text.ReadUInt();
+		m_modelType = ModelType::RemoveUnnecessary(header.modelType & modelType);
+		m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
+		m_boundingVolumeType = header.boundingVolumePrimitive;
+	}
+	void OMDLoader::ReadVerticesText(OMDTextCursor& text, OMDHeader& header)
+	{
+		text.SkipPast(':');
+		const char* sectionEnd = text.FindLabel("Indices:");
+
+		std::vector<TextSlot> slots;
+		auto addSlots = [this, &slots, &header](bool(*hasAttribute)(UINT), UINT count, UINT offset, bool integer) {
+			if (!hasAttribute(header.modelType))
+				return;
+			bool keep = hasAttribute(m_modelType);
+			for (UINT i = 0; i < count; i++)
+				slots.push_back({ integer, keep ? (int)(offset + i) : -1 });
+		};
+		addSlots(ModelType::HasPositions, 3, ModelType::PositionOffset(m_modelType), false);
+		addSlots(ModelType::HasTexcoords, 2, ModelType::TexCoordOffset(m_modelType), false);
+		addSlots(ModelType::HasNormals, 3, ModelType::NormalOffset(m_modelType), false);
+		addSlots(ModelType::HasTangentsBinormals, 6, ModelType::TangentOffset(m_modelType), false);
+		addSlots(ModelType::HasBones, 4, ModelType::BoneWeightsOffset(m_modelType), false);
+		addSlots(ModelType::HasBones, 4, ModelType::BoneIndexOffset(m_modelType), true);
+
+		CheckNumberCount(text.position, sectionEnd, (UINT64)header.vertexCount * slots.size());
+		m_vertices.resize((size_t)header.vertexCount * getVertexSizeInFloats());
+		ParseElementsText(text.position, sectionEnd, header.vertexCount, slots, (char*)m_vertices.data(), getVertexSizeInFloats(),
+			[this](UINT64 bytes) { AdvanceProgress(bytes); });
+		text.position = sectionEnd;
 	}
-	void OMDLoader::ReadIndicesText(std::wifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadIndicesText(OMDTextCursor& text, OMDHeader& header)
 	{
-		WCHAR ch;
-		do { infile >> ch; } while (ch != ':');
+		text.SkipPast(':');
+		const char* sectionEnd = text.FindLabel("Groups:");
+		CheckNumberCount(text.position, sectionEnd, header.indexCount);
 		m_indices.resize(header.indexCount);
-		for (UINT i = 0; i < header.indexCount; i++)
-			infile >> m_indices[i];
+		ParseElementsText(text.position, sectionEnd, header.indexCount, { { true, 0 } }, (char*)m_indices.data(), 1,
+			[this](UINT64 bytes) { AdvanceProgress(bytes); });
+		text.position = sectionEnd;
 	}
-	void OMDLoader::ReadGroupsText(std::wifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadGroupsText(OMDTextCursor& text, OMDHeader& header)
 	{
-		WCHAR ch;
-		do { infile >> ch; } while (ch != ':');
+		text.SkipPast(':');
 		m_groups.resize(header.groupCount);
 		for (UINT i = 0; i < header.groupCount; i++)
 		{
-			do { infile >> ch; } while (ch != ':');
-			infile >> m_groups[i].startIndex;
-			do { infile >> ch; } while (ch != ':');
-			infile >> m_groups[i].indexCount;
-			do { infile >> ch; } while (ch != ':');
-			infile >> m_groups[i].materialIndex;
+			text.SkipPast(':');
+			m_groups[i].startIndex = text.ReadUInt();
+			text.SkipPast(':');
+			m_groups[i].indexCount = text.ReadUInt();
+			text.SkipPast(':');
+			m_groups[i].materialIndex = text.ReadInt();
 		}
-
 	}
-	void OMDLoader::ReadMaterialsText(std::wifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadMaterialsText(OMDTextCursor& text, OMDHeader& header)
 	{
-		WCHAR ch;
-		do { infile >> ch; } while (ch != ':');
+		text.SkipPast(':');
 		m_textures.resize(header.materialCount);
 		m_normalmaps.resize(header.materialCount);
 		for (UINT i = 0; i < header.materialCount; i++)
 		{
-			do { infile >> ch; } while (ch != ':');
-			do { infile.read(&ch, 1); } while (ch == ' ');
-			for (; ch != '\n'; infile.read(&ch, 1))
-				m_textures[i].filename += ch;
-			do { infile >> ch; } while (ch != ':');
-			do { infile.read(&ch, 1); } while (ch == ' ');
-			for (; ch != '\n'; infile.read(&ch, 1))
-				m_normalmaps[i].filename += ch;
+			text.SkipPast(':');
+			if (ModelType::HasTexture(m_modelType))
+				m_textures[i].filename = text.ReadName();
+			else
+				text.SkipLine();
+			text.SkipPast(':');
+			if (ModelType::HasNormalmap(m_modelType))
+				m_normalmaps[i].filename = text.ReadName();
+			else
+				text.SkipLine();
 		}
 	}
-	void OMDLoader::ReadHitboxText(std::wifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadHitboxText(OMDTextCursor& text, OMDHeader& header)
 	{
-		WCHAR ch;
-		do { infile >> ch; } while (ch != ':');
+		text.SkipPast(':');
 		switch (header.boundingVolumePrimitive)
 		{
 		case mth::BoundingVolume::CUBOID:
-			infile >> m_bvPosition.x;
-			infile >> m_bvPosition.y;
-			infile >> m_bvPosition.z;
-			infile >> m_bvCuboidSize.x;
-			infile >> m_bvCuboidSize.y;
-			infile >> m_bvCuboidSize.z;
+			m_bvPosition.x = text.ReadFloat();
+			m_bvPosition.y = text.ReadFloat();
+			m_bvPosition.z = text.ReadFloat();
+			m_bvCuboidSize.x = text.ReadFloat();
+			m_bvCuboidSize.y = text.ReadFloat();
+			m_bvCuboidSize.z = text.ReadFloat();
 			break;
 		case mth::BoundingVolume::SPHERE:
-			infile >> m_bvPosition.x;
-			infile >> m_bvPosition.y;
-			infile >> m_bvPosition.z;
-			infile >> m_bvSphereRadius;
+			m_bvPosition.x = text.ReadFloat();
+			m_bvPosition.y = text.ReadFloat();
+			m_bvPosition.z = text.ReadFloat();
+			m_bvSphereRadius = text.ReadFloat();
 			break;
 		default:
 			header.boundingVolumePrimitive = mth::BoundingVolume::NO_TYPE;
 			break;
 		}
 
-		do { infile >> ch; } while (ch != ':');
+		text.SkipPast(':');
+		const char* sectionEnd = text.FindLabel("Bones:");
 		if (header.hitboxTriangleCount)
 		{
+			const UINT TriangleSize = 13;	//3 vertices, plain normal, plain distance
+			std::vector<float> values((size_t)header.hitboxTriangleCount * TriangleSize);
+			std::vector<TextSlot> slots;
+			for (UINT i = 0; i < TriangleSize; i++)
+				slots.push_back({ false, (int)i });
+			ParseElementsText(text.position, sectionEnd, header.hitboxTriangleCount, slots, (char*)values.data(), TriangleSize,
+				[this](UINT64 bytes) { AdvanceProgress(bytes); });
+
 			m_hitbox.resize(header.hitboxTriangleCount);
-			mth::float3 tri[3];
-			mth::float3 plainNormal;
-			float plainDistance;
 			for (UINT i = 0; i < header.hitboxTriangleCount; i++)
 			{
-				infile >> tri[0].x;
-				infile >> tri[0].y;
-				infile >> tri[0].z;
-				infile >> tri[1].x;
-				infile >> tri[1].y;
-				infile >> tri[1].z;
-				infile >> tri[2].x;
-				infile >> tri[2].y;
-				infile >> tri[2].z;
-				infile >> plainNormal.x;
-				infile >> plainNormal.y;
-				infile >> plainNormal.z;
-				infile >> plainDistance;
-				m_hitbox[i] = mth::Triangle(tri, plainNormal, plainDistance);
+				const float* v = &values[(size_t)i * TriangleSize];
+				mth::float3 tri[3] = { { v[0], v[1], v[2] }, { v[3], v[4], v[5] }, { v[6], v[7], v[8] } };
+				m_hitbox[i] = mth::Triangle(tri, mth::float3(v[9], v[10], v[11]), v[12]);
+			}
+		}
+		text.position = sectionEnd;
+	}
+	void OMDLoader::ReadBonesText(OMDTextCursor& text, OMDHeader& header)
+	{
+		text.SkipPast(':');
+		m_bones.assign(header.boneCount, Bone());
+		for (UINT i = 0; i < header.boneCount; i++)
+		{
+			Bone& bone = m_bones[i];
+			text.SkipPast(':');
+			bone.name = text.ReadName();
+			text.SkipPast(':');
+			bone.parent = text.ReadInt();
+			if (bone.parent < -1 || bone.parent >= (int)i)
+				throw std::exception("Corrupted OMD data: bone parent does not precede the bone");
+			text.SkipPast(':');
+			bone.translation.x = text.ReadFloat();
+			bone.translation.y = text.ReadFloat();
+			bone.translation.z = text.ReadFloat();
+			bone.rotation.x = text.ReadFloat();
+			bone.rotation.y = text.ReadFloat();
+			bone.rotation.z = text.ReadFloat();
+			bone.rotation.w = text.ReadFloat();
+			bone.scale.x = text.ReadFloat();
+			bone.scale.y = text.ReadFloat();
+			bone.scale.z = text.ReadFloat();
+		}
+	}
+	void OMDLoader::ReadAnimationsText(OMDTextCursor& text, OMDHeader& header)
+	{
+		text.SkipPast(':');
+		m_animations.clear();
+		for (UINT i = 0; i < header.animationCount; i++)
+		{
+			text.SkipPast(':');
+			std::wstring name = text.ReadName();
+			text.SkipPast(':');
+			float duration = text.ReadFloat();
+			text.SkipPast(':');
+			UINT channelCount = text.ReadUInt();
+			std::vector<AnimationChannelHeader> channels;
+			std::vector<char> keyData;
+			for (UINT c = 0; c < channelCount; c++)
+			{
+				AnimationChannelHeader channel;
+				text.SkipPast(':');
+				channel.bone = text.ReadUInt();
+				channel.kind = text.ReadUInt();
+				channel.keyCount = text.ReadUInt();
+				for (UINT k = 0; k < 3; k++)
+					channel.rangeMin[k] = text.ReadFloat();
+				for (UINT k = 0; k < 3; k++)
+					channel.rangeExtent[k] = text.ReadFloat();
+				if ((UINT64)channel.keyCount * AnimationChannel::KeySize > (UINT64)(text.end - text.position))
+					throw std::exception("Corrupted OMD data: animation has more keys than the file");
+				channel.dataOffset = (UINT)keyData.size();
+				keyData.resize(keyData.size() + (size_t)channel.keyCount * AnimationChannel::KeySize);
+				USHORT* values = (USHORT*)(keyData.data() + channel.dataOffset);
+				for (UINT k = 0; k < channel.keyCount * AnimationChannel::KeySize / sizeof(USHORT); k++)
+				{
+					UINT value = text.ReadUInt();
+					if (value > 0xffff)
+						throw std::exception("Corrupted OMD data: invalid animation key");
+					values[k] = (USHORT)value;
+				}
+				channels.push_back(channel);
+			}
+			m_animations.push_back(Animation(name, duration, channels.data(), channelCount,
+				keyData.data(), keyData.size(), header.boneCount));
+		}
+	}
+	void OMDLoader::ReadMorphsText(OMDTextCursor& text, OMDHeader& header)
+	{
+		m_morphs.clear();
+		const char* label = text.FindLabel("\nMorphs:");
+		if (label == text.end)	//written before morphs were stored
+			return;
+		text.position = label + 1;
+		text.SkipPast(':');
+		UINT morphCount = text.ReadUInt();
+		for (UINT i = 0; i < morphCount; i++)
+		{
+			Morph morph;
+			text.SkipPast(':');
+			morph.name = text.ReadName();
+			text.SkipPast(':');
+			UINT deltaCount = text.ReadUInt();
+			if ((UINT64)deltaCount * 2 > (UINT64)(text.end - text.position))
+				throw std::exception("Corrupted OMD data: morph has more deltas than the file");
+			morph.deltas.resize(deltaCount);
+			for (MorphDelta& delta : morph.deltas)
+			{
+				delta.vertex = text.ReadUInt();
+				delta.position.x = text.ReadFloat();
+				delta.position.y = text.ReadFloat();
+				delta.position.z = text.ReadFloat();
+				delta.normal.x = text.ReadFloat();
+				delta.normal.y = text.ReadFloat();
+				delta.normal.z = text.ReadFloat();
+				delta.texcoord.x = text.ReadFloat();
+				delta.texcoord.y = text.ReadFloat();
+			}
+			text.SkipPast(':');
+			UINT boneDeltaCount = text.ReadUInt();
+			if ((UINT64)boneDeltaCount * 2 > (UINT64)(text.end - text.position))
+				throw std::exception("Corrupted OMD data: morph has more deltas than the file");
+			morph.boneDeltas.resize(boneDeltaCount);
+			for (MorphBoneDelta& delta : morph.boneDeltas)
+			{
+				delta.bone = text.ReadUInt();
+				delta.translation.x = text.ReadFloat();
+				delta.translation.y = text.ReadFloat();
+				delta.translation.z = text.ReadFloat();
+				delta.rotation.x = text.ReadFloat();
+				delta.rotation.y = text.ReadFloat();
+				delta.rotation.z = text.ReadFloat();
+				delta.rotation.w = text.ReadFloat();
 			}
+			CheckMorph(morph, header.vertexCount, header.boneCount);
+			m_morphs.push_back(std::move(morph));
 		}
 	}
-	void OMDLoader::ReadBonesText(std::wifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadInstancesText(OMDTextCursor& text, OMDHeader& header)
 	{
-		WCHAR ch;
-		do { infile >> ch; } while (ch != ':');
+		m_instances.clear();
+		const char* label = text.FindLabel("\nInstances:");
+		if (label == text.end)	//written before instances were stored
+			return;
+		text.position = label + 1;
+		text.SkipPast(':');
+		UINT instanceCount = text.ReadUInt();
+		if ((UINT64)instanceCount * 2 > (UINT64)(text.end - text.position))
+			throw std::exception("Corrupted OMD data: more instances than the file");
+		m_instances.resize(instanceCount);
+		for (MeshInstance& instance : m_instances)
+		{
+			instance.group = text.ReadUInt();
+			if (instance.group >= header.groupCount)
+				throw std::exception("Corrupted OMD data: instance references a missing group");
+			for (int row = 0; row < 4; row++)
+				for (int column = 0; column < 4; column++)
+					instance.transform(row, column) = text.ReadFloat();
+		}
 	}
-	void OMDLoader::ReadAnimationsText(std::wifstream& infile, OMDHeader& header)
+	void OMDLoader::ReadBoneOffsetsText(OMDTextCursor& text, OMDHeader& header)
 	{
-		WCHAR ch;
-		do { infile >> ch; } while (ch != ':');
+		const char* label = text.FindLabel("\nBone offsets:");
+		if (label == text.end)	//written before bone offsets were stored
+			return;
+		text.position = label + 1;
+		text.SkipPast(':');
+		UINT offsetCount = text.ReadUInt();
+		if ((UINT64)offsetCount * 2 > (UINT64)(text.end - text.position))
+			throw std::exception("Corrupted OMD data: more bone offsets than the file");
+		for (UINT i = 0; i < offsetCount; i++)
+		{
+			UINT index = text.ReadUInt();
+			if (index >= header.boneCount)
+				throw std::exception("Corrupted OMD data: offset of a missing bone");
+			Bone& bone = m_bones[index];
+			bone.hasOffset = true;
+			for (int row = 0; row < 4; row++)
+				for (int column = 0; column < 4; column++)
+					bone.offset(row, column) = text.ReadFloat();
+		}
 	}
 
 #pragma endregion
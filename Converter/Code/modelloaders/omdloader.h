@@ -1,12 +1,14 @@
 #pragma once
 
 #include "modelloader.h"
+#include "mappedfile.h"
+#include "omdcodec.h"
 
 namespace gfx
 {
 	struct OMDHeader
 	{
-		char fileFormat;	//'t' for text, 'b' for binary
+		char fileFormat;	//'t' for text, 'b' for binary, 'v' for versioned binary (OMDHeaderV2)
 		char extension[3];	//"OMD"
 		UINT modelType;
 		UINT vertexCount;
@@ -19,31 +21,267 @@ namespace gfx
 		UINT animationCount;
 	};
 
+	/* Binary OMD version 2
+	All fields are little-endian. The file starts with OMDHeaderV2 (fileFormat is 'v'),
+	followed by the section table at sectionTableOffset. Every section starts at a
+	64 byte aligned offset, the section table is 16 byte aligned, readers reject sections
+	that are not at least 4 byte aligned. Readers look sections up by kind and skip the ones
+	they don't know, so new kinds can be added freely.
+	A reader with the wrong byte order sees a version number it doesn't support. */
+	namespace OMDSection
+	{
+		enum Kind :UINT
+		{
+			VERTICES = 1,
+			INDICES = 2,
+			GROUPS = 3,
+			MATERIALS = 4,
+			BOUNDING_VOLUME = 5,
+			HITBOX = 6,
+			BONES = 7,
+			ANIMATIONS = 8,
+			QUANTIZATION = 9,	//QuantizationBlock array for QUANTIZED vertices
+			BASE_VERTICES = 10,	//UINT per group, added to the INDEX16 indices of the group
+			MORPHS = 11,
+			INSTANCES = 12,	//MeshInstance array
+			BONE_OFFSETS = 13	//OMDBoneOffset per bone with an offset matrix
+		};
+
+		enum Encoding :UINT
+		{
+			RAW = 0,
+			QUANTIZED = 1 << 0,
+			INDEX16 = 1 << 1,
+			COMPRESSED = 1 << 2		//payload is a compressed stream, see omdcodec.h
+		};
+
+		const UINT Version = 2;
+		const UINT SectionAlignment = 64;
+		const UINT TableAlignment = 16;
+	}
+
+	struct OMDHeaderV2
+	{
+		OMDHeader header;
+		UINT version;
+		UINT sectionCount;
+		UINT64 sectionTableOffset;
+		UINT64 reserved;
+	};
+
+	struct OMDSectionEntry
+	{
+		UINT kind;
+		UINT encoding;		//OMDSection::Encoding flags
+		UINT64 offset;		//from the start of the file
+		UINT64 size;		//bytes stored in the file
+		UINT elementCount;
+		UINT elementSize;	//bytes per element after decoding
+	};
+
+	struct OMDBoundingVolumeV2
+	{
+		mth::float3 position;
+		mth::float3 cuboidSize;
+		float sphereRadius;
+	};
+
+	/* BONES section: OMDBone per bone, followed by the names */
+	struct OMDBone
+	{
+		int parent;			//-1 for roots, smaller than the index of the bone otherwise
+		UINT nameOffset;	//bytes from the start of the section
+		UINT nameLength;	//in characters
+		mth::float3 translation;
+		mth::quaternion rotation;
+		mth::float3 scale;
+		UINT reserved;
+	};
+
+	struct OMDBoneOffset
+	{
+		UINT bone;
+		mth::float4x4 offset;
+	};
+
+	/* ANIMATIONS section: OMDAnimation per animation, followed by the channels,
+	key data and names of the animations (see AnimationChannelHeader) */
+	struct OMDAnimation
+	{
+		float duration;		//seconds
+		UINT channelCount;
+		UINT nameLength;	//in characters
+		UINT reserved;
+		UINT64 nameOffset;	//bytes from the start of the section
+		UINT64 channelOffset;
+		UINT64 keyDataOffset;
+		UINT64 keyDataSize;
+	};
+
+	/* MORPHS section: OMDMorph per morph, followed by the deltas and names of the morphs,
+	the element count of the section is the morph count */
+	struct OMDMorph
+	{
+		UINT deltaCount;
+		UINT boneDeltaCount;
+		UINT nameLength;	//in characters
+		UINT reserved;
+		UINT64 nameOffset;	//bytes from the start of the section
+		UINT64 deltaOffset;	//MorphDelta array, sorted by vertex
+		UINT64 boneDeltaOffset;	//MorphBoneDelta array
+	};
+
+	static_assert(sizeof(OMDHeader) == 40, "OMDHeader must stay packed");
+	static_assert(sizeof(OMDHeaderV2) == 64, "OMDHeaderV2 must be 64 bytes");
+	static_assert(sizeof(OMDSectionEntry) == 32, "OMDSectionEntry must be 32 bytes");
+	static_assert(sizeof(OMDBone) == 56, "OMDBone must be 56 bytes");
+	static_assert(sizeof(OMDBoneOffset) == 68, "OMDBoneOffset must be 68 bytes");
+	static_assert(sizeof(OMDAnimation) == 48, "OMDAnimation must be 48 bytes");
+	static_assert(sizeof(OMDMorph) == 40, "OMDMorph must be 40 bytes");
+
+	/* Zero-copy access to a binary OMD (version 1 or 2) held in memory, usually a MappedFile.
+	The header counts are validated against the data size on Open, every section is
+	exposed as a pointer into the data, nothing is copied. The data must outlive the view.
+	Version 1 files are described with the same section entries as version 2 ones.
+	Compressed sections are decoded into memory owned by the view when they are first accessed,
+	from then on their entries describe the decoded data. */
+	class OMDView
+	{
+		NO_COPY(OMDView)
+
+	private:
+		const char* m_data;
+		size_t m_size;
+		OMDHeader m_header;
+		UINT m_version;
+		std::vector<OMDSectionEntry> m_sections;
+		std::vector<const char*> m_sectionData;
+		std::vector<std::vector<char>> m_decodedSections;
+
+		std::vector<const WCHAR*> m_textureNames;
+		std::vector<const WCHAR*> m_normalmapNames;
+		mth::float3 m_bvPosition;
+		mth::float3 m_bvCuboidSize;
+		float m_bvSphereRadius;
+
+	private:
+		void ParseVersion1();
+		void ParseVersion2();
+		void ParseMaterials();
+		void ParseBoundingVolume();
+		const char* getRawSection(UINT kind, UINT elementCount);
+
+	public:
+		OMDView();
+		OMDView(const char* data, size_t size);
+
+		void Open(const char* data, size_t size);
+
+		const OMDSectionEntry* FindSection(UINT kind);
+		const char* getSectionData(const OMDSectionEntry& section);
+		UINT64 getStoredElementSize(const OMDSectionEntry& section);	//bytes per element in the section, 0 for unknown encodings
+
+		inline OMDHeader& getHeader() { return m_header; }
+		inline UINT getVersion() { return m_version; }
+		inline UINT getVertexSizeInBytes() { return ModelType::VertexSizeInBytes(m_header.modelType); }
+		inline bool isQuantized() { const OMDSectionEntry* s = FindSection(OMDSection::VERTICES); return s && (s->encoding & OMDSection::QUANTIZED); }
+		/* null if the vertices are stored in the compact format, use getQuantizedVertices then
+		and decode them with DequantizeVertices, or keep them compact */
+		inline const VertexElement* getVertices() { return (const VertexElement*)getRawSection(OMDSection::VERTICES, m_header.vertexCount); }
+		const char* getQuantizedVertices();
+		const QuantizationBlock* getQuantizationBlocks();
+		UINT getQuantizationBlockCount();
+		inline bool isIndex16() { const OMDSectionEntry* s = FindSection(OMDSection::INDICES); return s && (s->encoding & OMDSection::INDEX16); }
+		/* null if the indices are stored in 16 bits, use getIndices16 and getBaseVertices then */
+		inline const UINT* getIndices() { return (const UINT*)getRawSection(OMDSection::INDICES, m_header.indexCount); }
+		const USHORT* getIndices16();
+		const UINT* getBaseVertices();	//null if every group starts at vertex 0
+		inline const VertexGroup* getGroups() { return (const VertexGroup*)getRawSection(OMDSection::GROUPS, m_header.groupCount); }
+		inline const WCHAR* getTextureName(UINT index) { return m_textureNames[index]; }
+		inline const WCHAR* getNormalmapName(UINT index) { return m_normalmapNames[index]; }
+		inline mth::float3 getBoundingVolumePosition() { return m_bvPosition; }
+		inline mth::float3 getBoundingVolumeCuboidSize() { return m_bvCuboidSize; }
+		inline float getBoundingVolumeSphereRadius() { return m_bvSphereRadius; }
+		/* in version 1 the hitbox follows the variable length material names,
+		so the triangles can be only 2 byte aligned */
+		inline const mth::Triangle* getHitbox() { return (const mth::Triangle*)getRawSection(OMDSection::HITBOX, m_header.hitboxTriangleCount); }
+	};
+
+	/* Parts of a binary OMD that can be loaded and released separately */
+	namespace OMDPart
+	{
+		enum Part :UINT
+		{
+			VERTICES = 1 << 0,
+			INDICES = 1 << 1,
+			GROUPS = 1 << 2,
+			MATERIALS = 1 << 3,
+			HITBOX = 1 << 4,
+			BONES = 1 << 5,
+			ANIMATIONS = 1 << 6,
+			MORPHS = 1 << 7,
+			INSTANCES = 1 << 8,
+			ALL = VERTICES | INDICES | GROUPS | MATERIALS | HITBOX | BONES | ANIMATIONS | MORPHS | INSTANCES
+		};
+	}
+
+	/* Read position in the text of a text OMD. Numbers are parsed with from_chars,
+	so the result does not depend on the locale. Errors throw. */
+	struct OMDTextCursor
+	{
+		const char* position;
+		const char* end;
+
+		void SkipWhitespace();
+		void SkipPast(char c);
+		const char* FindLabel(const char* label);	//start of the next occurrence of label, or end
+		UINT ReadUInt();
+		int ReadInt();
+		float ReadFloat();
+		std::wstring ReadName();	//rest of the line without the leading spaces
+		void SkipLine();			//to the end of the line, where ReadName would stop
+	};
+
 	class OMDLoader :public ModelLoader
 	{
 	private:
-		void ReadHeaderBinary(std::ifstream& infile, OMDHeader& header, UINT modelType);
-		void ReadVerticesBinary(std::ifstream& infile, OMDHeader& header);
-		void ReadIndicesBinary(std::ifstream& infile, OMDHeader& header);
-		void ReadGroupsBinary(std::ifstream& infile, OMDHeader& header);
-		void ReadMaterialsBinary(std::ifstream& infile, OMDHeader& header);
-		void ReadHitboxBinary(std::ifstream& infile, OMDHeader& header);
-		void ReadBonesBinary(std::ifstream& infile, OMDHeader& header);
-		void ReadAnimationsBinary(std::ifstream& infile, OMDHeader& header);
-
-		void ReadHeaderText(std::wifstream& infile, OMDHeader& header, UINT modelType);
-		void ReadVerticesText(std::wifstream& infile, OMDHeader& header);
-		void ReadIndicesText(std::wifstream& infile, OMDHeader& header);
-		void ReadGroupsText(std::wifstream& infile, OMDHeader& header);
-		void ReadMaterialsText(std::wifstream& infile, OMDHeader& header);
-		void ReadHitboxText(std::wifstream& infile, OMDHeader& header);
-		void ReadBonesText(std::wifstream& infile, OMDHeader& header);
-		void ReadAnimationsText(std::wifstream& infile, OMDHeader& header);
+		void ReadHeaderBinary(OMDView& view, UINT modelType);
+		void ReadVerticesBinary(OMDView& view);
+		void ReadIndicesBinary(OMDView& view);
+		void ReadGroupsBinary(OMDView& view);
+		void ReadMaterialsBinary(OMDView& view);
+		void ReadHitboxBinary(OMDView& view);
+		void ReadBonesBinary(OMDView& view);
+		void ReadAnimationsBinary(OMDView& view);
+		void ReadMorphsBinary(OMDView& view);
+		void ReadInstancesBinary(OMDView& view);
+
+		void ReadHeaderText(OMDTextCursor& text, OMDHeader& header, UINT modelType);
+		void ReadVerticesText(OMDTextCursor& text, OMDHeader& header);
+		void ReadIndicesText(OMDTextCursor& text, OMDHeader& header);
+		void ReadGroupsText(OMDTextCursor& text, OMDHeader& header);
+		void ReadMaterialsText(OMDTextCursor& text, OMDHeader& header);
+		void ReadHitboxText(OMDTextCursor& text, OMDHeader& header);
+		void ReadBonesText(OMDTextCursor& text, OMDHeader& header);
+		void ReadAnimationsText(OMDTextCursor& text, OMDHeader& header);
+		void ReadMorphsText(OMDTextCursor& text, OMDHeader& header);
+		void ReadInstancesText(OMDTextCursor& text, OMDHeader& header);
+		void ReadBoneOffsetsText(OMDTextCursor& text, OMDHeader& header);
 
 	public:
 		void LoadOMD(LPCWSTR filename, UINT modelType);
+		/* text or binary OMD held in memory, like an archive entry */
+		void LoadOMD(const char* data, size_t size, UINT modelType);
+		static bool IsOMD(const char* data, size_t size);
 
 		void LoadOMDText(LPCWSTR filename, UINT modelType);
+		/* the vertex, index and hitbox sections are parsed in parallel chunks split at whitespace */
+		void LoadOMDText(const char* data, size_t size, UINT modelType);
 		void LoadOMDBinary(LPCWSTR filename, UINT modelType);
+		void LoadOMDBinary(OMDView& view, UINT modelType);
+		/* Reads the header and the given OMDPart sections, the rest of the model is left untouched.
+		Materials are stored per group, the way LoadModel organizes them. */
+		void LoadOMDSections(OMDView& view, UINT modelType, UINT parts);
+		void ReleaseSections(UINT parts);	//frees the memory of the given OMDPart sections
 	};
 }
\ No newline at end of file
@@ -1,20 +1,83 @@
 #include "pmxloader.h"
+#include "mappedfile.h"
+#include "vertexlayout.h"
 
 namespace gfx
 {
-	void ReadPMXText(std::istream& src, std::wstring& dst, int byteCount)
+	namespace
 	{
-		int length;
-		wchar_t ch = 0;
-		src.read((char*)(&length), 4);
-		length /= byteCount;
-		for (int i = 0; i < length; i++)
+		const UINT PMXVertexChunkSize = 4096;
+	}
+
+#pragma region PMXReader
+
+	void PMXReader::Need(size_t byteCount)
+	{
+		if ((size_t)(end - position) < byteCount)
+			throw std::exception("Corrupted PMX data: unexpected end of file");
+	}
+	void PMXReader::Read(void* dst, size_t byteCount)
+	{
+		Need(byteCount);
+		memcpy(dst, position, byteCount);
+		position += byteCount;
+	}
+	void PMXReader::Skip(size_t byteCount)
+	{
+		Need(byteCount);
+		position += byteCount;
+	}
+	int PMXReader::ReadIndex(int indexSize)
+	{
+		switch (indexSize)
+		{
+		case 1: return Read<char>();
+		case 2: return Read<short>();
+		default: return Read<int>();
+		}
+	}
+	UINT PMXReader::ReadVertexIndex(int indexSize)
+	{
+		switch (indexSize)
+		{
+		case 1: return Read<unsigned char>();
+		case 2: return Read<USHORT>();
+		default: return Read<UINT>();
+		}
+	}
+	std::wstring PMXReader::ReadText(int textByteCount)
+	{
+		int length = Read<int>();
+		if (length < 0)
+			throw std::exception("Corrupted PMX data: negative text length");
+		Need(length);
+		std::wstring text;
+		if (textByteCount == 2)
 		{
-			src.read((char*)(&ch), byteCount);
-			dst += ch;
+			//an odd byte at the end is no character, but it is still skipped
+			text.resize(length / 2);
+			for (int i = 0; i < length / 2; i++)
+			{
+				USHORT ch;
+				memcpy(&ch, position + i * 2, 2);
+				text[i] = ch;
+			}
 		}
+		else
+			text = Utf8ToWStr(std::string(position, length).c_str());
+		position += length;
+		return text;
+	}
+	void PMXReader::SkipText()
+	{
+		int length = Read<int>();
+		if (length < 0)
+			throw std::exception("Corrupted PMX data: negative text length");
+		Skip(length);
 	}
 
+#pragma endregion
+
 	struct PMXHeader
 	{
 		char signature[4];
@@ -42,16 +105,26 @@ namespace gfx
 			globalCount(0),
 			globals() {}
 
-		void Read(std::istream& src)
+		void Read(PMXReader& src)
 		{
-			src.read(signature, 4);
-			src.read((char*)(&version), 4);
-			src.read(&globalCount, 1);
-			src.read(globals, globalCount);
-			ReadPMXText(src, localName, getTextByteCount());
-			ReadPMXText(src, universalName, getTextByteCount());
-			ReadPMXText(src, localComments, getTextByteCount());
-			ReadPMXText(src, universalComments, getTextByteCount());
+			src.Read(signature, 4);
+			if (memcmp(signature, "PMX ", 4) != 0)
+				throw std::exception("Corrupted PMX data: unknown file format");
+			src.Read(&version, 4);
+			src.Read(&globalCount, 1);
+			if (globalCount < 8)
+				throw std::exception("Corrupted PMX data: missing globals");
+			src.Read(globals, 8);
+			src.Skip(globalCount - 8);
+			if (globals[0] != 0 && globals[0] != 1 || globals[1] < 0 || globals[1] > 4)
+				throw std::exception("Corrupted PMX data: invalid globals");
+			for (int i = 2; i < 8; i++)
+				if (globals[i] != 1 && globals[i] != 2 && globals[i] != 4)
+					throw std::exception("Corrupted PMX data: invalid index size");
+			localName = src.ReadText(getTextByteCount());
+			universalName = src.ReadText(getTextByteCount());
+			localComments = src.ReadText(getTextByteCount());
+			universalComments = src.ReadText(getTextByteCount());
 		}
 
 		inline int getTextByteCount() { return 2 - globals[0]; }
@@ -87,57 +160,52 @@ namespace gfx
 			toonValue(0),
 			surfaceCount(0) {}
 
-		void Read(std::istream& src, int textByteCount, int texIndexSize)
+		void Read(PMXReader& src, int textByteCount, int texIndexSize)
 		{
-			ReadPMXText(src, localName, textByteCount);
-			ReadPMXText(src, universalName, textByteCount);
-			src.read((char*)& diffuseColor, 16);
-			src.read((char*)& specularColor, 12);
-			src.read((char*)& specularStrength, 4);
-			src.read((char*)& ambientColor, 12);
-			src.read((char*)& drawingFlags, 1);
-			src.read((char*)& edgeColor, 16);
-			src.read((char*)& edgeScale, 4);
-
-			switch (texIndexSize)
-			{
-			case 1:
-			{
-				char tmp;
-				src.read((char*)& tmp, texIndexSize);
-				textureIndex = tmp;
-				src.read((char*)& tmp, texIndexSize);
-				environmentIndex = tmp;
-				break;
-			}
-			case 2:
-			{
-				short tmp;
-				src.read((char*)& tmp, texIndexSize);
-				textureIndex = tmp;
-				src.read((char*)& tmp, texIndexSize);
-				environmentIndex = tmp;
-				break;
-			}
-			case 4:
-			{
-				int tmp;
-				src.read((char*)& tmp, texIndexSize);
-				textureIndex = tmp;
-				src.read((char*)& tmp, texIndexSize);
-				environmentIndex = tmp;
-				break;
-			}
-			}
-
-			src.read((char*)& environmentBlendMode, 1);
-			src.read((char*)& toonReference, 1);
+			localName = src.ReadText(textByteCount);
+			universalName = src.ReadText(textByteCount);
+			src.Read(&diffuseColor, 16);
+			src.Read(&specularColor, 12);
+			src.Read(&specularStrength, 4);
+			src.Read(&ambientColor, 12);
+			src.Read(&drawingFlags, 1);
+			src.Read(&edgeColor, 16);
+			src.Read(&edgeScale, 4);
+			textureIndex = src.ReadIndex(texIndexSize);
+			environmentIndex = src.ReadIndex(texIndexSize);
+			src.Read(&environmentBlendMode, 1);
+			src.Read(&toonReference, 1);
+			toonValue = src.ReadIndex(toonReference == 1 ? 1 : texIndexSize);
+			metaData = src.ReadText(textByteCount);
+			src.Read(&surfaceCount, 4);
+		}
+	};
 
-			src.read((char*)& toonValue, toonReference == 1 ? 1 : texIndexSize);
+	namespace PMXBoneFlag
+	{
+		enum Flag :USHORT
+		{
+			INDEXED_TAIL = 0x0001,
+			ROTATABLE = 0x0002,
+			TRANSLATABLE = 0x0004,
+			VISIBLE = 0x0008,
+			ENABLED = 0x0010,
+			IK = 0x0020,
+			INHERIT_ROTATION = 0x0100,
+			INHERIT_TRANSLATION = 0x0200,
+			FIXED_AXIS = 0x0400,
+			LOCAL_COORDINATE = 0x0800,
+			PHYSICS_AFTER_DEFORM = 0x1000,
+			EXTERNAL_PARENT = 0x2000
+		};
+	}
 
-			ReadPMXText(src, metaData, textByteCount);
-			src.read((char*)& surfaceCount, 4);
-		}
+	struct PMXIKLink
+	{
+		int boneIndex;
+		char hasLimits;
+		mth::float3 limitMin;
+		mth::float3 limitMax;
 	};
 
 	struct PMXBone
@@ -147,146 +215,532 @@ namespace gfx
 		mth::float3 pos;
 		int parentIndex;
 		int layer;
-		char flags[2];
-		union TailPos
+		USHORT flags;
+		int tailIndex;			//with INDEXED_TAIL
+		mth::float3 tailPos;	//without INDEXED_TAIL
+		int inheritIndex;
+		float inheritInfluence;
+		mth::float3 fixedAxis;
+		mth::float3 localX;
+		mth::float3 localZ;
+		int externalParent;
+		int ikTarget;
+		int ikLoopCount;
+		float ikLimitRadian;
+		std::vector<PMXIKLink> ikLinks;
+
+		PMXBone() :
+			parentIndex(-1),
+			layer(0),
+			flags(0),
+			tailIndex(-1),
+			inheritIndex(-1),
+			inheritInfluence(0.0f),
+			externalParent(0),
+			ikTarget(-1),
+			ikLoopCount(0),
+			ikLimitRadian(0.0f) {}
+
+		void Read(PMXReader& src, int textByteCount, int boneIndexSize)
 		{
-			mth::float3 f3;
-			int i;
-		};
-		TailPos tailPos;
+			localName = src.ReadText(textByteCount);
+			universalName = src.ReadText(textByteCount);
+			src.Read(&pos, 12);
+			parentIndex = src.ReadIndex(boneIndexSize);
+			src.Read(&layer, 4);
+			src.Read(&flags, 2);
+			if (flags & PMXBoneFlag::INDEXED_TAIL)
+				tailIndex = src.ReadIndex(boneIndexSize);
+			else
+				src.Read(&tailPos, 12);
+			if (flags & (PMXBoneFlag::INHERIT_ROTATION | PMXBoneFlag::INHERIT_TRANSLATION))
+			{
+				inheritIndex = src.ReadIndex(boneIndexSize);
+				src.Read(&inheritInfluence, 4);
+			}
+			if (flags & PMXBoneFlag::FIXED_AXIS)
+				src.Read(&fixedAxis, 12);
+			if (flags & PMXBoneFlag::LOCAL_COORDINATE)
+			{
+				src.Read(&localX, 12);
+				src.Read(&localZ, 12);
+			}
+			if (flags & PMXBoneFlag::EXTERNAL_PARENT)
+				src.Read(&externalParent, 4);
+			if (flags & PMXBoneFlag::IK)
+			{
+				ikTarget = src.ReadIndex(boneIndexSize);
+				src.Read(&ikLoopCount, 4);
+				src.Read(&ikLimitRadian, 4);
+				int linkCount = src.Read<int>();
+				if (linkCount < 0)
+					throw std::exception("Corrupted PMX data: negative IK link count");
+				for (int i = 0; i < linkCount; i++)
+				{
+					PMXIKLink link{};
+					link.boneIndex = src.ReadIndex(boneIndexSize);
+					src.Read(&link.hasLimits, 1);
+					if (link.hasLimits)
+					{
+						src.Read(&link.limitMin, 12);
+						src.Read(&link.limitMax, 12);
+					}
+					ikLinks.push_back(link);
+				}
+			}
+		}
 	};
 
-	void PMXLoader::LoadPMX(LPCWSTR filename, UINT modelType)
+	static int ReadBoneIndex(const char* src, int boneIndexSize)
 	{
-		std::ifstream infile;
-		infile.open(filename, std::ios::in | std::ios::binary);
-		if (infile.good())
+		switch (boneIndexSize)
 		{
-			PMXHeader header;
-			header.Read(infile);
-			PMXLoadVertexData(infile, header.globals[5], header.globals[1]);
-			PMXLoadIndexData(infile, header.globals[2]);
-			PMXLoadTextureNames(infile, header.getTextByteCount());
-			PMXLoadMaterials(infile, header.getTextByteCount(), header.globals[3]);
-			PMXLoadBones(infile, header.getTextByteCount(), header.globals[5]);
+		case 1: return *(const signed char*)src;
+		case 2: { short index; memcpy(&index, src, 2); return index; }
+		default: { int index; memcpy(&index, src, 4); return index; }
+		}
+	}
+
+	/* Writes up to 4 influences as normalized weights and bone indices. Influences of the same
+	bone are merged, negative bones and non-positive weights are dropped, unused slots are 0. */
+	static void StoreInfluences(VertexElement* dst, const int bones[4], const float weights[4], UINT count)
+	{
+		float w[4] = {};
+		UINT b[4] = {};
+		UINT used = 0;
+		float sum = 0.0f;
+		for (UINT i = 0; i < count; i++)
+		{
+			if (bones[i] < 0 || !(weights[i] > 0.0f))
+				continue;
+			UINT slot = 0;
+			while (slot < used && b[slot] != (UINT)bones[i])
+				slot++;
+			if (slot == used)
+				b[used++] = bones[i];
+			w[slot] += weights[i];
+			sum += weights[i];
+		}
+		float scale = sum > 0.0f ? 1.0f / sum : 0.0f;
+		for (UINT i = 0; i < 4; i++)
+		{
+			dst[i] = w[i] * scale;
+			dst[4 + i] = b[i];
+		}
+	}
+
+	/* PMX weight deform: BDEF1, BDEF2, BDEF4, SDEF, QDEF.
+	SDEF is blended linearly like BDEF2 and QDEF like BDEF4, the SDEF parameters are skipped. */
+	static void DecodeWeightDeform(VertexElement* dst, const char* src, int deformType, int boneIndexSize)
+	{
+		int bones[4];
+		float weights[4];
+		UINT count = deformType == 0 ? 1 : (deformType == 2 || deformType == 4 ? 4 : 2);
+		for (UINT i = 0; i < count; i++)
+			bones[i] = ReadBoneIndex(src + i * boneIndexSize, boneIndexSize);
+		src += count * boneIndexSize;
+		if (count == 1)
+			weights[0] = 1.0f;
+		else if (count == 2)
+		{
+			memcpy(weights, src, 4);
+			weights[1] = 1.0f - weights[0];
 		}
 		else
-			throw std::exception(("Could not open file: " + ToStr(filename)).c_str());
-		infile.close();
+			memcpy(weights, src, 16);
+		StoreInfluences(dst, bones, weights, count);
+	}
+
+	void PMXLoader::LoadPMX(LPCWSTR filename, UINT modelType)
+	{
+		MappedFile file(filename);
+		LoadPMX(file.getData(), file.getSize(), modelType);
+	}
+	void PMXLoader::LoadPMX(const char* data, size_t size, UINT modelType)
+	{
+		BeginProgress(LoadStage::READ, size);
+		PMXReader reader{ data, data + size };
+		PMXHeader header;
+		header.Read(reader);
+		SetProgress(reader.position - data);
+		PMXLoadVertexData(reader, header.globals[5], header.globals[1], modelType);
+		SetProgress(reader.position - data);
+		PMXLoadIndexData(reader, header.globals[2]);
+		PMXLoadTextureNames(reader, header.getTextByteCount());
+		PMXLoadMaterials(reader, header.getTextByteCount(), header.globals[3]);
+		SetProgress(reader.position - data);
+		std::vector<int> boneRemap = PMXLoadBones(reader, header.getTextByteCount(), header.globals[5]);
+		SetProgress(reader.position - data);
+		PMXLoadMorphs(reader, header, boneRemap);
+		SetProgress(reader.position - data);
 	}
 
-	void PMXLoader::PMXLoadVertexData(std::ifstream& file, int boneIndexSize, int extradata)
+	void PMXLoader::PMXLoadVertexData(PMXReader& reader, int boneIndexSize, int extradata, UINT modelType)
 	{
-		int vertexCount;
-		file.read((char*)(&vertexCount), 4);
-		struct Vertex
+		/* Vertex records differ in size by their weight deform type, they are walked once
+		to find where each chunk starts, then the chunks are decoded in parallel.
+		Record: position 3, normal 3, uv 2, extradata float4s, deform type, deform data, edge scale */
+		int vertexCount = reader.Read<int>();
+		if (vertexCount < 0)
+			throw std::exception("Corrupted PMX data: negative vertex count");
+		const size_t deformSize[] = { (size_t)boneIndexSize, 2 * (size_t)boneIndexSize + 4, 4 * (size_t)boneIndexSize + 16,
+			2 * (size_t)boneIndexSize + 4 + 3 * 3 * 4, 4 * (size_t)boneIndexSize + 16 };
+		const size_t fixedSize = 8 * sizeof(float) + extradata * sizeof(mth::float4);
+
+		std::vector<const char*> chunkStarts((vertexCount + PMXVertexChunkSize - 1) / PMXVertexChunkSize);
+		for (int i = 0; i < vertexCount; i++)
 		{
-			mth::float3 pos;
-			mth::float3 normal;
-			mth::float2 uv;
-			std::vector<mth::float4> additional;
-			char weightDeformType;
-			std::vector<char> weightDeform;
-			float edgeScale;
-
-			void Read(std::ifstream& src, int boneIndexSize, int extradata)
+			if (i % PMXVertexChunkSize == 0)
 			{
-				src.read((char*)(&pos), sizeof(pos));
-				src.read((char*)(&normal), sizeof(normal));
-				src.read((char*)(&uv), sizeof(uv));
-				if (extradata)
-				{
-					additional.resize(extradata);
-					src.read((char*)additional.data(), sizeof(mth::float4) * extradata);
-				}
-				src.read((char*)(&weightDeformType), sizeof(weightDeformType));
-				int deformSize[] = { boneIndexSize, 2 * boneIndexSize + 4, 4 * boneIndexSize + 16, 2 * boneIndexSize + 4 + 3 * 3 * 4, 4 * boneIndexSize + 16 };
-				weightDeform.resize(deformSize[weightDeformType]);
-				src.read((char*)(weightDeform.data()), deformSize[weightDeformType]);
-				short ind;
-				memcpy(&ind, weightDeform.data(), 2);
-				src.read((char*)(&edgeScale), sizeof(edgeScale));
+				CheckCanceled();
+				chunkStarts[i / PMXVertexChunkSize] = reader.position;
 			}
-		};
+			reader.Need(fixedSize + 1);
+			unsigned char deformType = (unsigned char)reader.position[fixedSize];
+			if (deformType >= sizeof(deformSize) / sizeof(deformSize[0]))
+				throw std::exception("Corrupted PMX data: unknown weight deform type");
+			reader.Skip(fixedSize + 1 + deformSize[deformType] + sizeof(float));
+		}
+		chunkStarts.push_back(reader.position);	//end of the last chunk
 
-		m_modelType = ModelType::PTN;
+		m_modelType = ModelType::RemoveUnnecessary((ModelType::PTN | ModelType::BONE) & modelType);
 		m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
-		m_vertices.resize(vertexCount * ModelType::VertexSizeInVertexElements(m_modelType));
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(m_modelType);
+		m_vertices.resize((size_t)vertexCount * vertexSize);
+		if (vertexSize == 0)
+			return;
+		bool hasTexcoords = ModelType::HasTexcoords(m_modelType);
+		bool hasNormals = ModelType::HasNormals(m_modelType);
+		bool hasBones = ModelType::HasBones(m_modelType);
+		UINT texcoordOffset = ModelType::TexCoordOffset(m_modelType);
+		UINT normalOffset = ModelType::NormalOffset(m_modelType);
+		UINT boneOffset = ModelType::BoneWeightsOffset(m_modelType);
 
-		int vertexCounter = 0;
-		Vertex v;
-		for (int i = 0; i < vertexCount; i++)
-		{
-			v.Read(file, boneIndexSize, extradata);
-			m_vertices[vertexCounter++] = v.pos.x;
-			m_vertices[vertexCounter++] = v.pos.y;
-			m_vertices[vertexCounter++] = v.pos.z;
-			m_vertices[vertexCounter++] = v.uv.x;
-			m_vertices[vertexCounter++] = v.uv.y;
-			m_vertices[vertexCounter++] = v.normal.x;
-			m_vertices[vertexCounter++] = v.normal.y;
-			m_vertices[vertexCounter++] = v.normal.z;
-		}
+		ParallelFor((UINT)chunkStarts.size() - 1, [&](UINT chunk) {
+			const char* src = chunkStarts[chunk];
+			UINT first = chunk * PMXVertexChunkSize;
+			UINT count = (std::min)(PMXVertexChunkSize, (UINT)vertexCount - first);
+			VertexElement* dst = m_vertices.data() + (size_t)first * vertexSize;
+			for (UINT i = 0; i < count; i++, dst += vertexSize)
+			{
+				float record[8];
+				memcpy(record, src, sizeof(record));
+				dst[0] = record[0];
+				dst[1] = record[1];
+				dst[2] = record[2];
+				if (hasTexcoords)
+				{
+					dst[texcoordOffset + 0] = record[6];
+					dst[texcoordOffset + 1] = record[7];
+				}
+				if (hasNormals)
+				{
+					dst[normalOffset + 0] = record[3];
+					dst[normalOffset + 1] = record[4];
+					dst[normalOffset + 2] = record[5];
+				}
+				src += fixedSize;
+				int deformType = (unsigned char)*src;
+				if (hasBones)
+					DecodeWeightDeform(dst + boneOffset, src + 1, deformType, boneIndexSize);
+				src += 1 + deformSize[deformType] + sizeof(float);
+			}
+			AdvanceProgress(chunkStarts[chunk + 1] - chunkStarts[chunk]);
+			});
 	}
 
-	void PMXLoader::PMXLoadIndexData(std::ifstream& file, int indexSize)
+	void PMXLoader::PMXLoadIndexData(PMXReader& reader, int indexSize)
 	{
-		int indexCount;
-		file.read((char*)(&indexCount), sizeof(indexCount));
+		int indexCount = reader.Read<int>();
+		if (indexCount < 0)
+			throw std::exception("Corrupted PMX data: negative index count");
+		reader.Need((size_t)indexCount * indexSize);
 		m_indices.resize(indexCount);
-		union Index
-		{
-			int i;
-			unsigned short s[2];
-			unsigned char ch[4];
-		};
-		Index index;
-		index.i = 0;
-		for (int i = 0; i < indexCount; i++)
+		const char* src = reader.position;
+		switch (indexSize)
 		{
-			file.read((char*)(index.ch), indexSize);
-			m_indices[i] = index.i;
+		case 1:
+			for (int i = 0; i < indexCount; i++)
+				m_indices[i] = (unsigned char)src[i];
+			break;
+		case 2:
+			for (int i = 0; i < indexCount; i++)
+			{
+				USHORT index;
+				memcpy(&index, src + i * 2, 2);
+				m_indices[i] = index;
+			}
+			break;
+		default:
+			memcpy(m_indices.data(), src, (size_t)indexCount * 4);
+			break;
 		}
+		reader.position += (size_t)indexCount * indexSize;
+
+		UINT vertexCount = m_vertexSizeInBytes ? getVertexCount() : 0;
+		UINT largest = 0;
+		for (UINT index : m_indices)
+			largest = (std::max)(largest, index);
+		if (indexCount > 0 && largest >= vertexCount)
+			throw std::exception("Corrupted PMX data: index out of range");
 	}
 
-	void PMXLoader::PMXLoadTextureNames(std::ifstream& file, int textByteCount)
+	void PMXLoader::PMXLoadTextureNames(PMXReader& reader, int textByteCount)
 	{
-		int textureCount;
-		file.read((char*)& textureCount, 4);
+		int textureCount = reader.Read<int>();
 		for (int i = 0; i < textureCount; i++)
 		{
-			std::wstring str;
-			ReadPMXText(file, str, textByteCount);
-			m_textures.push_back(TextureToLoad(str.c_str()));
+			if (ModelType::HasTexture(m_modelType))
+				m_textures.push_back(TextureToLoad(reader.ReadText(textByteCount).c_str()));
+			else
+			{
+				reader.SkipText();
+				m_textures.push_back(TextureToLoad());
+			}
 			m_normalmaps.push_back(TextureToLoad());
 		}
 		m_textures.push_back(TextureToLoad());
 		m_normalmaps.push_back(TextureToLoad());
 	}
 
-	void PMXLoader::PMXLoadMaterials(std::ifstream& file, int textByteCount, int texIndexSize)
+	void PMXLoader::PMXLoadMaterials(PMXReader& reader, int textByteCount, int texIndexSize)
 	{
-		int materialCount;
-		file.read((char*)& materialCount, 4);
-		int indexCounter = 0;
+		int materialCount = reader.Read<int>();
+		UINT64 indexCounter = 0;
 		for (int i = 0; i < materialCount; i++)
 		{
 			PMXMaterial mat;
-			mat.Read(file, textByteCount, texIndexSize);
+			mat.Read(reader, textByteCount, texIndexSize);
+			if (mat.surfaceCount < 0 || indexCounter + mat.surfaceCount > m_indices.size())
+				throw std::exception("Corrupted PMX data: materials use more indices than the file");
 
 			VertexGroup vg;
-			vg.startIndex = indexCounter;
+			vg.startIndex = (UINT)indexCounter;
 			vg.indexCount = mat.surfaceCount;
-			vg.materialIndex = mat.textureIndex < 0 ? (int)m_textures.size() - 1 : mat.textureIndex;
+			vg.materialIndex = mat.textureIndex < 0 || mat.textureIndex >= (int)m_textures.size() - 1 ? (int)m_textures.size() - 1 : mat.textureIndex;
 			m_groups.push_back(vg);
 			indexCounter += vg.indexCount;
 		}
 	}
 
-	void PMXLoader::PMXLoadBones(std::ifstream& file, int textByteCount, int indexSize)
+	std::vector<int> PMXLoader::PMXLoadBones(PMXReader& reader, int textByteCount, int indexSize)
 	{
-		int boneCount;
-		file.read((char*)& boneCount, 4);
+		int boneCount = reader.Read<int>();
+		if (boneCount < 0)
+			throw std::exception("Corrupted PMX data: negative bone count");
+		std::vector<PMXBone> pmxBones(boneCount);
+		for (PMXBone& bone : pmxBones)
+			bone.Read(reader, textByteCount, indexSize);
+
+		/* PMX lists bones in any order, the skeleton is sorted depth first so parents come
+		before their children. Invalid parents make roots, cycles are broken at their first bone. */
+		std::vector<int> parents(boneCount);
+		std::vector<std::vector<int>> children(boneCount);
+		for (int i = 0; i < boneCount; i++)
+		{
+			int parent = pmxBones[i].parentIndex;
+			parents[i] = parent >= 0 && parent < boneCount && parent != i ? parent : -1;
+			if (parents[i] >= 0)
+				children[parents[i]].push_back(i);
+		}
+		std::vector<int> order;
+		std::vector<int> remap(boneCount, -1);
+		std::vector<int> stack;
+		auto visit = [&](int root) {
+			stack.push_back(root);
+			while (!stack.empty())
+			{
+				int bone = stack.back();
+				stack.pop_back();
+				remap[bone] = (int)order.size();
+				order.push_back(bone);
+				for (auto child = children[bone].rbegin(); child != children[bone].rend(); child++)
+					stack.push_back(*child);
+			}
+		};
+		for (int i = 0; i < boneCount; i++)
+			if (parents[i] < 0)
+				visit(i);
+		//the bones not reached are in cycles or below one, a cycle stops at the bone it was broken at
+		for (int i = 0; i < boneCount; i++)
+			if (remap[i] < 0)
+			{
+				std::vector<int>& siblings = children[parents[i]];
+				siblings.erase(std::find(siblings.begin(), siblings.end(), i));
+				parents[i] = -1;
+				visit(i);
+			}
 
+		m_bones.resize(boneCount);
+		for (int i = 0; i < boneCount; i++)
+		{
+			const PMXBone& src = pmxBones[order[i]];
+			Bone& bone = m_bones[i];
+			bone.name = src.localName.empty() ? src.universalName : src.localName;
+			int parent = parents[order[i]];
+			bone.parent = parent < 0 ? -1 : remap[parent];
+			bone.translation = parent < 0 ? src.pos : src.pos - pmxBones[parent].pos;
+		}
+
+		if (!ModelType::HasBones(m_modelType))
+			return remap;
+		if (boneCount == 0)
+		{
+			UINT modelType = m_modelType & ~ModelType::BONE;
+			std::vector<VertexElement> vertices((size_t)getVertexCount() * ModelType::VertexSizeInVertexElements(modelType));
+			TranscodeVertices(m_vertices.data(), m_modelType, vertices.data(), modelType, getVertexCount());
+			m_vertices.swap(vertices);
+			m_modelType = modelType;
+			m_vertexSizeInBytes = ModelType::VertexSizeInBytes(m_modelType);
+			return remap;
+		}
+
+		UINT vertexSize = getVertexSizeInFloats();
+		UINT boneOffset = ModelType::BoneWeightsOffset(m_modelType);
+		UINT vertexCount = getVertexCount();
+		ParallelFor((vertexCount + PMXVertexChunkSize - 1) / PMXVertexChunkSize, [&](UINT chunk) {
+			UINT first = chunk * PMXVertexChunkSize;
+			UINT count = (std::min)(PMXVertexChunkSize, vertexCount - first);
+			VertexElement* dst = m_vertices.data() + (size_t)first * vertexSize + boneOffset;
+			for (UINT i = 0; i < count; i++, dst += vertexSize)
+			{
+				int bones[4];
+				float weights[4];
+				for (UINT w = 0; w < 4; w++)
+				{
+					bones[w] = dst[4 + w].u < (UINT)boneCount ? remap[dst[4 + w].u] : -1;
+					weights[w] = dst[w].f;
+				}
+				StoreInfluences(dst, bones, weights, 4);
+			}
+			});
+		return remap;
+	}
+
+	void PMXLoader::PMXLoadMorphs(PMXReader& reader, PMXHeader& header, const std::vector<int>& boneRemap)
+	{
+		enum MorphKind { GROUP, VERTEX, BONE, UV, UV1, UV2, UV3, UV4, MATERIAL, FLIP, IMPULSE };
+		struct GroupOffset
+		{
+			int morph;
+			float weight;
+		};
+
+		if (reader.position == reader.end)	//some exporters stop after the bones
+			return;
+		int morphCount = reader.Read<int>();
+		if (morphCount < 0)
+			throw std::exception("Corrupted PMX data: negative morph count");
+		UINT vertexCount = m_vertexSizeInBytes ? getVertexCount() : 0;
+		int boneCount = (int)boneRemap.size();
+		std::vector<Morph> morphs(morphCount);
+		std::vector<char> kinds(morphCount);
+		std::vector<std::vector<GroupOffset>> groups(morphCount);
+		for (int m = 0; m < morphCount; m++)
+		{
+			Morph& morph = morphs[m];
+			std::wstring localName = reader.ReadText(header.getTextByteCount());
+			std::wstring universalName = reader.ReadText(header.getTextByteCount());
+			morph.name = localName.empty() ? universalName : localName;
+			reader.Skip(1);	//panel
+			kinds[m] = reader.Read<char>();
+			int offsetCount = reader.Read<int>();
+			if (offsetCount < 0)
+				throw std::exception("Corrupted PMX data: negative morph offset count");
+			for (int o = 0; o < offsetCount; o++)
+			{
+				switch (kinds[m])
+				{
+				case GROUP:
+				case FLIP:
+				{
+					GroupOffset offset;
+					offset.morph = reader.ReadIndex(header.globals[6]);
+					offset.weight = reader.Read<float>();
+					if (kinds[m] == GROUP)
+						groups[m].push_back(offset);
+					break;
+				}
+				case VERTEX:
+				{
+					MorphDelta delta{};
+					delta.vertex = reader.ReadVertexIndex(header.globals[2]);
+					reader.Read(&delta.position, 12);
+					if (delta.vertex < vertexCount)
+						morph.deltas.push_back(delta);
+					break;
+				}
+				case BONE:
+				{
+					int bone = reader.ReadIndex(header.globals[5]);
+					MorphBoneDelta delta;
+					reader.Read(&delta.translation, 12);
+					reader.Read(&delta.rotation, 16);
+					if (bone >= 0 && bone < boneCount)
+					{
+						delta.bone = boneRemap[bone];
+						morph.boneDeltas.push_back(delta);
+					}
+					break;
+				}
+				case UV:
+				{
+					MorphDelta delta{};
+					delta.vertex = reader.ReadVertexIndex(header.globals[2]);
+					reader.Read(&delta.texcoord, 8);
+					reader.Skip(8);
+					if (delta.vertex < vertexCount && ModelType::HasTexcoords(m_modelType))
+						morph.deltas.push_back(delta);
+					break;
+				}
+				case UV1:
+				case UV2:
+				case UV3:
+				case UV4:
+					reader.ReadVertexIndex(header.globals[2]);
+					reader.Skip(16);
+					break;
+				case MATERIAL:
+					reader.ReadIndex(header.globals[4]);
+					reader.Skip(1 + 28 * sizeof(float));
+					break;
+				case IMPULSE:
+					reader.ReadIndex(header.globals[7]);
+					reader.Skip(1 + 6 * sizeof(float));
+					break;
+				default:
+					throw std::exception("Corrupted PMX data: unknown morph type");
+				}
+			}
+		}
+
+		//group morphs become the weighted sum of the vertex, uv and bone morphs they reference
+		for (int m = 0; m < morphCount; m++)
+			for (GroupOffset& offset : groups[m])
+			{
+				if (offset.morph < 0 || offset.morph >= morphCount || kinds[offset.morph] < VERTEX || kinds[offset.morph] > UV)
+					continue;
+				for (MorphDelta delta : morphs[offset.morph].deltas)
+				{
+					delta.position *= offset.weight;
+					delta.texcoord *= offset.weight;
+					morphs[m].deltas.push_back(delta);
+				}
+				for (MorphBoneDelta delta : morphs[offset.morph].boneDeltas)
+				{
+					delta.translation *= offset.weight;
+					delta.rotation = NormalizedLerp(mth::quaternion(1.0f), delta.rotation, offset.weight);
+					morphs[m].boneDeltas.push_back(delta);
+				}
+			}
+
+		for (int m = 0; m < morphCount; m++)
+		{
+			if (kinds[m] > UV)
+				continue;
+			SortMorphDeltas(morphs[m]);
+			if (!morphs[m].deltas.empty() || !morphs[m].boneDeltas.empty())
+				m_morphs.push_back(std::move(morphs[m]));
+		}
 	}
 }
\ No newline at end of file
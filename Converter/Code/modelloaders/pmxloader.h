@@ -4,16 +4,39 @@
 
 namespace gfx
 {
+	/* Bounds checked reader over a PMX file in memory, throws at the end of the data */
+	struct PMXReader
+	{
+		const char* position;
+		const char* end;
+
+		void Need(size_t byteCount);
+		void Read(void* dst, size_t byteCount);
+		void Skip(size_t byteCount);
+		int ReadIndex(int indexSize);		//signed, -1 is no reference
+		UINT ReadVertexIndex(int indexSize);	//unsigned for 1 and 2 byte indices
+		std::wstring ReadText(int textByteCount);
+		void SkipText();
+
+		template <typename T>
+		inline T Read() { T value; Read(&value, sizeof(T)); return value; }
+	};
+
+	struct PMXHeader;
+
 	class PMXLoader :public ModelLoader
 	{
 	private:
-		void PMXLoadVertexData(std::ifstream& file, int boneIndexSize, int extradata);
-		void PMXLoadIndexData(std::ifstream& file, int indexSize);
-		void PMXLoadTextureNames(std::ifstream& file, int textByteCount);
-		void PMXLoadMaterials(std::ifstream& file, int textByteCount, int texIndexSize);
-		void PMXLoadBones(std::ifstream& file, int textByteCount, int indexSize);
+		void PMXLoadVertexData(PMXReader& reader, int boneIndexSize, int extradata, UINT modelType);
+		void PMXLoadIndexData(PMXReader& reader, int indexSize);
+		void PMXLoadTextureNames(PMXReader& reader, int textByteCount);
+		void PMXLoadMaterials(PMXReader& reader, int textByteCount, int texIndexSize);
+		/* returns the index in m_bones for every PMX bone */
+		std::vector<int> PMXLoadBones(PMXReader& reader, int textByteCount, int indexSize);
+		void PMXLoadMorphs(PMXReader& reader, PMXHeader& header, const std::vector<int>& boneRemap);
 
 	public:
 		void LoadPMX(LPCWSTR filename, UINT modelType);
+		void LoadPMX(const char* data, size_t size, UINT modelType);
 	};
 }
\ No newline at end of file
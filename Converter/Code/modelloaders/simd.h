@@ -0,0 +1,36 @@
+#pragma once
+
+#include <xmmintrin.h>
+
+namespace gfx
+{
+	/* SSE helpers for 3 and 2 component vertex attributes, they never touch the float after them */
+	namespace simd
+	{
+		inline __m128 Load3(const float* v)
+		{
+			return _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)v), _mm_load_ss(v + 2));
+		}
+		inline void Store3(float* v, __m128 value)
+		{
+			_mm_storel_pi((__m64*)v, value);
+			_mm_store_ss(v + 2, _mm_movehl_ps(value, value));
+		}
+		inline __m128 Load2(const float* v)
+		{
+			return _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)v);
+		}
+		inline void Store2(float* v, __m128 value)
+		{
+			_mm_storel_pi((__m64*)v, value);
+		}
+		inline __m128 Normalize3(__m128 v)
+		{
+			__m128 sq = _mm_mul_ps(v, v);
+			__m128 dot = _mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(sq, sq));
+			if (_mm_cvtss_f32(dot) <= 0.0f)
+				return v;
+			return _mm_div_ps(v, _mm_sqrt_ps(_mm_shuffle_ps(dot, dot, _MM_SHUFFLE(0, 0, 0, 0))));
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "skinning.h"
+#include "simd.h"
+#include <chrono>
+
+namespace gfx
+{
+	namespace
+	{
+		const size_t SkinningChunkSize = 4096;
+
+		struct SkinningLayout
+		{
+			UINT vertexSize;
+			UINT position;
+			UINT normal;
+			UINT tangent;
+			UINT binormal;
+			UINT boneWeights;
+			UINT boneIndex;
+			bool hasPosition;
+			bool hasNormal;
+			bool hasTangent;
+		};
+
+		/* matrix columns without the projective row, the blended matrix is affine */
+		struct PaletteEntry
+		{
+			__m128 column[4];
+		};
+
+		inline __m128 Splat(__m128 v, int i)
+		{
+			switch (i)
+			{
+			case 0: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+			case 1: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+			default: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+			}
+		}
+		inline __m128 TransformDirection(const PaletteEntry& m, __m128 v)
+		{
+			return _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(m.column[0], Splat(v, 0)),
+				_mm_mul_ps(m.column[1], Splat(v, 1))),
+				_mm_mul_ps(m.column[2], Splat(v, 2)));
+		}
+		inline __m128 Cross(__m128 a, __m128 b)
+		{
+			__m128 ayzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 byzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 c = _mm_sub_ps(_mm_mul_ps(a, byzx), _mm_mul_ps(ayzx, b));
+			return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+		}
+		/* normals move with the inverse transpose of the blended matrix, the cofactor matrix is
+		that times the determinant and needs no division. Only the sign of the determinant is kept,
+		the normal is normalized afterwards. */
+		inline __m128 TransformNormal(const PaletteEntry& m, __m128 n)
+		{
+			__m128 c0 = Cross(m.column[1], m.column[2]);
+			__m128 c1 = Cross(m.column[2], m.column[0]);
+			__m128 c2 = Cross(m.column[0], m.column[1]);
+			__m128 d = _mm_mul_ps(m.column[0], c0);
+			float determinant = _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(d, d)));
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, Splat(n, 0)), _mm_mul_ps(c1, Splat(n, 1))), _mm_mul_ps(c2, Splat(n, 2)));
+			return determinant < 0.0f ? _mm_sub_ps(_mm_setzero_ps(), r) : r;
+		}
+		void SkinChunk(const VertexElement* src, VertexElement* dst, const SkinningLayout& layout, size_t vertexCount,
+			const PaletteEntry* palette, UINT boneCount)
+		{
+			for (size_t i = 0; i < vertexCount; i++, src += layout.vertexSize, dst += layout.vertexSize)
+			{
+				if (src != dst)
+					memcpy(dst, src, layout.vertexSize * sizeof(VertexElement));
+
+				PaletteEntry m;
+				for (UINT c = 0; c < 4; c++)
+					m.column[c] = _mm_setzero_ps();
+				float weightSum = 0.0f;
+				for (UINT b = 0; b < 4; b++)
+				{
+					UINT bone = src[layout.boneIndex + b].u;
+					float weight = src[layout.boneWeights + b].f;
+					if (bone >= boneCount || !(weight > 0.0f))
+						continue;
+					__m128 w = _mm_set1_ps(weight);
+					for (UINT c = 0; c < 4; c++)
+						m.column[c] = _mm_add_ps(m.column[c], _mm_mul_ps(palette[bone].column[c], w));
+					weightSum += weight;
+				}
+				if (weightSum <= 0.0f)
+					continue;
+				if (weightSum != 1.0f)
+				{
+					__m128 scale = _mm_set1_ps(1.0f / weightSum);
+					for (UINT c = 0; c < 4; c++)
+						m.column[c] = _mm_mul_ps(m.column[c], scale);
+				}
+
+				if (layout.hasPosition)
+					simd::Store3(&dst[layout.position].f, _mm_add_ps(TransformDirection(m, simd::Load3(&src[layout.position].f)), m.column[3]));
+				if (layout.hasNormal)
+					simd::Store3(&dst[layout.normal].f, simd::Normalize3(TransformNormal(m, simd::Load3(&src[layout.normal].f))));
+				if (layout.hasTangent)
+				{
+					simd::Store3(&dst[layout.tangent].f, simd::Normalize3(TransformDirection(m, simd::Load3(&src[layout.tangent].f))));
+					simd::Store3(&dst[layout.binormal].f, simd::Normalize3(TransformDirection(m, simd::Load3(&src[layout.binormal].f))));
+				}
+			}
+		}
+	}
+
+	void InverseBindMatrices(const std::vector<Bone>& bones, mth::float4x4* inverseBind)
+	{
+		std::vector<BonePose> pose(bones.size());
+		BindPose(bones, pose.data());
+		PoseToModelSpace(bones, pose.data(), inverseBind);
+		for (size_t i = 0; i < bones.size(); i++)
+		{
+			if (bones[i].hasOffset)
+				inverseBind[i] = bones[i].offset;
+			else
+				inverseBind[i].Invert();
+		}
+	}
+
+	void SkinningMatrices(const std::vector<Bone>& bones, const BonePose* pose, const mth::float4x4* inverseBind, mth::float4x4* palette)
+	{
+		PoseToModelSpace(bones, pose, palette);
+		for (size_t i = 0; i < bones.size(); i++)
+			palette[i] *= inverseBind[i];
+	}
+
+	void SkinVertices(const VertexElement* src, VertexElement* dst, UINT modelType, size_t vertexCount,
+		const mth::float4x4* palette, UINT boneCount, SkinningStatistics* statistics)
+	{
+		if (!ModelType::HasBones(modelType))
+			throw std::exception("Skinning needs bone weights and indices");
+		auto start = std::chrono::steady_clock::now();
+
+		SkinningLayout layout;
+		layout.vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		layout.position = ModelType::PositionOffset(modelType);
+		layout.normal = ModelType::NormalOffset(modelType);
+		layout.tangent = ModelType::TangentOffset(modelType);
+		layout.binormal = ModelType::BinormalOffset(modelType);
+		layout.boneWeights = ModelType::BoneWeightsOffset(modelType);
+		layout.boneIndex = ModelType::BoneIndexOffset(modelType);
+		layout.hasPosition = ModelType::HasPositions(modelType);
+		layout.hasNormal = ModelType::HasNormals(modelType);
+		layout.hasTangent = ModelType::HasTangentsBinormals(modelType);
+
+		std::vector<PaletteEntry> entries(boneCount);
+		for (UINT b = 0; b < boneCount; b++)
+			for (int c = 0; c < 4; c++)
+				entries[b].column[c] = _mm_setr_ps(palette[b](0, c), palette[b](1, c), palette[b](2, c), 0.0f);
+
+		UINT chunkCount = (UINT)((vertexCount + SkinningChunkSize - 1) / SkinningChunkSize);
+		ParallelFor(chunkCount, [&](UINT chunk) {
+			size_t first = chunk * SkinningChunkSize;
+			size_t count = (std::min)(SkinningChunkSize, vertexCount - first);
+			SkinChunk(src + first * layout.vertexSize, dst + first * layout.vertexSize, layout, count, entries.data(), boneCount);
+			});
+
+		if (statistics)
+		{
+			statistics->vertexCount = vertexCount;
+			statistics->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "graphics/shaderbase.h"
+#include "animation.h"
+
+namespace gfx
+{
+	struct SkinningStatistics
+	{
+		UINT64 vertexCount;	//vertices skinned by the last call
+		double seconds;		//time spent in SkinVertices
+
+		inline double getVerticesPerSecond() { return seconds > 0.0 ? vertexCount / seconds : 0.0; }
+	};
+
+	/* inverseBind[i] maps from model space to the space of bone i in the bind pose,
+	the offset matrix of the bone when it has one, the inverted bind pose otherwise */
+	void InverseBindMatrices(const std::vector<Bone>& bones, mth::float4x4* inverseBind);
+	/* palette[i] moves a bind pose vertex bound to bone i to its place in pose */
+	void SkinningMatrices(const std::vector<Bone>& bones, const BonePose* pose, const mth::float4x4* inverseBind, mth::float4x4* palette);
+
+	/* Linear blend skinning of vertexCount vertices in the layout of modelType, which must have bones.
+	Positions, tangents and binormals are transformed by the weighted sum of the palette
+	matrices of their four bones, normals by its inverse transpose, every other attribute is copied. Weights are renormalized over
+	the bones below boneCount, vertices without such weights keep their bind pose.
+	The vertices are blended with SSE in chunks spread over the cores, src may equal dst. */
+	void SkinVertices(const VertexElement* src, VertexElement* dst, UINT modelType, size_t vertexCount,
+		const mth::float4x4* palette, UINT boneCount, SkinningStatistics* statistics = nullptr);
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "vertexlayout.h"
+#include <array>
+#include <utility>
+#include <xmmintrin.h>
+
+namespace gfx
+{
+	namespace
+	{
+		const UINT LayoutCount = 32;
+		const UINT AttributeCount = 5;
+		constexpr UINT AttributeParts[AttributeCount] = {
+			ModelType::POSITION, ModelType::TEXCOORD, ModelType::NORMAL, ModelType::TANGENT_BINORMAL, ModelType::BONE };
+		constexpr UINT AttributeSizes[AttributeCount] = { 3, 2, 3, 6, 8 };
+
+		struct LayoutRun
+		{
+			UINT src;
+			UINT dst;
+			UINT count;
+			bool zero;	//attribute is missing from the source
+		};
+		struct LayoutRuns
+		{
+			LayoutRun runs[AttributeCount];
+			UINT count;
+			UINT srcSize;
+			UINT dstSize;
+		};
+
+		/* Attributes next to each other in both layouts are merged into one run */
+		constexpr LayoutRuns MakeRuns(UINT srcLayout, UINT dstLayout)
+		{
+			LayoutRuns table{};
+			UINT srcOffset = 0;
+			UINT dstOffset = 0;
+			for (UINT a = 0; a < AttributeCount; a++)
+			{
+				bool inSrc = (srcLayout & AttributeParts[a]) != 0;
+				bool inDst = (dstLayout & AttributeParts[a]) != 0;
+				if (inDst)
+				{
+					bool extend = false;
+					if (table.count > 0)
+					{
+						const LayoutRun& last = table.runs[table.count - 1];
+						extend = last.zero == !inSrc && last.dst + last.count == dstOffset &&
+							(!inSrc || last.src + last.count == srcOffset);
+					}
+					if (extend)
+						table.runs[table.count - 1].count += AttributeSizes[a];
+					else
+						table.runs[table.count++] = { srcOffset, dstOffset, AttributeSizes[a], !inSrc };
+					dstOffset += AttributeSizes[a];
+				}
+				if (inSrc)
+					srcOffset += AttributeSizes[a];
+			}
+			table.srcSize = srcOffset;
+			table.dstSize = dstOffset;
+			return table;
+		}
+
+		template <UINT Count>
+		inline void CopyRun(const float* src, float* dst)
+		{
+			for (UINT i = 0; i + 4 <= Count; i += 4)
+				_mm_storeu_ps(dst + i, _mm_loadu_ps(src + i));
+			if constexpr (Count % 4 != 0)
+				memcpy(dst + Count / 4 * 4, src + Count / 4 * 4, Count % 4 * sizeof(float));
+		}
+		template <UINT Count>
+		inline void ZeroRun(float* dst)
+		{
+			for (UINT i = 0; i + 4 <= Count; i += 4)
+				_mm_storeu_ps(dst + i, _mm_setzero_ps());
+			if constexpr (Count % 4 != 0)
+				memset(dst + Count / 4 * 4, 0, Count % 4 * sizeof(float));
+		}
+
+		template <UINT Src, UINT Dst, size_t Run>
+		inline void TranscodeRun(const float* src, float* dst)
+		{
+			constexpr LayoutRun run = MakeRuns(Src, Dst).runs[Run];
+			if constexpr (run.zero)
+				ZeroRun<run.count>(dst + run.dst);
+			else
+				CopyRun<run.count>(src + run.src, dst + run.dst);
+		}
+		template <UINT Src, UINT Dst, size_t... Runs>
+		void TranscodeRuns(const VertexElement* src, VertexElement* dst, size_t vertexCount, std::index_sequence<Runs...>)
+		{
+			constexpr LayoutRuns table = MakeRuns(Src, Dst);
+			const float* s = (const float*)src;
+			float* d = (float*)dst;
+			for (size_t i = 0; i < vertexCount; i++, s += table.srcSize, d += table.dstSize)
+				(TranscodeRun<Src, Dst, Runs>(s, d), ...);
+		}
+		template <UINT Src, UINT Dst>
+		void TranscodeKernel(const VertexElement* src, VertexElement* dst, size_t vertexCount)
+		{
+			TranscodeRuns<Src, Dst>(src, dst, vertexCount, std::make_index_sequence<MakeRuns(Src, Dst).count>());
+		}
+
+		using Kernel = void(*)(const VertexElement*, VertexElement*, size_t);
+		template <size_t... Pairs>
+		constexpr std::array<Kernel, sizeof...(Pairs)> MakeKernels(std::index_sequence<Pairs...>)
+		{
+			return { &TranscodeKernel<Pairs / LayoutCount, Pairs % LayoutCount>... };
+		}
+		const std::array<Kernel, LayoutCount * LayoutCount> Kernels = MakeKernels(std::make_index_sequence<LayoutCount * LayoutCount>());
+	}
+
+	void TranscodeVertices(const VertexElement* src, UINT srcModelType, VertexElement* dst, UINT dstModelType, size_t vertexCount)
+	{
+		UINT srcLayout = ModelType::VertexLayout(srcModelType);
+		UINT dstLayout = ModelType::VertexLayout(dstModelType);
+		if (srcLayout == dstLayout)
+			memcpy(dst, src, vertexCount * ModelType::VertexSizeInBytes(srcLayout));
+		else
+			Kernels[srcLayout * LayoutCount + dstLayout](src, dst, vertexCount);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "graphics/shaderbase.h"
+
+namespace gfx
+{
+	/* Converts vertexCount vertices from the layout of srcModelType to the layout of dstModelType
+	(see ModelType::VertexLayout). Attributes missing from the source are zeroed.
+	Every layout pair has its own kernel generated at compile time, which moves each run
+	of attributes the layouts share with fixed size SSE copies. */
+	void TranscodeVertices(const VertexElement* src, UINT srcModelType, VertexElement* dst, UINT dstModelType, size_t vertexCount);
+}
\ No newline at end of file
@@ -0,0 +1,381 @@
+#include "vertexquantizer.h"
+#include <algorithm>
+#include <climits>
+
+namespace gfx
+{
+#pragma region Scalar conversions
+
+	USHORT FloatToHalf(float f)
+	{
+		UINT bits;
+		memcpy(&bits, &f, sizeof(bits));
+		UINT sign = (bits >> 16) & 0x8000;
+		int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+		UINT mantissa = bits & 0x7fffff;
+		if (((bits >> 23) & 0xff) == 0xff)	//inf, nan
+			return (USHORT)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+		if (exponent >= 31)	//overflow
+			return (USHORT)(sign | 0x7c00);
+		if (exponent <= 0)	//denormal or zero
+		{
+			if (exponent < -10)
+				return (USHORT)sign;
+			mantissa |= 0x800000;
+			UINT shift = 14 - exponent;
+			UINT half = mantissa >> shift;
+			UINT rest = mantissa & ((1u << shift) - 1);
+			UINT halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (half & 1)))
+				half++;
+			return (USHORT)(sign | half);
+		}
+		UINT half = ((UINT)exponent << 10) | (mantissa >> 13);
+		UINT rest = mantissa & 0x1fff;
+		if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+			half++;	//may carry into the exponent, which rounds up correctly
+		return (USHORT)(sign | half);
+	}
+
+	float HalfToFloat(USHORT h)
+	{
+		UINT sign = (UINT)(h & 0x8000) << 16;
+		UINT exponent = (h >> 10) & 0x1f;
+		UINT mantissa = h & 0x3ff;
+		UINT bits;
+		if (exponent == 0x1f)
+			bits = sign | 0x7f800000 | (mantissa << 13);
+		else if (exponent)
+			bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+		else if (mantissa)
+		{
+			exponent = 127 - 15 + 1;
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+		}
+		else
+			bits = sign;
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	inline short FloatToSnorm16(float f)
+	{
+		f = f < -1.0f ? -1.0f : (f > 1.0f ? 1.0f : f);
+		return (short)lroundf(f * 32767.0f);
+	}
+	inline float Snorm16ToFloat(short s)
+	{
+		float f = (float)s / 32767.0f;
+		return f < -1.0f ? -1.0f : f;
+	}
+	inline USHORT FloatToUnorm16(float f)
+	{
+		f = f < 0.0f ? 0.0f : (f > 1.0f ? 1.0f : f);
+		return (USHORT)lroundf(f * 65535.0f);
+	}
+	inline float Unorm16ToFloat(USHORT u)
+	{
+		return (float)u / 65535.0f;
+	}
+
+	void OctahedralEncode(mth::float3 n, short encoded[2])
+	{
+		float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+		if (l1 == 0.0f)
+		{
+			encoded[0] = encoded[1] = 0;
+			return;
+		}
+		float x = n.x / l1;
+		float y = n.y / l1;
+		if (n.z < 0.0f)
+		{
+			float ox = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float oy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = ox;
+			y = oy;
+		}
+		encoded[0] = FloatToSnorm16(x);
+		encoded[1] = FloatToSnorm16(y);
+	}
+
+	mth::float3 OctahedralDecode(const short encoded[2])
+	{
+		float x = Snorm16ToFloat(encoded[0]);
+		float y = Snorm16ToFloat(encoded[1]);
+		float z = 1.0f - fabsf(x) - fabsf(y);
+		if (z < 0.0f)
+		{
+			float ox = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float oy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = ox;
+			y = oy;
+		}
+		mth::float3 n(x, y, z);
+		float length = n.Length();
+		return length > 0.0f ? n / length : n;
+	}
+
+	float AngleBetween(mth::float3 a, mth::float3 b)
+	{
+		float la = a.Length();
+		float lb = b.Length();
+		if (la == 0.0f || lb == 0.0f)
+			return 0.0f;
+		float c = a.Dot(b) / (la * lb);
+		c = c < -1.0f ? -1.0f : (c > 1.0f ? 1.0f : c);
+		return acosf(c) * 180.0f / mth::pi;
+	}
+
+#pragma endregion
+
+	UINT QuantizedVertexSizeInBytes(UINT modelType)
+	{
+		UINT size = 0;
+		if (ModelType::HasPositions(modelType))
+			size += 4 * sizeof(short);
+		if (ModelType::HasTexcoords(modelType))
+			size += 2 * sizeof(USHORT);
+		if (ModelType::HasNormals(modelType))
+			size += 2 * sizeof(short);
+		if (ModelType::HasTangentsBinormals(modelType))
+			size += 4 * sizeof(short);
+		if (ModelType::HasBones(modelType))
+			size += 8 * sizeof(USHORT);
+		return size;
+	}
+
+	std::vector<QuantizationBlock> MakeQuantizationBlocks(const VertexElement* vertices, UINT vertexCount, UINT modelType,
+		const UINT* indices, const VertexGroup* groups, UINT groupCount)
+	{
+		struct Range { UINT first; UINT last; };
+		std::vector<Range> ranges;
+		for (UINT g = 0; g < groupCount; g++)
+		{
+			if (groups[g].indexCount == 0)
+				continue;
+			Range r = { UINT_MAX, 0 };
+			for (UINT i = groups[g].startIndex; i < groups[g].startIndex + groups[g].indexCount; i++)
+			{
+				if (indices[i] < r.first) r.first = indices[i];
+				if (indices[i] > r.last) r.last = indices[i];
+			}
+			if (r.first < vertexCount)
+				ranges.push_back({ r.first, r.last < vertexCount ? r.last : vertexCount - 1 });
+		}
+		std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) { return a.first < b.first; });
+
+		std::vector<Range> merged;
+		UINT next = 0;
+		for (Range& r : ranges)
+		{
+			if (!merged.empty() && r.first <= merged.back().last)
+			{
+				if (r.last > merged.back().last)
+					merged.back().last = r.last;
+				next = merged.back().last + 1;
+				continue;
+			}
+			if (r.first > next)
+				merged.push_back({ next, r.first - 1 });
+			merged.push_back(r);
+			next = r.last + 1;
+		}
+		if (next < vertexCount)
+			merged.push_back({ next, vertexCount - 1 });
+
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		UINT offset = ModelType::PositionOffset(modelType);
+		std::vector<QuantizationBlock> blocks(merged.size());
+		for (size_t b = 0; b < merged.size(); b++)
+		{
+			QuantizationBlock& block = blocks[b];
+			block.firstVertex = merged[b].first;
+			block.vertexCount = merged[b].last - merged[b].first + 1;
+			block.offset = mth::float3();
+			block.scale = mth::float3();
+			if (!ModelType::HasPositions(modelType))
+				continue;
+			const VertexElement* v = vertices + (size_t)block.firstVertex * vertexSize + offset;
+			mth::float3 minpos(v[0].f, v[1].f, v[2].f);
+			mth::float3 maxpos = minpos;
+			for (UINT i = 1; i < block.vertexCount; i++)
+			{
+				v += vertexSize;
+				for (int c = 0; c < 3; c++)
+				{
+					if (minpos(c) > v[c].f) minpos(c) = v[c].f;
+					if (maxpos(c) < v[c].f) maxpos(c) = v[c].f;
+				}
+			}
+			block.offset = (minpos + maxpos) * 0.5f;
+			block.scale = (maxpos - minpos) * 0.5f;
+		}
+		return blocks;
+	}
+
+	void QuantizeVertices(const VertexElement* src, UINT vertexCount, UINT modelType,
+		const QuantizationBlock* blocks, UINT blockCount, char* dst, QuantizationError* error)
+	{
+		QuantizationError err = {};
+		for (UINT b = 0; b < blockCount; b++)
+		{
+			const QuantizationBlock& block = blocks[b];
+			mth::float3 invScale(
+				block.scale.x > 0.0f ? 1.0f / block.scale.x : 0.0f,
+				block.scale.y > 0.0f ? 1.0f / block.scale.y : 0.0f,
+				block.scale.z > 0.0f ? 1.0f / block.scale.z : 0.0f);
+			for (UINT i = block.firstVertex; i < block.firstVertex + block.vertexCount && i < vertexCount; i++)
+			{
+				if (ModelType::HasPositions(modelType))
+				{
+					short p[4] = { 0, 0, 0, 0 };
+					for (int c = 0; c < 3; c++)
+					{
+						p[c] = FloatToSnorm16((src[c].f - block.offset(c)) * invScale(c));
+						float decoded = block.offset(c) + Snorm16ToFloat(p[c]) * block.scale(c);
+						err.position = (std::max)(err.position, fabsf(decoded - src[c].f));
+					}
+					memcpy(dst, p, sizeof(p));
+					dst += sizeof(p);
+					src += 3;
+				}
+				if (ModelType::HasTexcoords(modelType))
+				{
+					USHORT t[2] = { FloatToHalf(src[0].f), FloatToHalf(src[1].f) };
+					err.texcoord = (std::max)(err.texcoord, fabsf(HalfToFloat(t[0]) - src[0].f));
+					err.texcoord = (std::max)(err.texcoord, fabsf(HalfToFloat(t[1]) - src[1].f));
+					memcpy(dst, t, sizeof(t));
+					dst += sizeof(t);
+					src += 2;
+				}
+				if (ModelType::HasNormals(modelType))
+				{
+					short n[2];
+					mth::float3 normal(src[0].f, src[1].f, src[2].f);
+					OctahedralEncode(normal, n);
+					err.normal = (std::max)(err.normal, AngleBetween(normal, OctahedralDecode(n)));
+					memcpy(dst, n, sizeof(n));
+					dst += sizeof(n);
+					src += 3;
+				}
+				if (ModelType::HasTangentsBinormals(modelType))
+				{
+					short t[4];
+					mth::float3 tangent(src[0].f, src[1].f, src[2].f);
+					mth::float3 binormal(src[3].f, src[4].f, src[5].f);
+					OctahedralEncode(tangent, t);
+					OctahedralEncode(binormal, t + 2);
+					err.tangent = (std::max)(err.tangent, AngleBetween(tangent, OctahedralDecode(t)));
+					err.binormal = (std::max)(err.binormal, AngleBetween(binormal, OctahedralDecode(t + 2)));
+					memcpy(dst, t, sizeof(t));
+					dst += sizeof(t);
+					src += 6;
+				}
+				if (ModelType::HasBones(modelType))
+				{
+					USHORT bones[8];
+					for (int w = 0; w < 4; w++)
+					{
+						bones[w] = FloatToUnorm16(src[w].f);
+						err.boneWeight = (std::max)(err.boneWeight, fabsf(Unorm16ToFloat(bones[w]) - src[w].f));
+					}
+					for (int w = 4; w < 8; w++)
+					{
+						if (src[w].u > 0xffff)
+							throw std::exception("Bone index does not fit the quantized vertex format");
+						bones[w] = (USHORT)src[w].u;
+					}
+					memcpy(dst, bones, sizeof(bones));
+					dst += sizeof(bones);
+					src += 8;
+				}
+			}
+		}
+		if (error)
+			*error = err;
+	}
+
+	void DequantizeVertices(const char* src, UINT vertexCount, UINT srcModelType,
+		const QuantizationBlock* blocks, UINT blockCount, VertexElement* dst, UINT dstModelType)
+	{
+		for (UINT b = 0; b < blockCount; b++)
+		{
+			const QuantizationBlock& block = blocks[b];
+			for (UINT i = block.firstVertex; i < block.firstVertex + block.vertexCount && i < vertexCount; i++)
+			{
+				if (ModelType::HasPositions(srcModelType))
+				{
+					short p[4];
+					memcpy(p, src, sizeof(p));
+					src += sizeof(p);
+					if (ModelType::HasPositions(dstModelType))
+					{
+						for (int c = 0; c < 3; c++)
+							(dst++)->f = block.offset(c) + Snorm16ToFloat(p[c]) * block.scale(c);
+					}
+				}
+				if (ModelType::HasTexcoords(srcModelType))
+				{
+					USHORT t[2];
+					memcpy(t, src, sizeof(t));
+					src += sizeof(t);
+					if (ModelType::HasTexcoords(dstModelType))
+					{
+						(dst++)->f = HalfToFloat(t[0]);
+						(dst++)->f = HalfToFloat(t[1]);
+					}
+				}
+				if (ModelType::HasNormals(srcModelType))
+				{
+					short n[2];
+					memcpy(n, src, sizeof(n));
+					src += sizeof(n);
+					if (ModelType::HasNormals(dstModelType))
+					{
+						mth::float3 normal = OctahedralDecode(n);
+						(dst++)->f = normal.x;
+						(dst++)->f = normal.y;
+						(dst++)->f = normal.z;
+					}
+				}
+				if (ModelType::HasTangentsBinormals(srcModelType))
+				{
+					short t[4];
+					memcpy(t, src, sizeof(t));
+					src += sizeof(t);
+					if (ModelType::HasTangentsBinormals(dstModelType))
+					{
+						mth::float3 tangent = OctahedralDecode(t);
+						mth::float3 binormal = OctahedralDecode(t + 2);
+						(dst++)->f = tangent.x;
+						(dst++)->f = tangent.y;
+						(dst++)->f = tangent.z;
+						(dst++)->f = binormal.x;
+						(dst++)->f = binormal.y;
+						(dst++)->f = binormal.z;
+					}
+				}
+				if (ModelType::HasBones(srcModelType))
+				{
+					USHORT bones[8];
+					memcpy(bones, src, sizeof(bones));
+					src += sizeof(bones);
+					if (ModelType::HasBones(dstModelType))
+					{
+						for (int w = 0; w < 4; w++)
+							(dst++)->f = Unorm16ToFloat(bones[w]);
+						for (int w = 4; w < 8; w++)
+							(dst++)->u = bones[w];
+					}
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
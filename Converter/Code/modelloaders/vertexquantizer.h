@@ -0,0 +1,47 @@
+#pragma once
+
+#include "graphics/shaderbase.h"
+
+namespace gfx
+{
+	/* Compact vertex format, attributes follow each other in the usual order:
+	position			short[4]	snorm16, dequantized with the QuantizationBlock of the vertex, w is unused
+	texcoord			USHORT[2]	half float
+	normal				short[2]	octahedral encoded snorm16
+	tangent, binormal	short[2]	octahedral encoded snorm16 each
+	bone weights		USHORT[4]	unorm16
+	bone indices		USHORT[4] */
+	struct QuantizationBlock
+	{
+		UINT firstVertex;
+		UINT vertexCount;
+		mth::float3 offset;	//position = offset + snorm * scale
+		mth::float3 scale;
+	};
+
+	struct QuantizationError
+	{
+		float position;		//largest absolute component error
+		float texcoord;		//largest absolute component error
+		float normal;		//largest angle error in degrees
+		float tangent;		//largest angle error in degrees
+		float binormal;		//largest angle error in degrees
+		float boneWeight;	//largest absolute error
+	};
+
+	USHORT FloatToHalf(float f);
+	float HalfToFloat(USHORT h);
+	void OctahedralEncode(mth::float3 n, short encoded[2]);
+	mth::float3 OctahedralDecode(const short encoded[2]);
+
+	UINT QuantizedVertexSizeInBytes(UINT modelType);
+	/* One block per group with the vertex range its indices reference.
+	Groups sharing vertices are merged into one block, unreferenced vertices get their own blocks. */
+	std::vector<QuantizationBlock> MakeQuantizationBlocks(const VertexElement* vertices, UINT vertexCount, UINT modelType,
+		const UINT* indices, const VertexGroup* groups, UINT groupCount);
+	void QuantizeVertices(const VertexElement* src, UINT vertexCount, UINT modelType,
+		const QuantizationBlock* blocks, UINT blockCount, char* dst, QuantizationError* error = nullptr);
+	/* dstModelType selects the attributes to expand, it must be a subset of srcModelType */
+	void DequantizeVertices(const char* src, UINT vertexCount, UINT srcModelType,
+		const QuantizationBlock* blocks, UINT blockCount, VertexElement* dst, UINT dstModelType);
+}
\ No newline at end of file
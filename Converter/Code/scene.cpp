@@ -151,7 +151,7 @@ namespace cvt
 			auto& n = ml.getNormalmap(i);
 			if (t.loaded)
 			{
-				tex = std::make_shared<gfx::Texture>(m_graphics, t.data.data(), t.width, t.height);
+				tex = std::make_shared<gfx::Texture>(m_graphics, t.data->data(), t.width, t.height);
 			}
 			else
 			{
@@ -180,7 +180,7 @@ namespace cvt
 			}
 			if (n.loaded)
 			{
-				norm = std::make_shared<gfx::Texture>(m_graphics, n.data.data(), n.width, n.height);
+				norm = std::make_shared<gfx::Texture>(m_graphics, n.data->data(), n.width, n.height);
 			}
 			else
 			{
@@ -56,11 +56,12 @@ namespace cvt
 		modelType = 0xffff;
 		m_modelLoader.Clear();
 		m_modelLoader.LoadModel(filename, modelType);
+		m_modelLoader.FlattenInstances();	//the scene draws every group once
 		if (m_modelLoader.HasHitbox())
 		{
 			m_hitboxLoader.Clear();
 			m_modelLoader.SwapHitboxes(m_hitboxLoader);
-			m_hitboxLoader.MakeVerticesFromHitbox();
+			m_hitboxLoader.MakeVerticesFromHitbox(true);
 			m_modelLoader.SwapHitboxes(m_hitboxLoader);
 			m_scene->SetHitbox(m_hitboxLoader);
 		}
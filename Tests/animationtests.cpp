@@ -0,0 +1,158 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/animation.h"
+#include <cmath>
+
+using namespace gfx;
+
+namespace
+{
+	const float Duration = 10.0f;
+	const UINT SampleCount = 601;
+
+	mth::float3 CurveTranslation(float t) { return mth::float3(sinf(t), 2.0f * cosf(0.7f * t), 0.1f * t); }
+	mth::float3 CurveScale(float t) { return mth::float3(1.0f + 0.2f * sinf(t), 1.0f, 1.0f + 0.1f * t); }
+	mth::quaternion CurveRotation(float t)
+	{
+		mth::float3 axis = mth::float3(1.0f, 2.0f, 3.0f).Normalized();
+		float angle = 0.8f * sinf(0.5f * t) + 0.3f * t;
+		float s = sinf(angle * 0.5f);
+		return mth::quaternion(axis.x * s, axis.y * s, axis.z * s, cosf(angle * 0.5f));
+	}
+
+	float VectorError(const mth::float3& a, const mth::float3& b)
+	{
+		return (std::max)((std::max)(fabsf(a.x - b.x), fabsf(a.y - b.y)), fabsf(a.z - b.z));
+	}
+	float RotationError(const mth::quaternion& a, const mth::quaternion& b)
+	{
+		float dot = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+		return 2.0f * acosf((std::min)(fabsf(dot), 1.0f));
+	}
+	float LargestExtent(const AnimationChannelHeader& channel)
+	{
+		return (std::max)((std::max)(channel.rangeExtent[0], channel.rangeExtent[1]), channel.rangeExtent[2]);
+	}
+
+	BonePose IdentityPose()
+	{
+		return { mth::float3(0.0f), mth::quaternion(1.0f), mth::float3(1.0f) };
+	}
+}
+
+TEST(AnimationCompressionErrorBounds)
+{
+	AnimationData data;
+	data.name = L"curve";
+	data.duration = Duration;
+	AnimationTrack track;
+	track.bone = 0;
+	for (UINT i = 0; i < SampleCount; i++)
+	{
+		float t = Duration * i / (SampleCount - 1);
+		track.translations.push_back({ t, CurveTranslation(t) });
+		track.rotations.push_back({ t, CurveRotation(t) });
+		track.scales.push_back({ t, CurveScale(t) });
+	}
+	data.tracks.push_back(track);
+	AnimationTolerance tolerance;
+	Animation animation(data, tolerance);
+	CHECK(animation.getChannelCount() == 3);
+
+	/* Every channel keeps its error at the sampled times within the tolerance of the key reduction,
+	plus a quantization step of the values and the slope of the curve over a quantization step of the times */
+	float bounds[3];
+	for (UINT c = 0; c < 3; c++)
+	{
+		AnimationChannelHeader& channel = animation.getChannel(c);
+		CHECK(channel.keyCount > 1 && channel.keyCount < SampleCount);
+		float timeStep = Duration / 65535.0f;
+		if (channel.kind == AnimationChannel::ROTATION)
+			bounds[c] = tolerance.rotation + 16.0f * LargestExtent(channel) / 32767.0f + 0.7f * timeStep;
+		else if (channel.kind == AnimationChannel::TRANSLATION)
+			bounds[c] = tolerance.translation + LargestExtent(channel) / 65535.0f + 1.4f * timeStep;
+		else
+			bounds[c] = tolerance.scale + LargestExtent(channel) / 65535.0f + 0.2f * timeStep;
+	}
+
+	AnimationSampler sampler(animation);
+	float maxError[3] = {};
+	for (UINT i = 0; i < SampleCount; i++)
+	{
+		float t = Duration * i / (SampleCount - 1);
+		BonePose pose = IdentityPose();
+		sampler.Sample(t, &pose);
+		for (UINT c = 0; c < 3; c++)
+		{
+			float error;
+			switch (animation.getChannel(c).kind)
+			{
+			case AnimationChannel::TRANSLATION: error = VectorError(pose.translation, CurveTranslation(t)); break;
+			case AnimationChannel::ROTATION: error = RotationError(pose.rotation, CurveRotation(t)); break;
+			default: error = VectorError(pose.scale, CurveScale(t)); break;
+			}
+			maxError[c] = (std::max)(maxError[c], error);
+		}
+	}
+	for (UINT c = 0; c < 3; c++)
+		CHECK(maxError[c] <= bounds[c]);
+
+	//a straight line keeps its two ends only
+	AnimationData line;
+	line.duration = 1.0f;
+	AnimationTrack lineTrack;
+	lineTrack.bone = 0;
+	for (UINT i = 0; i <= 100; i++)
+		lineTrack.translations.push_back({ i / 100.0f, mth::float3(0.01f * i, 1.0f, -0.02f * i) });
+	line.tracks.push_back(lineTrack);
+	Animation lineAnimation(line);
+	CHECK(lineAnimation.getChannelCount() == 1 && lineAnimation.getChannel(0).keyCount == 2);
+}
+
+TEST(AnimationSamplerKeys)
+{
+	//bone 0 moves through three keys and turns a quarter around y, bone 1 has a constant scale, bone 2 no channels
+	const float Pi = 3.14159265f;
+	mth::quaternion quarterTurn(0.0f, sinf(0.25f * Pi), 0.0f, cosf(0.25f * Pi));
+	mth::quaternion eighthTurn(0.0f, sinf(0.125f * Pi), 0.0f, cosf(0.125f * Pi));
+	AnimationData data;
+	data.duration = 2.0f;
+	AnimationTrack moving;
+	moving.bone = 0;
+	moving.translations = { { 0.0f, mth::float3(0.0f, 0.0f, 0.0f) }, { 1.0f, mth::float3(2.0f, 0.0f, 0.0f) }, { 2.0f, mth::float3(2.0f, 4.0f, 0.0f) } };
+	moving.rotations = { { 0.0f, mth::quaternion(1.0f) }, { 2.0f, quarterTurn } };
+	AnimationTrack scaled;
+	scaled.bone = 1;
+	scaled.scales = { { 0.0f, mth::float3(1.0f, 2.0f, 3.0f) }, { 2.0f, mth::float3(1.0f, 2.0f, 3.0f) } };
+	data.tracks = { moving, scaled };
+	Animation animation(data);
+	CHECK(animation.getChannelCount() == 3);
+
+	//at the keys, between them, past the end, backwards and before the start
+	struct Expected { float time; mth::float3 translation; };
+	const Expected samples[] = {
+		{ 0.0f, mth::float3(0.0f, 0.0f, 0.0f) },
+		{ 0.5f, mth::float3(1.0f, 0.0f, 0.0f) },
+		{ 1.0f, mth::float3(2.0f, 0.0f, 0.0f) },
+		{ 1.5f, mth::float3(2.0f, 2.0f, 0.0f) },
+		{ 2.0f, mth::float3(2.0f, 4.0f, 0.0f) },
+		{ 5.0f, mth::float3(2.0f, 4.0f, 0.0f) },
+		{ 0.25f, mth::float3(0.5f, 0.0f, 0.0f) },
+		{ -1.0f, mth::float3(0.0f, 0.0f, 0.0f) } };
+	const float step = 4.0f / 65535.0f;	//a quantization step of the largest range
+	AnimationSampler sampler(animation);
+	BonePose kept = { mth::float3(7.0f), mth::quaternion(1.0f), mth::float3(1.0f) };
+	for (const Expected& sample : samples)
+	{
+		BonePose pose[3] = { IdentityPose(), IdentityPose(), kept };
+		sampler.Sample(sample.time, pose);
+		CHECK(VectorError(pose[0].translation, sample.translation) <= step);
+		CHECK(VectorError(pose[1].scale, mth::float3(1.0f, 2.0f, 3.0f)) <= step);
+		CHECK(VectorError(pose[2].translation, kept.translation) == 0.0f);
+		float t = (std::min)((std::max)(sample.time / data.duration, 0.0f), 1.0f);
+		CHECK(RotationError(pose[0].rotation, NormalizedLerp(mth::quaternion(1.0f), quarterTurn, t)) <= 1e-3f);
+	}
+	BonePose pose[3] = { IdentityPose(), IdentityPose(), kept };
+	sampler.Sample(1.0f, pose);
+	CHECK(RotationError(pose[0].rotation, eighthTurn) <= 1e-3f);
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/omdarchive.h"
+#include <filesystem>
+
+using namespace gfx;
+
+TEST(ArchiveAddDirectory)
+{
+	const std::wstring folder = L"test_archive";
+	std::filesystem::remove_all(folder);
+	std::filesystem::create_directories(folder + L"/sub");
+	TempFile archiveFile(L"test_archive.omda");
+	std::vector<TestModel> models(6);
+	for (UINT i = 0; i < (UINT)models.size(); i++)
+	{
+		models[i].CreateGrid(4 + i, ModelType::PTN);
+		std::wstring name = folder + (i % 2 ? L"/sub/model" : L"/model") + std::to_wstring(i) + L".omd";
+		models[i].ExportOMD(name.c_str(), ModelType::PTN, i != 3);
+	}
+
+	OMDArchivePacker packer(ModelType::PTN);
+	packer.AddDirectory(folder.c_str());
+	CHECK(packer.getEntryCount() == models.size());
+	packer.Write(archiveFile.getFilename());
+	std::filesystem::remove_all(folder);
+
+	OMDArchive archive(archiveFile.getFilename());
+	for (UINT i = 0; i < (UINT)models.size(); i++)
+	{
+		std::wstring name = (i % 2 ? L"sub/model" : L"model") + std::to_wstring(i);
+		UINT entry = archive.FindEntry(name.c_str());
+		CHECK(entry != OMDArchive::InvalidEntry && archive.VerifyEntry(entry));
+		CHECK(((archive.getEntry(entry).flags & OMDArchiveFlag::TEXT) != 0) == (i == 3));
+		TestModel loaded;
+		loaded.LoadModel(archive, entry, ModelType::PTN);
+		CHECK(loaded.getVertexCount() == models[i].getVertexCount() && loaded.m_indices == models[i].m_indices);
+	}
+}
@@ -0,0 +1,154 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/omdcodec.h"
+#include <filesystem>
+
+using namespace gfx;
+
+static std::vector<char> MakeTestData(size_t size)
+{
+	std::vector<char> data(size);
+	UINT seed = 12345;
+	for (size_t i = 0; i < size; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		data[i] = (char)(i % 7 == 0 ? seed >> 24 : i / 13);
+	}
+	return data;
+}
+
+static std::vector<char> GridIndices(TestModel& model, UINT stride)
+{
+	std::vector<char> data(model.m_indices.size() * stride);
+	for (size_t i = 0; i < model.m_indices.size(); i++)
+		memcpy(data.data() + i * stride, &model.m_indices[i], stride);
+	return data;
+}
+
+TEST(CodecRoundTrip)
+{
+	for (UINT filter : { StreamFilter::NONE, StreamFilter::BYTE_PLANES })
+	{
+		for (UINT stride : { 1u, 3u, 4u, 12u, 40u, 88u })
+		{
+			for (size_t size : { (size_t)0, (size_t)1, (size_t)17, (size_t)1000, (size_t)100003 })
+			{
+				std::vector<char> data = MakeTestData(size);
+				std::vector<char> compressed = CompressStream(data.data(), data.size(), filter, stride);
+				CHECK(DecompressStream(compressed.data(), compressed.size()) == data);
+			}
+		}
+	}
+
+	TestModel model;
+	model.CreateGrid(40, ModelType::P);
+	model.ApplyPostProcess(PostProcess::VERTEX_CACHE);
+	model.m_indices.push_back(7);	//indices after the last whole triangle
+	for (UINT filter : { StreamFilter::INDICES, StreamFilter::TRIANGLES })
+	{
+		for (UINT stride : { 2u, 4u })
+		{
+			std::vector<char> data = GridIndices(model, stride);
+			std::vector<char> compressed = CompressStream(data.data(), data.size(), filter, stride);
+			CHECK(DecompressStream(compressed.data(), compressed.size()) == data);
+			compressed = CompressStream(nullptr, 0, filter, stride);
+			CHECK(DecompressStream(compressed.data(), compressed.size()).empty());
+		}
+	}
+
+	std::vector<char> scattered = MakeTestData(30000);
+	std::vector<char> compressed = CompressStream(scattered.data(), scattered.size(), StreamFilter::TRIANGLES, 4);
+	CHECK(DecompressStream(compressed.data(), compressed.size()) == scattered);
+}
+
+TEST(CodecTriangleCoding)
+{
+	TestModel model;
+	model.CreateGrid(100, ModelType::P);
+	model.ApplyPostProcess(PostProcess::VERTEX_CACHE | PostProcess::VERTEX_FETCH);
+	std::vector<char> data = GridIndices(model, 4);
+	std::vector<char> indices = CompressStream(data.data(), data.size(), StreamFilter::INDICES, 4);
+	std::vector<char> triangles = CompressStream(data.data(), data.size(), StreamFilter::TRIANGLES, 4);
+	CHECK(triangles.size() < indices.size());
+	CHECK(triangles.size() < data.size() / 8);
+}
+
+TEST(CodecCorruptedStream)
+{
+	TestModel model;
+	model.CreateGrid(8, ModelType::P);
+	std::vector<char> data = GridIndices(model, 4);
+	for (UINT filter : { StreamFilter::BYTE_PLANES, StreamFilter::INDICES, StreamFilter::TRIANGLES })
+	{
+		std::vector<char> compressed = CompressStream(data.data(), data.size(), filter, 4);
+		for (size_t size = 0; size < compressed.size(); size++)
+			CHECK_THROWS(DecompressStream(compressed.data(), size));
+	}
+}
+
+TEST(CodecCorruptedStride)
+{
+	std::vector<char> data = MakeTestData(880);
+	std::vector<char> compressed = CompressStream(data.data(), data.size(), StreamFilter::BYTE_PLANES, 88);
+	CHECK(((OMDCompressedHeader*)compressed.data())->filter == StreamFilter::BYTE_PLANES);
+	//none, not dividing the size, larger than the size, larger than any vertex
+	for (UINT stride : { 0u, 3u, 1760u, 176u, 0xffffffffu })
+	{
+		std::vector<char> corrupted = compressed;
+		((OMDCompressedHeader*)corrupted.data())->stride = stride;
+		CHECK_THROWS(DecompressStream(corrupted.data(), corrupted.size()));
+	}
+}
+
+TEST(CompressedOMDRoundTrip)
+{
+	TempFile file(L"test_compressed.omd");
+	TestModel model;
+	model.CreateGrid(30, ModelType::AllPart);
+	model.ApplyPostProcess(PostProcess::VERTEX_CACHE);
+	OMDExportReport report = {};
+	model.ExportOMD(file.getFilename(), ModelType::AllPart, true, OMDExport::COMPRESS, &report);
+	CHECK(report.indexBytes < report.uncompressedIndexBytes && report.vertexBytes < report.uncompressedVertexBytes);
+	TestModel loaded;
+	loaded.LoadModel(file.getFilename(), ModelType::AllPart);
+	CHECK(loaded.HasSameMesh(model));
+}
+
+BENCHMARK(CodecDecode)
+{
+	TestModel model;
+	model.CreateGrid(1000, ModelType::AllPart);
+	model.ApplyPostProcess(PostProcess::VERTEX_CACHE | PostProcess::VERTEX_FETCH);
+	struct Stream
+	{
+		const char* name;
+		std::vector<char> data;
+		UINT filter;
+		UINT stride;
+	};
+	std::vector<char> vertices((const char*)model.getVertices(), (const char*)(model.getVertices() + model.m_vertices.size()));
+	Stream streams[] = {
+		{ "vertices, byte planes", vertices, StreamFilter::BYTE_PLANES, model.getVertexSizeInBytes() },
+		{ "vertices, no filter", vertices, StreamFilter::NONE, 1 },
+		{ "indices, zigzag", GridIndices(model, 4), StreamFilter::INDICES, 4 },
+		{ "indices, edge cache", GridIndices(model, 4), StreamFilter::TRIANGLES, 4 } };
+	for (Stream& stream : streams)
+	{
+		std::vector<char> compressed;
+		double encodeSeconds = MeasureBest(1, [&]() { compressed = CompressStream(stream.data.data(), stream.data.size(), stream.filter, stream.stride); });
+		double decodeSeconds = MeasureBest(5, [&]() { DecompressStream(compressed.data(), compressed.size()); });
+		printf("  %s: ratio %.2f, encode %.0f MB/s, decode %.0f MB/s\n", stream.name, (double)stream.data.size() / compressed.size(),
+			stream.data.size() / encodeSeconds / 1e6, stream.data.size() / decodeSeconds / 1e6);
+	}
+
+	for (UINT flags : { 0u, (UINT)OMDExport::COMPRESS, (UINT)(OMDExport::COMPRESS | OMDExport::QUANTIZE) })
+	{
+		TempFile file(L"bench_codec.omd");
+		model.ExportOMD(file.getFilename(), ModelType::AllPart, true, flags);
+		double fileSize = (double)std::filesystem::file_size(file.getFilename());
+		TestModel loaded;
+		double seconds = MeasureBest(5, [&]() { loaded.LoadModel(file.getFilename(), ModelType::AllPart); });
+		printf("  load%s%s: %.1f MB file in %.2f ms\n", flags & OMDExport::COMPRESS ? ", compressed" : "",
+			flags & OMDExport::QUANTIZE ? ", quantized" : "", fileSize / 1e6, seconds * 1e3);
+	}
+}
\ No newline at end of file
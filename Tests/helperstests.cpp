@@ -0,0 +1,60 @@
+#include "test.h"
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+
+TEST(ParallelForRunsEveryTask)
+{
+	for (UINT taskCount : { 0u, 1u, 7u, 10000u })
+	{
+		std::vector<std::atomic<UINT>> runs(taskCount);
+		for (std::atomic<UINT>& run : runs)
+			run = 0;
+		ParallelFor(taskCount, [&](UINT task) { runs[task]++; });
+		for (std::atomic<UINT>& run : runs)
+			CHECK(run == 1);
+	}
+}
+
+TEST(ParallelForNested)
+{
+	std::mutex lock;
+	std::set<std::thread::id> threads;
+	std::atomic<UINT> runs(0);
+	ParallelFor(64, [&](UINT) {
+		ParallelFor(64, [&](UINT) {
+			runs++;
+			std::lock_guard<std::mutex> guard(lock);
+			threads.insert(std::this_thread::get_id());
+		});
+	});
+	CHECK(runs == 64 * 64);
+	CHECK(threads.size() <= (std::max)(std::thread::hardware_concurrency(), 1u));
+}
+
+TEST(ParallelForException)
+{
+	std::atomic<UINT> runs(0);
+	CHECK_THROWS(ParallelFor(1000, [&](UINT task) {
+		runs++;
+		if (task == 10)
+			throw std::exception("task failed");
+	}));
+	CHECK(runs <= 1000);
+	runs = 0;
+	ParallelFor(1000, [&](UINT) { runs++; });
+	CHECK(runs == 1000);
+}
+
+BENCHMARK(ParallelForOverhead)
+{
+	const UINT CallCount = 10000;
+	UINT taskCount = std::thread::hardware_concurrency();
+	std::atomic<UINT> runs(0);
+	double seconds = MeasureBest(3, [&]() {
+		for (UINT i = 0; i < CallCount; i++)
+			ParallelFor(taskCount, [&](UINT) { runs++; });
+	});
+	printf("  %.2f us per call with %u empty tasks\n", seconds / CallCount * 1e6, taskCount);
+}
\ No newline at end of file
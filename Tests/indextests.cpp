@@ -0,0 +1,74 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/omdloader.h"
+
+using namespace gfx;
+
+namespace
+{
+	std::vector<UINT> Expand(TestModel& model, const std::vector<USHORT>& indices16, const std::vector<UINT>& baseVertices)
+	{
+		std::vector<UINT> indices(indices16.size());
+		for (size_t g = 0; g < model.m_groups.size(); g++)
+			for (UINT i = model.m_groups[g].startIndex; i < model.m_groups[g].startIndex + model.m_groups[g].indexCount; i++)
+				indices[i] = indices16[i] + baseVertices[g];
+		return indices;
+	}
+}
+
+TEST(IndexSizeSmallModel)
+{
+	TestModel model;
+	model.CreateGrid(255, ModelType::PT);
+	CHECK(model.getVertexCount() == 0x10000);
+	std::vector<UINT> baseVertices;
+	CHECK(model.ChooseIndexSize(baseVertices) == sizeof(USHORT));
+	CHECK(baseVertices.size() == model.m_groups.size());
+	for (UINT base : baseVertices)
+		CHECK(base == 0);
+	std::vector<USHORT> indices16(model.m_indices.size());
+	model.CopyIndices16(indices16.data(), baseVertices);
+	CHECK(Expand(model, indices16, baseVertices) == model.m_indices);
+}
+
+TEST(IndexSizeBaseVertices)
+{
+	//every half of the grid spans about 45000 vertices of the 90601
+	TestModel model;
+	model.CreateGrid(300, ModelType::PT);
+	CHECK(model.getVertexCount() > 0x10000);
+	std::vector<UINT> baseVertices;
+	CHECK(model.ChooseIndexSize(baseVertices) == sizeof(USHORT));
+	CHECK(baseVertices.size() == 2 && baseVertices[0] == 0 && baseVertices[1] > 0);
+	std::vector<USHORT> indices16(model.m_indices.size());
+	model.CopyIndices16(indices16.data(), baseVertices);
+	CHECK(Expand(model, indices16, baseVertices) == model.m_indices);
+
+	//the same through an OMD file
+	TempFile file(L"test_index16.omd");
+	model.ExportOMD(file.getFilename(), ModelType::PT);
+	std::vector<char> data = ReadTestFile(file.getFilename());
+	OMDView view(data.data(), data.size());
+	CHECK(view.getIndices16() != nullptr && view.getBaseVertices() != nullptr);
+	TestModel loaded;
+	loaded.LoadModel(file.getFilename(), ModelType::PT);
+	CHECK(loaded.HasSameMesh(model));
+}
+
+TEST(IndexSizeWideGroup)
+{
+	TestModel model;
+	model.CreateGrid(300, ModelType::PT);
+	model.m_groups.back().startIndex = 0;
+	model.m_groups.back().indexCount = (UINT)model.m_indices.size();
+	model.m_groups.erase(model.m_groups.begin());
+	std::vector<UINT> baseVertices;
+	CHECK(model.ChooseIndexSize(baseVertices) == sizeof(UINT));
+	for (UINT base : baseVertices)
+		CHECK(base == 0);
+
+	//groups that overlap can't have a base vertex each either
+	model.CreateGrid(300, ModelType::PT);
+	model.m_groups[1].startIndex -= 3;
+	CHECK(model.ChooseIndexSize(baseVertices) == sizeof(UINT));
+}
\ No newline at end of file
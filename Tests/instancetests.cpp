@@ -0,0 +1,66 @@
+#include "test.h"
+#include "testmodel.h"
+
+using namespace gfx;
+
+namespace
+{
+	mth::float3 ReadVector(TestModel& model, UINT vertex, UINT offset)
+	{
+		const VertexElement* v = &model.m_vertices[(size_t)vertex * ModelType::VertexSizeInVertexElements(model.m_modelType) + offset];
+		return mth::float3(v[0].f, v[1].f, v[2].f);
+	}
+
+	/* which side of the triangle the winding makes its front, relative to its first normal */
+	float FrontSide(TestModel& model, UINT firstIndex)
+	{
+		UINT* corners = &model.m_indices[firstIndex];
+		UINT positionOffset = ModelType::PositionOffset(model.m_modelType);
+		mth::float3 p0 = ReadVector(model, corners[0], positionOffset);
+		mth::float3 p1 = ReadVector(model, corners[1], positionOffset);
+		mth::float3 p2 = ReadVector(model, corners[2], positionOffset);
+		return (p1 - p0).Cross(p2 - p0).Dot(ReadVector(model, corners[0], ModelType::NormalOffset(model.m_modelType)));
+	}
+}
+
+TEST(FlattenInstances)
+{
+	TestModel model;
+	model.CreateGrid(4, ModelType::PTN);
+	CHECK(model.m_groups.size() == 2);
+	VertexGroup instancedGroup = model.m_groups[1];
+	model.m_instances.push_back({ 1, mth::float4x4::Translation(10.0f, 0.0f, 0.0f) });
+	model.m_instances.push_back({ 1, mth::float4x4::Scaling(-1.0f, 2.0f, 1.0f) });
+	model.MakeHitboxFromVertices();
+	std::vector<mth::Triangle> hitbox = model.m_hitbox;
+	float side = FrontSide(model, instancedGroup.startIndex);
+
+	model.FlattenInstances();
+	CHECK(model.m_instances.empty());
+	CHECK(model.m_groups.size() == 3 && model.m_textures.size() == 3 && model.m_normalmaps.size() == 3);
+	CHECK(model.m_textures[1].filename == L"grid1.png" && model.m_textures[2].filename == L"grid1.png");
+	CHECK(model.m_normalmaps[1].filename == L"grid1_n.png");
+	for (UINT g = 1; g < 3; g++)
+	{
+		CHECK(model.m_groups[g].indexCount == instancedGroup.indexCount && model.m_groups[g].materialIndex == (int)g);
+		for (UINT i = 0; i < model.m_groups[g].indexCount; i += 3)
+		{
+			CHECK(FrontSide(model, model.m_groups[g].startIndex + i) * side > 0.0f);
+			mth::float3 normal = ReadVector(model, model.m_indices[model.m_groups[g].startIndex + i], ModelType::NormalOffset(model.m_modelType));
+			CHECK(fabsf(normal.Length() - 1.0f) < 1e-5f);
+		}
+	}
+
+	//the flattened groups are where the instances drew them, the mirrored one with the other winding
+	model.MakeHitboxFromVertices();
+	CHECK(model.m_hitbox.size() == hitbox.size());
+	auto near = [](mth::float3 a, mth::float3 b) { return (a - b).Length() < 1e-5f; };
+	for (size_t t = 0; t < hitbox.size(); t++)
+	{
+		mth::Triangle& a = model.m_hitbox[t];
+		mth::Triangle& b = hitbox[t];
+		CHECK(near(a.getVertex(0), b.getVertex(0)));
+		CHECK((near(a.getVertex(1), b.getVertex(1)) && near(a.getVertex(2), b.getVertex(2))) ||
+			(near(a.getVertex(1), b.getVertex(2)) && near(a.getVertex(2), b.getVertex(1))));
+	}
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "test.h"
+#include "modelloaders/vertexlayout.h"
+
+using namespace gfx;
+
+namespace
+{
+	struct Attribute
+	{
+		bool(*has)(UINT);
+		UINT(*offset)(UINT);
+		UINT size;
+	};
+
+	const Attribute Attributes[] = {
+		{ ModelType::HasPositions, ModelType::PositionOffset, 3 },
+		{ ModelType::HasTexcoords, ModelType::TexCoordOffset, 2 },
+		{ ModelType::HasNormals, ModelType::NormalOffset, 3 },
+		{ ModelType::HasTangentsBinormals, ModelType::TangentOffset, 3 },
+		{ ModelType::HasTangentsBinormals, ModelType::BinormalOffset, 3 },
+		{ ModelType::HasBones, ModelType::BoneWeightsOffset, 4 },
+		{ ModelType::HasBones, ModelType::BoneIndexOffset, 4 } };
+
+	/* Attribute by attribute through the ModelType offsets */
+	void TranscodeReference(const VertexElement* src, UINT srcModelType, VertexElement* dst, UINT dstModelType, size_t vertexCount)
+	{
+		UINT srcSize = ModelType::VertexSizeInVertexElements(srcModelType);
+		UINT dstSize = ModelType::VertexSizeInVertexElements(dstModelType);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			for (const Attribute& attribute : Attributes)
+			{
+				if (!attribute.has(dstModelType))
+					continue;
+				for (UINT i = 0; i < attribute.size; i++)
+				{
+					VertexElement& element = dst[v * dstSize + attribute.offset(dstModelType) + i];
+					if (attribute.has(srcModelType))
+						element.u = src[v * srcSize + attribute.offset(srcModelType) + i].u;
+					else
+						element.u = 0;
+				}
+			}
+		}
+	}
+
+	std::vector<VertexElement> MakeVertices(UINT modelType, size_t vertexCount)
+	{
+		std::vector<VertexElement> vertices(ModelType::VertexSizeInVertexElements(modelType) * vertexCount);
+		UINT seed = modelType + 1;
+		for (VertexElement& element : vertices)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			element.u = seed;
+		}
+		return vertices;
+	}
+}
+
+TEST(TranscodeEveryLayoutPair)
+{
+	const UINT LayoutBits = ModelType::VertexLayout(ModelType::AllPart);
+	//odd counts leave a remainder after the unrolled loops
+	for (size_t vertexCount : { (size_t)0, (size_t)1, (size_t)7, (size_t)1001 })
+	{
+		for (UINT src = 0; src <= LayoutBits; src++)
+		{
+			if ((src & LayoutBits) != src)
+				continue;
+			std::vector<VertexElement> vertices = MakeVertices(src, vertexCount);
+			for (UINT dst = 0; dst <= LayoutBits; dst++)
+			{
+				if ((dst & LayoutBits) != dst)
+					continue;
+				UINT dstSize = ModelType::VertexSizeInVertexElements(dst);
+				std::vector<VertexElement> expected(dstSize * vertexCount + 1);
+				std::vector<VertexElement> result(dstSize * vertexCount + 1);
+				expected.back().u = result.back().u = 0xdeadbeef;	//nothing is written past the buffer
+				TranscodeReference(vertices.data(), src, expected.data(), dst, vertexCount);
+				TranscodeVertices(vertices.data(), src, result.data(), dst, vertexCount);
+				CHECK(memcmp(expected.data(), result.data(), result.size() * sizeof(VertexElement)) == 0);
+			}
+		}
+	}
+}
+
+BENCHMARK(TranscodeVertices)
+{
+	const size_t VertexCount = 1 << 20;
+	const UINT Pairs[][2] = {
+		{ ModelType::AllPart, ModelType::AllPart },
+		{ ModelType::AllPart, ModelType::PTN },
+		{ ModelType::AllPart, ModelType::P },
+		{ ModelType::PTN, ModelType::AllPart } };
+	for (auto& pair : Pairs)
+	{
+		std::vector<VertexElement> src = MakeVertices(pair[0], VertexCount);
+		std::vector<VertexElement> dst(ModelType::VertexSizeInVertexElements(pair[1]) * VertexCount);
+		std::vector<VertexElement> reference(dst.size());
+		double seconds = MeasureBest(5, [&]() { TranscodeVertices(src.data(), pair[0], dst.data(), pair[1], VertexCount); });
+		double referenceSeconds = MeasureBest(5, [&]() { TranscodeReference(src.data(), pair[0], reference.data(), pair[1], VertexCount); });
+		printf("  %2u -> %2u bytes: %.0f M vertices/s, %.1fx the attribute by attribute copy\n",
+			ModelType::VertexSizeInBytes(pair[0]), ModelType::VertexSizeInBytes(pair[1]),
+			VertexCount / seconds / 1e6, referenceSeconds / seconds);
+	}
+}
\ No newline at end of file
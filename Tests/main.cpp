@@ -0,0 +1,42 @@
+#include "test.h"
+
+std::vector<TestCase>& GetTestCases()
+{
+	static std::vector<TestCase> testCases;
+	return testCases;
+}
+
+/* Tests.exe runs every test, "Tests.exe bench" the benchmarks too.
+Any other argument only runs the cases whose name contains it. */
+int wmain(int argc, wchar_t* argv[])
+{
+	bool benchmarks = false;
+	std::string filter;
+	for (int i = 1; i < argc; i++)
+	{
+		if (wcscmp(argv[i], L"bench") == 0)
+			benchmarks = true;
+		else
+			filter = ToStr(argv[i]);
+	}
+
+	UINT failed = 0, run = 0;
+	for (TestCase& testCase : GetTestCases())
+	{
+		if ((testCase.benchmark && !benchmarks) || std::string(testCase.name).find(filter) == std::string::npos)
+			continue;
+		run++;
+		printf("%s\n", testCase.name);
+		try
+		{
+			testCase.run();
+		}
+		catch (std::exception& e)
+		{
+			printf("  FAILED: %s\n", e.what());
+			failed++;
+		}
+	}
+	printf("%u of %u passed\n", run - failed, run);
+	return failed ? 1 : 0;
+}
\ No newline at end of file
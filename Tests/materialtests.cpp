@@ -0,0 +1,49 @@
+#include "test.h"
+#include "testmodel.h"
+
+using namespace gfx;
+
+TEST(EmbeddedTextureShared)
+{
+	//the state an embedded image used by every material leaves: several groups, one decoded texture
+	TestModel model;
+	model.CreateGrid(8, ModelType::PTN);
+	UINT indexCount = (UINT)model.m_indices.size();
+	model.m_groups.clear();
+	for (UINT g = 0; g < 6; g++)
+	{
+		UINT start = indexCount / 6 / 3 * 3 * g;
+		UINT end = g == 5 ? indexCount : indexCount / 6 / 3 * 3 * (g + 1);
+		model.m_groups.push_back({ start, end - start, (int)(g % 2) });
+	}
+	std::vector<unsigned char> pixels(64 * 64 * 4);
+	for (size_t i = 0; i < pixels.size(); i++)
+		pixels[i] = (unsigned char)(i * 7);
+	auto decoded = std::make_shared<const std::vector<unsigned char>>(pixels);
+	for (std::vector<TextureToLoad>* textures : { &model.m_textures, &model.m_normalmaps })
+		for (TextureToLoad& texture : *textures)
+		{
+			texture.filename = L"*0";
+			texture.width = 64;
+			texture.height = 64;
+			texture.data = decoded;
+			texture.loaded = true;
+		}
+
+	model.OrganizeMaterials();
+	model.m_instances.push_back({ 3, mth::float4x4::Translation(10.0f, 0.0f, 0.0f) });
+	model.m_instances.push_back({ 3, mth::float4x4::Translation(20.0f, 0.0f, 0.0f) });
+	model.FlattenInstances();
+	CHECK(model.m_groups.size() == 7 && model.m_textures.size() == 7 && model.m_normalmaps.size() == 7);
+	for (UINT g = 0; g < 7; g++)
+	{
+		CHECK(model.m_groups[g].materialIndex == (int)g);
+		CHECK(model.m_textures[g].loaded && model.m_textures[g].data.get() == decoded.get());
+		CHECK(model.m_normalmaps[g].loaded && model.m_normalmaps[g].data.get() == decoded.get());
+	}
+	CHECK(decoded.use_count() == 1 + 7 * 2);
+	CHECK(*model.m_textures[6].data == pixels);
+
+	model.m_textures[0].Clear();
+	CHECK(!model.m_textures[0].data && *model.m_textures[1].data == pixels);
+}
\ No newline at end of file
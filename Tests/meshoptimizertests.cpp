@@ -0,0 +1,279 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/meshoptimizer.h"
+#include <array>
+#include <climits>
+#include <limits>
+#include <map>
+
+using namespace gfx;
+
+namespace
+{
+	/* the triangles sorted, each rotated to start at its smallest index, which keeps its winding */
+	std::vector<std::array<UINT, 3>> SortedTriangles(const std::vector<UINT>& indices)
+	{
+		std::vector<std::array<UINT, 3>> triangles;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			std::array<UINT, 3> t = { indices[i], indices[i + 1], indices[i + 2] };
+			std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+			triangles.push_back(t);
+		}
+		std::sort(triangles.begin(), triangles.end());
+		return triangles;
+	}
+
+	/* a closed box of size*size quads per face around the origin in the PN layout, the faces wound
+	clockwise seen from outside and with vertices of their own, like a model with hard edges */
+	void AddBox(std::vector<VertexElement>& vertices, std::vector<UINT>& indices, float halfSize, UINT size)
+	{
+		const UINT vertexSize = ModelType::VertexSizeInVertexElements(ModelType::PN);
+		const mth::float3 x(1.0f, 0.0f, 0.0f), y(0.0f, 1.0f, 0.0f), z(0.0f, 0.0f, 1.0f);
+		const mth::float3 faces[6][2] = { { z, y }, { y, z }, { x, z }, { z, x }, { y, x }, { x, y } };	//u and v with v x u outwards
+		float step = 2.0f * halfSize / size;
+		for (const mth::float3* face : faces)
+		{
+			mth::float3 u = face[0], v = face[1], normal = v.Cross(u);
+			mth::float3 corner = (normal - u - v) * halfSize;
+			UINT base = (UINT)(vertices.size() / vertexSize);
+			for (UINT b = 0; b <= size; b++)
+				for (UINT a = 0; a <= size; a++)
+				{
+					mth::float3 p = corner + u * (step * a) + v * (step * b);
+					size_t start = vertices.size();
+					vertices.resize(start + vertexSize);
+					for (UINT c = 0; c < 3; c++)
+					{
+						vertices[start + ModelType::PositionOffset(ModelType::PN) + c] = p(c);
+						vertices[start + ModelType::NormalOffset(ModelType::PN) + c] = normal(c);
+					}
+				}
+			for (UINT b = 0; b < size; b++)
+				for (UINT a = 0; a < size; a++)
+				{
+					UINT c = base + a + b * (size + 1), side = size + 1;
+					UINT quad[6] = { c, c + side, c + 1, c + 1, c + side, c + side + 1 };
+					indices.insert(indices.end(), quad, quad + 6);
+				}
+		}
+	}
+}
+
+TEST(RemapVerticesChecksRemap)
+{
+	TestModel model;
+	model.CreateGrid(4, ModelType::PTN);
+	UINT vertexCount = model.getVertexCount();
+	std::vector<VertexElement> vertices = model.m_vertices;
+	std::vector<UINT> indices = model.m_indices;
+	std::vector<UINT> identity(vertexCount);
+	for (UINT v = 0; v < vertexCount; v++)
+		identity[v] = v;
+
+	std::vector<UINT> dropped = identity;
+	dropped[indices[0]] = UINT_MAX;
+	std::vector<UINT> pastEnd = identity;
+	pastEnd[1] = vertexCount;
+	std::vector<UINT> empty = identity;
+	empty[vertexCount - 1] = 0;
+	std::vector<UINT> shortRemap(identity.begin(), identity.end() - 1);
+	for (std::vector<UINT>* remap : { &dropped, &pastEnd, &empty, &shortRemap })
+	{
+		CHECK_THROWS(model.RemapVertices(*remap, vertexCount));
+		CHECK(model.m_indices == indices && memcmp(model.m_vertices.data(), vertices.data(), vertices.size() * sizeof(VertexElement)) == 0);
+	}
+	model.m_indices[5] = vertexCount;
+	CHECK_THROWS(model.RemapVertices(identity, vertexCount));
+
+	//reversed, every index follows its vertex
+	model.m_indices = indices;
+	std::vector<UINT> reversed(vertexCount);
+	for (UINT v = 0; v < vertexCount; v++)
+		reversed[v] = vertexCount - 1 - v;
+	model.RemapVertices(reversed, vertexCount);
+	UINT vertexSize = ModelType::VertexSizeInVertexElements(model.m_modelType);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		CHECK(model.m_indices[i] == reversed[indices[i]]);
+		CHECK(memcmp(&model.m_vertices[(size_t)model.m_indices[i] * vertexSize], &vertices[(size_t)indices[i] * vertexSize],
+			vertexSize * sizeof(VertexElement)) == 0);
+	}
+}
+
+TEST(WeldRejectsOffGridPositions)
+{
+	const float inf = std::numeric_limits<float>::infinity();
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	const float positions[][3] = {
+		{ 0.0f, 0.0f, 0.0f }, { nan, 0.0f, 0.0f }, { 0.0f, inf, 0.0f }, { 0.0f, 0.0f, -inf },
+		{ 1e30f, 0.0f, 0.0f }, { 1e30f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1e-6f }, { nan, 0.0f, 0.0f } };
+	std::vector<VertexElement> vertices(8 * 3);
+	for (UINT i = 0; i < 8 * 3; i++)
+		vertices[i] = positions[i / 3][i % 3];
+	std::vector<UINT> remap;
+	CHECK(BuildWeldRemap(vertices.data(), 8, ModelType::P, &DefaultWeldTolerance, nullptr, remap) == 7);
+	//the off-grid ones stay on their own, the near one joins the first
+	const UINT expected[] = { 0, 1, 2, 3, 4, 5, 0, 6 };
+	for (UINT v = 0; v < 8; v++)
+		CHECK(remap[v] == expected[v]);
+
+	for (float position : { inf, nan })
+	{
+		WeldTolerance tolerance = DefaultWeldTolerance;
+		tolerance.position = position;
+		CHECK_THROWS(BuildWeldRemap(vertices.data(), 8, ModelType::P, &tolerance, nullptr, remap));
+	}
+}
+
+TEST(WeldJoinsFirstKeptVertex)
+{
+	//a chain spaced just under the tolerance, the middle one joins the first, the last stays apart
+	const float positions[] = { 0.0f, 0.9f, 1.8f, 1.7f, 0.95f };
+	std::vector<VertexElement> vertices(5 * 3);
+	for (UINT v = 0; v < 5; v++)
+	{
+		vertices[v * 3] = positions[v];
+		vertices[v * 3 + 1] = 0.0f;
+		vertices[v * 3 + 2] = 0.0f;
+	}
+	WeldTolerance tolerance = DefaultWeldTolerance;
+	tolerance.position = 1.0f;
+	std::vector<UINT> remap;
+	CHECK(BuildWeldRemap(vertices.data(), 3, ModelType::P, &tolerance, nullptr, remap) == 2);
+	CHECK(remap[0] == 0 && remap[1] == 0 && remap[2] == 1);
+
+	//the first match of the fourth is the middle one, which was welded out of its reach, it joins the kept third
+	CHECK(BuildWeldRemap(vertices.data(), 5, ModelType::P, &tolerance, nullptr, remap) == 2);
+	const UINT expected[] = { 0, 0, 1, 1, 0 };
+	for (UINT v = 0; v < 5; v++)
+		CHECK(remap[v] == expected[v]);
+
+	std::vector<bool> locked = { false, false, true, false, false };
+	CHECK(BuildWeldRemap(vertices.data(), 5, ModelType::P, &tolerance, &locked, remap) == 3);
+	const UINT expectedLocked[] = { 0, 0, 1, 2, 0 };
+	for (UINT v = 0; v < 5; v++)
+		CHECK(remap[v] == expectedLocked[v]);
+}
+
+TEST(MakeVerticesFromHitbox)
+{
+	TestModel model;
+	model.CreateGrid(4, ModelType::PTN);
+	model.MakeHitboxFromVertices();
+	size_t cornerCount = model.m_hitbox.size() * 3;
+	model.MakeVerticesFromHitbox();
+	CHECK(model.getVertexCount() == cornerCount && model.m_indices.size() == cornerCount);
+	model.MakeVerticesFromHitbox(true);
+	CHECK(model.getVertexCount() == 5 * 5 && model.m_indices.size() == cornerCount);
+}
+
+TEST(OptimizeVertexCacheShuffledGrid)
+{
+	TestModel model;
+	model.CreateGrid(32, ModelType::P);
+	std::vector<UINT> indices = model.m_indices;
+	UINT triangleCount = (UINT)indices.size() / 3;
+	std::vector<UINT> order(triangleCount);
+	for (UINT t = 0; t < triangleCount; t++)
+		order[t] = t;
+	UINT seed = 1234;
+	auto random = [&seed]() { seed = seed * 1664525 + 1013904223; return seed >> 8; };
+	for (UINT t = triangleCount - 1; t > 0; t--)
+		std::swap(order[t], order[random() % (t + 1)]);
+	std::vector<UINT> shuffled;
+	for (UINT t : order)	//every triangle starts at a random corner too
+	{
+		UINT start = random() % 3;
+		for (UINT c = 0; c < 3; c++)
+			shuffled.push_back(indices[t * 3 + (start + c) % 3]);
+	}
+	CHECK(SortedTriangles(shuffled) == SortedTriangles(indices));
+
+	std::vector<UINT> optimized = shuffled;
+	OptimizeVertexCache(optimized.data(), optimized.size());
+	CHECK(optimized.size() == shuffled.size());
+	CHECK(SortedTriangles(optimized) == SortedTriangles(shuffled));
+	double before = AnalyzeVertexCache(shuffled.data(), shuffled.size()).getACMR();
+	double after = AnalyzeVertexCache(optimized.data(), optimized.size()).getACMR();
+	CHECK(after < before && after < 0.8);
+}
+
+TEST(OptimizeOverdrawClusters)
+{
+	//hills and valleys, the pieces on the hills get drawn first
+	TestModel model;
+	model.CreateGrid(48, ModelType::PN);
+	UINT vertexSize = ModelType::VertexSizeInVertexElements(ModelType::PN);
+	for (UINT v = 0; v < model.getVertexCount(); v++)
+	{
+		VertexElement* vertex = &model.m_vertices[(size_t)v * vertexSize];
+		float x = vertex[ModelType::PositionOffset(ModelType::PN)].f, z = vertex[ModelType::PositionOffset(ModelType::PN) + 2].f;
+		vertex[ModelType::PositionOffset(ModelType::PN) + 1] = 2.0f * sinf(x * 0.3f) * sinf(z * 0.3f);
+		mth::float3 normal = mth::float3(-0.6f * cosf(x * 0.3f) * sinf(z * 0.3f), 1.0f, -0.6f * sinf(x * 0.3f) * cosf(z * 0.3f)).Normalized();
+		for (UINT c = 0; c < 3; c++)
+			vertex[ModelType::NormalOffset(ModelType::PN) + c] = normal(c);
+	}
+	std::vector<UINT>& indices = model.m_indices;
+	OptimizeVertexCache(indices.data(), indices.size());
+	size_t triangleCount = indices.size() / 3;
+
+	/* the hard clusters start where the simulated cache misses with every vertex of a triangle */
+	std::vector<size_t> cluster(triangleCount);
+	std::vector<double> clusterACMR;
+	for (size_t t = 0, start = 0; t <= triangleCount; t++)
+	{
+		if (t == triangleCount || (t > 0 && AnalyzeVertexCache(indices.data(), t * 3 + 3).transformedCount -
+			AnalyzeVertexCache(indices.data(), t * 3).transformedCount == 3))
+		{
+			clusterACMR.push_back(AnalyzeVertexCache(&indices[start * 3], (t - start) * 3).getACMR());
+			start = t;
+		}
+		if (t < triangleCount)
+			cluster[t] = clusterACMR.size();
+	}
+	std::map<std::array<UINT, 3>, size_t> position;
+	for (size_t t = 0; t < triangleCount; t++)
+		position[{ indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] }] = t;
+
+	for (float threshold : { 1.0f, OverdrawThreshold, 1.5f })
+	{
+		std::vector<UINT> optimized = indices;
+		OptimizeOverdraw(optimized.data(), optimized.size(), model.m_vertices.data(), ModelType::PN, threshold);
+		CHECK(SortedTriangles(optimized) == SortedTriangles(indices));
+
+		//the pieces keep the order of their triangles, each has an ACMR within the threshold of its hard cluster
+		size_t pieceCount = 0;
+		for (size_t t = 0, start = 0; t < triangleCount; t++)
+		{
+			size_t p = position[{ optimized[t * 3], optimized[t * 3 + 1], optimized[t * 3 + 2] }];
+			size_t next = t + 1 < triangleCount ? position[{ optimized[t * 3 + 3], optimized[t * 3 + 4], optimized[t * 3 + 5] }] : p;
+			if (next != p + 1 || cluster[next] != cluster[p])
+			{
+				double acmr = AnalyzeVertexCache(&optimized[start * 3], (t + 1 - start) * 3).getACMR();
+				CHECK(acmr <= threshold * clusterACMR[cluster[p]] + 1e-9);
+				start = t + 1;
+				pieceCount++;
+			}
+		}
+		CHECK(threshold == 1.0f || pieceCount > clusterACMR.size());
+	}
+}
+
+TEST(OptimizeOverdrawNestedBoxes)
+{
+	//the inner box is drawn first, the outer one then covers it everywhere
+	std::vector<VertexElement> vertices;
+	std::vector<UINT> indices;
+	AddBox(vertices, indices, 1.0f, 8);
+	AddBox(vertices, indices, 2.0f, 8);
+	OptimizeVertexCache(indices.data(), indices.size());
+	std::vector<UINT> optimized = indices;
+	OptimizeOverdraw(optimized.data(), optimized.size(), vertices.data(), ModelType::PN, OverdrawThreshold);
+	CHECK(SortedTriangles(optimized) == SortedTriangles(indices));
+
+	OverdrawStatistics before = AnalyzeOverdraw(indices.data(), indices.size(), vertices.data(), ModelType::PN);
+	OverdrawStatistics after = AnalyzeOverdraw(optimized.data(), optimized.size(), vertices.data(), ModelType::PN);
+	CHECK(before.getOverdraw() > 1.1);
+	CHECK(after.coveredPixels == before.coveredPixels && after.getOverdraw() < before.getOverdraw());
+}
\ No newline at end of file
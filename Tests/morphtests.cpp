@@ -0,0 +1,118 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/morph.h"
+
+using namespace gfx;
+
+namespace
+{
+	/* Moves every step-th vertex starting at first */
+	Morph MakeMorph(UINT vertexCount, UINT first, UINT step)
+	{
+		Morph morph;
+		for (UINT v = first; v < vertexCount; v += step)
+		{
+			MorphDelta delta;
+			delta.vertex = v;
+			delta.position = mth::float3(0.1f * (v % 7), 1.0f, -0.5f);
+			delta.normal = mth::float3(0.25f, 0.0f, 0.25f * (v % 3));
+			delta.texcoord = mth::float2(0.01f, 0.02f * (v % 5));
+			morph.deltas.push_back(delta);
+		}
+		return morph;
+	}
+
+	/* Every vertex from base with the float matrix classes */
+	std::vector<VertexElement> MorphReference(TestModel& model, const std::vector<Morph>& morphs, const float* weights)
+	{
+		UINT modelType = model.m_modelType;
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		std::vector<VertexElement> result = model.m_vertices;
+		std::vector<bool> moved(model.getVertexCount(), false);
+		for (size_t m = 0; m < morphs.size(); m++)
+		{
+			if (weights[m] == 0.0f)
+				continue;
+			for (const MorphDelta& delta : morphs[m].deltas)
+			{
+				VertexElement* v = &result[(size_t)delta.vertex * vertexSize];
+				for (UINT i = 0; i < 3; i++)
+				{
+					v[ModelType::PositionOffset(modelType) + i].f += (&delta.position.x)[i] * weights[m];
+					v[ModelType::NormalOffset(modelType) + i].f += (&delta.normal.x)[i] * weights[m];
+				}
+				for (UINT i = 0; i < 2; i++)
+					v[ModelType::TexCoordOffset(modelType) + i].f += (&delta.texcoord.x)[i] * weights[m];
+				moved[delta.vertex] = true;
+			}
+		}
+		for (UINT v = 0; v < model.getVertexCount(); v++)
+		{
+			if (!moved[v])
+				continue;
+			VertexElement* n = &result[(size_t)v * vertexSize + ModelType::NormalOffset(modelType)];
+			mth::float3 normal = mth::float3(n[0].f, n[1].f, n[2].f).Normalized();
+			n[0] = normal.x;
+			n[1] = normal.y;
+			n[2] = normal.z;
+		}
+		return result;
+	}
+
+	bool IsNear(const std::vector<VertexElement>& a, const std::vector<VertexElement>& b)
+	{
+		for (size_t i = 0; i < a.size(); i++)
+			if (a[i].u != b[i].u && !(fabsf(a[i].f - b[i].f) < 1e-5f))
+				return false;
+		return a.size() == b.size();
+	}
+}
+
+TEST(MorphEvaluatorMatchesReference)
+{
+	TestModel model;
+	model.CreateGrid(200, ModelType::PTN);
+	//a morph small enough for the calling thread, and two that are spread over the workers
+	std::vector<Morph> morphs = {
+		MakeMorph(model.getVertexCount(), 5, 97),
+		MakeMorph(model.getVertexCount(), 0, 1),
+		MakeMorph(model.getVertexCount(), 1, 2) };
+	const float weightSets[][3] = {
+		{ 0.5f, 0.0f, 0.0f },
+		{ 1.0f, 0.0f, 0.0f },
+		{ 0.0f, 0.3f, 0.0f },
+		{ 0.2f, 0.7f, -0.4f },
+		{ 0.0f, 0.0f, 1.0f },
+		{ 0.6f, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, 0.0f } };
+	std::vector<VertexElement> dst = model.m_vertices;
+	MorphEvaluator evaluator;
+	for (auto& weights : weightSets)
+	{
+		evaluator.Apply(model.m_vertices.data(), dst.data(), model.m_modelType, morphs, weights);
+		CHECK(IsNear(dst, MorphReference(model, morphs, weights)));
+	}
+	CHECK(memcmp(dst.data(), model.m_vertices.data(), dst.size() * sizeof(VertexElement)) == 0);
+}
+
+BENCHMARK(MorphApply)
+{
+	TestModel model;
+	model.CreateGrid(1000, ModelType::PTN);
+	std::vector<VertexElement> dst = model.m_vertices;
+	for (UINT step : { 1000u, 100u, 10u, 1u })
+	{
+		std::vector<Morph> morphs = { MakeMorph(model.getVertexCount(), 0, step) };
+		MorphEvaluator evaluator;
+		const UINT CallCount = 20;
+		double seconds = MeasureBest(3, [&]() {
+			for (UINT i = 0; i < CallCount; i++)
+			{
+				float weight = (i + 1) / (float)CallCount;
+				evaluator.Apply(model.m_vertices.data(), dst.data(), model.m_modelType, morphs, &weight);
+			}
+		});
+		printf("  %zu deltas: %.1f us per call, %.0f M deltas/s\n", morphs[0].deltas.size(), seconds / CallCount * 1e6,
+			morphs[0].deltas.size() * CallCount / seconds / 1e6);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/omdhandle.h"
+
+using namespace gfx;
+
+namespace
+{
+	bool HasSameSections(ModelLoader& model, TestModel& reference)
+	{
+		if (model.getModelType() != reference.getModelType() || model.getVertexCount() != reference.getVertexCount() ||
+			model.getIndexCount() != reference.getIndexCount() || model.getVertexGroupCount() != reference.getVertexGroupCount() ||
+			model.getMaterialCount() != reference.getMaterialCount() || model.getBoneCount() != reference.getBoneCount())
+			return false;
+		for (UINT g = 0; g < model.getVertexGroupCount(); g++)
+		{
+			VertexGroup& a = model.getVertexGroup(g);
+			VertexGroup& b = reference.getVertexGroup(g);
+			if (a.startIndex != b.startIndex || a.indexCount != b.indexCount || a.materialIndex != b.materialIndex ||
+				model.getTexture(a.materialIndex).filename != reference.getTexture(b.materialIndex).filename ||
+				model.getNormalmap(a.materialIndex).filename != reference.getNormalmap(b.materialIndex).filename)
+				return false;
+		}
+		return memcmp(model.getVertices(), reference.getVertices(), (size_t)model.getVertexCount() * model.getVertexSizeInBytes()) == 0 &&
+			memcmp(model.getIndices(), reference.getIndices(), model.getIndexCount() * sizeof(UINT)) == 0;
+	}
+}
+
+TEST(OMDHandleFetchRelease)
+{
+	for (UINT flags : { 0u, (UINT)OMDExport::COMPRESS })
+	{
+		TempFile file(L"test_handle.omd");
+		TestModel model;
+		model.CreateGrid(20, ModelType::AllPart);
+		model.ExportOMD(file.getFilename(), ModelType::AllPart, true, flags);
+		TestModel reference;
+		reference.LoadModel(file.getFilename(), ModelType::PTN);
+
+		OMDHandle handle(file.getFilename(), ModelType::PTN);
+		CHECK(handle.isOpen() && handle.getResidentParts() == 0 && handle.getModel().getVertices() == nullptr);
+		CHECK(handle.getVertexCount() == reference.getVertexCount() && handle.getModelType() == ModelType::PTN);
+
+		//the second fetch of resident parts reads nothing, the data stays where it is
+		handle.Fetch(OMDPart::VERTICES | OMDPart::INDICES);
+		CHECK(handle.isResident(OMDPart::VERTICES | OMDPart::INDICES) && !handle.isResident(OMDPart::GROUPS));
+		const VertexElement* vertices = handle.getModel().getVertices();
+		handle.Fetch(OMDPart::ALL);
+		CHECK(handle.isResident(OMDPart::ALL) && handle.getModel().getVertices() == vertices);
+		CHECK(HasSameSections(handle.getModel(), reference));
+
+		//released parts are empty until they are fetched again, the others stay
+		handle.Release(OMDPart::VERTICES | OMDPart::MATERIALS);
+		CHECK(!handle.isResident(OMDPart::VERTICES) && !handle.isResident(OMDPart::MATERIALS) && handle.isResident(OMDPart::INDICES));
+		CHECK(handle.getModel().getVertexCount() == 0 && handle.getModel().getMaterialCount() == 0);
+		CHECK(handle.getModel().getIndexCount() == reference.getIndexCount());
+		handle.Fetch(OMDPart::VERTICES | OMDPart::MATERIALS);
+		CHECK(handle.isResident(OMDPart::ALL));
+		CHECK(HasSameSections(handle.getModel(), reference));
+
+		handle.Close();
+		CHECK(!handle.isOpen() && handle.getResidentParts() == 0);
+		CHECK_THROWS(handle.Fetch(OMDPart::VERTICES));
+	}
+}
+
+TEST(OMDHandleTextFile)
+{
+	TempFile file(L"test_handle_text.omd");
+	TestModel model;
+	model.CreateGrid(2, ModelType::PT);
+	model.ExportOMD(file.getFilename(), ModelType::PT, false);
+	OMDHandle handle;
+	CHECK_THROWS(handle.Open(file.getFilename()));
+	CHECK(!handle.isOpen());
+}
\ No newline at end of file
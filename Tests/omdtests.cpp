@@ -0,0 +1,294 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/omdloader.h"
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+using namespace gfx;
+
+TEST(BinaryOMDRoundTrip)
+{
+	TempFile file(L"test_binary.omd");
+	TestModel model;
+	model.CreateGrid(16, ModelType::AllPart);
+	model.ExportOMD(file.getFilename(), ModelType::AllPart);
+	TestModel loaded;
+	loaded.LoadModel(file.getFilename(), ModelType::AllPart);
+	CHECK(loaded.HasSameMesh(model));
+	CHECK(loaded.getMaterialCount() == 2);
+}
+
+namespace
+{
+	/* version 1 is the header followed by the vertices, indices, groups and material names */
+	void ExportVersion1(LPCWSTR filename, TestModel& model)
+	{
+		OMDHeader header = {};
+		header.fileFormat = 'b';
+		memcpy(header.extension, "OMD", 3);
+		header.modelType = model.m_modelType;
+		header.vertexCount = model.getVertexCount();
+		header.indexCount = (UINT)model.m_indices.size();
+		header.groupCount = (UINT)model.m_groups.size();
+		header.materialCount = model.getMaterialCount();
+		header.boundingVolumePrimitive = mth::BoundingVolume::NO_TYPE;
+		std::ofstream outfile(filename, std::ios::out | std::ios::binary);
+		outfile.write((const char*)&header, sizeof(header));
+		outfile.write((const char*)model.m_vertices.data(), model.m_vertices.size() * sizeof(VertexElement));
+		outfile.write((const char*)model.m_indices.data(), model.m_indices.size() * sizeof(UINT));
+		outfile.write((const char*)model.m_groups.data(), model.m_groups.size() * sizeof(VertexGroup));
+		for (UINT i = 0; i < header.materialCount; i++)
+		{
+			outfile.write((const char*)model.m_textures[i].filename.c_str(), (model.m_textures[i].filename.length() + 1) * sizeof(WCHAR));
+			outfile.write((const char*)model.m_normalmaps[i].filename.c_str(), (model.m_normalmaps[i].filename.length() + 1) * sizeof(WCHAR));
+		}
+	}
+
+	/* The loader before the mapped one, every section through std::ifstream::read
+	and the material names a WCHAR at a time */
+	void StreamLoadVersion1(LPCWSTR filename, TestModel& model)
+	{
+		std::ifstream infile(filename, std::ios::in | std::ios::binary);
+		OMDHeader header;
+		infile.read((char*)&header, sizeof(header));
+		model.m_modelType = header.modelType;
+		model.m_vertexSizeInBytes = ModelType::VertexSizeInBytes(header.modelType);
+		model.m_vertices.resize((size_t)header.vertexCount * model.m_vertexSizeInBytes / sizeof(VertexElement));
+		infile.read((char*)model.m_vertices.data(), model.m_vertices.size() * sizeof(VertexElement));
+		model.m_indices.resize(header.indexCount);
+		infile.read((char*)model.m_indices.data(), header.indexCount * sizeof(UINT));
+		model.m_groups.resize(header.groupCount);
+		infile.read((char*)model.m_groups.data(), header.groupCount * sizeof(VertexGroup));
+		model.m_textures.assign(header.materialCount, TextureToLoad());
+		model.m_normalmaps.assign(header.materialCount, TextureToLoad());
+		for (UINT i = 0; i < header.materialCount; i++)
+		{
+			for (std::wstring* name : { &model.m_textures[i].filename, &model.m_normalmaps[i].filename })
+			{
+				WCHAR ch;
+				infile.read((char*)&ch, sizeof(WCHAR));
+				while (ch)
+				{
+					*name += ch;
+					infile.read((char*)&ch, sizeof(WCHAR));
+				}
+			}
+		}
+		if (!infile.good())
+			throw std::exception("Failed to read the version 1 file");
+	}
+}
+
+BENCHMARK(BinaryOMDLoad)
+{
+	//the same version 1 file with about 1M vertices through the mapping and through the stream
+	TempFile file(L"bench_binary.omd");
+	TestModel model;
+	model.CreateGrid(1000, ModelType::AllPart);
+	ExportVersion1(file.getFilename(), model);
+	double fileSize = (double)std::filesystem::file_size(file.getFilename());
+	TestModel mapped;
+	double mappedSeconds = MeasureBest(5, [&]() { mapped.LoadModel(file.getFilename(), ModelType::AllPart); });
+	TestModel streamed;
+	double streamSeconds = MeasureBest(5, [&]() { StreamLoadVersion1(file.getFilename(), streamed); });
+	CHECK(mapped.HasSameMesh(model) && streamed.HasSameMesh(model));
+	printf("  %.1f MB with %u vertices\n", fileSize / 1e6, model.getVertexCount());
+	printf("  mapped: %.2f ms, %.0f MB/s\n", mappedSeconds * 1e3, fileSize / mappedSeconds / 1e6);
+	printf("  stream: %.2f ms, %.0f MB/s\n", streamSeconds * 1e3, fileSize / streamSeconds / 1e6);
+	printf("  mapped is %.1fx the stream\n", streamSeconds / mappedSeconds);
+}
+
+TEST(TextOMDRoundTrip)
+{
+	//the index section is one line of about 1.4 MB, it is parsed in several chunks
+	TempFile file(L"test_text.omd");
+	TestModel model;
+	model.CreateGrid(200, ModelType::AllPart);
+	model.ExportOMD(file.getFilename(), ModelType::AllPart, false);
+	TestModel loaded;
+	loaded.LoadModel(file.getFilename(), ModelType::AllPart);
+	CHECK(loaded.HasSameMesh(model));
+	loaded.LoadModel(file.getFilename(), ModelType::PT);
+	CHECK(loaded.getVertexCount() == model.getVertexCount() && loaded.m_indices == model.m_indices);
+
+	std::vector<char> data = ReadTestFile(file.getFilename());
+	const char label[] = "Indices:";
+	size_t indices = std::search(data.begin(), data.end(), label, label + sizeof(label) - 1) - data.begin();
+	CHECK(indices < data.size());
+	data[indices + 5000] = 'x';
+	CHECK_THROWS(loaded.LoadModel(data.data(), data.size(), L"corrupted.omd", ModelType::AllPart));
+}
+
+TEST(CorruptedMaterialCount)
+{
+	//twice the count wraps around to 2 in 32 bits, which the names after the header would satisfy
+	std::vector<char> data(sizeof(OMDHeader) + 4 * sizeof(WCHAR), 0);
+	OMDHeader header = {};
+	header.fileFormat = 'b';
+	memcpy(header.extension, "OMD", 3);
+	header.modelType = ModelType::P;
+	header.materialCount = 0x80000001;
+	memcpy(data.data(), &header, sizeof(header));
+	TestModel model;
+	CHECK_THROWS(model.LoadModel(data.data(), data.size(), L"corrupted.omd", ModelType::P));
+
+	TempFile file(L"test_materials.omd");
+	model.CreateGrid(2, ModelType::PT);
+	model.ExportOMD(file.getFilename(), ModelType::PT);
+	std::vector<char> v2 = ReadTestFile(file.getFilename());
+	((OMDHeader*)v2.data())->materialCount = 0x80000001;
+	CHECK_THROWS(model.LoadModel(v2.data(), v2.size(), L"corrupted.omd", ModelType::PT));
+}
+
+TEST(MisalignedSection)
+{
+	TempFile file(L"test_aligned.omd");
+	TestModel model;
+	model.CreateGrid(4, ModelType::PT);
+	model.ExportOMD(file.getFilename(), ModelType::PT);
+	std::vector<char> data = ReadTestFile(file.getFilename());
+	const OMDHeaderV2* header = (const OMDHeaderV2*)data.data();
+	OMDSectionEntry* sections = (OMDSectionEntry*)(data.data() + header->sectionTableOffset);
+	for (UINT i = 0; i < header->sectionCount; i++)
+	{
+		std::vector<char> misaligned = data;
+		OMDSectionEntry& section = ((OMDSectionEntry*)(misaligned.data() + header->sectionTableOffset))[i];
+		section.offset += 2;
+		section.size -= (std::min)(section.size, (UINT64)2);
+		bool thrown = false;
+		try
+		{
+			model.LoadModel(misaligned.data(), misaligned.size(), L"misaligned.omd", ModelType::PT);
+		}
+		catch (std::exception& e)
+		{
+			thrown = strstr(e.what(), "aligned") != nullptr;
+		}
+		CHECK(thrown);
+	}
+	CHECK(header->sectionCount > 0 && sections[0].offset % OMDSection::SectionAlignment == 0);
+}
+
+
+TEST(QuantizedOMDRoundTrip)
+{
+	TempFile file(L"test_quantized.omd");
+	TestModel model;
+	model.CreateGrid(16, ModelType::AllPart);
+	OMDExportReport report = {};
+	model.ExportOMD(file.getFilename(), ModelType::AllPart, true, OMDExport::QUANTIZE, &report);
+	CHECK(QuantizedVertexSizeInBytes(ModelType::AllPart) == 40);
+	CHECK(report.vertexBytes == (UINT64)model.getVertexCount() * 40);
+	TestModel loaded;
+	loaded.LoadModel(file.getFilename(), ModelType::AllPart);
+	CHECK(loaded.getVertexCount() == model.getVertexCount() && loaded.m_indices == model.m_indices);
+	const float* a = (const float*)model.getVertices();
+	const float* b = (const float*)loaded.getVertices();
+	UINT positionOffset = ModelType::PositionOffset(ModelType::AllPart);
+	for (UINT v = 0; v < model.getVertexCount(); v++)
+	{
+		for (UINT c = 0; c < 3; c++)
+		{
+			size_t i = (size_t)v * model.getVertexSizeInFloats() + positionOffset + c;
+			CHECK(fabsf(a[i] - b[i]) <= report.quantizationError.position + 1e-6f);
+		}
+	}
+	CHECK(report.quantizationError.position < 1e-3f);
+}
+
+BENCHMARK(QuantizedOMDExportLoad)
+{
+	TestModel model;
+	model.CreateGrid(1000, ModelType::AllPart);
+	for (UINT flags : { 0u, (UINT)OMDExport::QUANTIZE })
+	{
+		TempFile file(L"bench_quantized.omd");
+		OMDExportReport report = {};
+		double exportSeconds = MeasureBest(1, [&]() { model.ExportOMD(file.getFilename(), ModelType::AllPart, true, flags, &report); });
+		double fileSize = (double)std::filesystem::file_size(file.getFilename());
+		TestModel loaded;
+		double loadSeconds = MeasureBest(5, [&]() { loaded.LoadModel(file.getFilename(), ModelType::AllPart); });
+		printf("  %s: %.0f bytes per vertex, %.1f MB file, export %.0f ms, load %.2f ms (%.1f M vertices/s)\n",
+			flags ? "quantized" : "float", (double)report.vertexBytes / model.getVertexCount(), fileSize / 1e6,
+			exportSeconds * 1e3, loadSeconds * 1e3, model.getVertexCount() / loadSeconds / 1e6);
+	}
+}
+
+
+TEST(TextOMDUtf8Names)
+{
+	const std::wstring texture = L"caf\u00e9/\u5c71\u98a8.png";
+	const std::wstring normalmap = L"\u0393\u03b5\u03b9\u03ac_n.png";
+	TempFile file(L"test_names.omd");
+	TestModel model;
+	model.CreateGrid(2, ModelType::PTM);
+	model.m_textures[1].filename = texture;
+	model.m_normalmaps[1].filename = normalmap;
+	model.ExportOMD(file.getFilename(), ModelType::PTM, false);
+	std::vector<char> data = ReadTestFile(file.getFilename());
+	CHECK(std::search(data.begin(), data.end(), "caf\xc3\xa9/", "caf\xc3\xa9/" + 6) != data.end());
+
+	TestModel loaded;
+	loaded.LoadModel(file.getFilename(), ModelType::PTM);
+	CHECK(loaded.HasSameMesh(model));
+	CHECK(loaded.getTexture(1).filename == texture);
+	CHECK(loaded.getNormalmap(1).filename == normalmap);
+
+	//files written before names were UTF-8 have one byte per character
+	const char legacy[] = "caf\xe9.png";
+	size_t position = std::search(data.begin(), data.end(), "caf\xc3\xa9/", "caf\xc3\xa9/" + 6) - data.begin();
+	size_t lineEnd = std::find(data.begin() + position, data.end(), '\n') - data.begin();
+	data.erase(data.begin() + position, data.begin() + lineEnd);
+	data.insert(data.begin() + position, legacy, legacy + sizeof(legacy) - 1);
+	loaded.LoadModel(data.data(), data.size(), L"legacy.omd", ModelType::PTM);
+	CHECK(loaded.getTexture(1).filename == L"caf\u00e9.png");
+}
+
+
+TEST(TextOMDUtf8BoneNames)
+{
+	const std::wstring boneNames[] = { L"\u982d", L"arm_\u00e9paule", L"\u041a\u043e\u0441\u0442\u044c" };
+	const std::wstring animationName = L"\u6b69\u304f";
+	TempFile file(L"test_bone_names.omd");
+	TestModel model;
+	model.CreateGrid(2, ModelType::PB);
+	for (UINT i = 0; i < 3; i++)
+	{
+		Bone bone;
+		bone.name = boneNames[i];
+		bone.parent = (int)i - 1;
+		model.m_bones.push_back(bone);
+	}
+	AnimationData animation;
+	animation.name = animationName;
+	animation.duration = 1.0f;
+	model.m_animations.push_back(Animation(animation));
+	model.ExportOMD(file.getFilename(), ModelType::PB, false);
+
+	TestModel loaded;
+	loaded.LoadModel(file.getFilename(), ModelType::PB);
+	CHECK(loaded.getBoneCount() == 3 && loaded.getAnimationCount() == 1);
+	for (UINT i = 0; i < 3; i++)
+		CHECK(loaded.getBone(i).name == boneNames[i]);
+	CHECK(loaded.getAnimation(0).getName() == animationName);
+}
+
+TEST(TextOMDUtf8MorphNames)
+{
+	const std::wstring morphName = L"\u307e\u3070\u305f\u304d_\u00e9";
+	TempFile file(L"test_morph_names.omd");
+	TestModel model;
+	model.CreateGrid(2, ModelType::PTN);
+	Morph morph;
+	morph.name = morphName;
+	morph.deltas.push_back({ 1, mth::float3(0.0f, 1.0f, 0.0f), mth::float3(0.0f), mth::float2(0.0f) });
+	model.m_morphs.push_back(morph);
+	model.ExportOMD(file.getFilename(), ModelType::PTN, false);
+	std::vector<char> data = ReadTestFile(file.getFilename());
+	CHECK(std::search(data.begin(), data.end(), "_\xc3\xa9", "_\xc3\xa9" + 3) != data.end());
+
+	TestModel loaded;
+	loaded.LoadModel(file.getFilename(), ModelType::PTN);
+	CHECK(loaded.getMorphCount() == 1 && loaded.getMorph(0).name == morphName);
+}
\ No newline at end of file
@@ -0,0 +1,331 @@
+#include "test.h"
+#include "testmodel.h"
+
+using namespace gfx;
+
+namespace
+{
+	struct PMXTestBone
+	{
+		std::wstring name;
+		mth::float3 position;
+		short parent;
+		USHORT flags;	//the indexed tail, inherit and IK fields are written with the flags
+	};
+
+	/* PMX weight deform of a vertex, type 0 - 4 is BDEF1, BDEF2, BDEF4, SDEF, QDEF */
+	struct PMXTestDeform
+	{
+		char type;
+		short bones[4];
+		float weights[4];	//only the first one for BDEF2 and SDEF
+	};
+
+	/* What PMXWriter puts in a file besides the vertices, indices and materials */
+	struct PMXOptions
+	{
+		bool utf8 = false;
+		bool oddComment = false;	//a stray byte after the UTF-16 comment, counted in its length
+		std::vector<std::wstring> textures = { L"a.png", L"b.png" };
+		std::vector<PMXTestBone> bones;
+		std::vector<PMXTestDeform> deforms;	//vertex i gets deforms[i % size], zeros of every type in turn without them
+		std::wstring morphName;		//a vertex morph moving vertex 0 if not empty
+	};
+
+	/* PMX 2.0 in UTF-16 or UTF-8 with one extra vec4, 4 byte vertex and 2 byte bone indices */
+	class PMXWriter
+	{
+		std::string m_data;
+		bool m_utf8;
+
+		template <typename T>
+		void Put(T value)
+		{
+			m_data.append((const char*)&value, sizeof(T));
+		}
+		void PutText(const std::wstring& text, bool strayByte = false)
+		{
+			if (m_utf8)
+			{
+				std::string utf8 = ToUtf8(text.c_str());
+				Put<int>((int)utf8.length());
+				m_data += utf8;
+				return;
+			}
+			Put<int>((int)text.length() * 2 + (strayByte ? 1 : 0));
+			for (WCHAR c : text)
+				Put<USHORT>((USHORT)c);
+			if (strayByte)
+				Put<char>('?');
+		}
+
+		void PutDeform(const PMXTestDeform& deform)
+		{
+			const UINT boneCounts[] = { 1, 2, 4, 2, 4 };
+			Put(deform.type);
+			for (UINT b = 0; b < boneCounts[deform.type]; b++)
+				Put(deform.bones[b]);
+			if (deform.type == 1 || deform.type == 3)
+				Put(deform.weights[0]);
+			else if (deform.type != 0)
+				m_data.append((const char*)deform.weights, sizeof(deform.weights));
+			if (deform.type == 3)
+				m_data.append(3 * sizeof(mth::float3), '\0');	//SDEF C, R0, R1
+		}
+		void PutBone(const PMXTestBone& bone)
+		{
+			PutText(bone.name);
+			PutText(L"");
+			Put(bone.position);
+			Put(bone.parent);
+			Put<int>(0);	//layer
+			Put(bone.flags);
+			if (bone.flags & 0x0001)
+				Put<short>(-1);
+			else
+				Put(mth::float3(0.0f, 1.0f, 0.0f));
+			if (bone.flags & (0x0100 | 0x0200))
+			{
+				Put<short>(0);
+				Put(0.5f);
+			}
+			if (bone.flags & 0x0020)
+			{
+				Put<short>(0);	//target
+				Put<int>(10);
+				Put(0.1f);
+				Put<int>(2);
+				Put<short>(0);
+				Put<char>(1);
+				Put(mth::float3(-1.0f));
+				Put(mth::float3(1.0f));
+				Put<short>(0);
+				Put<char>(0);
+			}
+		}
+
+	public:
+		/* a material per surface count */
+		PMXWriter(UINT vertexCount, const std::vector<UINT>& indices, const std::vector<int>& surfaceCounts,
+			const PMXOptions& options = PMXOptions()) :
+			m_utf8(options.utf8)
+		{
+			m_data = "PMX ";
+			Put(2.0f);
+			const char globals[] = { 8, options.utf8 ? (char)1 : (char)0, 1, 4, 1, 1, 2, 1, 1 };
+			m_data.append(globals, sizeof(globals));
+			PutText(L"model");
+			PutText(L"model");
+			PutText(L"comment", options.oddComment);
+			PutText(L"");
+
+			Put<int>((int)vertexCount);
+			const size_t deformSize[] = { 2, 8, 24, 44, 24 };
+			for (UINT i = 0; i < vertexCount; i++)
+			{
+				float values[] = { (float)i, 1.0f, 2.0f, 0.0f, 1.0f, 0.0f, 0.5f, (float)i / vertexCount, 9.0f, 9.0f, 9.0f, 9.0f };
+				for (float value : values)
+					Put(value);
+				if (options.deforms.empty())
+				{
+					char deformType = (char)(i % 5);
+					Put(deformType);
+					m_data.append(deformSize[deformType], '\0');
+				}
+				else
+					PutDeform(options.deforms[i % options.deforms.size()]);
+				Put(1.0f);
+			}
+
+			Put<int>((int)indices.size());
+			for (UINT index : indices)
+				Put(index);
+
+			Put<int>((int)options.textures.size());
+			for (const std::wstring& texture : options.textures)
+				PutText(texture);
+
+			Put<int>((int)surfaceCounts.size());
+			for (size_t m = 0; m < surfaceCounts.size(); m++)
+			{
+				PutText(L"material");
+				PutText(L"material");
+				m_data.append(16 + 12 + 4 + 12 + 1 + 16 + 4, '\0');
+				Put<char>((char)(m % 2 ? -1 : 1));	//texture
+				Put<char>(-1);	//sphere texture
+				Put<char>(0);	//sphere mode
+				Put<char>(1);	//shared toon
+				Put<char>(3);
+				PutText(L"");
+				Put<int>(surfaceCounts[m]);
+			}
+			Put<int>((int)options.bones.size());
+			for (const PMXTestBone& bone : options.bones)
+				PutBone(bone);
+			if (options.morphName.empty())
+			{
+				Put<int>(0);
+				return;
+			}
+			Put<int>(1);
+			PutText(options.morphName);
+			PutText(L"");
+			Put<char>(1);	//panel
+			Put<char>(1);	//vertex morph
+			Put<int>(1);
+			Put<UINT>(0);
+			Put(mth::float3(0.0f, 1.0f, 0.0f));
+		}
+
+		inline std::string& getData() { return m_data; }
+	};
+
+	std::vector<UINT> CycleIndices(UINT indexCount, UINT vertexCount)
+	{
+		std::vector<UINT> indices(indexCount);
+		for (UINT i = 0; i < indexCount; i++)
+			indices[i] = i % vertexCount;
+		return indices;
+	}
+
+	void LoadPMX(TestModel& model, std::string& data)
+	{
+		model.LoadModel(data.data(), data.size(), L"test.pmx", ModelType::PTN);
+	}
+}
+
+TEST(PMXLoad)
+{
+	const UINT VertexCount = 1000;
+	PMXWriter pmx(VertexCount, CycleIndices(3000, VertexCount), { 1200, 1800 });
+	TestModel model;
+	LoadPMX(model, pmx.getData());
+	CHECK(model.getVertexCount() == VertexCount && model.m_indices.size() == 3000 && model.m_groups.size() == 2);
+	UINT vertexSize = ModelType::VertexSizeInVertexElements(model.m_modelType);
+	for (UINT i = 0; i < VertexCount; i++)
+	{
+		const VertexElement* v = &model.m_vertices[(size_t)i * vertexSize + ModelType::PositionOffset(model.m_modelType)];
+		CHECK(v[0].f == (float)i && v[1].f == 1.0f && v[2].f == 2.0f);
+	}
+	for (size_t i = 0; i < model.m_indices.size(); i++)
+		CHECK(model.m_indices[i] == i % VertexCount);
+
+	//the morph count at the end is optional
+	std::string& data = pmx.getData();
+	for (size_t size = 0; size + sizeof(int) < data.size(); size += size < 2000 ? 1 : 997)
+	{
+		TestModel truncated;
+		CHECK_THROWS(truncated.LoadModel(data.data(), size, L"test.pmx", ModelType::PTN));
+	}
+}
+
+TEST(PMXTextEncodings)
+{
+	//a UTF-8 file with Japanese names, and a UTF-16 one with an odd text length before everything else
+	const std::wstring texture = L"\u30c6\u30af\u30b9\u30c1\u30e3.png";
+	const std::wstring morph = L"\u307e\u3070\u305f\u304d";
+	for (bool utf8 : { true, false })
+	{
+		PMXOptions options;
+		options.utf8 = utf8;
+		options.oddComment = !utf8;
+		options.textures = { L"a.png", texture };	//the first material uses the second texture
+		options.morphName = morph;
+		PMXWriter pmx(100, CycleIndices(300, 100), { 150, 150 }, options);
+		TestModel model;
+		LoadPMX(model, pmx.getData());
+		CHECK(model.getVertexCount() == 100 && model.m_groups.size() == 2);
+		CHECK(model.getTexture(model.m_groups[0].materialIndex).filename == texture);
+		CHECK(model.getMorphCount() == 1 && model.getMorph(0).name == morph && model.getMorph(0).deltas.size() == 1);
+	}
+}
+
+TEST(PMXSkeletonAndWeights)
+{
+	/* File order with a child before its parent, a bone that is its own parent, one with a missing
+	parent and a cycle of two. Depth first from the roots in file order gives root, arm, hand, self,
+	lost, then the cycle broken at its first bone: loopA, loopB. */
+	PMXOptions options;
+	options.bones = {
+		{ L"root", mth::float3(0.0f), -1, 0 },
+		{ L"hand", mth::float3(1.0f, 1.0f, 0.0f), 2, 0 },
+		{ L"arm", mth::float3(1.0f, 0.0f, 0.0f), 0, 0x0001 | 0x0100 | 0x0020 },
+		{ L"loopA", mth::float3(5.0f, 0.0f, 0.0f), 4, 0 },
+		{ L"loopB", mth::float3(6.0f, 0.0f, 0.0f), 3, 0x0200 },
+		{ L"self", mth::float3(0.0f, 2.0f, 0.0f), 5, 0 },
+		{ L"lost", mth::float3(0.0f, 3.0f, 0.0f), 99, 0 } };
+	const int remap[] = { 0, 2, 1, 5, 6, 3, 4 };
+	//BDEF1, BDEF2, BDEF4 with a repeated and a missing bone, SDEF with the same bone twice, QDEF
+	options.deforms = {
+		{ 0, { 1 } },
+		{ 1, { 1, 2 }, { 0.25f } },
+		{ 2, { 0, 3, 3, -1 }, { 0.2f, 0.3f, 0.3f, 0.4f } },
+		{ 3, { 4, 4 }, { 0.6f } },
+		{ 4, { 6, 5, 0, 1 }, { 1.0f, 1.0f, 1.0f, 1.0f } } };
+	struct Influences { UINT bones[4]; float weights[4]; };
+	const Influences expected[] = {
+		{ { (UINT)remap[1] }, { 1.0f } },
+		{ { (UINT)remap[1], (UINT)remap[2] }, { 0.25f, 0.75f } },
+		{ { (UINT)remap[0], (UINT)remap[3] }, { 0.25f, 0.75f } },
+		{ { (UINT)remap[4] }, { 1.0f } },
+		{ { (UINT)remap[6], (UINT)remap[5], (UINT)remap[0], (UINT)remap[1] }, { 0.25f, 0.25f, 0.25f, 0.25f } } };
+
+	PMXWriter pmx(50, CycleIndices(150, 50), { 150 }, options);
+	TestModel model;
+	model.LoadModel(pmx.getData().data(), pmx.getData().size(), L"test.pmx", ModelType::PTNB);
+	CHECK(ModelType::HasBones(model.m_modelType) && model.getBoneCount() == 7);
+	const LPCWSTR names[] = { L"root", L"arm", L"hand", L"self", L"lost", L"loopA", L"loopB" };
+	const int parents[] = { -1, 0, 1, -1, -1, -1, 5 };
+	for (UINT b = 0; b < 7; b++)
+		CHECK(model.getBone(b).name == names[b] && model.getBone(b).parent == parents[b]);
+	auto near = [](mth::float3 a, mth::float3 b) { return (a - b).Length() < 1e-6f; };
+	CHECK(near(model.getBone(1).translation, mth::float3(1.0f, 0.0f, 0.0f)));
+	CHECK(near(model.getBone(2).translation, mth::float3(0.0f, 1.0f, 0.0f)));
+	CHECK(near(model.getBone(5).translation, mth::float3(5.0f, 0.0f, 0.0f)));
+	CHECK(near(model.getBone(6).translation, mth::float3(1.0f, 0.0f, 0.0f)));
+
+	UINT vertexSize = ModelType::VertexSizeInVertexElements(model.m_modelType);
+	UINT boneOffset = ModelType::BoneWeightsOffset(model.m_modelType);
+	for (UINT v = 0; v < model.getVertexCount(); v++)
+	{
+		const VertexElement* influences = &model.m_vertices[(size_t)v * vertexSize + boneOffset];
+		const Influences& e = expected[v % 5];
+		for (UINT i = 0; i < 4; i++)
+			CHECK(fabsf(influences[i].f - e.weights[i]) < 1e-6f && influences[4 + i].u == e.bones[i]);
+	}
+}
+
+TEST(PMXCorruptedMaterials)
+{
+	for (auto& surfaceCounts : { std::vector<int>{ 3000, 3 }, std::vector<int>{ -3, 3 }, std::vector<int>{ 0x7ffffffe, 0x7ffffffe } })
+	{
+		PMXWriter pmx(100, CycleIndices(3000, 100), surfaceCounts);
+		TestModel model;
+		CHECK_THROWS(LoadPMX(model, pmx.getData()));
+	}
+}
+
+TEST(PMXIndexOutOfRange)
+{
+	for (UINT vertex : { 100u, 0xffffffffu })
+	{
+		std::vector<UINT> indices = CycleIndices(300, 100);
+		indices.back() = vertex;
+		PMXWriter pmx(100, indices, { 300 });
+		TestModel model;
+		CHECK_THROWS(LoadPMX(model, pmx.getData()));
+	}
+	PMXWriter empty(0, { 0, 0, 0 }, { 3 });
+	TestModel model;
+	CHECK_THROWS(LoadPMX(model, empty.getData()));
+}
+
+BENCHMARK(PMXParse)
+{
+	const UINT VertexCount = 1 << 20;
+	PMXWriter pmx(VertexCount, CycleIndices(VertexCount * 3, VertexCount), { (int)VertexCount, (int)VertexCount * 2 });
+	std::string& data = pmx.getData();
+	TestModel model;
+	double seconds = MeasureBest(5, [&]() { LoadPMX(model, data); });
+	printf("  %.1f MB with %u vertices: %.0f MB/s\n", data.size() / 1e6, VertexCount, data.size() / seconds / 1e6);
+}
\ No newline at end of file
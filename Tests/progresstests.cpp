@@ -0,0 +1,72 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/loadprogress.h"
+#include <atomic>
+#include <thread>
+
+using namespace gfx;
+
+namespace
+{
+	const UINT PostProcessFlags = PostProcess::WELD | PostProcess::VERTEX_CACHE | PostProcess::VERTEX_FETCH;
+
+	/* a model with many groups, so the post-process reports in several batches */
+	void ExportGroups(LPCWSTR filename, UINT size, UINT groupCount)
+	{
+		TestModel model;
+		model.CreateGrid(size, ModelType::PTN);
+		UINT triangleCount = (UINT)model.m_indices.size() / 3;
+		model.m_groups.clear();
+		for (UINT g = 0; g < groupCount; g++)
+		{
+			UINT first = triangleCount * g / groupCount;
+			UINT last = triangleCount * (g + 1) / groupCount;
+			model.m_groups.push_back({ first * 3, (last - first) * 3, (int)(g % 2) });
+		}
+		model.ExportOMD(filename, ModelType::PTN);
+	}
+}
+
+TEST(PostProcessProgress)
+{
+	TempFile file(L"test_progress.omd");
+	ExportGroups(file.getFilename(), 100, 300);
+	LoadProgress progress;
+	TestModel model;
+	model.LoadModel(file.getFilename(), ModelType::PTN, PostProcessFlags, &progress);
+	CHECK(progress.getStage() == LoadStage::POSTPROCESS);
+	CHECK(progress.getTotal() > 0 && progress.getDone() == progress.getTotal());
+}
+
+TEST(PostProcessCancel)
+{
+	TempFile file(L"test_cancel.omd");
+	ExportGroups(file.getFilename(), 300, 1000);
+	for (UINT run = 0; run < 3; run++)
+	{
+		LoadProgress progress;
+		std::atomic<bool> loading(true);
+		std::thread watcher([&]() {
+			while (loading && progress.getStage() != LoadStage::POSTPROCESS)
+				std::this_thread::yield();
+			progress.Cancel();
+		});
+		TestModel model;
+		bool canceled = false;
+		try
+		{
+			model.LoadModel(file.getFilename(), ModelType::PTN, PostProcessFlags, &progress);
+		}
+		catch (std::exception&)
+		{
+			canceled = true;
+		}
+		loading = false;
+		watcher.join();
+		//a cancel after the last check lets the load finish, then the model is whole
+		if (canceled)
+			CHECK(model.m_vertices.empty() && model.m_indices.empty() && model.m_groups.empty());
+		else
+			CHECK(progress.getDone() == progress.getTotal());
+	}
+}
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "test.h"
+#include "testmodel.h"
+#include "modelloaders/skinning.h"
+
+using namespace gfx;
+
+namespace
+{
+	/* One vertex at a time with the matrix classes, the normal through the inverted blended matrix */
+	void SkinReference(std::vector<VertexElement>& vertices, UINT modelType, const std::vector<mth::float4x4>& palette)
+	{
+		UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+		for (size_t v = 0; v < vertices.size() / vertexSize; v++)
+		{
+			VertexElement* vertex = &vertices[v * vertexSize];
+			mth::float4x4 m(0.0f);
+			float weightSum = 0.0f;
+			for (UINT b = 0; b < 4; b++)
+			{
+				UINT bone = vertex[ModelType::BoneIndexOffset(modelType) + b].u;
+				float weight = vertex[ModelType::BoneWeightsOffset(modelType) + b].f;
+				if (bone < palette.size() && weight > 0.0f)
+				{
+					m += palette[bone] * weight;
+					weightSum += weight;
+				}
+			}
+			if (weightSum <= 0.0f)
+				continue;
+			m /= weightSum;
+			m(3, 3) = 1.0f;
+			mth::float4x4 normalTransform = m.Inverse();
+			normalTransform.Transpose();
+			auto transform = [vertex](const mth::float4x4& m, UINT offset, float w) {
+				mth::float4 r = m * mth::float4(vertex[offset].f, vertex[offset + 1].f, vertex[offset + 2].f, w);
+				mth::float3 d(r.x, r.y, r.z);
+				if (w == 0.0f)
+					d.Normalize();
+				vertex[offset] = d.x;
+				vertex[offset + 1] = d.y;
+				vertex[offset + 2] = d.z;
+			};
+			transform(m, ModelType::PositionOffset(modelType), 1.0f);
+			if (ModelType::HasNormals(modelType))
+				transform(normalTransform, ModelType::NormalOffset(modelType), 0.0f);
+			if (ModelType::HasTangentsBinormals(modelType))
+			{
+				transform(m, ModelType::TangentOffset(modelType), 0.0f);
+				transform(m, ModelType::BinormalOffset(modelType), 0.0f);
+			}
+		}
+	}
+
+	std::vector<mth::float4x4> MakePalette()
+	{
+		return {
+			mth::float4x4::Scaling(2.0f, 1.0f, 0.5f),
+			mth::float4x4::Translation(1.0f, 2.0f, 3.0f) * mth::float4x4::RotationY(0.7f),
+			mth::float4x4::Scaling(-1.0f, 1.0f, 1.0f),
+			mth::float4x4::RotationAxis(mth::float3(1.0f, 1.0f, 0.0f).Normalized(), 1.2f) * mth::float4x4::Scaling(1.0f, 3.0f, 1.0f) };
+	}
+
+	mth::float3 ReadVector(const VertexElement* v)
+	{
+		return mth::float3(v[0].f, v[1].f, v[2].f);
+	}
+}
+
+TEST(SkinningNormalsUseInverseTranspose)
+{
+	const UINT modelType = ModelType::PNB;
+	UINT vertexSize = ModelType::VertexSizeInVertexElements(modelType);
+	std::vector<VertexElement> vertex(vertexSize);
+	const float n = sqrtf(0.5f);
+	vertex[ModelType::NormalOffset(modelType)] = n;
+	vertex[ModelType::NormalOffset(modelType) + 1] = n;
+	vertex[ModelType::BoneWeightsOffset(modelType)] = 1.0f;
+
+	//stretching along x tilts the normal of a 45 degree plane away from x
+	mth::float4x4 scaling = mth::float4x4::Scaling(2.0f, 1.0f, 1.0f);
+	std::vector<VertexElement> skinned(vertexSize);
+	SkinVertices(vertex.data(), skinned.data(), modelType, 1, &scaling, 1);
+	mth::float3 expected = mth::float3(0.5f, 1.0f, 0.0f).Normalized();
+	CHECK((ReadVector(&skinned[ModelType::NormalOffset(modelType)]) - expected).Length() < 1e-5f);
+
+	//a mirror keeps the normal on the outside
+	mth::float4x4 mirror = mth::float4x4::Scaling(-1.0f, 1.0f, 1.0f);
+	SkinVertices(vertex.data(), skinned.data(), modelType, 1, &mirror, 1);
+	CHECK((ReadVector(&skinned[ModelType::NormalOffset(modelType)]) - mth::float3(-n, n, 0.0f)).Length() < 1e-5f);
+
+	TestModel model;
+	model.CreateGrid(20, ModelType::AllPart);
+	std::vector<mth::float4x4> palette = MakePalette();
+	std::vector<VertexElement> reference = model.m_vertices;
+	SkinReference(reference, model.m_modelType, palette);
+	SkinVertices(model.m_vertices.data(), model.m_vertices.data(), model.m_modelType, model.getVertexCount(), palette.data(), (UINT)palette.size());
+	//the reference has no normal where the blend of a mirrored and a plain bone is singular
+	for (size_t i = 0; i < reference.size(); i++)
+		CHECK(fabsf(reference[i].f - model.m_vertices[i].f) < 1e-4f || reference[i].u == model.m_vertices[i].u || std::isnan(reference[i].f));
+}
+
+TEST(SkinningUsesBoneOffsets)
+{
+	std::vector<Bone> bones(2);
+	bones[0].translation = mth::float3(1.0f, 0.0f, 0.0f);
+	bones[1].parent = 0;
+	bones[1].translation = mth::float3(0.0f, 2.0f, 0.0f);
+	bones[1].hasOffset = true;
+	bones[1].offset = mth::float4x4::Translation(-1.0f, -2.0f, -5.0f);
+	mth::float4x4 inverseBind[2];
+	InverseBindMatrices(bones, inverseBind);
+	CHECK(inverseBind[0].isNear(mth::float4x4::Translation(-1.0f, 0.0f, 0.0f), 1e-6f));
+	CHECK(inverseBind[1].isNear(bones[1].offset, 1e-6f));
+
+	TestModel model;
+	model.CreateGrid(2, ModelType::PB);
+	model.m_bones = bones;
+	for (bool binary : { true, false })
+	{
+		TempFile file(L"test_bone_offsets.omd");
+		model.ExportOMD(file.getFilename(), ModelType::PB, binary);
+		TestModel loaded;
+		loaded.LoadModel(file.getFilename(), ModelType::PB);
+		CHECK(loaded.getBoneCount() == 2);
+		CHECK(!loaded.getBone(0).hasOffset);
+		CHECK(loaded.getBone(1).hasOffset && loaded.getBone(1).offset == bones[1].offset);
+	}
+}
+
+BENCHMARK(SkinVertices)
+{
+	TestModel model;
+	model.CreateGrid(1000, ModelType::AllPart);
+	std::vector<mth::float4x4> palette = MakePalette();
+	std::vector<VertexElement> skinned(model.m_vertices.size());
+	std::vector<VertexElement> reference;
+	double seconds = MeasureBest(5, [&]() {
+		SkinVertices(model.m_vertices.data(), skinned.data(), model.m_modelType, model.getVertexCount(), palette.data(), (UINT)palette.size());
+	});
+	double referenceSeconds = MeasureBest(3, [&]() {
+		reference = model.m_vertices;
+		SkinReference(reference, model.m_modelType, palette);
+	});
+	printf("  %u vertices of %u bytes: %.0f M vertices/s, %.1fx the matrix class reference\n", model.getVertexCount(),
+		model.getVertexSizeInBytes(), model.getVertexCount() / seconds / 1e6, referenceSeconds / seconds);
+}
\ No newline at end of file
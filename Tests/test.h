@@ -0,0 +1,56 @@
+#pragma once
+
+#include "helpers.h"
+#include <chrono>
+#include <cstdio>
+
+/* A test throws to fail. A benchmark prints its measurements and only runs when asked for,
+see main.cpp. Both register themselves before main starts. */
+struct TestCase
+{
+	const char* name;
+	void(*run)();
+	bool benchmark;
+};
+
+std::vector<TestCase>& GetTestCases();
+
+struct TestRegistration
+{
+	TestRegistration(const char* name, void(*run)(), bool benchmark) { GetTestCases().push_back({ name, run, benchmark }); }
+};
+
+#define TEST_CASE(name, benchmark) static void name(); static TestRegistration name##Registration(#name, name, benchmark); static void name()
+#define TEST(name) TEST_CASE(name, false)
+#define BENCHMARK(name) TEST_CASE(name, true)
+
+#define TEST_STRING(text) #text
+#define TEST_LINE(line) TEST_STRING(line)
+#define CHECK(condition) do { if (!(condition)) throw std::exception(__FILE__ "(" TEST_LINE(__LINE__) "): " #condition); } while (false)
+#define CHECK_THROWS(statement) do { bool thrown = false; try { statement; } catch (std::exception&) { thrown = true; } \
+	if (!thrown) throw std::exception(__FILE__ "(" TEST_LINE(__LINE__) "): no exception from " #statement); } while (false)
+
+class Timer
+{
+	std::chrono::steady_clock::time_point m_start;
+
+public:
+	Timer() :m_start(std::chrono::steady_clock::now()) {}
+	inline double getSeconds() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count(); }
+};
+
+/* Runs func repeat times and returns the shortest time in seconds */
+template <typename Func>
+double MeasureBest(UINT repeat, Func func)
+{
+	double best = 0.0;
+	for (UINT i = 0; i < repeat; i++)
+	{
+		Timer timer;
+		func();
+		double seconds = timer.getSeconds();
+		if (i == 0 || seconds < best)
+			best = seconds;
+	}
+	return best;
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "testmodel.h"
+#include "modelloaders/vertexlayout.h"
+#include <filesystem>
+#include <fstream>
+
+using namespace gfx;
+
+void TestModel::CreateGrid(UINT size, UINT modelType)
+{
+	Clear();
+	UINT side = size + 1;
+	std::vector<Vertex_PTMB> grid(side * side);
+	for (UINT z = 0; z < side; z++)
+	{
+		for (UINT x = 0; x < side; x++)
+		{
+			Vertex_PTMB& v = grid[x + z * side];
+			v.position = mth::float3((float)x, 0.0f, (float)z);
+			v.texcoord = mth::float2((float)x / size, (float)z / size);
+			v.normal = mth::float3(0.0f, 1.0f, 0.0f);
+			v.tangent = mth::float3(1.0f, 0.0f, 0.0f);
+			v.binormal = mth::float3(0.0f, 0.0f, 1.0f);
+			float weight = (float)(x % 5) * 0.25f;
+			v.boneWeights[0] = 1.0f - weight * 0.5f;
+			v.boneWeights[1] = weight * 0.5f;
+			v.boneWeights[2] = 0.0f;
+			v.boneWeights[3] = 0.0f;
+			v.boneIndex[0] = x % 4;
+			v.boneIndex[1] = z % 4;
+			v.boneIndex[2] = 0;
+			v.boneIndex[3] = 0;
+		}
+	}
+
+	m_modelType = modelType;
+	m_vertexSizeInBytes = ModelType::VertexSizeInBytes(modelType);
+	m_vertices.resize(grid.size() * getVertexSizeInFloats());
+	TranscodeVertices((const VertexElement*)grid.data(), ModelType::AllPart, m_vertices.data(), modelType, grid.size());
+
+	for (UINT z = 0; z < size; z++)
+	{
+		for (UINT x = 0; x < size; x++)
+		{
+			UINT corner = x + z * side;
+			UINT quad[6] = { corner, corner + side, corner + 1, corner + 1, corner + side, corner + side + 1 };
+			m_indices.insert(m_indices.end(), quad, quad + 6);
+		}
+	}
+	UINT half = (UINT)m_indices.size() / 6 * 3;
+	m_groups.push_back({ 0, half, 0 });
+	m_groups.push_back({ half, (UINT)m_indices.size() - half, 1 });
+	m_textures.push_back(TextureToLoad(L"grid0.png"));
+	m_textures.push_back(TextureToLoad(L"grid1.png"));
+	m_normalmaps.push_back(TextureToLoad());
+	m_normalmaps.push_back(TextureToLoad(L"grid1_n.png"));
+}
+
+bool TestModel::HasSameMesh(TestModel& other)
+{
+	if (m_modelType != other.m_modelType || m_vertices.size() != other.m_vertices.size() ||
+		m_indices != other.m_indices || m_groups.size() != other.m_groups.size())
+		return false;
+	for (size_t i = 0; i < m_groups.size(); i++)
+		if (m_groups[i].startIndex != other.m_groups[i].startIndex || m_groups[i].indexCount != other.m_groups[i].indexCount)
+			return false;
+	return memcmp(m_vertices.data(), other.m_vertices.data(), m_vertices.size() * sizeof(VertexElement)) == 0;
+}
+
+TempFile::TempFile(LPCWSTR filename) :
+	m_filename(filename) {}
+TempFile::~TempFile()
+{
+	std::error_code error;
+	std::filesystem::remove(m_filename, error);
+}
+
+std::vector<char> ReadTestFile(LPCWSTR filename)
+{
+	std::ifstream infile(filename, std::ios::in | std::ios::binary);
+	if (!infile.good())
+		throw std::exception("Failed to open test file");
+	return std::vector<char>(std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>());
+}
\ No newline at end of file
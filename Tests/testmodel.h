@@ -0,0 +1,43 @@
+#pragma once
+
+#include "modelloaders/modelloader.h"
+
+/* Gives the tests access to the data of a model */
+class TestModel :public gfx::ModelLoader
+{
+public:
+	using ModelLoader::m_vertices;
+	using ModelLoader::m_indices;
+	using ModelLoader::m_textures;
+	using ModelLoader::m_normalmaps;
+	using ModelLoader::m_groups;
+	using ModelLoader::m_hitbox;
+	using ModelLoader::m_bones;
+	using ModelLoader::m_animations;
+	using ModelLoader::m_morphs;
+	using ModelLoader::m_instances;
+	using ModelLoader::m_modelType;
+	using ModelLoader::m_vertexSizeInBytes;
+	using ModelLoader::RemapVertices;
+	using ModelLoader::OrganizeMaterials;
+
+	/* size*size quads in the xz plane facing up, split into two groups with a material each.
+	Every attribute of the layout gets values that differ between the vertices. */
+	void CreateGrid(UINT size, UINT modelType);
+	/* compares the vertex, index and material data */
+	bool HasSameMesh(TestModel& other);
+};
+
+/* A name in the test working directory that is deleted with the object */
+class TempFile
+{
+	std::wstring m_filename;
+
+public:
+	TempFile(LPCWSTR filename);
+	~TempFile();
+
+	inline LPCWSTR getFilename() { return m_filename.c_str(); }
+};
+
+std::vector<char> ReadTestFile(LPCWSTR filename);
\ No newline at end of file